@@ -26,27 +26,35 @@ int set_graphic_mode(void)
    return ERR_SUCCESS;
 }
 
-/*-- com32_putc ----------------------------------------------------------------
+/*-- com32_puts ----------------------------------------------------------------
  *
- *      Wrapper for the 'Write Character' COM32 service.
+ *      Wrapper for the 'Write string' COM32 service.
  *
  * Parameters
- *      IN c: the character to be printed.
+ *      IN str: pointer to the null-terminated string to be printed, which must
+ *              be located in the COM32 bounce buffer.
  *----------------------------------------------------------------------------*/
-static void com32_putc(uint8_t c)
+static void com32_puts(const char *str)
 {
    com32sys_t iregs;
+   farptr_t fptr;
 
    memset(&iregs, 0, sizeof (iregs));
-   iregs.eax.b[1] = 0x02;
-   iregs.edx.b[0] = c;
-   intcall(COM32_INT_DOS_COMPATIBLE, &iregs, NULL);
+   fptr = virtual_to_real(str);
+   iregs.eax.w[0] = 0x02;
+   iregs.es = fptr.real.segment;
+   iregs.ebx.w[0] = fptr.real.offset;
+   intcall(COM32_INT, &iregs, NULL);
 }
 
 /*-- firmware_print ------------------------------------------------------------
  *
  *      Print a string to the COM32 console.
  *
+ *      The string is copied to the bounce buffer, with a carriage return
+ *      inserted before each newline, so that it can be printed with as few
+ *      real-mode transitions as possible.
+ *
  * Parameters
  *      IN str: pointer to the ASCII string to print
  *
@@ -55,11 +63,28 @@ static void com32_putc(uint8_t c)
  *----------------------------------------------------------------------------*/
 int firmware_print(const char *str)
 {
+   size_t size, n;
+   char *buf;
+
+   buf = get_bounce_buffer();
+   size = get_bounce_buffer_size();
+   n = 0;
+
    for ( ; *str != '\0'; str++) {
+      if (n + 3 > size) {
+         buf[n] = '\0';
+         com32_puts(buf);
+         n = 0;
+      }
       if (*str == '\n') {
-         com32_putc('\r');
+         buf[n++] = '\r';
       }
-      com32_putc(*str);
+      buf[n++] = *str;
+   }
+
+   if (n > 0) {
+      buf[n] = '\0';
+      com32_puts(buf);
    }
 
    return ERR_SUCCESS;
@@ -579,6 +579,8 @@ int get_disk_info(uint8_t drive, disk_t *disk)
    disk->heads_per_cylinder = h;
    disk->sectors_per_track = s;
    disk->bytes_per_sector = bytes_per_sector;
+   disk->io_align = 1;
+   disk->xfer_blocks = 1;
 
    return ERR_SUCCESS;
 }
@@ -516,6 +516,28 @@ int firmware_file_read(const char *filepath, int (*callback)(size_t),
    return status;
 }
 
+/*-- firmware_file_read_range --------------------------------------------------
+ *
+ *      Read part of a file. COM32 file services can only read files from the
+ *      beginning.
+ *
+ * Parameters
+ *      IN  filepath: absolute path of the file
+ *      IN  offset:   offset of the first byte to read
+ *      IN  size:     number of bytes to read
+ *      OUT buffer:   where to read them
+ *
+ * Results
+ *      ERR_UNSUPPORTED
+ *----------------------------------------------------------------------------*/
+int firmware_file_read_range(UNUSED_PARAM(const char *filepath),
+                             UNUSED_PARAM(uint64_t offset),
+                             UNUSED_PARAM(size_t size),
+                             UNUSED_PARAM(void *buffer))
+{
+   return ERR_UNSUPPORTED;
+}
+
 
 /*-- firmware_file_write -------------------------------------------------------
  *
@@ -217,6 +217,7 @@ void *sys_malloc(size_t size)
 {
    struct free_arena_header *fp;
    struct stack_frame *frame;
+   void *ptr;
 
    if (size == 0) {
       return NULL;
@@ -229,7 +230,9 @@ void *sys_malloc(size_t size)
         fp = fp->next_free) {
       if (fp->a.size >= size) {
          /* Found fit -- allocate out of this block */
-         return __malloc_from_block(fp, size);
+         ptr = __malloc_from_block(fp, size);
+         memprof_alloc(ptr, size, __builtin_return_address(0));
+         return ptr;
       }
    }
 
@@ -250,6 +253,8 @@ void sys_free(void *ptr)
       return;
    }
 
+   memprof_free(ptr);
+
    ah = (struct free_arena_header *)((struct arena_header *)ptr - 1);
 
    __free_block(ah);
@@ -416,5 +416,22 @@ void free_memory_map(e820_range_t *e820_mmap,
  *----------------------------------------------------------------------------*/
 void *sys_realloc(void *ptr, size_t oldsize, size_t newsize)
 {
-   return (oldsize == newsize) ? ptr : realloc(ptr, newsize);
+   void *p;
+
+   if (oldsize == newsize) {
+      return ptr;
+   }
+
+   p = realloc(ptr, newsize);
+
+   /*
+    * When realloc() allocates, frees or moves the buffer, it goes through
+    * sys_malloc() and sys_free(), which already account for it: only a
+    * resize in place is left to record here.
+    */
+   if (p != NULL && p == ptr) {
+      memprof_realloc(p, ptr, oldsize, newsize, __builtin_return_address(0));
+   }
+
+   return p;
 }
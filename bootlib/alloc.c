@@ -228,22 +228,23 @@ static bool is_free_mem(uint64_t base, uint64_t len)
    return true;
 }
 
-/*-- find_free_mem -------------------------------------------------------------
+/*-- find_free_range -----------------------------------------------------------
  *
- *      Find memory that has not been allocated yet. This function does not
- *      allocate the returned memory.
+ *      Find memory that has not been allocated yet, within the given limits.
+ *      This function does not allocate the returned memory.
  *
  * Parameters
- *      IN  size:   amount of needed memory
- *      IN  align:  memory will have to be aligned on this much
- *      IN  option: ALLOC_32BIT or ALLOC_ANY
- *      OUT addr:   the aligned address of the found free memory
+ *      IN  size:  amount of needed memory
+ *      IN  align: memory will have to be aligned on this much
+ *      IN  min:   lowest acceptable address
+ *      IN  limit: highest acceptable address
+ *      OUT addr:  the aligned address of the found free memory
  *
  * Results
- *      ERR_SUCCESS, or a generic error status.
+ *      true if free memory was found, false otherwise.
  *----------------------------------------------------------------------------*/
-static int find_free_mem(uint64_t size, size_t align,
-                         int option, uint64_t *addr)
+static bool find_free_range(uint64_t size, size_t align, uint64_t min,
+                            uint64_t limit, uint64_t *addr)
 {
    uint64_t hole_base, hole_len;
    uint64_t aligned_addr, padding;
@@ -252,33 +253,63 @@ static int find_free_mem(uint64_t size, size_t align,
    hole_base = 0;
 
    for (i = 0; i < alloc_count; i++) {
-      hole_len = allocs[i].base - hole_base;
-
-      if (hole_len >= size) {
-         aligned_addr = roundup64(hole_base, align);
-         if (aligned_addr < hole_base) {
-            // Overflow
-            break;
+      if (allocs[i].base > min) {
+         hole_base = MAX(hole_base, min);
+         hole_len = allocs[i].base - hole_base;
+
+         if (hole_len >= size) {
+            aligned_addr = roundup64(hole_base, align);
+            if (aligned_addr < hole_base) {
+               // Overflow
+               break;
+            }
+
+            padding = aligned_addr - hole_base;
+            if (size + padding < size) {
+               // Overflow
+               break;
+            }
+
+            if (aligned_addr + size - 1 > limit) {
+               break;
+            }
+
+            if (padding + size <= hole_len) {
+               *addr = aligned_addr;
+               return true;
+            }
          }
+      }
 
-         padding = aligned_addr - hole_base;
-         if (size + padding < size) {
-            // Overflow
-            break;
-         }
+      hole_base = allocs[i].base + allocs[i].len;
+   }
 
-         if (option == ALLOC_32BIT &&
-             aligned_addr + size > MAX_32_BIT_ADDR) {
-            break;
-         }
+   return false;
+}
 
-         if (padding + size <= hole_len) {
-            *addr = aligned_addr;
-            return ERR_SUCCESS;
-         }
-      }
+/*-- find_free_mem -------------------------------------------------------------
+ *
+ *      Find memory that has not been allocated yet. This function does not
+ *      allocate the returned memory.
+ *
+ * Parameters
+ *      IN  size:   amount of needed memory
+ *      IN  align:  memory will have to be aligned on this much
+ *      IN  option: ALLOC_32BIT or ALLOC_ANY
+ *      OUT addr:   the aligned address of the found free memory
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+static int find_free_mem(uint64_t size, size_t align,
+                         int option, uint64_t *addr)
+{
+   uint64_t limit;
 
-      hole_base = allocs[i].base + allocs[i].len;
+   limit = (option == ALLOC_32BIT) ? MAX_32_BIT_ADDR : MAX_64_BIT_ADDR;
+
+   if (find_free_range(size, align, 0, limit, addr)) {
+      return ERR_SUCCESS;
    }
 
    Log(LOG_ERR, "No free memory to alloc 0x%"PRIx64" bytes", size);
@@ -338,8 +369,50 @@ int alloc(uint64_t *addr, uint64_t size, size_t align, int option)
          alloc_sanity_check(true);
          return status;
       }
+
+      memprof_runtime_alloc(base, size);
+   }
+
+   *addr = base;
+
+   return ERR_SUCCESS;
+}
+
+/*-- alloc_range ---------------------------------------------------------------
+ *
+ *      Allocate memory anywhere within the [min, max] range. Unlike alloc(),
+ *      this function fails quietly, so that callers can try several ranges in
+ *      turn.
+ *
+ * Parameters
+ *      OUT addr:  the address of the allocated memory
+ *      IN  size:  amount of needed memory
+ *      IN  align: returned address must be aligned on this much
+ *      IN  min:   lowest address of the range
+ *      IN  max:   highest address of the range
+ *
+ * Results
+ *      ERR_SUCCESS, ERR_OUT_OF_RESOURCES if there is no free memory in the
+ *      range, or a generic error status.
+ *----------------------------------------------------------------------------*/
+int alloc_range(uint64_t *addr, uint64_t size, size_t align,
+                uint64_t min, uint64_t max)
+{
+   uint64_t base;
+   int status;
+
+   if (size == 0 || max < min || !find_free_range(size, align, min, max,
+                                                  &base)) {
+      return ERR_OUT_OF_RESOURCES;
+   }
+
+   status = alloc_add(base, size);
+   if (status != ERR_SUCCESS) {
+      alloc_sanity_check(true);
+      return status;
    }
 
+   memprof_runtime_alloc(base, size);
    *addr = base;
 
    return ERR_SUCCESS;
@@ -158,7 +158,7 @@ void e820_mmap_merge(e820_range_t *mmap, size_t *count)
  * Results
  *      ERR_SUCCESS or ERR_INVALID_PARAMETER.
  *----------------------------------------------------------------------------*/
-static int e820_sanity_check(e820_range_t *mmap, size_t count)
+int e820_sanity_check(e820_range_t *mmap, size_t count)
 {
    uint64_t max_base, max_limit, base, len, limit;
    bool error, overlap;
@@ -217,6 +217,40 @@ static int e820_sanity_check(e820_range_t *mmap, size_t count)
    return ERR_SUCCESS;
 }
 
+/*-- e820_range_has_type -------------------------------------------------------
+ *
+ *      Check whether any part of a memory range is described with the given
+ *      type in a sorted memory map.
+ *
+ * Parameters
+ *      IN mmap:  pointer to the memory map
+ *      IN count: number of entries in the memory map
+ *      IN base:  memory range start address
+ *      IN len:   memory range size
+ *      IN type:  E820 memory type to look for
+ *
+ * Results
+ *      true/false
+ *----------------------------------------------------------------------------*/
+bool e820_range_has_type(const e820_range_t *mmap, size_t count,
+                         uint64_t base, uint64_t len, uint32_t type)
+{
+   size_t i;
+
+   for (i = 0; i < count; i++) {
+      if (base + len > base && E820_BASE(&mmap[i]) >= base + len) {
+         break;
+      }
+
+      if (mmap[i].type == type &&
+          is_overlap(E820_BASE(&mmap[i]), E820_LENGTH(&mmap[i]), base, len)) {
+         return true;
+      }
+   }
+
+   return false;
+}
+
 /*-- e820_to_blacklist ---------------------------------------------------------
  *
  *      Blacklist memory that the memory map does not report as available:
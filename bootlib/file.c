@@ -13,9 +13,14 @@
 #include <libfat.h>
 #include <libfatint.h>
 #include <md5.h>
+#include <crc.h>
+#include <blkmap.h>
 
 #define FAT_SHORT_NAME_LEN      11
 
+#define FAT_ATTR_VFAT_SLOT      0x0f
+#define FAT_DIRENT_DELETED      0xe5
+
 typedef struct {
    disk_t *disk;
    partition_t *partition;
@@ -25,6 +30,19 @@ static disk_t disk_info;
 static partition_t part_info;
 static volume_t dfd;
 
+/*
+ * Block map of the last FAT volume a file was loaded from. The map is looked
+ * up only once per volume; 'map' is left NULL if the volume has no block map,
+ * or if the block map is stale or invalid.
+ */
+static struct {
+   int volid;
+   disk_t disk;
+   partition_t partition;
+   char *map;
+   size_t size;
+} blkmap = { FIRMWARE_BOOT_VOLUME, { 0 }, { { 0 }, 0 }, NULL, 0 };
+
 /*-- partition_read_handler ----------------------------------------------------
  *
  *      Handler used by the libfat read() function to read disk sectors on a FAT
@@ -170,30 +188,20 @@ void fat_get_shortname(const char *name, char *shortname)
    }
 }
 
-/*-- fat_file_open -------------------------------------------------------------
+/*-- fat_volume_open -----------------------------------------------------------
  *
- *      Open a file on a FAT filesystem.
+ *      Open a FAT filesystem.
  *
  * Parameters
- *      IN  volid:    MBR/GPT partition number of the volume to load from
- *      IN  filename: absolute path to the file
- *      OUT fsinfo:   newly created FAT filesystem info
- *      OUT sector:   starting sector number of the file
- *      OUT size:     the size of the file in bytes
+ *      IN  volid:  MBR/GPT partition number of the volume to open
+ *      OUT fsinfo: newly created FAT filesystem info
  *
  * Results
  *      ERR_SUCCESS, or a generic error status.
  *----------------------------------------------------------------------------*/
-int fat_file_open(int volid, const char *filename,
-                  struct libfat_filesystem **fsinfo, libfat_sector_t *sector,
-                  size_t *size)
+static int fat_volume_open(int volid, struct libfat_filesystem **fsinfo)
 {
-   char shortname[FAT_SHORT_NAME_LEN];
    struct libfat_filesystem *fs;
-   struct libfat_direntry dentry;
-   struct fat_dirent *entry;
-   libfat_sector_t sector_offset;
-   int cluster;
    int status;
 
    status = get_boot_disk(&disk_info);
@@ -216,6 +224,42 @@ int fat_file_open(int volid, const char *filename,
       return ERR_NOT_FOUND;
    }
 
+   *fsinfo = fs;
+
+   return ERR_SUCCESS;
+}
+
+/*-- fat_file_open -------------------------------------------------------------
+ *
+ *      Open a file on a FAT filesystem.
+ *
+ * Parameters
+ *      IN  volid:    MBR/GPT partition number of the volume to load from
+ *      IN  filename: absolute path to the file
+ *      OUT fsinfo:   newly created FAT filesystem info
+ *      OUT sector:   starting sector number of the file
+ *      OUT size:     the size of the file in bytes
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+int fat_file_open(int volid, const char *filename,
+                  struct libfat_filesystem **fsinfo, libfat_sector_t *sector,
+                  size_t *size)
+{
+   char shortname[FAT_SHORT_NAME_LEN];
+   struct libfat_filesystem *fs;
+   struct libfat_direntry dentry;
+   struct fat_dirent *entry;
+   libfat_sector_t sector_offset;
+   int cluster;
+   int status;
+
+   status = fat_volume_open(volid, &fs);
+   if (status != ERR_SUCCESS) {
+      return status;
+   }
+
    fat_get_shortname(filename, shortname);
 
    cluster = libfat_searchdir(fs, 0, shortname, &dentry);
@@ -318,6 +362,357 @@ static int fat_file_load(int volid, const char *filename,
    return status;
 }
 
+/*-- fat_root_generation -------------------------------------------------------
+ *
+ *      Compute the generation stamp of a FAT root directory, as defined in
+ *      blkmap.h.
+ *
+ * Parameters
+ *      IN  fs:         pointer to the FAT filesystem info structure
+ *      OUT generation: the generation stamp
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+static int fat_root_generation(struct libfat_filesystem *fs,
+                               uint32_t *generation)
+{
+   char shortname[FAT_SHORT_NAME_LEN];
+   struct fat_dirent dirent;
+   libfat_sector_t sector;
+   const char *data;
+   uint32_t crc, offset;
+
+   fat_get_shortname(BLKMAP_FILENAME, shortname);
+
+   crc = 0;
+   sector = libfat_clustertosector(fs, 0);
+
+   while (sector != 0) {
+      if (sector == (libfat_sector_t)(-1)) {
+         return ERR_VOLUME_CORRUPTED;
+      }
+
+      data = libfat_get_sector(fs, sector);
+      if (data == NULL) {
+         return ERR_DEVICE_ERROR;
+      }
+
+      for (offset = 0; offset < fs->bytes_per_sector;
+           offset += sizeof (dirent)) {
+         memcpy(&dirent, data + offset, sizeof (dirent));
+
+         if (dirent.name[0] == 0) {
+            *generation = crc;
+            return ERR_SUCCESS;
+         }
+
+         if (dirent.name[0] == FAT_DIRENT_DELETED ||
+             dirent.attribute == FAT_ATTR_VFAT_SLOT ||
+             memcmp(dirent.name, shortname, FAT_SHORT_NAME_LEN) == 0) {
+            continue;
+         }
+
+         memset(&dirent.atime, 0, sizeof (dirent.atime));
+         crc = crc_32_update(crc, &dirent, sizeof (dirent));
+      }
+
+      sector = libfat_nextsector(fs, sector);
+   }
+
+   *generation = crc;
+
+   return ERR_SUCCESS;
+}
+
+/*-- blkmap_check --------------------------------------------------------------
+ *
+ *      Check the consistency of a block map.
+ *
+ * Parameters
+ *      IN map:  pointer to the block map
+ *      IN size: size of the block map, in bytes
+ *      IN disk: disk the block map describes
+ *      IN part: partition the block map describes
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+static int blkmap_check(char *map, size_t size, const disk_t *disk,
+                        const partition_t *part)
+{
+   blkmap_header_t *hdr;
+   blkmap_entry_t *entry;
+   blkmap_extent_t *extent;
+   uint32_t crc, i, j;
+   uint64_t sectors;
+   size_t offset;
+
+   if (size < sizeof (blkmap_header_t)) {
+      return ERR_BAD_TYPE;
+   }
+
+   hdr = (blkmap_header_t *)map;
+   if (memcmp(hdr->magic, BLKMAP_MAGIC, BLKMAP_MAGIC_LEN) != 0) {
+      return ERR_BAD_TYPE;
+   }
+   if (hdr->version != BLKMAP_VERSION) {
+      return ERR_INCOMPATIBLE_VERSION;
+   }
+   if (hdr->bytes_per_sector != disk->bytes_per_sector) {
+      return ERR_INCONSISTENT_DATA;
+   }
+
+   crc = hdr->crc;
+   hdr->crc = 0;
+   if (crc_32(map, size) != crc) {
+      return ERR_CRC_ERROR;
+   }
+   hdr->crc = crc;
+
+   offset = sizeof (blkmap_header_t);
+
+   for (i = 0; i < hdr->entry_count; i++) {
+      if (size - offset < sizeof (blkmap_entry_t)) {
+         return ERR_UNEXPECTED_EOF;
+      }
+      entry = (blkmap_entry_t *)(map + offset);
+      offset += sizeof (blkmap_entry_t);
+
+      if (entry->extent_count > (size - offset) / sizeof (blkmap_extent_t)) {
+         return ERR_UNEXPECTED_EOF;
+      }
+
+      sectors = 0;
+      for (j = 0; j < entry->extent_count; j++) {
+         extent = (blkmap_extent_t *)(map + offset);
+         offset += sizeof (blkmap_extent_t);
+
+         if (extent->count == 0 ||
+             extent->sector >= part->info.sectors_num ||
+             extent->count > part->info.sectors_num - extent->sector) {
+            return ERR_INCONSISTENT_DATA;
+         }
+         sectors += extent->count;
+      }
+
+      if (sectors != ceil(entry->size, disk->bytes_per_sector)) {
+         return ERR_INCONSISTENT_DATA;
+      }
+   }
+
+   return ERR_SUCCESS;
+}
+
+/*-- blkmap_open ---------------------------------------------------------------
+ *
+ *      Load and validate the block map of a FAT volume. This is done only once
+ *      per volume; subsequent calls return the cached result.
+ *
+ * Parameters
+ *      IN volid: MBR/GPT partition number of the FAT volume
+ *
+ * Results
+ *      ERR_SUCCESS if a valid block map is available, ERR_NOT_FOUND if the
+ *      volume has no block map, or a generic error status if the block map
+ *      cannot be used.
+ *----------------------------------------------------------------------------*/
+static int blkmap_open(int volid)
+{
+   struct libfat_filesystem *fs;
+   uint32_t generation;
+   size_t size;
+   void *map;
+   int status;
+
+   if (volid == blkmap.volid) {
+      return (blkmap.map != NULL) ? ERR_SUCCESS : ERR_NOT_FOUND;
+   }
+
+   if (blkmap.map != NULL) {
+      sys_free(blkmap.map);
+      blkmap.map = NULL;
+   }
+   blkmap.volid = volid;
+
+   status = fat_file_load(volid, BLKMAP_FILENAME, NULL, &map, &size);
+   if (status != ERR_SUCCESS) {
+      return status;
+   }
+
+   status = fat_volume_open(volid, &fs);
+   if (status == ERR_SUCCESS) {
+      status = fat_root_generation(fs, &generation);
+      libfat_close(fs);
+   }
+   if (status == ERR_SUCCESS) {
+      status = blkmap_check(map, size, &disk_info, &part_info);
+   }
+   if (status == ERR_SUCCESS &&
+       ((blkmap_header_t *)map)->generation != generation) {
+      status = ERR_INCONSISTENT_DATA;
+   }
+
+   if (status != ERR_SUCCESS) {
+      Log(LOG_DEBUG, "Ignoring stale or invalid block map on volume %d: %s",
+          volid, error_str[status]);
+      sys_free(map);
+      return status;
+   }
+
+   memcpy(&blkmap.disk, &disk_info, sizeof (disk_t));
+   memcpy(&blkmap.partition, &part_info, sizeof (partition_t));
+   blkmap.map = map;
+   blkmap.size = size;
+
+   return ERR_SUCCESS;
+}
+
+/*-- blkmap_lookup -------------------------------------------------------------
+ *
+ *      Look a file up in the block map of a FAT volume.
+ *
+ * Parameters
+ *      IN volid:    MBR/GPT partition number of the FAT volume
+ *      IN filename: absolute path to the file
+ *
+ * Results
+ *      A pointer to the file entry, or NULL if the volume has no usable block
+ *      map or if the file is not listed in it.
+ *----------------------------------------------------------------------------*/
+static blkmap_entry_t *blkmap_lookup(int volid, const char *filename)
+{
+   char shortname[FAT_SHORT_NAME_LEN];
+   blkmap_header_t *hdr;
+   blkmap_entry_t *entry;
+   size_t offset;
+   uint32_t i;
+
+   if (blkmap_open(volid) != ERR_SUCCESS) {
+      return NULL;
+   }
+
+   fat_get_shortname(filename, shortname);
+
+   hdr = (blkmap_header_t *)blkmap.map;
+   offset = sizeof (blkmap_header_t);
+
+   for (i = 0; i < hdr->entry_count; i++) {
+      entry = (blkmap_entry_t *)(blkmap.map + offset);
+      if (memcmp(entry->name, shortname, FAT_SHORT_NAME_LEN) == 0) {
+         return entry;
+      }
+      offset += sizeof (blkmap_entry_t) +
+         entry->extent_count * sizeof (blkmap_extent_t);
+   }
+
+   return NULL;
+}
+
+/*-- blkmap_file_load ----------------------------------------------------------
+ *
+ *      Load a file from a FAT volume, reading its data directly from the disk
+ *      extents recorded in the volume block map.
+ *
+ *      Each extent is read in chunks, as fat_file_load() does, and the CRC of
+ *      each chunk is accumulated right after it is read, while it is still in
+ *      the cache. Progress is reported per chunk. If the file data turns out
+ *      not to match the map, the caller falls back to the libfat path, which
+ *      reports the progress of the file again.
+ *
+ * Parameters
+ *      IN  volid:    MBR/GPT partition number of the volume to load from
+ *      IN  filename: absolute path to the file
+ *      IN  callback: routine to be called periodically while the file is being
+ *                    loaded
+ *      OUT buffer:   pointer to the buffer where the file was loaded
+ *      OUT bufsize:  the size of the loaded buffer
+ *      OUT fallback: true if the file must be loaded with libfat instead
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+static int blkmap_file_load(int volid, const char *filename,
+                            int (*callback)(size_t), void **buffer,
+                            size_t *bufsize, bool *fallback)
+{
+   blkmap_entry_t *entry;
+   blkmap_extent_t *extent;
+   size_t bytes_per_sector, count, left, len, n;
+   uint64_t sector;
+   uint32_t i, crc;
+   char *bufp;
+   void *data;
+   int status;
+
+   *fallback = true;
+
+   entry = blkmap_lookup(volid, filename);
+   if (entry == NULL) {
+      return ERR_NOT_FOUND;
+   }
+
+   bytes_per_sector = blkmap.disk.bytes_per_sector;
+   count = ceil(entry->size, bytes_per_sector);
+
+   data = sys_malloc(count * bytes_per_sector);
+   if (data == NULL) {
+      return ERR_OUT_OF_RESOURCES;
+   }
+
+   extent = (blkmap_extent_t *)(entry + 1);
+   bufp = data;
+   left = entry->size;
+   crc = 0;
+   status = ERR_SUCCESS;
+
+   for (i = 0; i < entry->extent_count; i++, extent++) {
+      sector = blkmap.partition.info.start_lba + extent->sector;
+
+      for (count = extent->count; count > 0; count -= n) {
+         n = MIN(count, READ_CHUNK_SIZE / bytes_per_sector);
+         status = disk_read(&blkmap.disk, bufp, sector, n);
+         if (status != ERR_SUCCESS) {
+            break;
+         }
+
+         len = n * bytes_per_sector;
+         crc = crc_32_update(crc, bufp, MIN(len, left));
+         left -= MIN(len, left);
+         bufp += len;
+         sector += n;
+
+         if (callback != NULL) {
+            status = callback(len);
+            if (status != ERR_SUCCESS) {
+               /* Aborted by the caller: libfat would not do any better. */
+               *fallback = false;
+               break;
+            }
+         }
+      }
+      if (status != ERR_SUCCESS) {
+         break;
+      }
+   }
+
+   if (status == ERR_SUCCESS && crc != entry->crc) {
+      status = ERR_CRC_ERROR;
+   }
+
+   if (status != ERR_SUCCESS) {
+      Log(LOG_DEBUG, "Block map read of %s failed: %s", filename,
+          error_str[status]);
+      sys_free(data);
+      return status;
+   }
+
+   *buffer = data;
+   *bufsize = entry->size;
+
+   return ERR_SUCCESS;
+}
+
 /*-- fat_file_get_size ---------------------------------------------------------
  *
  *      Get the size of a file in a FAT filesystem.
@@ -335,9 +730,16 @@ static int fat_file_get_size(int volid, const char *filename,
 {
    struct libfat_filesystem *fs;
    libfat_sector_t sector;
+   blkmap_entry_t *entry;
    size_t size;
    int status;
 
+   entry = blkmap_lookup(volid, filename);
+   if (entry != NULL) {
+      *filesize = entry->size;
+      return ERR_SUCCESS;
+   }
+
    status = fat_file_open(volid, filename, &fs, &sector, &size);
    if (status != ERR_SUCCESS) {
       return status;
@@ -410,9 +812,20 @@ int file_get_size_hint(int volid, const char *filename, size_t *filesize)
 int file_load(int volid, const char *filename, int (*callback)(size_t),
               void **buffer, size_t *bufsize)
 {
+   bool fallback;
    int status;
+
    if (volid != FIRMWARE_BOOT_VOLUME) {
-      status = fat_file_load(volid, filename, callback, buffer, bufsize);
+      /*
+       * Bootbanks written at install/upgrade time may carry a block map that
+       * allows reading modules without walking the FAT. Any problem with it
+       * (missing, stale, corrupted data...) falls back to the libfat path.
+       */
+      status = blkmap_file_load(volid, filename, callback, buffer, bufsize,
+                                &fallback);
+      if (status != ERR_SUCCESS && fallback) {
+         status = fat_file_load(volid, filename, callback, buffer, bufsize);
+      }
    } else {
       status = firmware_file_read(filename, callback, buffer, bufsize);
    }
@@ -420,6 +833,32 @@ int file_load(int volid, const char *filename, int (*callback)(size_t),
    return status;
 }
 
+/*-- file_load_range -----------------------------------------------------------
+ *
+ *      Load part of a file into a given memory buffer. Only some of the boot
+ *      volume file access methods support this.
+ *
+ * Parameters
+ *      IN  volid:    MBR/GPT partition number of the volume to load from, or
+ *                    zero for the boot volume
+ *      IN  filepath: absolute path to the file
+ *      IN  offset:   offset of the first byte to load
+ *      IN  size:     number of bytes to load
+ *      OUT buffer:   where to load them
+ *
+ * Results
+ *      ERR_SUCCESS, ERR_UNSUPPORTED, or a generic error status.
+ *----------------------------------------------------------------------------*/
+int file_load_range(int volid, const char *filename, uint64_t offset,
+                    size_t size, void *buffer)
+{
+   if (volid != FIRMWARE_BOOT_VOLUME) {
+      return ERR_UNSUPPORTED;
+   }
+
+   return firmware_file_read_range(filename, offset, size, buffer);
+}
+
 /*-- file_save -----------------------------------------------------------------
  *
  *      Save a file from a memory buffer, overwriting the file if it exists.
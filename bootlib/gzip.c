@@ -22,6 +22,31 @@
 #define GZIP_FLAG_COMMENT      0x10 /* bit 4 set: file comment present */
 #define GZIP_FLAG_RESERVED     0xE0 /* bits 5..7: reserved */
 
+/*
+ * Preset-dictionary deflate container (zdict):
+ *
+ *    zdict_header_t
+ *    raw deflate stream, compressed against the preset dictionary
+ *    CRC-32 of the uncompressed data (4 bytes, little-endian)
+ *    uncompressed size modulo 2^32 (4 bytes, little-endian)
+ *
+ * The trailer is the same as the gzip one. The dictionary is identified by its
+ * Adler-32 checksum, as in the zlib FDICT header field.
+ */
+#define ZDICT_MAGIC            "ZDF1"
+#define ZDICT_MAGIC_LEN        4
+#define ZDICT_VERSION          1
+
+#pragma pack(1)
+typedef struct {
+   char magic[ZDICT_MAGIC_LEN];
+   uint8_t version;
+   uint8_t method;            /* Z_DEFLATED */
+   uint16_t reserved;
+   uint32_t dict_id;          /* Adler-32 of the preset dictionary */
+} zdict_header_t;
+#pragma pack()
+
 /*-- error_zlib_to_generic -----------------------------------------------------
  *
  *      Convert a Zlib error number to a generic status code.
@@ -177,6 +202,8 @@ static int gzip_get_info(const void *buffer, size_t filesize, size_t hdrsize,
  * Parameters
  *      IN  source:    pointer to the compressed data
  *      IN  sourceLen: size of the compressed data
+ *      IN  dict:      preset dictionary, or NULL
+ *      IN  dictLen:   size of the preset dictionary
  *      IN  dest:      destination buffer
  *      IN  destLen:   size of the destination buffer
  *      OUT destLen:   number of bytes that have been written into the
@@ -185,7 +212,8 @@ static int gzip_get_info(const void *buffer, size_t filesize, size_t hdrsize,
  * Results
  *      ERR_SUCCESS, or a generic error status.
  *----------------------------------------------------------------------------*/
-static int gunzip_buffer(const void *source, size_t sourceLen, void *dest,
+static int gunzip_buffer(const void *source, size_t sourceLen,
+                         const void *dict, size_t dictLen, void *dest,
                          size_t *destLen)
 {
    z_stream stream;
@@ -204,6 +232,14 @@ static int gunzip_buffer(const void *source, size_t sourceLen, void *dest,
       return error_zlib_to_generic(err);
    }
 
+   if (dict != NULL) {
+      err = inflateSetDictionary(&stream, dict, (uInt)dictLen);
+      if (err != Z_OK) {
+         inflateEnd(&stream);
+         return error_zlib_to_generic(err);
+      }
+   }
+
    err = inflate(&stream, Z_FINISH);
    inflateEnd(&stream);
    if (err != Z_STREAM_END) {
@@ -215,37 +251,35 @@ static int gunzip_buffer(const void *source, size_t sourceLen, void *dest,
    return ERR_SUCCESS;
 }
 
-/*-- gzip_extract --------------------------------------------------------------
+/*-- deflate_extract -----------------------------------------------------------
  *
- *      Buffer to buffer gzip extraction. The output buffer is dynamically
- *      allocated, or points to the input buffer if the input data are not a
- *      gzip archive.
+ *      Buffer to buffer extraction of a raw deflate stream wrapped between a
+ *      header and a gzip trailer.
  *
  * Parameters
- *      IN  ibuffer: pointer to the gzip'ed data
- *      IN  isize:   size of the gzip'ed data
- *      OUT obuffer: pointer to the freshly allocated extracted data
- *      OUT osize:   size of the extracted data
+ *      IN  ibuffer:    pointer to the compressed data
+ *      IN  isize:      size of the compressed data
+ *      IN  header_len: size of the header preceding the deflate stream
+ *      IN  dict:       preset dictionary, or NULL
+ *      IN  dict_size:  size of the preset dictionary
+ *      OUT obuffer:    pointer to the freshly allocated extracted data
+ *      OUT osize:      size of the extracted data
+ *      OUT crc:        if not NULL, the CRC-32 of the extracted data is not
+ *                      verified, and the expected value is returned instead
  *
  * Results
  *      ERR_SUCCESS, or a generic error status.
  *----------------------------------------------------------------------------*/
-int gzip_extract(const void *ibuffer, size_t isize,
-                 void **obuffer, size_t *osize)
+static int deflate_extract(const void *ibuffer, size_t isize,
+                           size_t header_len, const void *dict,
+                           size_t dict_size, void **obuffer, size_t *osize,
+                           uint32_t *crc)
 {
    void *output;
-   size_t header_len;
    size_t size = 0;
    int status;
    uint32_t received_crc, calculated_crc;
 
-   status = gzip_header_size(ibuffer, isize, &header_len);
-   if (status != ERR_SUCCESS) {
-      Log(LOG_ERR, "Error %d (%s) while parsing gzip header\n",
-          status, error_str[status]);
-      return status;
-   }
-
    status = gzip_get_info(ibuffer, isize, header_len, &size, &received_crc);
    if (status != ERR_SUCCESS) {
       Log(LOG_ERR, "Error %d (%s) reading original filesize or received crc\n",
@@ -265,7 +299,7 @@ int gzip_extract(const void *ibuffer, size_t isize,
       return ERR_SUCCESS;
    }
 
-   /* ibuffer starts after the gzip header */
+   /* ibuffer starts after the header */
    ibuffer = (char *)ibuffer + header_len;
    /*
     * ibuffer ends before the CRC and output size (4 + 4 bytes). gzip requires
@@ -282,7 +316,7 @@ int gzip_extract(const void *ibuffer, size_t isize,
       return ERR_OUT_OF_RESOURCES;
    }
 
-   status = gunzip_buffer(ibuffer, isize, output, &size);
+   status = gunzip_buffer(ibuffer, isize, dict, dict_size, output, &size);
    if (status != ERR_SUCCESS) {
       sys_free(output);
       Log(LOG_ERR, "Error %d (%s) while decompressing data\n",
@@ -291,6 +325,15 @@ int gzip_extract(const void *ibuffer, size_t isize,
       return status;
    }
 
+   if (crc != NULL) {
+      *crc = received_crc;
+      *obuffer = output;
+      *osize = size;
+      Log(LOG_DEBUG, "recdCRC 0x%x (not verified), tSize %zu, eSize %zu\n",
+          received_crc, isize, size);
+      return ERR_SUCCESS;
+   }
+
    calculated_crc = crc32(0, output, size);
 
    if (received_crc != calculated_crc) {
@@ -309,6 +352,71 @@ int gzip_extract(const void *ibuffer, size_t isize,
    return ERR_SUCCESS;
 }
 
+/*-- gzip_extract --------------------------------------------------------------
+ *
+ *      Buffer to buffer gzip extraction. The output buffer is dynamically
+ *      allocated, or points to the input buffer if the input data are not a
+ *      gzip archive.
+ *
+ * Parameters
+ *      IN  ibuffer: pointer to the gzip'ed data
+ *      IN  isize:   size of the gzip'ed data
+ *      OUT obuffer: pointer to the freshly allocated extracted data
+ *      OUT osize:   size of the extracted data
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+int gzip_extract(const void *ibuffer, size_t isize,
+                 void **obuffer, size_t *osize)
+{
+   size_t header_len;
+   int status;
+
+   status = gzip_header_size(ibuffer, isize, &header_len);
+   if (status != ERR_SUCCESS) {
+      Log(LOG_ERR, "Error %d (%s) while parsing gzip header\n",
+          status, error_str[status]);
+      return status;
+   }
+
+   return deflate_extract(ibuffer, isize, header_len, NULL, 0, obuffer, osize,
+                          NULL);
+}
+
+/*-- gzip_extract_unverified ---------------------------------------------------
+ *
+ *      Same as gzip_extract(), except that the CRC-32 of the extracted data is
+ *      not verified. It is returned instead, so that the caller can verify it
+ *      later if nothing else guarantees the integrity of the data.
+ *
+ * Parameters
+ *      IN  ibuffer: pointer to the gzip'ed data
+ *      IN  isize:   size of the gzip'ed data
+ *      OUT obuffer: pointer to the freshly allocated extracted data
+ *      OUT osize:   size of the extracted data
+ *      OUT crc:     expected CRC-32 of the extracted data
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+int gzip_extract_unverified(const void *ibuffer, size_t isize,
+                            void **obuffer, size_t *osize, uint32_t *crc)
+{
+   size_t header_len;
+   int status;
+
+   status = gzip_header_size(ibuffer, isize, &header_len);
+   if (status != ERR_SUCCESS) {
+      Log(LOG_ERR, "Error %d (%s) while parsing gzip header\n",
+          status, error_str[status]);
+      return status;
+   }
+
+   return deflate_extract(ibuffer, isize, header_len, NULL, 0, obuffer, osize,
+                          crc);
+}
+
 /*-- is_gzip -------------------------------------------------------------------
  *
  *      Check whether the given buffer contains a gzip archive.
@@ -328,3 +436,118 @@ bool is_gzip(const void *buffer, size_t bufsize, int *status)
    *status = gzip_header_size(buffer, bufsize, &hdr_size);
    return *status == ERR_SUCCESS ? true : false;
 }
+
+/*-- zdict_check_header --------------------------------------------------------
+ *
+ *      Check a preset-dictionary deflate container header.
+ *
+ * Parameters
+ *      IN buffer:   data buffer
+ *      IN filesize: data size
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+static int zdict_check_header(const void *buffer, size_t filesize)
+{
+   const zdict_header_t *hdr = buffer;
+
+   if (filesize < sizeof (zdict_header_t) ||
+       memcmp(hdr->magic, ZDICT_MAGIC, ZDICT_MAGIC_LEN) != 0) {
+      return ERR_BAD_TYPE;
+   }
+
+   if (hdr->version != ZDICT_VERSION) {
+      return ERR_INCOMPATIBLE_VERSION;
+   }
+
+   if (hdr->method != Z_DEFLATED) {
+      return ERR_UNSUPPORTED;
+   }
+
+   return ERR_SUCCESS;
+}
+
+/*-- is_zdict ------------------------------------------------------------------
+ *
+ *      Check whether the given buffer contains data compressed against a preset
+ *      dictionary.
+ *
+ * Parameters
+ *       IN  buffer:   data buffer
+ *       IN  bufsize:  data size
+ *       OUT dict_id:  Adler-32 checksum of the required dictionary
+ *       OUT status:   header status
+ *
+ * Results
+ *       true if buffer is a preset-dictionary container, false otherwise.
+ *----------------------------------------------------------------------------*/
+bool is_zdict(const void *buffer, size_t bufsize, uint32_t *dict_id,
+              int *status)
+{
+   *status = zdict_check_header(buffer, bufsize);
+   if (*status != ERR_SUCCESS) {
+      return false;
+   }
+
+   *dict_id = ((const zdict_header_t *)buffer)->dict_id;
+
+   return true;
+}
+
+/*-- zdict_id ------------------------------------------------------------------
+ *
+ *      Compute the identifier of a preset dictionary.
+ *
+ * Parameters
+ *      IN dict:      preset dictionary
+ *      IN dict_size: size of the preset dictionary
+ *
+ * Results
+ *      The dictionary Adler-32 checksum.
+ *----------------------------------------------------------------------------*/
+uint32_t zdict_id(const void *dict, size_t dict_size)
+{
+   return (uint32_t)adler32(adler32(0L, Z_NULL, 0), dict, (uInt)dict_size);
+}
+
+/*-- zdict_extract -------------------------------------------------------------
+ *
+ *      Buffer to buffer extraction of data compressed against a preset
+ *      dictionary. The output buffer is dynamically allocated.
+ *
+ * Parameters
+ *      IN  ibuffer:   pointer to the compressed data
+ *      IN  isize:     size of the compressed data
+ *      IN  dict:      preset dictionary
+ *      IN  dict_size: size of the preset dictionary
+ *      OUT obuffer:   pointer to the freshly allocated extracted data
+ *      OUT osize:     size of the extracted data
+ *      OUT crc:       if not NULL, the CRC-32 of the extracted data is not
+ *                     verified, and the expected value is returned instead
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+int zdict_extract(const void *ibuffer, size_t isize, const void *dict,
+                  size_t dict_size, void **obuffer, size_t *osize,
+                  uint32_t *crc)
+{
+   const zdict_header_t *hdr = ibuffer;
+   int status;
+
+   status = zdict_check_header(ibuffer, isize);
+   if (status != ERR_SUCCESS) {
+      Log(LOG_ERR, "Error %d (%s) while parsing zdict header\n",
+          status, error_str[status]);
+      return status;
+   }
+
+   if (dict == NULL || hdr->dict_id != zdict_id(dict, dict_size)) {
+      Log(LOG_ERR, "Preset dictionary 0x%x is not available\n", hdr->dict_id);
+      return ERR_NOT_FOUND;
+   }
+
+   return deflate_extract(ibuffer, isize, sizeof (zdict_header_t), dict,
+                          dict_size, obuffer, osize, crc);
+}
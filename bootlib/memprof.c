@@ -0,0 +1,332 @@
+/*******************************************************************************
+ * Copyright (c) 2026 VMware, Inc.  All rights reserved.
+ * SPDX-License-Identifier: GPL-2.0
+ ******************************************************************************/
+
+/*
+ * memprof.c -- Memory allocation profiler (debug builds only)
+ *
+ *   Keeps track of the dynamic memory allocated through sys_malloc() and
+ *   sys_realloc(), and of the run-time memory allocated with alloc():
+ *
+ *      - live and peak dynamic memory,
+ *      - allocations per call site,
+ *      - bytes copied by sys_realloc(),
+ *      - fragmentation of the available memory, sampled at a few points
+ *        of the boot process.
+ *
+ *   The profiler uses fixed-size tables so that it never allocates memory
+ *   itself. Allocations that don't fit in the tables are only counted.
+ */
+
+#include <string.h>
+#include <e820.h>
+#include <boot_services.h>
+#include <bootlib.h>
+
+#define MEMPROF_PTRS_NR     8192   /* Size of the live allocations table */
+#define MEMPROF_SITES_NR    128    /* Maximum number of call sites */
+#define MEMPROF_SAMPLES_NR  8      /* Maximum number of samples */
+#define MEMPROF_TOP_SITES   16     /* Number of call sites to report */
+
+#define PTR_EMPTY           ((uintptr_t)0)
+#define PTR_DELETED         ((uintptr_t)1)
+
+typedef struct {
+   uintptr_t ptr;
+   size_t size;
+   unsigned int site;
+} memprof_ptr_t;
+
+typedef struct {
+   const void *caller;
+   uint64_t count;
+   uint64_t bytes;
+   uint64_t live;
+} memprof_site_t;
+
+typedef struct {
+   const char *label;
+   uint64_t live;
+   uint64_t free_bytes;
+   uint64_t free_largest;
+   uint64_t free_largest_32bit;
+   size_t free_ranges;
+} memprof_sample_t;
+
+static memprof_ptr_t ptrs[MEMPROF_PTRS_NR];
+static memprof_site_t sites[MEMPROF_SITES_NR];
+static memprof_sample_t samples[MEMPROF_SAMPLES_NR];
+static unsigned int sites_nr = 0;
+static unsigned int samples_nr = 0;
+
+static struct {
+   uint64_t live;
+   uint64_t peak;
+   uint64_t allocs;
+   uint64_t frees;
+   uint64_t untracked;
+   uint64_t realloc_copies;
+   uint64_t realloc_bytes;
+   uint64_t runtime_allocs;
+   uint64_t runtime_bytes;
+   uint64_t runtime_bytes_32bit;
+} stats;
+
+/*-- ptr_hash ------------------------------------------------------------------
+ *
+ *      Hash a pointer into the live allocations table.
+ *
+ * Parameters
+ *      IN ptr: pointer to hash
+ *
+ * Results
+ *      The table index to start probing from.
+ *----------------------------------------------------------------------------*/
+static INLINE unsigned int ptr_hash(uintptr_t ptr)
+{
+   return (unsigned int)((ptr >> 4) * 2654435761U) % MEMPROF_PTRS_NR;
+}
+
+/*-- site_lookup ---------------------------------------------------------------
+ *
+ *      Find, or add, a call site.
+ *
+ * Parameters
+ *      IN caller: call site address
+ *
+ * Results
+ *      The call site index. When the sites table is full, all the new call
+ *      sites are accounted to the last entry.
+ *----------------------------------------------------------------------------*/
+static unsigned int site_lookup(const void *caller)
+{
+   unsigned int i;
+
+   for (i = 0; i < sites_nr; i++) {
+      if (sites[i].caller == caller) {
+         return i;
+      }
+   }
+
+   if (sites_nr < MEMPROF_SITES_NR) {
+      sites[sites_nr].caller = caller;
+      return sites_nr++;
+   }
+
+   sites[MEMPROF_SITES_NR - 1].caller = NULL;
+   return MEMPROF_SITES_NR - 1;
+}
+
+/*-- memprof_alloc -------------------------------------------------------------
+ *
+ *      Record a dynamic memory allocation.
+ *
+ * Parameters
+ *      IN ptr:    allocated memory (nothing is recorded if NULL)
+ *      IN size:   allocated size, in bytes
+ *      IN caller: call site address
+ *----------------------------------------------------------------------------*/
+void memprof_alloc(const void *ptr, size_t size, const void *caller)
+{
+   unsigned int i, n, site;
+
+   if (ptr == NULL) {
+      return;
+   }
+
+   site = site_lookup(caller);
+   sites[site].count++;
+   sites[site].bytes += size;
+
+   stats.allocs++;
+
+   i = ptr_hash((uintptr_t)ptr);
+   for (n = 0; n < MEMPROF_PTRS_NR; n++) {
+      if (ptrs[i].ptr == PTR_EMPTY || ptrs[i].ptr == PTR_DELETED) {
+         ptrs[i].ptr = (uintptr_t)ptr;
+         ptrs[i].size = size;
+         ptrs[i].site = site;
+         sites[site].live += size;
+         stats.live += size;
+         stats.peak = MAX(stats.peak, stats.live);
+         return;
+      }
+      i = (i + 1) % MEMPROF_PTRS_NR;
+   }
+
+   stats.untracked++;
+}
+
+/*-- memprof_free --------------------------------------------------------------
+ *
+ *      Record the release of dynamic memory. Memory that was not allocated
+ *      through sys_malloc() or sys_realloc() is ignored.
+ *
+ * Parameters
+ *      IN ptr: released memory
+ *----------------------------------------------------------------------------*/
+void memprof_free(const void *ptr)
+{
+   unsigned int i, n;
+
+   if (ptr == NULL) {
+      return;
+   }
+
+   i = ptr_hash((uintptr_t)ptr);
+   for (n = 0; n < MEMPROF_PTRS_NR && ptrs[i].ptr != PTR_EMPTY; n++) {
+      if (ptrs[i].ptr == (uintptr_t)ptr) {
+         sites[ptrs[i].site].live -= ptrs[i].size;
+         stats.live -= ptrs[i].size;
+         stats.frees++;
+         ptrs[i].ptr = PTR_DELETED;
+         return;
+      }
+      i = (i + 1) % MEMPROF_PTRS_NR;
+   }
+}
+
+/*-- memprof_realloc -----------------------------------------------------------
+ *
+ *      Record a dynamic memory reallocation.
+ *
+ * Parameters
+ *      IN new:     reallocated memory
+ *      IN old:     previous memory buffer
+ *      IN oldsize: size of the previous buffer, in bytes
+ *      IN newsize: size of the reallocated buffer, in bytes
+ *      IN caller:  call site address
+ *----------------------------------------------------------------------------*/
+void memprof_realloc(const void *new, const void *old, size_t oldsize,
+                     size_t newsize, const void *caller)
+{
+   if (new == NULL && newsize > 0) {
+      return;
+   }
+
+   memprof_free(old);
+   memprof_alloc(new, newsize, caller);
+
+   if (old != NULL && new != NULL && new != old) {
+      stats.realloc_copies++;
+      stats.realloc_bytes += MIN(oldsize, newsize);
+   }
+}
+
+/*-- memprof_runtime_alloc -----------------------------------------------------
+ *
+ *      Record a run-time memory allocation.
+ *
+ * Parameters
+ *      IN addr: allocated memory address
+ *      IN size: allocated size, in bytes
+ *----------------------------------------------------------------------------*/
+void memprof_runtime_alloc(uint64_t addr, uint64_t size)
+{
+   stats.runtime_allocs++;
+   stats.runtime_bytes += size;
+   if (addr + size - 1 <= MAX_32_BIT_ADDR) {
+      stats.runtime_bytes_32bit += size;
+   }
+}
+
+/*-- memprof_sample ------------------------------------------------------------
+ *
+ *      Record the current dynamic memory usage, and how fragmented the
+ *      available system memory is.
+ *
+ * Parameters
+ *      IN label: name of this point of the boot process
+ *----------------------------------------------------------------------------*/
+void memprof_sample(const char *label)
+{
+   memprof_sample_t *sample;
+   uint64_t base, len, len_32bit;
+   e820_range_t *mmap;
+   efi_info_t efi_info;
+   size_t count, i;
+
+   if (samples_nr == MEMPROF_SAMPLES_NR) {
+      return;
+   }
+
+   sample = &samples[samples_nr++];
+   memset(sample, 0, sizeof (*sample));
+   sample->label = label;
+   sample->live = stats.live;
+
+   memset(&efi_info, 0, sizeof (efi_info));
+   if (get_memory_map(0, &mmap, &count, &efi_info) != ERR_SUCCESS) {
+      return;
+   }
+
+   for (i = 0; i < count; i++) {
+      if (mmap[i].type != E820_TYPE_AVAILABLE) {
+         continue;
+      }
+
+      base = E820_BASE(&mmap[i]);
+      len = E820_LENGTH(&mmap[i]);
+      len_32bit = (base > MAX_32_BIT_ADDR) ? 0 :
+                  MIN(len, MAX_32_BIT_ADDR - base + 1);
+
+      sample->free_ranges++;
+      sample->free_bytes += len;
+      sample->free_largest = MAX(sample->free_largest, len);
+      sample->free_largest_32bit = MAX(sample->free_largest_32bit, len_32bit);
+   }
+
+   free_memory_map(mmap, &efi_info);
+}
+
+/*-- memprof_report ------------------------------------------------------------
+ *
+ *      Take a last sample, and log the profiling summary.
+ *
+ * Parameters
+ *      IN label: name of this point of the boot process
+ *----------------------------------------------------------------------------*/
+void memprof_report(const char *label)
+{
+   const memprof_sample_t *sample;
+   bool reported[MEMPROF_SITES_NR];
+   unsigned int i, j, top;
+
+   memprof_sample(label);
+
+   Log(LOG_DEBUG, "Memory profile: %"PRIu64" bytes live, %"PRIu64" peak\n",
+       stats.live, stats.peak);
+   Log(LOG_DEBUG, "  %"PRIu64" allocations, %"PRIu64" frees, "
+       "%"PRIu64" untracked\n", stats.allocs, stats.frees, stats.untracked);
+   Log(LOG_DEBUG, "  realloc: %"PRIu64" copies, %"PRIu64" bytes\n",
+       stats.realloc_copies, stats.realloc_bytes);
+   Log(LOG_DEBUG, "  run-time: %"PRIu64" allocations, %"PRIu64" bytes "
+       "(%"PRIu64" below 4GB)\n", stats.runtime_allocs, stats.runtime_bytes,
+       stats.runtime_bytes_32bit);
+
+   for (i = 0; i < samples_nr; i++) {
+      sample = &samples[i];
+      Log(LOG_DEBUG, "  [%s] live %"PRIu64", free %"PRIu64" in %zu ranges, "
+          "largest %"PRIu64" (%"PRIu64" below 4GB)\n", sample->label,
+          sample->live, sample->free_bytes, sample->free_ranges,
+          sample->free_largest, sample->free_largest_32bit);
+   }
+
+   memset(reported, 0, sizeof (reported));
+   for (top = 0; top < MIN(sites_nr, MEMPROF_TOP_SITES); top++) {
+      j = sites_nr;
+      for (i = 0; i < sites_nr; i++) {
+         if (!reported[i] &&
+             (j == sites_nr || sites[i].bytes > sites[j].bytes)) {
+            j = i;
+         }
+      }
+      reported[j] = true;
+
+      Log(LOG_DEBUG, "  site +0x%zx: %"PRIu64" calls, %"PRIu64" bytes, "
+          "%"PRIu64" live\n",
+          (size_t)((uintptr_t)sites[j].caller - (uintptr_t)__executable_start),
+          sites[j].count, sites[j].bytes, sites[j].live);
+   }
+}
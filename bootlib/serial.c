@@ -26,8 +26,10 @@ static uart_t serial_dev;
  *----------------------------------------------------------------------------*/
 static int serial_log(const char *msg)
 {
+   const char *eol;
    int len, level;
    bool newline;
+   size_t n;
 
    newline = true;
    len = 0;
@@ -51,15 +53,18 @@ static int serial_log(const char *msg)
       }
 
       if (*msg == '\n') {
-         uart_putc(&serial_dev, '\r');
-         len++;
+         uart_write(&serial_dev, "\r\n", 2);
+         len += 2;
          newline = true;
       } else {
+         /* Hand the rest of the line to the UART in one go. */
+         eol = strchr(msg, '\n');
+         n = (eol != NULL) ? (size_t)(eol - msg) : strlen(msg);
+         uart_write(&serial_dev, msg, n);
+         len += n;
+         msg += n - 1;
          newline = false;
       }
-
-      uart_putc(&serial_dev, *msg);
-      len++;
    }
 
    return len;
@@ -10,8 +10,6 @@
 #include <bootlib.h>
 #include <boot_services.h>
 
-#define ALIGN_DOWN(_offset_, _bound_) ((_offset_) - ((_offset_) % (_bound_)))
-
 /*-- get_volume_info -----------------------------------------------------------
  *
  *      Scan a disk and return information for a given partition. Both legacy
@@ -113,6 +111,10 @@ int get_max_volume(disk_t *disk, int *max)
  *      Read raw bytes from a volume. All the bytes are read or an error is
  *      returned.
  *
+ *      Only the partial first and last sectors, if any, go through a bounce
+ *      buffer. The whole sectors in between are read straight into the output
+ *      buffer.
+ *
  * Parameters
  *      IN disk:      disk to read from
  *      IN partition: volume within disk
@@ -126,31 +128,62 @@ int get_max_volume(disk_t *disk, int *max)
 int volume_read(disk_t *disk, partition_t *partition,
                 void *dest, uint64_t offset, size_t size)
 {
-   size_t sector, start, bytes;
-   void *buffer;
+   size_t bytes_per_sector, head, len, count;
+   char *p, *sector;
+   uint64_t lba;
+   void *mem;
    int status;
 
-   start = ALIGN_DOWN(offset, disk->bytes_per_sector);
-   bytes = (size_t)roundup64(offset + size, disk->bytes_per_sector) - start;
-   sector = partition->info.start_lba + start / disk->bytes_per_sector;
+   bytes_per_sector = disk->bytes_per_sector;
+   lba = partition->info.start_lba + offset / bytes_per_sector;
+   head = (size_t)(offset % bytes_per_sector);
+   p = dest;
 
-   if (bytes > size) {
-      buffer = sys_malloc(size);
-      if (buffer == NULL) {
+   mem = NULL;
+   sector = NULL;
+   if (head > 0 || (size % bytes_per_sector) != 0) {
+      mem = sys_malloc(bytes_per_sector + MAX(disk->io_align, 1) - 1);
+      if (mem == NULL) {
          return ERR_OUT_OF_RESOURCES;
       }
-   } else {
-      buffer = dest;
+      sector = (char *)(uintptr_t)roundup64((uintptr_t)mem,
+                                            MAX(disk->io_align, 1));
+   }
+
+   status = ERR_SUCCESS;
+
+   if (head > 0) {
+      status = disk_read(disk, sector, lba, 1);
+      if (status != ERR_SUCCESS) {
+         goto out;
+      }
+      len = MIN(bytes_per_sector - head, size);
+      memcpy(p, sector + head, len);
+      p += len;
+      size -= len;
+      lba++;
    }
 
-   status = disk_read(disk, buffer, sector, bytes / disk->bytes_per_sector);
+   count = size / bytes_per_sector;
+   if (count > 0) {
+      status = disk_read(disk, p, lba, count);
+      if (status != ERR_SUCCESS) {
+         goto out;
+      }
+      p += count * bytes_per_sector;
+      size -= count * bytes_per_sector;
+      lba += count;
+   }
 
-   if (buffer != dest) {
+   if (size > 0) {
+      status = disk_read(disk, sector, lba, 1);
       if (status == ERR_SUCCESS) {
-         memcpy(dest, buffer, size);
+         memcpy(p, sector, size);
       }
-      sys_free(buffer);
    }
 
+ out:
+   sys_free(mem);
+
    return status;
 }
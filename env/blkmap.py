@@ -0,0 +1,228 @@
+#! /usr/bin/python
+
+#*******************************************************************************
+# Copyright (c) 2026 VMware, Inc.  All rights reserved.
+# SPDX-License-Identifier: GPL-2.0
+#*******************************************************************************
+
+# Generate or verify the block map of a FAT bootbank (see include/blkmap.h).
+#
+# Usage: blkmap.py generate image [-o output] [--offset bytes]
+#        blkmap.py verify image [--offset bytes]
+#
+# 'image' is either a FAT filesystem image or a disk device/image, in which case
+# --offset gives the byte offset of the FAT partition.
+#
+# 'generate' must be run once all the bootbank files have been written. The
+# resulting map must then be copied to the root directory of the bootbank as
+# blkmap.dat, without modifying any other file (which would make the map
+# stale). 'verify' checks an installed map against the filesystem.
+
+import argparse
+import struct
+import sys
+import zlib
+
+BLKMAP_FILENAME = 'BLKMAP  DAT'
+BLKMAP_MAGIC = b'ESXBMAP1'
+BLKMAP_VERSION = 1
+
+HEADER_FMT = '<8sIIIIII'
+ENTRY_FMT = '<11sBIII'
+EXTENT_FMT = '<QII'
+
+ATTR_VOLUME_ID = 0x08
+ATTR_DIRECTORY = 0x10
+ATTR_VFAT_SLOT = 0x0f
+DIRENT_DELETED = 0xe5
+DIRENT_SIZE = 32
+
+class FatError(Exception):
+   pass
+
+# Minimal read-only FAT12/16/32 parser, following the same rules as libfat.
+class Fat:
+   def __init__(self, f, offset):
+      self.f = f
+      self.offset = offset
+      bs = self.read(0, 512)
+      (self.bps, spc, rsvd, nfats, rootents, total16, fatsz16) = \
+         struct.unpack_from('<HBHBHHxH', bs, 11)
+      (total32, fatsz32, rootclus) = struct.unpack_from('<4xIIxxxxI', bs, 28)
+      if self.bps not in (512, 4096) or spc == 0 or spc & (spc - 1):
+         raise FatError('not a FAT filesystem')
+      self.spc = spc
+      self.end = total16 or total32
+      fatsz = fatsz16 or fatsz32
+      self.fat = rsvd
+      self.fatsz = fatsz
+      self.fatdata = None
+      self.rootdir = rsvd + fatsz * nfats
+      self.data = self.rootdir + (rootents * 32 + self.bps - 1) // self.bps
+      if self.data >= self.end:
+         raise FatError('not a FAT filesystem')
+      nclusters = (self.end - self.data) // spc
+      self.endcluster = nclusters + 2
+      if nclusters <= 0xff4:
+         self.bits = 12
+      elif nclusters <= 0xfff4:
+         self.bits = 16
+      else:
+         self.bits = 32
+      self.rootcluster = rootclus if self.bits == 32 else 0
+
+   def read(self, sector, count):
+      self.f.seek(self.offset + sector * getattr(self, 'bps', 512))
+      data = self.f.read(count)
+      if len(data) != count:
+         raise FatError('unexpected end of image')
+      return data
+
+   def sectors(self, sector, count):
+      return self.read(sector, count * self.bps)
+
+   def next_cluster(self, cluster):
+      if self.fatdata is None:
+         self.fatdata = self.sectors(self.fat, self.fatsz)
+      if self.bits == 12:
+         off = cluster + (cluster >> 1)
+         val = struct.unpack_from('<H', self.fatdata, off)[0]
+         val = (val >> 4) if cluster & 1 else (val & 0xfff)
+         return None if val >= 0xff8 else val
+      if self.bits == 16:
+         val = struct.unpack_from('<H', self.fatdata, cluster * 2)[0]
+         return None if val >= 0xfff8 else val
+      val = struct.unpack_from('<I', self.fatdata, cluster * 4)[0]
+      val &= 0x0fffffff
+      return None if val >= 0x0ffffff8 else val
+
+   def cluster_sector(self, cluster):
+      if cluster < 2 or cluster >= self.endcluster:
+         raise FatError('invalid cluster %d' % cluster)
+      return self.data + (cluster - 2) * self.spc
+
+   # List of (sector, count) extents covering 'nsectors' of a cluster chain.
+   def chain_extents(self, cluster, nsectors):
+      extents = []
+      while nsectors > 0:
+         if cluster is None:
+            raise FatError('truncated cluster chain')
+         sector = self.cluster_sector(cluster)
+         count = min(self.spc, nsectors)
+         if extents and extents[-1][0] + extents[-1][1] == sector:
+            extents[-1] = (extents[-1][0], extents[-1][1] + count)
+         else:
+            extents.append((sector, count))
+         nsectors -= count
+         cluster = self.next_cluster(cluster)
+      return extents
+
+   def root_data(self):
+      if self.rootcluster == 0:
+         return self.sectors(self.rootdir, self.data - self.rootdir)
+      data = b''
+      cluster = self.rootcluster
+      while cluster is not None:
+         data += self.sectors(self.cluster_sector(cluster), self.spc)
+         cluster = self.next_cluster(cluster)
+      return data
+
+   # Live short directory entries of the root directory, in on-disk order.
+   def root_entries(self):
+      data = self.root_data()
+      for off in range(0, len(data), DIRENT_SIZE):
+         dirent = data[off:off + DIRENT_SIZE]
+         if dirent[0:1] == b'\0':
+            break
+         if dirent[0:1] == bytes([DIRENT_DELETED]) or \
+            dirent[11] == ATTR_VFAT_SLOT:
+            continue
+         yield dirent
+
+   def generation(self):
+      crc = 0
+      for dirent in self.root_entries():
+         if dirent[0:11] == BLKMAP_FILENAME.encode():
+            continue
+         crc = zlib.crc32(dirent[:18] + b'\0\0' + dirent[20:], crc)
+      return crc & 0xffffffff
+
+   def files(self):
+      for dirent in self.root_entries():
+         (name, attr) = struct.unpack_from('<11sB', dirent)
+         (hi, lo, size) = struct.unpack_from('<H4xHI', dirent, 20)
+         if attr & (ATTR_VOLUME_ID | ATTR_DIRECTORY):
+            continue
+         cluster = (hi << 16) | lo
+         nsectors = (size + self.bps - 1) // self.bps
+         extents = self.chain_extents(cluster, nsectors) if nsectors else []
+         yield (name, size, extents)
+
+   def file_data(self, size, extents):
+      data = b''.join(self.sectors(s, c) for (s, c) in extents)
+      return data[:size]
+
+def build_map(fat):
+   body = b''
+   count = 0
+   for (name, size, extents) in fat.files():
+      if name == BLKMAP_FILENAME.encode():
+         continue
+      crc = zlib.crc32(fat.file_data(size, extents)) & 0xffffffff
+      body += struct.pack(ENTRY_FMT, name, 0, size, crc, len(extents))
+      for (sector, n) in extents:
+         body += struct.pack(EXTENT_FMT, sector, n, 0)
+      count += 1
+   header = struct.pack(HEADER_FMT, BLKMAP_MAGIC, BLKMAP_VERSION, fat.bps,
+                        count, fat.generation(), 0, 0)
+   crc = zlib.crc32(header + body) & 0xffffffff
+   header = struct.pack(HEADER_FMT, BLKMAP_MAGIC, BLKMAP_VERSION, fat.bps,
+                        count, fat.generation(), crc, 0)
+   return header + body
+
+def installed_map(fat):
+   for (name, size, extents) in fat.files():
+      if name == BLKMAP_FILENAME.encode():
+         return fat.file_data(size, extents)
+   raise FatError('no %s in the root directory' % BLKMAP_FILENAME)
+
+def generate(args, fat):
+   blkmap = build_map(fat)
+   with open(args.output, 'wb') as f:
+      f.write(blkmap)
+   print('%s: %d bytes, generation 0x%08x' %
+         (args.output, len(blkmap), fat.generation()))
+
+def verify(args, fat):
+   installed = installed_map(fat)
+   expected = build_map(fat)
+   if installed == expected:
+      print('Block map is valid')
+      return 0
+   hsize = struct.calcsize(HEADER_FMT)
+   if installed[:8] != BLKMAP_MAGIC:
+      print('Block map has a bad magic')
+   elif installed[hsize - 12:hsize - 8] != expected[hsize - 12:hsize - 8]:
+      print('Block map is stale (generation mismatch)')
+   else:
+      print('Block map does not match the filesystem')
+   return 1
+
+parser = argparse.ArgumentParser(description='FAT bootbank block map tool')
+parser.add_argument('command', choices=['generate', 'verify'])
+parser.add_argument('image')
+parser.add_argument('-o', '--output', default='blkmap.dat')
+parser.add_argument('--offset', type=int, default=0,
+                    help='byte offset of the FAT partition in the image')
+args = parser.parse_args()
+
+try:
+   with open(args.image, 'rb') as f:
+      fat = Fat(f, args.offset)
+      if args.command == 'generate':
+         generate(args, fat)
+      else:
+         sys.exit(verify(args, fat))
+except (FatError, IOError) as e:
+   sys.stderr.write('blkmap.py: %s\n' % e)
+   sys.exit(2)
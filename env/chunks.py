@@ -0,0 +1,40 @@
+#! /usr/bin/python
+
+#*******************************************************************************
+# Copyright (c) 2026 VMware, Inc.  All rights reserved.
+# SPDX-License-Identifier: GPL-2.0
+#*******************************************************************************
+
+# Generate the chunk hash list of a boot module.
+# Usage: chunks.py [-s chunkSize] inputFile...
+#
+# Writes inputFile.chunks next to each input file: the chunk size and the file
+# size, in bytes, followed by the MD5 sum of each chunk, one per line. With the
+# chunkhashes=1 boot.cfg option, mboot checks each module it loads against its
+# list, and fetches only the corrupted chunks again. The default chunk size is
+# 1MB; smaller chunks make repairs cheaper, at the cost of a longer list.
+
+import hashlib
+import sys
+
+DEFAULT_CHUNK_SIZE = 1024 * 1024
+
+args = sys.argv[1:]
+chunkSize = DEFAULT_CHUNK_SIZE
+if len(args) >= 2 and args[0] == '-s':
+   chunkSize = int(args[1])
+   args = args[2:]
+
+if len(args) < 1 or chunkSize <= 0:
+   sys.stderr.write('Usage: chunks.py [-s chunkSize] inputFile...\n')
+   sys.exit(1)
+
+for name in args:
+   with open(name, 'rb') as f:
+      data = f.read()
+
+   with open(name + '.chunks', 'w') as f:
+      f.write('%d %d\n' % (chunkSize, len(data)))
+      for offset in range(0, len(data), chunkSize):
+         f.write(hashlib.md5(data[offset:offset + chunkSize]).hexdigest())
+         f.write('\n')
@@ -7,12 +7,21 @@
 
 # Wrapper script around the signing process.
 # Usage: sign.py key1+key2+...+keyn inputFile [outputFile]
+#        sign.py --tree[=leafSize] key inputFile [outputFile]
 # Environment variables:
 #  SIGN_RELEASE_BINARIES, LOCALKEYS,
-#  SBSIGN, SBATTACH, SBVERIFY, AUTHENTICODESIGNC
+#  SBSIGN, SBATTACH, SBVERIFY, AUTHENTICODESIGNC, OPENSSL
+#
+# The first form attaches Authenticode signatures to an UEFI binary. The
+# second form attaches an mboot schema version 5 signature to a boot module:
+# the signature covers the root of a hash tree over fixed-size leaves of the
+# module (1MB by default), which mboot verifies on all the CPUs at once. See
+# mboot/secure.c for the format.
 
 import sys
 import os
+import struct
+import hashlib
 import subprocess
 
 # Pick up optional environment variables.
@@ -21,6 +30,7 @@ sbsign = os.getenv('SBSIGN') or 'sbsign'
 sbattach = os.getenv('SBATTACH') or 'sbattach'
 sbverify = os.getenv('SBVERIFY') or 'sbverify'
 authenticodesignc = os.getenv('AUTHENTICODESIGNC') or 'authenticodesignc'
+openssl = os.getenv('OPENSSL') or 'openssl'
 topdir = os.getenv('TOPDIR') or '.'
 sigcache = topdir + '/sigcache'
 localkeys = os.getenv('LOCALKEYS') or topdir + '/localkeys'
@@ -101,6 +111,80 @@ def cleanup(iname, keys):
       except:
          pass
 
+# Module signature format (mboot/secure.c).
+SCHEMA_MAGIC = 0x1abe11ed
+TREE_SCHEMA = 5
+TREE_MIN_LEAF_SIZE = 64 * 1024
+TREE_LEAF_SIZE = 1024 * 1024
+TREE_LEAF_TAG = b'\x00'
+TREE_ROOT_TAG = b'\x01'
+KEYID_LEN = 16
+
+# Hash algorithm of a signing key, as mboot infers it from the certificate.
+def certhash(cert):
+   text = subprocess.check_output([openssl, 'x509', '-in', cert,
+                                   '-noout', '-text'])
+   if b'sha512WithRSAEncryption' in text:
+      return 'sha512'
+   return 'sha256'
+
+# Sign a boot module locally with a hash tree signature.  Usable only with
+# test keys, since it requires access to the private key as a file.
+def treesign(iname, oname, key, leafSize):
+   k = localkeys + '/' + key + '/' + key
+   keyid = key.encode('ascii')
+   if len(keyid) > KEYID_LEN:
+      raise ValueError('Key name %s is longer than %d' % (key, KEYID_LEN))
+   alg = certhash(k + '.cert')
+
+   with open(iname, 'rb') as f:
+      data = f.read()
+   data += struct.pack('<II', leafSize, TREE_SCHEMA)
+
+   leaves = [hashlib.new(alg, TREE_LEAF_TAG +
+                         hashlib.new(alg, data[offset:offset + leafSize])
+                         .digest()).digest()
+             for offset in range(0, len(data), leafSize)]
+   root = hashlib.new(alg, TREE_ROOT_TAG +
+                      struct.pack('<II', leafSize, len(leaves)) +
+                      b''.join(leaves) +
+                      struct.pack('<I', TREE_SCHEMA)).digest()
+
+   proc = subprocess.Popen([openssl, 'pkeyutl', '-sign',
+                            '-inkey', k + '.key',
+                            '-pkeyopt', 'digest:' + alg],
+                           stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+   (rsasig, err) = proc.communicate(root)
+   if proc.returncode != 0:
+      raise subprocess.CalledProcessError(proc.returncode, openssl)
+
+   sig = keyid.ljust(KEYID_LEN, b'\0') + rsasig
+   with open(oname, 'wb') as f:
+      f.write(data)
+      f.write(sig)
+      f.write(struct.pack('<II', len(sig), SCHEMA_MAGIC))
+
+# Hash tree signature of a boot module.
+if sys.argv[1].startswith('--tree'):
+   leafSize = TREE_LEAF_SIZE
+   if sys.argv[1].startswith('--tree='):
+      leafSize = int(sys.argv[1][len('--tree='):])
+   if leafSize < TREE_MIN_LEAF_SIZE or leafSize & (leafSize - 1) != 0:
+      print('Invalid leaf size %d' % leafSize)
+      exit(1)
+   key = sys.argv[2]
+   iname = sys.argv[3]
+   if len(sys.argv) > 4:
+      oname = sys.argv[4]
+   else:
+      oname = iname + '-' + key
+   if key.find('vmware') >= 0:
+      print('Skipped signing with %s; hash tree signatures need a local key'
+            % key)
+      exit(0)
+   treesign(iname, oname, key, leafSize)
+   exit(0)
+
 # Parse command line.
 keys = sys.argv[1].split('+')
 iname = sys.argv[2]
@@ -0,0 +1,49 @@
+#! /usr/bin/python
+
+#*******************************************************************************
+# Copyright (c) 2026 VMware, Inc.  All rights reserved.
+# SPDX-License-Identifier: GPL-2.0
+#*******************************************************************************
+
+# Compress a boot module against a preset dictionary.
+# Usage: zdict.py dictFile inputFile [outputFile]
+#
+# The output is a zdict container as understood by bootlib/gzip.c: a small
+# header carrying the Adler-32 of the dictionary, a raw deflate stream, and the
+# same CRC-32/size trailer as gzip. The dictionary (raw, or gzip'ed) is passed
+# to mboot with the zdict= boot.cfg option. Only its last 32KB are used by
+# deflate, so larger dictionaries are pointless.
+
+import gzip
+import struct
+import sys
+import zlib
+
+ZDICT_MAGIC = b'ZDF1'
+ZDICT_VERSION = 1
+
+def read(name):
+   with open(name, 'rb') as f:
+      data = f.read()
+   if data[:2] == b'\x1f\x8b':
+      data = gzip.decompress(data)
+   return data
+
+if len(sys.argv) < 3:
+   sys.stderr.write('Usage: zdict.py dictFile inputFile [outputFile]\n')
+   sys.exit(1)
+
+zdict = read(sys.argv[1])
+data = read(sys.argv[2])
+oname = sys.argv[3] if len(sys.argv) > 3 else sys.argv[2] + '.zd'
+
+c = zlib.compressobj(9, zlib.DEFLATED, -zlib.MAX_WBITS, 9,
+                     zlib.Z_DEFAULT_STRATEGY, zdict)
+stream = c.compress(data) + c.flush()
+
+with open(oname, 'wb') as f:
+   f.write(struct.pack('<4sBBHI', ZDICT_MAGIC, ZDICT_VERSION, zlib.DEFLATED, 0,
+                       zlib.adler32(zdict) & 0xffffffff))
+   f.write(stream)
+   f.write(struct.pack('<II', zlib.crc32(data) & 0xffffffff,
+                       len(data) & 0xffffffff))
@@ -0,0 +1,69 @@
+/*******************************************************************************
+ * Copyright (c) 2026 VMware, Inc.  All rights reserved.
+ * SPDX-License-Identifier: GPL-2.0
+ ******************************************************************************/
+
+/*
+ * blkmap.h -- Bootbank block map file format
+ *
+ *      A block map is written to the root directory of a FAT bootbank at
+ *      install/upgrade time (see env/blkmap.py). It records, for every file of
+ *      the root directory, the list of on-disk sector extents the file data
+ *      lives in. When the map is valid, files can be read straight from the
+ *      disk without walking the FAT.
+ *
+ *      Layout (all fields are little-endian):
+ *
+ *         blkmap_header_t
+ *         entry_count x { blkmap_entry_t, extent_count x blkmap_extent_t }
+ *
+ *      The map is only trusted if:
+ *       - its header CRC matches (computed over the whole file with the 'crc'
+ *         field set to 0),
+ *       - its generation matches the generation of the FAT root directory. The
+ *         generation is the CRC-32 of all the live short directory entries of
+ *         the root directory, in on-disk order, with the access date zeroed.
+ *         Deleted entries, VFAT long name slots and the block map own entry
+ *         are skipped.
+ *
+ *      In addition, each file read through the map must match the CRC-32
+ *      recorded in its entry.
+ */
+
+#ifndef BLKMAP_H_
+#define BLKMAP_H_
+
+#include <stdint.h>
+
+#define BLKMAP_FILENAME        "blkmap.dat"
+#define BLKMAP_MAGIC           "ESXBMAP1"
+#define BLKMAP_MAGIC_LEN       8
+#define BLKMAP_VERSION         1
+
+#pragma pack(1)
+typedef struct {
+   char magic[BLKMAP_MAGIC_LEN];
+   uint32_t version;
+   uint32_t bytes_per_sector;  /* Sector size the extents are expressed in */
+   uint32_t entry_count;       /* Number of blkmap_entry_t */
+   uint32_t generation;        /* FAT root directory generation stamp */
+   uint32_t crc;               /* CRC-32 of the whole map file */
+   uint32_t reserved;
+} blkmap_header_t;
+
+typedef struct {
+   char name[11];              /* FAT 8.3 short name */
+   uint8_t reserved;
+   uint32_t size;              /* File size, in bytes */
+   uint32_t crc;               /* CRC-32 of the file data */
+   uint32_t extent_count;      /* Number of blkmap_extent_t that follow */
+} blkmap_entry_t;
+
+typedef struct {
+   uint64_t sector;            /* First sector, relative to the partition */
+   uint32_t count;             /* Number of contiguous sectors */
+   uint32_t reserved;
+} blkmap_extent_t;
+#pragma pack()
+
+#endif /* !BLKMAP_H_ */
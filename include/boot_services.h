@@ -90,6 +90,8 @@ EXTERN int get_boot_dir(char **buffer);
 EXTERN int firmware_file_get_size_hint(const char *filepath, size_t *size);
 EXTERN int firmware_file_read(const char *filepath, int (*callback)(size_t),
                               void **buffer, size_t *buflen);
+EXTERN int firmware_file_read_range(const char *filepath, uint64_t offset,
+                                    size_t size, void *buffer);
 EXTERN int firmware_file_write(const char *filepath, int (*callback)(size_t),
                                void *buffer, size_t buflen);
 EXTERN int firmware_file_exec(const char *filepath, const char *options);
@@ -346,12 +348,26 @@ typedef enum {
    http_always = 3,
 } http_criteria_t;
 
+typedef enum {
+   snphttp_never = 0,
+   snphttp_if_no_firmware_http = 1,
+   snphttp_always = 2,
+} snphttp_criteria_t;
+
 #ifdef __COM32__
 #   define set_http_criteria(mode)
+#   define set_snphttp_criteria(mode)
+#   define set_snphttp_extra_nics(count)
 #   define tftp_set_block_size(size)
+#   define tftp_set_snp(enable)
+#   define disk_set_nvme_passthru(enable)
 #else
 EXTERN void set_http_criteria(http_criteria_t mode);
+EXTERN void set_snphttp_criteria(snphttp_criteria_t mode);
+EXTERN void set_snphttp_extra_nics(unsigned int count);
 EXTERN void tftp_set_block_size(size_t blksize);
+EXTERN void tftp_set_snp(bool enable);
+EXTERN void disk_set_nvme_passthru(bool enable);
 #endif
 
 #endif /* !BOOT_SERVICES_H_ */
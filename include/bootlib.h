@@ -77,6 +77,8 @@ typedef struct {
 
 void alloc_sanity_check(bool verbose);
 int alloc(uint64_t *addr, uint64_t size, size_t align, int option);
+int alloc_range(uint64_t *addr, uint64_t size, size_t align,
+                uint64_t min, uint64_t max);
 
 #define runtime_alloc_fixed(_addr_, _size_)                          \
    alloc((_addr_), (_size_), ALIGN_ANY, ALLOC_FIXED)
@@ -106,6 +108,26 @@ static INLINE int blacklist_runtime_mem(uint64_t addr, uint64_t size)
    return alloc(&page_start, size, ALIGN_ANY, ALLOC_FORCE);
 }
 
+/*
+ * memprof.c
+ */
+#ifdef DEBUG
+EXTERN void memprof_alloc(const void *ptr, size_t size, const void *caller);
+EXTERN void memprof_free(const void *ptr);
+EXTERN void memprof_realloc(const void *new, const void *old, size_t oldsize,
+                            size_t newsize, const void *caller);
+EXTERN void memprof_runtime_alloc(uint64_t addr, uint64_t size);
+EXTERN void memprof_sample(const char *label);
+EXTERN void memprof_report(const char *label);
+#else
+#define memprof_alloc(_ptr_, _size_, _caller_)
+#define memprof_free(_ptr_)
+#define memprof_realloc(_new_, _old_, _oldsize_, _newsize_, _caller_)
+#define memprof_runtime_alloc(_addr_, _size_)
+#define memprof_sample(_label_)
+#define memprof_report(_label_)
+#endif /* DEBUG */
+
 /*
  * e820.c
  */
@@ -113,6 +135,9 @@ static INLINE int blacklist_runtime_mem(uint64_t addr, uint64_t size)
 EXTERN void e820_mmap_merge(e820_range_t *mmap, size_t *count);
 EXTERN bool is_mergeable(uint64_t a1, uint64_t l1, uint64_t a2, uint64_t l2);
 EXTERN bool is_overlap(uint64_t a1, uint64_t l1, uint64_t a2, uint64_t l2);
+EXTERN int e820_sanity_check(e820_range_t *mmap, size_t count);
+EXTERN bool e820_range_has_type(const e820_range_t *mmap, size_t count,
+                                uint64_t base, uint64_t len, uint32_t type);
 EXTERN int e820_to_blacklist(e820_range_t *mmap, size_t count);
 
 /*
@@ -141,6 +166,15 @@ EXTERN int delete_char(char *str, size_t n);
 EXTERN bool is_gzip(const void *buffer, size_t size, int *status);
 EXTERN int gzip_extract(const void *src, size_t src_size, void **dest,
                         size_t *dest_size);
+EXTERN bool is_zdict(const void *buffer, size_t size, uint32_t *dict_id,
+                     int *status);
+EXTERN uint32_t zdict_id(const void *dict, size_t dict_size);
+EXTERN int gzip_extract_unverified(const void *src, size_t src_size,
+                                   void **dest, size_t *dest_size,
+                                   uint32_t *crc);
+EXTERN int zdict_extract(const void *src, size_t src_size, const void *dict,
+                         size_t dict_size, void **dest, size_t *dest_size,
+                         uint32_t *crc);
 
 /*
  * file.c
@@ -151,6 +185,8 @@ EXTERN int file_get_size_hint(int volid, const char *filename,
                               size_t *filesize);
 EXTERN int file_load(int volid, const char *filename, int (*callback)(size_t),
                      void **buffer, size_t *bufsize);
+EXTERN int file_load_range(int volid, const char *filename, uint64_t offset,
+                           size_t size, void *buffer);
 EXTERN int file_save(int volid, const char *filename, int (*callback)(size_t),
                      void *buffer, size_t bufsize);
 EXTERN int file_overwrite(int volid, const char *filepath, void *buffer,
@@ -14,5 +14,6 @@
 #include <compat.h>
 
 EXTERN uint32_t crc_32(void *buffer, size_t buflen);
+EXTERN uint32_t crc_32_update(uint32_t crc, const void *buffer, size_t buflen);
 
 #endif /* !CRC_H_ */
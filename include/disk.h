@@ -17,6 +17,25 @@ typedef struct disk_t {
    uint32_t heads_per_cylinder;
    uint32_t sectors_per_track;
    uint16_t bytes_per_sector;
+   uint32_t io_align;         /* Read buffer alignment (bytes, 0/1: none) */
+   uint32_t xfer_blocks;      /* Optimal transfer granularity (sectors) */
 } disk_t;
 
+/*-- disk_buffer_aligned -------------------------------------------------------
+ *
+ *      Check whether a buffer can be handed to the firmware for a disk
+ *      transfer without being bounced.
+ *
+ * Parameters
+ *      IN disk: pointer to the disk info structure
+ *      IN buf:  pointer to the buffer
+ *
+ * Results
+ *      True if the buffer is suitably aligned, false otherwise.
+ *----------------------------------------------------------------------------*/
+static INLINE bool disk_buffer_aligned(const disk_t *disk, const void *buf)
+{
+   return disk->io_align <= 1 || (uintptr_t)buf % disk->io_align == 0;
+}
+
 #endif
@@ -116,6 +116,13 @@ static INLINE void SetDevPathEndNode(EFI_DEVICE_PATH *Node)
 
 #define IS_PATH_SEPARATOR(_c_) ((_c_) == L'\\' || (_c_) == L'/')
 
+/*
+ * Stack buffer sizes for building file paths (in characters) and file device
+ * paths (in bytes) without memory allocation. Longer paths are allocated.
+ */
+#define EFI_FILEPATH_BUFLEN    256
+#define EFI_DEVPATH_BUFLEN     1024
+
 #define FOREACH_DEVPATH_NODE(_DevPath_, _Node_)                \
    for ((_Node_) = (_DevPath_);                                \
         !IsDevPathEnd((_Node_));                               \
@@ -131,6 +138,10 @@ EXTERN EFI_STATUS devpath_get(EFI_HANDLE Handle, EFI_DEVICE_PATH **DevPath);
 EXTERN EFI_STATUS devpath_handle(EFI_DEVICE_PATH *DevPath, EFI_HANDLE *Handle);
 EXTERN EFI_STATUS file_devpath(EFI_HANDLE Device, const CHAR16 *FileName,
                                EFI_DEVICE_PATH **FileDevPath);
+EXTERN EFI_STATUS file_devpath_buf(EFI_HANDLE Device, const CHAR16 *FileName,
+                                   VOID *Buf, size_t BufSize,
+                                   EFI_DEVICE_PATH **FileDevPath);
+EXTERN void file_devpath_free(EFI_DEVICE_PATH *DevPath, const VOID *Buf);
 EXTERN EFI_STATUS devpath_get_filepath(const EFI_DEVICE_PATH *DevPath,
                                        CHAR16 **FilePath);
 EXTERN EFI_STATUS devpath_duplicate(const EFI_DEVICE_PATH *DevPath,
@@ -157,6 +168,13 @@ EXTERN VOID *efi_malloc(UINTN size);
 EXTERN VOID *efi_calloc(UINTN nmemb, UINTN size);
 EXTERN VOID *efi_realloc(VOID *ptr, UINTN oldsize, UINTN newsize);
 EXTERN VOID efi_free(VOID *ptr);
+EXTERN void efi_set_page_alloc(UINTN threshold, UINTN align);
+
+/*
+ * mp.c
+ */
+EXTERN EFI_STATUS mp_run_all(EFI_AP_PROCEDURE Procedure, VOID *Argument,
+                             UINTN *Count);
 
 /*
  * simplefile.c
@@ -166,6 +184,9 @@ EXTERN EFI_STATUS simple_file_get_size(EFI_HANDLE Volume,
 EXTERN EFI_STATUS simple_file_load(EFI_HANDLE Volume, const char *filepath,
                                    int (*callback)(size_t), VOID **Buffer,
                                    UINTN *BufSize);
+EXTERN EFI_STATUS simple_file_load_range(EFI_HANDLE Volume,
+                                         const char *filepath, UINT64 Offset,
+                                         UINTN Size, VOID *Buffer);
 EXTERN EFI_STATUS simple_file_save(EFI_HANDLE Volume, const char *filepath,
                                    int (*callback)(size_t), VOID *Buffer,
                                    UINTN BufSize);
@@ -197,6 +218,20 @@ EXTERN EFI_STATUS http_file_get_size(EFI_HANDLE Volume, const char *filepath,
                                      UINTN *FileSize);
 EXTERN void http_cleanup(void);
 
+/*
+ * snphttp.c
+ */
+EXTERN EFI_STATUS snphttp_file_load(EFI_HANDLE Volume, const char *filepath,
+                                    int (*callback)(size_t), VOID **Buffer,
+                                    UINTN *BufSize);
+EXTERN EFI_STATUS snphttp_file_get_size(EFI_HANDLE Volume,
+                                        const char *filepath,
+                                        UINTN *FileSize);
+EXTERN EFI_STATUS snphttp_file_load_range(EFI_HANDLE Volume,
+                                          const char *filepath, UINT64 Offset,
+                                          UINTN Size, VOID *Buffer);
+EXTERN void snphttp_cleanup(void);
+
 /*
  * dhcpv4.c
  */
@@ -226,6 +261,8 @@ EXTERN bool is_pxe_boot(EFI_PXE_BASE_CODE **Pxe);
  */
 EXTERN EFI_STATUS filepath_unix_to_efi(const char *unix_path,
                                        CHAR16 **uefi_path);
+EXTERN EFI_STATUS filepath_unix_to_efi_buf(const char *unix_path, CHAR16 *Buf,
+                                           size_t BufLen, CHAR16 **uefi_path);
 EXTERN bool last_file_read_via_http(void);
 EXTERN int firmware_image_load(const char *filepath, const char *options,
                                void *image, size_t imgsize,
@@ -250,6 +287,8 @@ EXTERN size_t ucs2_strnlen(const CHAR16 *Str, size_t maxlen);
 EXTERN CHAR16 *ucs2_strcpy(CHAR16 *Dest, const CHAR16 *Src);
 EXTERN EFI_STATUS ucs2_to_ascii(const CHAR16 *Src, char **dest, bool strict);
 EXTERN EFI_STATUS ascii_to_ucs2(const char *src, CHAR16 **Dest);
+EXTERN EFI_STATUS ascii_to_ucs2_buf(const char *src, CHAR16 *Buf, size_t BufLen,
+                                    CHAR16 **Dest);
 EXTERN EFI_STATUS ucs2_alloc(size_t length, CHAR16 **Str);
 EXTERN EFI_STATUS ucs2_strdup(const CHAR16 *Str, CHAR16 **Duplicate);
 EXTERN EFI_STATUS argv_to_ucs2(int argc, char **argv, CHAR16 **ArgStr);
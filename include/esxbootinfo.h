@@ -58,6 +58,9 @@
 #define ESXBOOTINFO_FLAG_LOADESX_VERSION  (1 << 19)  /* LoadESX version field valid */
 #define ESXBOOTINFO_FLAG_VIDEO_MIN        (1 << 20)  /* Video min fields valid */
 #define ESXBOOTINFO_FLAG_TPM_MEASUREMENT  (1 << 21)  /* TPM measurement field valid */
+#define ESXBOOTINFO_FLAG_RELOCATABLE      (1 << 22)  /* x86 kernel may be placed
+                                                        anywhere; reloc fields
+                                                        valid */
 
 /*
  * ARM64 supports multiple image types identified by a mode which is
@@ -129,6 +132,9 @@ typedef struct ESXBootInfo_Header {
    uint64_t rts_size;        /* For new-style RTS. */
    uint32_t loadesx_version; /* LoadESX version supported */
    uint32_t tpm_measure;     /* TPM: determine what bootloader measures */
+   uint64_t reloc_align;     /* Reloc: run-time image base alignment */
+   uint64_t reloc_min;       /* Reloc: lowest run-time image address */
+   uint64_t reloc_max;       /* Reloc: highest run-time image address */
 } __attribute__((packed)) ESXBootInfo_Header;
 
 /*
@@ -163,6 +169,7 @@ typedef enum ESXBootInfo_Type {
    ESXBOOTINFO_LOADESX_CHECKS_TYPE,
    ESXBOOTINFO_TPM_TYPE,
    ESXBOOTINFO_RWD_TYPE,
+   ESXBOOTINFO_MODULE_DIGESTS_TYPE,
    NUM_ESXBOOTINFO_TYPE
 } ESXBootInfo_Type;
 
@@ -289,6 +296,51 @@ typedef struct ESXBootInfo_Tpm {
    uint8_t eventLog[0];
 } __attribute__((packed)) ESXBootInfo_Tpm;
 
+/* Module digest algorithms */
+#define ESXBOOTINFO_DIGEST_MD5                  1
+#define ESXBOOTINFO_DIGEST_SHA256               2
+#define ESXBOOTINFO_DIGEST_SHA512               3
+#define ESXBOOTINFO_DIGEST_SHA256_TREE          4  /* Hash tree root, SHA-256 */
+#define ESXBOOTINFO_DIGEST_SHA512_TREE          5  /* Hash tree root, SHA-512 */
+
+/* Module digest coverage */
+#define ESXBOOTINFO_DIGEST_COMPRESSED           1  /* Module file, as loaded */
+#define ESXBOOTINFO_DIGEST_UNCOMPRESSED         2  /* Module in memory */
+
+#define ESXBOOTINFO_DIGEST_MAX_LEN              64
+
+/*
+ * A digest covers the first 'length' bytes of the module, in the form given by
+ * 'coverage'. The signature digest of a signed module does not cover the
+ * trailing signature, hence the explicit length.
+ *
+ * Modules signed with a hash tree (Secure Boot schema version 5) have a
+ * signature digest of type ESXBOOTINFO_DIGEST_SHA*_TREE instead: the signed
+ * root of the tree over the covered bytes, whose last 8 bytes are the leaf
+ * size and the schema version number. See mboot/secure.c for how the root is
+ * computed. It is not a hash of the covered bytes themselves.
+ */
+typedef struct ESXBootInfo_Digest {
+   uint32_t algorithm;
+   uint32_t coverage;
+   uint64_t length;
+   uint32_t digestSize;
+   uint8_t digest[ESXBOOTINFO_DIGEST_MAX_LEN];
+} __attribute__((packed)) ESXBootInfo_Digest;
+
+/*
+ * Digests computed by the bootloader for one boot module. moduleIndex is the
+ * index of the module among the ESXBOOTINFO_MODULE_TYPE elements.
+ */
+typedef struct ESXBootInfo_ModuleDigests {
+   ESXBootInfo_Type type;
+   uint64_t elmtSize;
+
+   uint32_t moduleIndex;
+   uint32_t numDigests;
+   ESXBootInfo_Digest digests[0];
+} __attribute__((packed)) ESXBootInfo_ModuleDigests;
+
 typedef struct ESXBootInfo {
    uint64_t cmdline;
 
@@ -66,6 +66,18 @@ static INLINE void HLT(void)
    }
 }
 
+/*
+ * Timer.
+ */
+static INLINE uint64_t rdtsc(void)
+{
+   uint64_t cnt;
+
+   __asm__ __volatile__ ("rdtime %0" : "=r" (cnt));
+
+   return cnt;
+}
+
 /*
  * Paging
  */
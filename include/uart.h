@@ -10,6 +10,7 @@
 #ifndef UART_H_
 #define UART_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <boot_services.h>
 
@@ -18,6 +19,7 @@ typedef struct uart_t {
    uint32_t baudrate;
    io_channel_t io;
    void (*putc)(const struct uart_t *dev, char c);
+   void (*write)(const struct uart_t *dev, const char *buf, size_t len);
    serial_type_t type;
    /*
     * uart_putc should not be used until firmware is quiesced.
@@ -28,6 +30,7 @@ typedef struct uart_t {
 
 int  uart_init(const uart_t *dev);
 void uart_putc(const uart_t *dev, char c);
+void uart_write(const uart_t *dev, const char *buf, size_t len);
 uint32_t uart_flags(const uart_t *dev);
 
 #endif /* !UART_H_ */
@@ -220,6 +220,19 @@ static INLINE void HLT(void)
    __asm__ __volatile__("hlt");
 }
 
+/*
+ * Time Stamp Counter
+ */
+static INLINE uint64_t rdtsc(void)
+{
+   uint32_t lo, hi;
+
+   __asm__ __volatile__("rdtsc"
+                        : "=a" (lo), "=d" (hi));
+
+   return ((uint64_t)hi << 32) | lo;
+}
+
 /*
  * Control registers
  */
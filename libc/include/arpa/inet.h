@@ -15,11 +15,26 @@
 #define AF_INET  2
 #define AF_INET6 10
 
-INLINE uint16_t ntohs(uint16_t netshort)
+static INLINE uint16_t ntohs(uint16_t netshort)
 {
    return ((netshort << 8) | (netshort >> 8));
 }
 
+static INLINE uint16_t htons(uint16_t hostshort)
+{
+   return ntohs(hostshort);
+}
+
+static INLINE uint32_t ntohl(uint32_t netlong)
+{
+   return ((uint32_t)ntohs(netlong & 0xffff) << 16) | ntohs(netlong >> 16);
+}
+
+static INLINE uint32_t htonl(uint32_t hostlong)
+{
+   return ntohl(hostlong);
+}
+
 int inet_pton(int af, const char *src, void *dst);
 
 #endif /* !_ARPA_INET_H */
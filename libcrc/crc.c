@@ -64,36 +64,57 @@ static const uint32_t crc32_table[256] = {
    0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
 };
 
-/*-- crc32 ---------------------------------------------------------------------
+/*-- crc_32_update -------------------------------------------------------------
  *
- *      CRC calculation.
+ *      Incremental CRC calculation. Feeding a buffer in several pieces through
+ *      this function yields the same result as a single crc_32() call over the
+ *      whole buffer.
  *
  * Parameters
+ *      IN crc:    CRC of the data processed so far (0 for the first piece)
  *      IN buffer: data buffer
  *      IN buflen: buffer size, in bytes
  *
  * Results
- *      The 32-bit CRC
+ *      The updated 32-bit CRC
  *----------------------------------------------------------------------------*/
-uint32_t crc_32(void *buffer, size_t buflen)
+uint32_t crc_32_update(uint32_t crc, const void *buffer, size_t buflen)
 {
-   size_t crc;
-   uint8_t *p;
+   const uint8_t *p;
+   uint32_t c;
 
    if (buffer == NULL) {
-      return 0;
+      return crc;
    }
 
-   crc = 0xffffffff;
+   c = crc ^ 0xffffffff;
    p = buffer;
 
    while (buflen > 0) {
-      crc = (crc >> 8) ^ crc32_table[(uint8_t) crc ^ *p];
+      c = (c >> 8) ^ crc32_table[(uint8_t) c ^ *p];
       p++;
       buflen--;
    }
 
-   crc ^= 0xffffffff;
+   return c ^ 0xffffffff;
+}
+
+/*-- crc32 ---------------------------------------------------------------------
+ *
+ *      CRC calculation.
+ *
+ * Parameters
+ *      IN buffer: data buffer
+ *      IN buflen: buffer size, in bytes
+ *
+ * Results
+ *      The 32-bit CRC
+ *----------------------------------------------------------------------------*/
+uint32_t crc_32(void *buffer, size_t buflen)
+{
+   if (buffer == NULL) {
+      return 0;
+   }
 
-   return (uint32_t)crc;
+   return crc_32_update(0, buffer, buflen);
 }
@@ -63,6 +63,39 @@ static void aapl_s5l_putc(const uart_t *dev, char c)
    }
 }
 
+/*-- aapl_s5l_write_burst -------------------------------------------------------
+ *
+ *      Write a buffer on a serial port, filling the whole TX FIFO each time it
+ *      becomes empty.
+ *
+ * Parameters
+ *      IN dev: pointer to a UART descriptor
+ *      IN buf: characters to be written
+ *      IN len: number of characters to be written
+ *----------------------------------------------------------------------------*/
+static void aapl_s5l_write_burst(const uart_t *dev, const char *buf,
+                                 size_t len)
+{
+   uint16_t timeout;
+   size_t n;
+
+   while (len > 0) {
+      for (timeout = 0xffff; timeout > 0; timeout--) {
+         if ((aapl_s5l_read(dev, AAPL_S5L_UTRSTAT) &
+              AAPL_S5L_UTRSTAT_TX_FIFO_EMPTY) != 0) {
+            break;
+         }
+      }
+      if (timeout == 0) {
+         return;
+      }
+
+      for (n = MIN(len, AAPL_S5L_FIFO_SIZE); n > 0; n--, len--) {
+         aapl_s5l_write(dev, AAPL_S5L_UTXH, *buf++);
+      }
+   }
+}
+
 /*-- aapl_s5l_init --------------------------------------------------------------
  *
  *      Prepare an S5L UART.
@@ -84,5 +117,9 @@ int aapl_s5l_init(uart_t *dev)
    }
 
    dev->putc = aapl_s5l_putc;
+   if ((aapl_s5l_read(dev, AAPL_S5L_UFCON) &
+        AAPL_S5L_UFCON_FIFO_ENABLE) != 0) {
+      dev->write = aapl_s5l_write_burst;
+   }
    return ERR_SUCCESS;
 }
@@ -24,4 +24,7 @@
 #define AAPL_S5L_UTRSTAT_TX_FIFO_EMPTY     0x2
 #define APPL_S5L_UTRSTAT_RX_READY          0x1
 
+#define AAPL_S5L_UFCON_FIFO_ENABLE         0x1
+#define AAPL_S5L_FIFO_SIZE                 16
+
 #endif /* AAPL_S5L_H */
@@ -62,6 +62,40 @@ static void pl011_putc(const uart_t *dev, char c)
    }
 }
 
+/*-- pl011_write_burst -------------------------------------------------------
+ *
+ *      Write a buffer on a serial port. Characters are written until the TX
+ *      FIFO is full, and only then is the flag register polled for space.
+ *
+ * Parameters
+ *      IN dev: pointer to a UART descriptor
+ *      IN buf: characters to be written
+ *      IN len: number of characters to be written
+ *----------------------------------------------------------------------------*/
+static void pl011_write_burst(const uart_t *dev, const char *buf, size_t len)
+{
+   uint16_t timeout;
+
+   while (len > 0) {
+      while (len > 0 && (pl011_read(dev, PL011_FR) & PL011_FR_TXFF) == 0) {
+         pl011_write(dev, PL011_DR, *buf++);
+         len--;
+      }
+      if (len == 0) {
+         return;
+      }
+
+      for (timeout = 0xffff; timeout > 0; timeout--) {
+         if ((pl011_read(dev, PL011_FR) & PL011_FR_TXFF) == 0) {
+            break;
+         }
+      }
+      if (timeout == 0) {
+         return;
+      }
+   }
+}
+
 /*-- pl011_init --------------------------------------------------------------
  *
  *      Initialize a UART device with the given baudrate.
@@ -92,5 +126,6 @@ int pl011_init(uart_t *dev)
    }
 
    dev->putc = pl011_putc;
+   dev->write = pl011_write_burst;
    return ERR_SUCCESS;
 }
@@ -8,6 +8,7 @@
  */
 
 #include <stdint.h>
+#include <string.h>
 #include <io.h>
 #include <uart.h>
 
@@ -20,6 +21,7 @@
 
 #define FIFO_LENGTH          256
 #define TMFIFO_CHECK_SECONDS 1
+#define TMFIFO_TX_WORDS      8    /* Maximum data words per console message */
 
 typedef union {
   struct {
@@ -31,10 +33,13 @@ typedef union {
   uint64_t data;
 } tmfifo_msg_header_t;
 
-const tmfifo_msg_header_t tx_header = {
-  .type = TMFIFO_MSG_CONSOLE,
-  .len_lo = 1,
-};
+/*
+ * Console output is packed eight characters per FIFO word, and sent as a
+ * single message per write call (split when the buffer is full), so that
+ * nothing is left behind in the buffer once a write returns.
+ */
+static char tx_buf[TMFIFO_TX_WORDS * sizeof (uint64_t)];
+static unsigned int tx_len = 0;
 
 /*-- tmfifo_full ---------------------------------------------------------------
  *
@@ -49,10 +54,11 @@ const tmfifo_msg_header_t tx_header = {
 static bool tmfifo_full(const uart_t *dev)
 {
    /*
-    * Full means we can't stuff another two packets (message header and the
-    * actual data).
+    * Full means we can't stuff another complete message (message header and
+    * up to TMFIFO_TX_WORDS of data).
     */
-   return io_read64(&dev->io, TILE_TO_HOST_STATUS) > (FIFO_LENGTH - 2);
+   return io_read64(&dev->io, TILE_TO_HOST_STATUS) >
+      (FIFO_LENGTH - (TMFIFO_TX_WORDS + 1));
 }
 
 /*-- tmfifo_connected ----------------------------------------------------------
@@ -132,29 +138,88 @@ static bool tmfifo_connected(const uart_t *dev)
    return last_state == TMF_CONNECTED;
 }
 
-/*-- tmfifo_putc ---------------------------------------------------------------
+/*-- tmfifo_send ---------------------------------------------------------------
  *
- *      Write a character to the TMFIFO console.
+ *      Send a console message, made of a message header followed by the
+ *      payload packed eight bytes per FIFO word.
  *
  * Parameters
  *      IN dev: pointer to a UART descriptor
- *      IN c:   character to be written
+ *      IN buf: message payload
+ *      IN len: payload length, at most TMFIFO_TX_WORDS * 8 bytes
  *----------------------------------------------------------------------------*/
-static void tmfifo_putc(const uart_t *dev, char c)
+static void tmfifo_send(const uart_t *dev, const char *buf, unsigned int len)
 {
+   tmfifo_msg_header_t header = {
+      .type = TMFIFO_MSG_CONSOLE,
+      .len_hi = (len >> 8) & 0xff,
+      .len_lo = len & 0xff,
+   };
+   unsigned int i, n;
+   uint64_t data;
+
    while (tmfifo_connected(dev)) {
       /*
        * If the FIFO continues being full after TMFIFO_CHECK_SECONDS,
        * tmfifo_connected will time out and return false.
        */
       if (!tmfifo_full(dev)) {
-         io_write64(&dev->io, TILE_TO_HOST_DATA, tx_header.data);
-         io_write64(&dev->io, TILE_TO_HOST_DATA, c);
+         io_write64(&dev->io, TILE_TO_HOST_DATA, header.data);
+         for (i = 0; i < len; i += n) {
+            n = len - i;
+            if (n > sizeof (data)) {
+               n = sizeof (data);
+            }
+            data = 0;
+            memcpy(&data, buf + i, n);
+            io_write64(&dev->io, TILE_TO_HOST_DATA, data);
+         }
          return;
       }
    }
 }
 
+/*-- tmfifo_write --------------------------------------------------------------
+ *
+ *      Write a buffer to the TMFIFO console. Characters are buffered and sent
+ *      whenever the buffer is full, and whatever remains is sent before
+ *      returning.
+ *
+ * Parameters
+ *      IN dev: pointer to a UART descriptor
+ *      IN buf: characters to be written
+ *      IN len: number of characters to be written
+ *----------------------------------------------------------------------------*/
+static void tmfifo_write(const uart_t *dev, const char *buf, size_t len)
+{
+   for ( ; len > 0; len--) {
+      tx_buf[tx_len++] = *buf++;
+
+      if (tx_len == sizeof (tx_buf)) {
+         tmfifo_send(dev, tx_buf, tx_len);
+         tx_len = 0;
+      }
+   }
+
+   if (tx_len > 0) {
+      tmfifo_send(dev, tx_buf, tx_len);
+      tx_len = 0;
+   }
+}
+
+/*-- tmfifo_putc ---------------------------------------------------------------
+ *
+ *      Write a character to the TMFIFO console.
+ *
+ * Parameters
+ *      IN dev: pointer to a UART descriptor
+ *      IN c:   character to be written
+ *----------------------------------------------------------------------------*/
+static void tmfifo_putc(const uart_t *dev, char c)
+{
+   tmfifo_write(dev, &c, 1);
+}
+
 /*-- tmfifo_init --------------------------------------------------------------
  *
  *      Prepares a TMFIFO console.
@@ -172,6 +237,7 @@ int tmfifo_init(uart_t *dev)
    }
 
    dev->putc = tmfifo_putc;
+   dev->write = tmfifo_write;
    dev->flags = UART_USE_AFTER_EXIT_BOOT_SERVICES;
    return ERR_SUCCESS;
 }
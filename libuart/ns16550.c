@@ -62,6 +62,37 @@ static void ns16550_putc(const uart_t *dev, char c)
    }
 }
 
+/*-- ns16550_write_burst -------------------------------------------------------
+ *
+ *      Write a buffer on a serial port, filling the whole TX FIFO each time it
+ *      becomes empty.
+ *
+ * Parameters
+ *      IN dev: pointer to a UART descriptor
+ *      IN buf: characters to be written
+ *      IN len: number of characters to be written
+ *----------------------------------------------------------------------------*/
+static void ns16550_write_burst(const uart_t *dev, const char *buf, size_t len)
+{
+   uint16_t timeout;
+   size_t n;
+
+   while (len > 0) {
+      for (timeout = 0xffff; timeout > 0; timeout--) {
+         if ((ns16550_read(dev, NS16550_LSR) & NS16550_LSR_THRE) != 0) {
+            break;
+         }
+      }
+      if (timeout == 0) {
+         return;
+      }
+
+      for (n = MIN(len, NS16550_FIFO_SIZE); n > 0; n--, len--) {
+         ns16550_write(dev, NS16550_TX, *buf++);
+      }
+   }
+}
+
 /*-- ns16550_init --------------------------------------------------------------
  *
  *      Initialize a UART device with the given baudrate.
@@ -80,6 +111,7 @@ static void ns16550_putc(const uart_t *dev, char c)
 int ns16550_init(uart_t *dev)
 {
    uint8_t c;
+   bool fifo;
 
    if (dev->type != SERIAL_NS16550) {
       return ERR_UNSUPPORTED;
@@ -139,10 +171,12 @@ int ns16550_init(uart_t *dev)
       c = 0;
    }
    ns16550_write(dev, NS16550_FCR, c);
+   fifo = (c != 0);
 
    /* Read the line status register to clear the error flags */
    c = ns16550_read(dev, NS16550_LSR);
 
    dev->putc = ns16550_putc;
+   dev->write = fifo ? ns16550_write_burst : NULL;
    return ERR_SUCCESS;
 }
@@ -39,4 +39,6 @@
 
 #define NS16550_LSR_THRE         (1 << 5)  /* Transmit-hold-register empty */
 
+#define NS16550_FIFO_SIZE        16        /* TX FIFO depth */
+
 #endif /* NS16550_H */
@@ -26,6 +26,28 @@ void uart_putc(const uart_t *dev, char c)
   }
 }
 
+/*-- uart_write ----------------------------------------------------------------
+ *
+ *      Write a buffer on a serial port. Drivers that can fill their transmit
+ *      FIFO in bursts provide their own write method, otherwise the buffer is
+ *      written one character at a time.
+ *
+ * Parameters
+ *      IN dev: pointer to a UART descriptor
+ *      IN buf: characters to be written
+ *      IN len: number of characters to be written
+ *----------------------------------------------------------------------------*/
+void uart_write(const uart_t *dev, const char *buf, size_t len)
+{
+   if (dev->write != NULL) {
+      dev->write(dev, buf, len);
+   } else if (dev->putc != NULL) {
+      for ( ; len > 0; len--) {
+         dev->putc(dev, *buf++);
+      }
+   }
+}
+
 /*-- uart_flags ----------------------------------------------------------------
  *
  *      Return UART flags to be used by upper layers.
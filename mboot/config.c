@@ -59,6 +59,47 @@
  *    ACPI table list separated by \"---\".
  * runtimewdtimeout=<SECONDS>
  *    Timeout in seconds before watchdog resets in seconds. Default: 0.
+ * zdict=<FILEPATH>
+ *    Preset dictionary for modules compressed as raw deflate against a shared
+ *    dictionary (optionally gzip'ed). Only loaded if such a module is found.
+ * integrity=<full|standard|fast>
+ *    Module integrity checks. full: CRC-32 and MD5 sums of every module.
+ *    standard: CRC-32 of every module, MD5 sums only when they are logged
+ *    (debug, verbose or serial logging). fast: as standard, but the CRC-32 is
+ *    skipped for modules whose signature is verified by UEFI Secure Boot
+ *    (except for modules loaded from mirrors=, which are always checked).
+ *    Default: build dependent (full unless overridden).
+ * mirrors=<PREFIX1 --- PREFIX2... --- PREFIXn>
+ *    Alternative prefixes holding the same files as prefix=. Each kernel or
+ *    module with a relative path is loaded from the mirror (prefix= included)
+ *    expected to be the fastest, based on a probe at load time and on the
+ *    throughput of the previous transfers. If a load fails, or the file turns
+ *    out to be corrupted, the next mirror is tried.
+ * snptftp=<0|1>
+ *    1: Download IPv4 TFTP files with the bootloader's own UDP stack, driving
+ *    the NIC through the Simple Network Protocol, with windowed transfers
+ *    (RFC 7440). The firmware TFTP client is used if that fails. Default: 0.
+ *    UEFI only.
+ * snphttp=<0|1|2>
+ *    Download plain http:// URLs, on IPv4 PXE boots, with the bootloader's own
+ *    HTTP/1.1 client and TCP stack (keep-alive, window scaling), driving the
+ *    NIC through the Simple Network Protocol. 0: never (default), 1: unless
+ *    native UEFI HTTP is used (see nativehttp), 2: always. UEFI only.
+ * chunkhashes=<0|1>
+ *    1: Verify each module against the per-chunk MD5 sums listed in
+ *    <FILEPATH>.chunks, if present (see env/chunks.py), and fetch only the
+ *    corrupted chunks again. Default: 0.
+ * nvmepassthru=<0|1>
+ *    1: Read the boot disk with NVMe commands through the NVM Express Pass
+ *    Thru protocol, with large transfers and several commands in flight, when
+ *    it is an NVMe namespace. Block I/O is used if that fails. Default: 0.
+ *    UEFI only.
+ * multinic=<N>
+ *    Spread the downloads of large modules by the native HTTP client (see
+ *    snphttp) across up to N other NICs that get a DHCP lease on the boot
+ *    subnet, with Range requests. Each NIC gets a single, short DHCP attempt,
+ *    and the leases are released before booting. The boot NIC loads whatever
+ *    an extra NIC fails to. Default: 0 (off). UEFI only.
  */
 static option_t mboot_options[] = {
    {"kernel", "=", {NULL}, OPT_STRING, {0}},
@@ -76,6 +117,14 @@ static option_t mboot_options[] = {
    {"tftpblksize", "=", {.integer = 0}, OPT_INTEGER, {0}},
    {"acpitables", "=", {NULL}, OPT_STRING, {0}},
    {"runtimewdtimeout", "=", {.integer = 0}, OPT_INTEGER, {0}},
+   {"zdict", "=", {NULL}, OPT_STRING, {0}},
+   {"integrity", "=", {NULL}, OPT_STRING, {0}},
+   {"mirrors", "=", {NULL}, OPT_STRING, {0}},
+   {"snptftp", "=", {.integer = 0}, OPT_INTEGER, {0}},
+   {"snphttp", "=", {.integer = -1}, OPT_INTEGER, {0}},
+   {"chunkhashes", "=", {.integer = 0}, OPT_INTEGER, {0}},
+   {"nvmepassthru", "=", {.integer = 0}, OPT_INTEGER, {0}},
+   {"multinic", "=", {.integer = 0}, OPT_INTEGER, {0}},
    {NULL, NULL, {NULL}, OPT_INVAL, {0}}
 };
 
@@ -186,17 +235,20 @@ static char *find_next_listitem(char **list)
  *      IN list:       list of files separated by "---"
  *      IN prefix_dir: relative paths are relative to there
  *      IN context:    callback context
- *      IN setitem:    callback to set filename and options for a list item
- *      IN clearitem:  callback to free filename and options for a list item
+ *      IN setitem:    callback to set filename, relative path and options for
+ *                     a list item
+ *      IN clearitem:  callback to free filename, relative path and options for
+ *                     a list item
  *
  * Results
  *      ERR_SUCCESS, or a generic error status.
  *----------------------------------------------------------------------------*/
 static int parse_filelist(char *list, const char *prefix_dir, void *context,
-                          void (*setitem)(void *, unsigned int, char *, char *),
+                          void (*setitem)(void *, unsigned int, char *, char *,
+                                          char *),
                           void (*clearitem)(void *, unsigned int))
 {
-   char *delim, *p, *parameter, *filename, *options;
+   char *delim, *p, *parameter, *filename, *relpath, *options;
    unsigned int i;
    int status;
    char c;
@@ -220,6 +272,15 @@ static int parse_filelist(char *list, const char *prefix_dir, void *context,
       c = *p;
       *p = '\0';
       status = make_path(prefix_dir, parameter, &filename);
+      if (status == ERR_SUCCESS && !is_absolute(parameter)) {
+         relpath = strdup(parameter);
+         if (relpath == NULL) {
+            sys_free(filename);
+            status = ERR_OUT_OF_RESOURCES;
+         }
+      } else {
+         relpath = NULL;
+      }
       *p = c;
       if (status != ERR_SUCCESS) {
          break;
@@ -239,6 +300,7 @@ static int parse_filelist(char *list, const char *prefix_dir, void *context,
          *delim = c;
          if (options == NULL) {
             sys_free(filename);
+            sys_free(relpath);
             status = ERR_OUT_OF_RESOURCES;
             break;
          }
@@ -246,7 +308,7 @@ static int parse_filelist(char *list, const char *prefix_dir, void *context,
          options = NULL;
       }
 
-      setitem(context, i, filename, options);
+      setitem(context, i, filename, relpath, options);
    }
 
    do {
@@ -264,17 +326,19 @@ static int parse_filelist(char *list, const char *prefix_dir, void *context,
  *      IN context:    pointer to the module info array
  *      IN index:      table entry offset
  *      IN filename:   module filename
+ *      IN relpath:    module filename relative to the prefix, or NULL
  *      IN options:    module options
  *
  * Results
  *      ERR_SUCCESS, or a generic error status.
  *----------------------------------------------------------------------------*/
 static void parse_modules_setitem(void *context, unsigned int index,
-                                  char *filename, char *options)
+                                  char *filename, char *relpath, char *options)
 {
    module_t *modules = context;
 
    modules[index].filename = filename;
+   modules[index].relpath = relpath;
    modules[index].options = options;
 }
 
@@ -294,8 +358,10 @@ static void parse_modules_clearitem(void *context, unsigned int index)
    module_t *modules = context;
 
    sys_free(modules[index].filename);
+   sys_free(modules[index].relpath);
    sys_free(modules[index].options);
    modules[index].filename = NULL;
+   modules[index].relpath = NULL;
    modules[index].options = NULL;
 }
 
@@ -326,17 +392,19 @@ static int parse_modules(char *mod_list, const char *prefix_dir,
  *      IN context:    pointer to the acpitab info array
  *      IN index:      table entry offset
  *      IN filename:   ACPI table filename
+ *      IN relpath:    ignored
  *      IN options:    ignored
  *
  * Results
  *      ERR_SUCCESS, or a generic error status.
  *----------------------------------------------------------------------------*/
 static void parse_acpitab_setitem(void *context, unsigned int index,
-                                  char *filename, char *options)
+                                  char *filename, char *relpath, char *options)
 {
    acpitab_t *acpitab = context;
 
    acpitab[index].filename = filename;
+   sys_free(relpath);
    sys_free(options);
 }
 
@@ -400,7 +468,7 @@ static int parse_cmdlines(const char *prefix_dir, const char *kernel,
                           char *acpitab_list)
 {
    char *m;
-   char *kname = NULL, *kopts = NULL;
+   char *kname = NULL, *krelpath = NULL, *kopts = NULL;
    unsigned int mod_count, acpitab_count;
    module_t *modules = NULL;
    acpitab_t *acpitab = NULL;
@@ -411,6 +479,14 @@ static int parse_cmdlines(const char *prefix_dir, const char *kernel,
       goto error;
    }
 
+   if (!is_absolute(kernel)) {
+      krelpath = strdup(kernel);
+      if (krelpath == NULL) {
+         status = ERR_OUT_OF_RESOURCES;
+         goto error;
+      }
+   }
+
    kopts = (options != NULL) ? strdup(options) : NULL;
    if (options != NULL && kopts == NULL) {
       status = ERR_OUT_OF_RESOURCES;
@@ -456,6 +532,7 @@ static int parse_cmdlines(const char *prefix_dir, const char *kernel,
    }
 
    modules[0].filename = kname;
+   modules[0].relpath = krelpath;
    modules[0].options = kopts;
    boot.modules = modules;
    boot.modules_nr = mod_count;
@@ -466,6 +543,7 @@ static int parse_cmdlines(const char *prefix_dir, const char *kernel,
 
  error:
    sys_free(kname);
+   sys_free(krelpath);
    sys_free(kopts);
    sys_free(modules);
    sys_free(acpitab);
@@ -616,6 +694,92 @@ static int locate_config_file(const char *filename, char **path)
    return ERR_SUCCESS;
 }
 
+/*-- parse_integrity -----------------------------------------------------------
+ *
+ *      Parse the module integrity policy.
+ *
+ * Parameters
+ *      IN policy: integrity= option value
+ *
+ * Results
+ *      ERR_SUCCESS, or ERR_SYNTAX if the policy is unknown.
+ *----------------------------------------------------------------------------*/
+static int parse_integrity(const char *policy)
+{
+   if (strcasecmp(policy, "full") == 0) {
+      boot.integrity = INTEGRITY_FULL;
+   } else if (strcasecmp(policy, "standard") == 0) {
+      boot.integrity = INTEGRITY_STANDARD;
+   } else if (strcasecmp(policy, "fast") == 0) {
+      boot.integrity = INTEGRITY_FAST;
+   } else {
+      return ERR_SYNTAX;
+   }
+
+   return ERR_SUCCESS;
+}
+
+/*-- parse_mirrors -------------------------------------------------------------
+ *
+ *      Parse the mirror list and populate the mirror table. The prefix is
+ *      always the first mirror.
+ *
+ * Parameters
+ *      IN list:   list of prefixes separated by "---"
+ *      IN prefix: path prefix
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+static int parse_mirrors(char *list, char *prefix)
+{
+   char *m, *item, *delim, *p;
+   mirror_t *mirrors;
+   unsigned int count, i;
+
+   m = list;
+   for (count = 1; find_next_listitem(&m) != NULL; count++) {
+      ;
+   }
+
+   mirrors = sys_malloc(count * sizeof (mirror_t));
+   if (mirrors == NULL) {
+      return ERR_OUT_OF_RESOURCES;
+   }
+   memset(mirrors, 0, count * sizeof (mirror_t));
+   mirrors[0].prefix = prefix;
+
+   m = list;
+   for (i = 1; i < count; i++) {
+      item = find_next_listitem(&m);
+
+      delim = strstr(item, LISTITEM_SEPARATOR);
+      if (delim == NULL) {
+         delim = item + strlen(item);
+      }
+      for (p = item; p < delim && !isspace(*p); p++) {
+         ;
+      }
+
+      mirrors[i].prefix = sys_malloc(p - item + 1);
+      if (mirrors[i].prefix == NULL) {
+         while (--i > 0) {
+            sys_free(mirrors[i].prefix);
+         }
+         sys_free(mirrors);
+         return ERR_OUT_OF_RESOURCES;
+      }
+      memcpy(mirrors[i].prefix, item, p - item);
+      mirrors[i].prefix[p - item] = '\0';
+      Log(LOG_DEBUG, "Mirror: %s", mirrors[i].prefix);
+   }
+
+   boot.mirrors = mirrors;
+   boot.mirrors_nr = count;
+
+   return ERR_SUCCESS;
+}
+
 /*-- parse_config --------------------------------------------------------------
  *
  *      Parse the bootloader configuration file.
@@ -628,7 +792,8 @@ static int locate_config_file(const char *filename, char **path)
  *----------------------------------------------------------------------------*/
 int parse_config(const char *filename)
 {
-   char *mod_list, *acpitab_list, *title, *prefix, *kernel, *kopts;
+   char *mod_list, *acpitab_list, *title, *prefix, *kernel, *kopts, *zdict;
+   char *mirrors;
    char *path = NULL;
    int status;
 
@@ -669,6 +834,25 @@ int parse_config(const char *filename)
    }
    acpitab_list = mboot_options[13].value.str;  /* ACPI table list */
    boot.runtimewd_timeout = mboot_options[14].value.integer;
+   zdict = mboot_options[15].value.str;         /* Preset dictionary */
+   mirrors = mboot_options[17].value.str;       /* Mirror list */
+   tftp_set_snp(mboot_options[18].value.integer > 0);
+   if (mboot_options[19].value.integer >= 0) {
+      set_snphttp_criteria(mboot_options[19].value.integer);
+   }
+   boot.chunk_hashes = mboot_options[20].value.integer > 0;
+   disk_set_nvme_passthru(mboot_options[21].value.integer > 0);
+   if (mboot_options[22].value.integer > 0) {
+      set_snphttp_extra_nics(mboot_options[22].value.integer);
+   }
+   if (mboot_options[16].value.str != NULL) {   /* Integrity policy */
+      status = parse_integrity(mboot_options[16].value.str);
+      if (status != ERR_SUCCESS) {
+         Log(LOG_ERR, "Invalid integrity=%s in %s",
+             mboot_options[16].value.str, path);
+         goto error;
+      }
+   }
 
    if (kernel == NULL) {
       Log(LOG_ERR, "kernel=<FILEPATH> must be set in %s", path);
@@ -691,6 +875,12 @@ int parse_config(const char *filename)
    Log(LOG_DEBUG, "Prefix: %s", (prefix[0] != '\0') ? prefix : "(None)");
    boot.prefix = prefix;
    status = parse_cmdlines(prefix, kernel, kopts, mod_list, acpitab_list);
+   if (status == ERR_SUCCESS && zdict != NULL) {
+      status = make_path(prefix, zdict, &boot.zdict);
+   }
+   if (status == ERR_SUCCESS && mirrors != NULL) {
+      status = parse_mirrors(mirrors, prefix);
+   }
 
  error:
    if (boot.prefix != path) {
@@ -701,6 +891,9 @@ int parse_config(const char *filename)
    sys_free(mboot_options[2].value.str);   /* List of modules */
    sys_free(mboot_options[3].value.str);   /* Title string */
    sys_free(mboot_options[13].value.str);  /* ACPI table list */
+   sys_free(mboot_options[15].value.str);  /* Preset dictionary */
+   sys_free(mboot_options[16].value.str);  /* Integrity policy */
+   sys_free(mboot_options[17].value.str);  /* Mirror list */
 
    if (status == ERR_SUCCESS) {
       status = get_load_size_hint();
@@ -723,6 +916,7 @@ void config_clear(void)
    while (boot.modules_nr > 0) {
       boot.modules_nr--;
       sys_free(boot.modules[boot.modules_nr].filename);
+      sys_free(boot.modules[boot.modules_nr].relpath);
       sys_free(boot.modules[boot.modules_nr].options);
    }
 
@@ -737,5 +931,20 @@ void config_clear(void)
    sys_free(boot.acpitab);
    boot.acpitab = NULL;
 
+   while (boot.mirrors_nr > 1) {
+      boot.mirrors_nr--;
+      sys_free(boot.mirrors[boot.mirrors_nr].prefix);
+   }
+
+   sys_free(boot.mirrors);
+   boot.mirrors = NULL;
+   boot.mirrors_nr = 0;
+
+   sys_free(boot.zdict);
+   boot.zdict = NULL;
+   sys_free(boot.zdict_data);
+   boot.zdict_data = NULL;
+   boot.zdict_size = 0;
+
    boot.load_size = 0;
 }
@@ -303,6 +303,22 @@ int check_esxbootinfo_kernel(void *kbuf, size_t ksize)
    boot.tpm_measure = (mbh->flags & ESXBOOTINFO_FLAG_TPM_MEASUREMENT) != 0 &&
                       (mbh->tpm_measure & ESXBOOTINFO_TPM_MEASURE_V1) != 0;
 
+   boot.kernel.relocatable = false;
+   if ((mbh->flags & ESXBOOTINFO_FLAG_RELOCATABLE) != 0) {
+      if (mbh->reloc_align < PAGE_SIZE ||
+          (mbh->reloc_align & (mbh->reloc_align - 1)) != 0 ||
+          mbh->reloc_min > mbh->reloc_max) {
+         Log(LOG_WARNING, "Ignoring invalid kernel relocation range "
+             "[0x%"PRIx64":0x%"PRIx64"] (align 0x%"PRIx64")\n",
+             mbh->reloc_min, mbh->reloc_max, mbh->reloc_align);
+      } else {
+         boot.kernel.relocatable = true;
+         boot.kernel.reloc_align = mbh->reloc_align;
+         boot.kernel.reloc_min = mbh->reloc_min;
+         boot.kernel.reloc_max = mbh->reloc_max;
+      }
+   }
+
    return ERR_SUCCESS;
 }
 
@@ -365,6 +381,97 @@ static int ebi_set_modules_info(module_t *mods, unsigned int mods_count)
    return status;
 }
 
+/*-- ebi_add_digest ------------------------------------------------------------
+ *
+ *      Append a digest to a module digests element.
+ *
+ * Parameters
+ *      IN elmt:      pointer to the module digests element
+ *      IN algorithm: ESXBOOTINFO_DIGEST_* algorithm
+ *      IN coverage:  ESXBOOTINFO_DIGEST_COMPRESSED or _UNCOMPRESSED
+ *      IN length:    number of bytes covered by the digest
+ *      IN digest:    pointer to the digest
+ *      IN size:      size of the digest, in bytes
+ *----------------------------------------------------------------------------*/
+static void ebi_add_digest(ESXBootInfo_ModuleDigests *elmt, uint32_t algorithm,
+                           uint32_t coverage, uint64_t length,
+                           const void *digest, uint32_t size)
+{
+   ESXBootInfo_Digest *d = &elmt->digests[elmt->numDigests];
+
+   memset(d, 0, sizeof(ESXBootInfo_Digest));
+   d->algorithm = algorithm;
+   d->coverage = coverage;
+   d->length = length;
+   d->digestSize = size;
+   memcpy(d->digest, digest, size);
+
+   elmt->numDigests++;
+   elmt->elmtSize += sizeof(ESXBootInfo_Digest);
+}
+
+/*-- ebi_set_module_digests ----------------------------------------------------
+ *
+ *      Hand the module digests computed while loading (MD5 of the compressed
+ *      and uncompressed module, and the Secure Boot signature digest if any)
+ *      over to the kernel, so it does not have to hash the modules again.
+ *
+ * Parameters
+ *      IN mods:       pointer to the module info structure
+ *      IN mods_count: number of modules
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+static int ebi_set_module_digests(module_t *mods, unsigned int mods_count)
+{
+   unsigned int i;
+   int status;
+
+   for (i = 0; i < mods_count; i++) {
+      ESXBootInfo_ModuleDigests *elmt = (ESXBootInfo_ModuleDigests *)next_elmt;
+      const sig_digest_t *sig = &mods[i].sig_digest;
+
+      if (!mods[i].is_loaded) {
+         continue;
+      }
+
+      status = eb_check_space(sizeof(ESXBootInfo_ModuleDigests) +
+                              3 * sizeof(ESXBootInfo_Digest));
+      if (status != ERR_SUCCESS) {
+         return status;
+      }
+
+      elmt->type = ESXBOOTINFO_MODULE_DIGESTS_TYPE;
+      elmt->elmtSize = sizeof(ESXBootInfo_ModuleDigests);
+      elmt->moduleIndex = i;
+      elmt->numDigests = 0;
+
+      if (boot.md5) {
+         ebi_add_digest(elmt, ESXBOOTINFO_DIGEST_MD5,
+                        ESXBOOTINFO_DIGEST_COMPRESSED, mods[i].load_size,
+                        &mods[i].md5_compressed, sizeof(md5_t));
+         ebi_add_digest(elmt, ESXBOOTINFO_DIGEST_MD5,
+                        ESXBOOTINFO_DIGEST_UNCOMPRESSED, mods[i].size,
+                        &mods[i].md5_uncompressed, sizeof(md5_t));
+      }
+
+      if (sig->algorithm == ESXBOOTINFO_DIGEST_SHA256 ||
+          sig->algorithm == ESXBOOTINFO_DIGEST_SHA256_TREE) {
+         ebi_add_digest(elmt, sig->algorithm, ESXBOOTINFO_DIGEST_UNCOMPRESSED,
+                        sig->length, sig->value, 256 / 8);
+      } else if (sig->algorithm == ESXBOOTINFO_DIGEST_SHA512 ||
+                 sig->algorithm == ESXBOOTINFO_DIGEST_SHA512_TREE) {
+         ebi_add_digest(elmt, sig->algorithm, ESXBOOTINFO_DIGEST_UNCOMPRESSED,
+                        sig->length, sig->value, 512 / 8);
+      }
+
+      eb_advance_next_elmt();
+   }
+
+   return ERR_SUCCESS;
+}
+
 /*-- ebi_set_kernel_info -------------------------------------------------------
  *
  *      Set kernel-related fields in the EBI.
@@ -633,6 +740,11 @@ int esxbootinfo_set_runtime_pointers(run_addr_t *run_ebi)
       return status;
    }
 
+   status = ebi_set_module_digests(&boot.modules[1], boot.modules_nr - 1);
+   if (status != ERR_SUCCESS) {
+      return status;
+   }
+
    status = ebi_set_kernel_info(eb_info);
    if (status != ERR_SUCCESS) {
       return status;
@@ -801,12 +913,7 @@ int esxbootinfo_register(void)
    if (status != ERR_SUCCESS) {
       return status;
    }
-   if (boot.efi_info.valid) {
-      status = blacklist_runtime_mem(boot.efi_info.systab,
-                                     boot.efi_info.systab_size);
-      if (status != ERR_SUCCESS) {
-         return status;
-      }
+   if (boot.efi_info.mmap != NULL) {
       status = add_sysinfo_object(boot.efi_info.mmap,
                                   boot.efi_info.desc_size *
                                   boot.efi_info.num_descs,
@@ -946,6 +1053,8 @@ int esxbootinfo_init(void)
    size_ebi += sizeof(ESXBootInfo_MemRange) *
       (num_e820_ranges + NUM_E820_SLACK);
    size_ebi += size_mod * boot.modules_nr;
+   size_ebi += (sizeof(ESXBootInfo_ModuleDigests) +
+                3 * sizeof(ESXBootInfo_Digest)) * boot.modules_nr;
    size_ebi += sizeof(ESXBootInfo_Vbe);
    size_ebi += sizeof(ESXBootInfo_RuntimeWdt);
    if (tpm_event_log.size != 0) {
@@ -9,10 +9,30 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
 #include <libgen.h>
 #include <boot_services.h>
 #include "mboot.h"
 #include <md5.h>
+#include <crc.h>
+
+#define MIRROR_COST_SIZE  (1024 * 1024)  /* Reference transfer size (bytes) */
+#define MIRROR_MIN_TIME   1000           /* Minimum measured time (ms) */
+
+#define CHUNKS_SUFFIX     ".chunks"      /* Chunk hash list file suffix */
+#define CHUNKS_MAX_SIZE   (64 * 1024 * 1024) /* Largest chunk size (bytes) */
+#define CHUNKS_RETRIES    3              /* Re-fetches of a corrupted chunk */
+
+/*
+ * Chunk hash list of a module, as published next to it by env/chunks.py.
+ */
+typedef struct {
+   size_t chunk_size;         /* Chunk size (in bytes) */
+   size_t file_size;          /* Module file size (in bytes) */
+   size_t count;              /* Number of chunks */
+   md5_t *md5;                /* MD5 sum of each chunk */
+} chunk_list_t;
 
 static void load_sanity_check(void)
 {
@@ -244,6 +264,30 @@ static uint64_t get_transfer_bandwidth(uint64_t size, uint64_t time,
    return bandwidth;
 }
 
+/*-- module_md5_to_str ---------------------------------------------------------
+ *
+ *      Convert a module MD5 sum to a printable string, taking into account that
+ *      the integrity policy may have skipped the MD5 computation.
+ *
+ * Parameters
+ *      IN  md5_raw: the MD5 sum
+ *      OUT md5_str: the output string
+ *      IN  size:    size of the output string buffer
+ *
+ * Results
+ *      The output string.
+ *----------------------------------------------------------------------------*/
+static char *module_md5_to_str(const md5_t *md5_raw, char *md5_str,
+                               size_t size)
+{
+   if (!boot.md5) {
+      snprintf(md5_str, size, "not computed");
+      return md5_str;
+   }
+
+   return md5_to_str(md5_raw, md5_str, size);
+}
+
 /*-- log_module_transfer_stats ------------------------------------------------
  *
  *      Log module transfer statistics.
@@ -270,7 +314,7 @@ static void log_module_transfer_stats(unsigned int n)
    pretty_size = load_size;
    pretty_unit = modify_size_units(&pretty_size);
    pretty_unit_str = size_unit_to_str(pretty_unit);
-   md5_to_str(&mod->md5_compressed, md5str, sizeof(md5str));
+   module_md5_to_str(&mod->md5_compressed, md5str, sizeof(md5str));
 
    seconds = MILLISEC_TO_SEC_SIGNIFICAND(mod->load_time);
    tenths_of_second = MILLISEC_TO_SEC_FRACTIONAL(mod->load_time);
@@ -317,7 +361,7 @@ static void log_module_transfer_stats(unsigned int n)
    pretty_size = extracted_size;
    pretty_unit = modify_size_units(&pretty_size);
    pretty_unit_str = size_unit_to_str(pretty_unit);
-   md5_to_str(&mod->md5_uncompressed, md5str, sizeof(md5str));
+   module_md5_to_str(&mod->md5_uncompressed, md5str, sizeof(md5str));
 
    if (pretty_unit > BYTES) {
       Log(LOG_DEBUG, "%s (MD5: %s): extracted %"PRIu64"%s (%"PRIu64" bytes)\n",
@@ -330,46 +374,152 @@ static void log_module_transfer_stats(unsigned int n)
    sys_free(filepath);
 }
 
+/*-- load_zdict ----------------------------------------------------------------
+ *
+ *      Load the preset dictionary named by the zdict= option, if it has not
+ *      been loaded yet. The dictionary may itself be gzip'ed.
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+static int load_zdict(void)
+{
+   void *data, *dict;
+   size_t size;
+   int status;
+
+   if (boot.zdict_data != NULL) {
+      return ERR_SUCCESS;
+   }
+
+   if (boot.zdict == NULL) {
+      return ERR_NOT_FOUND;
+   }
+
+   Log(LOG_INFO, "Loading %s\n", boot.zdict);
+
+   status = file_load(boot.volid, boot.zdict, NULL, &data, &size);
+   if (status != ERR_SUCCESS) {
+      return status;
+   }
+
+   if (is_gzip(data, size, &status)) {
+      status = gzip_extract(data, size, &dict, &size);
+      sys_free(data);
+      if (status != ERR_SUCCESS) {
+         return status;
+      }
+      data = dict;
+   }
+
+   if (data == NULL || size == 0) {
+      sys_free(data);
+      return ERR_INCONSISTENT_DATA;
+   }
+
+   Log(LOG_DEBUG, "Preset dictionary 0x%x, %zu bytes\n",
+       zdict_id(data, size), size);
+
+   boot.zdict_data = data;
+   boot.zdict_size = size;
+
+   return ERR_SUCCESS;
+}
+
 /*-- extract_cksum_module ------------------------------------------------------
  *
- *      Extract and calculate md5 checksums for incoming compressed module
+ *      Extract and calculate md5 checksums for incoming compressed module.
+ *      Modules are either gzip'ed, or compressed as raw deflate against the
+ *      preset dictionary given by the zdict= option.
+ *
+ *      Which checks are performed depends on the integrity policy: MD5 sums
+ *      are only computed if boot.md5 is set, and the CRC-32 verification may be
+ *      deferred to check_deferred_crcs().
  *
  * Parameters
- *      IN     modulename:       name of the compressed module
- *      IN/OUT buffer:           incoming compressed buffer is replaced with
- *                               newly allocated outgoing uncompressed buffer.
- *                               Incoming buffer is freed in this routine.
- *      IN/OUT bufsize:          incoming compressed buffer size is replaced
- *                               with newly allocated uncompressed size.
- *      OUT    md5_compressed:   MD5 sum of compressed buffer.
- *      OUT    md5_uncompressed: MD5 sum of uncompressed buffer.
+ *      IN/OUT mod:     module info structure (MD5 sums and deferred CRC-32
+ *                      are set)
+ *      IN/OUT buffer:  incoming compressed buffer is replaced with newly
+ *                      allocated outgoing uncompressed buffer. Incoming buffer
+ *                      is freed in this routine.
+ *      IN/OUT bufsize: incoming compressed buffer size is replaced with newly
+ *                      allocated uncompressed size.
  *
  * Results
  *      ERR_SUCCESS, or a generic error status.
  *----------------------------------------------------------------------------*/
-static int extract_cksum_module(const char *modname, void **buffer,
-                                size_t *bufsize, md5_t *md5_compressed,
-                                md5_t *md5_uncompressed)
+static int extract_cksum_module(module_t *mod, void **buffer, size_t *bufsize)
 {
+   const char *modname = mod->filename;
    void *data = NULL;
    size_t size = *bufsize;
+   uint32_t dict_id, *crc;
    int status;
 
-   md5_compute(*buffer, size, md5_compressed);
-
-   if (!is_gzip(*buffer, size, &status)) {
-      return status;
+   if (boot.md5) {
+      md5_compute(*buffer, size, &mod->md5_compressed);
    }
 
-   status = gzip_extract(*buffer, size, &data, &size);
-   sys_free(*buffer);
-   if (status != ERR_SUCCESS) {
-      Log(LOG_ERR, "gzip_extract failed for %s (size %zu): %s\n",
-          modname, size, error_str[status]);
+   /*
+    * Under the fast policy, the CRC-32 of the modules is only verified once it
+    * is known whether the Secure Boot signature check covered them. Modules
+    * loaded from mirrors are verified right away, so that a corrupted copy
+    * makes fetch_mirrored_module() try the next mirror.
+    */
+   mod->crc_pending = false;
+   crc = (boot.integrity == INTEGRITY_FAST && boot.efi_info.secure_boot &&
+          !(boot.mirrors_nr > 1 && mod->relpath != NULL)) ? &mod->crc : NULL;
+
+   if (is_zdict(*buffer, size, &dict_id, &status)) {
+      status = load_zdict();
+      if (status != ERR_SUCCESS) {
+         sys_free(*buffer);
+         Log(LOG_ERR, "No preset dictionary for %s (dictionary 0x%x): %s\n",
+             modname, dict_id, error_str[status]);
+         return status;
+      }
+
+      status = zdict_extract(*buffer, size, boot.zdict_data, boot.zdict_size,
+                             &data, &size, crc);
+      sys_free(*buffer);
+      if (status != ERR_SUCCESS) {
+         Log(LOG_ERR, "zdict_extract failed for %s (size %zu): %s\n",
+             modname, size, error_str[status]);
+         return status;
+      }
+   } else if (status != ERR_BAD_TYPE) {
+      sys_free(*buffer);
       return status;
+   } else {
+      if (!is_gzip(*buffer, size, &status)) {
+         if (status == ERR_BAD_TYPE) {
+            /* Uncompressed module */
+            memcpy(&mod->md5_uncompressed, &mod->md5_compressed,
+                   sizeof (md5_t));
+         } else {
+            sys_free(*buffer);
+         }
+         return status;
+      }
+
+      if (crc != NULL) {
+         status = gzip_extract_unverified(*buffer, size, &data, &size, crc);
+      } else {
+         status = gzip_extract(*buffer, size, &data, &size);
+      }
+      sys_free(*buffer);
+      if (status != ERR_SUCCESS) {
+         Log(LOG_ERR, "gzip_extract failed for %s (size %zu): %s\n",
+             modname, size, error_str[status]);
+         return status;
+      }
    }
 
-   md5_compute(data, size, md5_uncompressed);
+   mod->crc_pending = (crc != NULL && size > 0);
+
+   if (boot.md5) {
+      md5_compute(data, size, &mod->md5_uncompressed);
+   }
 
    *bufsize = size;
    *buffer = data;
@@ -377,53 +527,337 @@ static int extract_cksum_module(const char *modname, void **buffer,
    return status;
 }
 
-/*-- load_module --------------------------------------------------------------
+/*-- parse_md5 -----------------------------------------------------------------
  *
- *      Load a boot module.
+ *      Parse a hexadecimal MD5 sum.
  *
  * Parameters
- *      IN n: module id
+ *      IN  str: the MD5 sum string
+ *      OUT md5: the MD5 sum
+ *
+ * Results
+ *      A pointer to the first character following the MD5 sum, or NULL if str
+ *      does not start with a valid MD5 sum.
+ *----------------------------------------------------------------------------*/
+static const char *parse_md5(const char *str, md5_t *md5)
+{
+   unsigned int i, hi, lo;
+
+   for (i = 0; i < MD5_HASH_LEN; i++) {
+      if (!isxdigit(str[0]) || !isxdigit(str[1])) {
+         return NULL;
+      }
+      hi = isdigit(str[0]) ? str[0] - '0' : tolower(str[0]) - 'a' + 10;
+      lo = isdigit(str[1]) ? str[1] - '0' : tolower(str[1]) - 'a' + 10;
+      (*md5)[i] = (unsigned char)((hi << 4) | lo);
+      str += 2;
+   }
+
+   return isxdigit(*str) ? NULL : str;
+}
+
+/*-- load_chunk_list -----------------------------------------------------------
+ *
+ *      Load the chunk hash list of a module. The list is a text file: the chunk
+ *      size and the module size, in bytes, followed by the MD5 sum of each
+ *      chunk, separated by white space.
+ *
+ * Parameters
+ *      IN  filepath: module path
+ *      OUT list:     the chunk hash list
+ *
+ * Results
+ *      ERR_SUCCESS, ERR_NOT_FOUND if the module has no (valid) list, or a
+ *      generic error status.
+ *----------------------------------------------------------------------------*/
+static int load_chunk_list(const char *filepath, chunk_list_t *list)
+{
+   char *path, *text, *end;
+   const char *p;
+   void *buffer;
+   size_t size, i;
+   int status;
+
+   if (asprintf(&path, "%s%s", filepath, CHUNKS_SUFFIX) < 0) {
+      return ERR_OUT_OF_RESOURCES;
+   }
+   status = file_load(boot.volid, path, NULL, &buffer, &size);
+   sys_free(path);
+   if (status != ERR_SUCCESS) {
+      Log(LOG_DEBUG, "No chunk hashes for %s: %s\n", filepath,
+          error_str[status]);
+      return ERR_NOT_FOUND;
+   }
+
+   text = sys_realloc(buffer, size, size + 1);
+   if (text == NULL) {
+      sys_free(buffer);
+      return ERR_OUT_OF_RESOURCES;
+   }
+   text[size] = '\0';
+
+   memset(list, 0, sizeof (*list));
+   list->chunk_size = strtoul(text, &end, 10);
+   list->file_size = strtoul(end, &end, 10);
+   if (list->chunk_size == 0 || list->chunk_size > CHUNKS_MAX_SIZE) {
+      goto invalid;
+   }
+
+   list->count = (list->file_size + list->chunk_size - 1) / list->chunk_size;
+   list->md5 = sys_malloc(MAX(list->count, 1) * sizeof (md5_t));
+   if (list->md5 == NULL) {
+      sys_free(text);
+      return ERR_OUT_OF_RESOURCES;
+   }
+
+   p = end;
+   for (i = 0; i < list->count; i++) {
+      while (isspace(*p)) {
+         p++;
+      }
+      p = parse_md5(p, &list->md5[i]);
+      if (p == NULL) {
+         goto invalid;
+      }
+   }
+
+   sys_free(text);
+
+   return ERR_SUCCESS;
+
+ invalid:
+   Log(LOG_WARNING, "Ignoring invalid chunk hash list for %s\n", filepath);
+   sys_free(list->md5);
+   sys_free(text);
+
+   return ERR_NOT_FOUND;
+}
+
+/*-- chunk_is_valid ------------------------------------------------------------
+ *
+ *      Check a chunk against its MD5 sum.
+ *
+ * Parameters
+ *      IN list:  chunk hash list
+ *      IN i:     chunk number
+ *      IN chunk: chunk data
+ *
+ * Results
+ *      True if the chunk is intact, false otherwise.
+ *----------------------------------------------------------------------------*/
+static bool chunk_is_valid(const chunk_list_t *list, size_t i, void *chunk)
+{
+   size_t len;
+   md5_t md5;
+
+   len = MIN(list->chunk_size, list->file_size - i * list->chunk_size);
+   md5_compute(chunk, len, &md5);
+
+   return memcmp(md5, list->md5[i], sizeof (md5_t)) == 0;
+}
+
+/*-- repair_chunks -------------------------------------------------------------
+ *
+ *      Fetch the corrupted chunks of a module again. Each corrupted chunk is
+ *      re-read on its own when the file access method allows it (e.g. HTTP
+ *      Range requests). Otherwise (e.g. TFTP), the whole module is read again,
+ *      and only the corrupted chunks are taken from the new copy.
+ *
+ * Parameters
+ *      IN     filepath: module path
+ *      IN     list:     chunk hash list
+ *      IN/OUT bad:      corrupted chunks (cleared when repaired)
+ *      IN/OUT buffer:   module data
+ *
+ * Results
+ *      The number of chunks that are still corrupted.
+ *----------------------------------------------------------------------------*/
+static size_t repair_chunks(const char *filepath, const chunk_list_t *list,
+                            bool *bad, uint8_t *buffer)
+{
+   size_t i, len, size, remaining;
+   unsigned int try;
+   uint8_t *chunk;
+   void *copy;
+   int status;
+
+   remaining = 0;
+   for (i = 0; i < list->count; i++) {
+      remaining += bad[i] ? 1 : 0;
+   }
+
+   chunk = sys_malloc(list->chunk_size);
+   if (chunk == NULL) {
+      return remaining;
+   }
+
+   status = ERR_SUCCESS;
+   for (i = 0; i < list->count && status != ERR_UNSUPPORTED; i++) {
+      len = MIN(list->chunk_size, list->file_size - i * list->chunk_size);
+
+      for (try = 0; try < CHUNKS_RETRIES && bad[i]; try++) {
+         status = file_load_range(boot.volid, filepath, i * list->chunk_size,
+                                  len, chunk);
+         if (status == ERR_UNSUPPORTED) {
+            break;
+         }
+         if (status == ERR_SUCCESS && chunk_is_valid(list, i, chunk)) {
+            memcpy(buffer + i * list->chunk_size, chunk, len);
+            bad[i] = false;
+            remaining--;
+         }
+      }
+   }
+
+   sys_free(chunk);
+
+   for (try = 0; try < CHUNKS_RETRIES && remaining > 0; try++) {
+      Log(LOG_DEBUG, "Reloading %s to repair %zu chunks\n", filepath,
+          remaining);
+
+      status = file_load(boot.volid, filepath, NULL, &copy, &size);
+      if (status != ERR_SUCCESS) {
+         continue;
+      }
+      if (size == list->file_size) {
+         for (i = 0; i < list->count; i++) {
+            if (bad[i] && chunk_is_valid(list, i,
+                                         (uint8_t *)copy +
+                                         i * list->chunk_size)) {
+               len = MIN(list->chunk_size,
+                         list->file_size - i * list->chunk_size);
+               memcpy(buffer + i * list->chunk_size,
+                      (uint8_t *)copy + i * list->chunk_size, len);
+               bad[i] = false;
+               remaining--;
+            }
+         }
+      }
+      sys_free(copy);
+   }
+
+   return remaining;
+}
+
+/*-- verify_chunks -------------------------------------------------------------
+ *
+ *      Verify a freshly loaded module against its chunk hash list, if it has
+ *      one, and fetch the corrupted chunks again. This catches corruption in
+ *      transit before the module is decompressed, and avoids loading the whole
+ *      module again to recover from it.
+ *
+ * Parameters
+ *      IN     filepath: module path
+ *      IN/OUT buffer:   module data
+ *      IN     size:     module size, in bytes
+ *
+ * Results
+ *      ERR_SUCCESS, ERR_CRC_ERROR if some chunks could not be repaired, or a
+ *      generic error status.
+ *----------------------------------------------------------------------------*/
+static int verify_chunks(const char *filepath, void *buffer, size_t size)
+{
+   chunk_list_t list;
+   size_t i, nbad;
+   bool *bad;
+   int status;
+
+   status = load_chunk_list(filepath, &list);
+   if (status != ERR_SUCCESS) {
+      /* The CRC-32 and MD5 checks still apply. */
+      return (status == ERR_NOT_FOUND) ? ERR_SUCCESS : status;
+   }
+
+   if (list.file_size != size) {
+      Log(LOG_WARNING, "%s: %zu bytes, %zu expected by the chunk hash list\n",
+          filepath, size, list.file_size);
+      sys_free(list.md5);
+      return ERR_SUCCESS;
+   }
+
+   bad = sys_malloc(MAX(list.count, 1) * sizeof (bool));
+   if (bad == NULL) {
+      sys_free(list.md5);
+      return ERR_OUT_OF_RESOURCES;
+   }
+
+   nbad = 0;
+   for (i = 0; i < list.count; i++) {
+      bad[i] = !chunk_is_valid(&list, i,
+                               (uint8_t *)buffer + i * list.chunk_size);
+      nbad += bad[i] ? 1 : 0;
+   }
+
+   if (nbad > 0) {
+      Log(LOG_WARNING, "%s: %zu of %zu chunks corrupted, fetching again\n",
+          filepath, nbad, list.count);
+      nbad = repair_chunks(filepath, &list, bad, buffer);
+      if (nbad > 0) {
+         Log(LOG_ERR, "%s: %zu chunks could not be repaired\n", filepath,
+             nbad);
+         status = ERR_CRC_ERROR;
+      }
+   }
+
+   sys_free(bad);
+   sys_free(list.md5);
+
+   return status;
+}
+
+/*-- fetch_module --------------------------------------------------------------
+ *
+ *      Load a boot module file, then extract it and compute its checksums.
+ *
+ * Parameters
+ *      IN  n:         module id
+ *      IN  filepath:  path of the module file
+ *      OUT addr:      extracted module
+ *      OUT load_size: size of the module file, in bytes
+ *      OUT size:      size of the extracted module, in bytes
  *
  * Results
  *      ERR_SUCCESS, or a generic error status.
  *----------------------------------------------------------------------------*/
-static int load_module(unsigned int n)
+static int fetch_module(unsigned int n, const char *filepath, void **addr,
+                        size_t *load_size, size_t *size)
 {
-   const char *filepath;
-   size_t load_size, size;
-   void *addr;
    int status;
    uint64_t start_time, end_time;
-   bool show_bandwidth = boot.is_network_boot || boot.debug;
-
-   filepath = boot.modules[n].filename;
-   Log(LOG_INFO, "Loading %s\n", filepath);
+   bool show_bandwidth = boot.is_network_boot || boot.debug ||
+      boot.mirrors_nr > 1;
 
    if (show_bandwidth) {
       start_time = firmware_get_time_ms(false);
    }
    status = file_load(boot.volid, filepath,
                       (boot.load_size > 0) ? load_callback : NULL,
-                      &addr, &load_size);
+                      addr, load_size);
    if (status != ERR_SUCCESS) {
       return status;
    }
 
+   if (boot.chunk_hashes) {
+      status = verify_chunks(filepath, *addr, *load_size);
+      if (status != ERR_SUCCESS) {
+         sys_free(*addr);
+         return status;
+      }
+   }
+
    if (show_bandwidth) {
       end_time = firmware_get_time_ms(true);
    }
 
    /* Boot modules should be in compressed(gzip) format. */
-   size = load_size;
-   status = extract_cksum_module(filepath, &addr, &size,
-                                 &boot.modules[n].md5_compressed,
-                                 &boot.modules[n].md5_uncompressed);
+   *size = *load_size;
+   status = extract_cksum_module(&boot.modules[n], addr, size);
 
    if (status != ERR_SUCCESS) {
       const module_t *mod = &boot.modules[n];
       char md5str[MD5_STRING_LEN];
 
-      md5_to_str(&mod->md5_compressed, md5str, sizeof(md5str));
+      module_md5_to_str(&mod->md5_compressed, md5str, sizeof(md5str));
 
       if (status == ERR_BAD_TYPE) {
          /*
@@ -433,12 +867,12 @@ static int load_module(unsigned int n)
           * and contains garbage.
           */
          Log(LOG_WARNING, "Warning: uncompressed module %s\n", filepath);
-         Log(LOG_WARNING, "MD5: %s, size %zu\n", md5str, load_size);
+         Log(LOG_WARNING, "MD5: %s, size %zu\n", md5str, *load_size);
       } else {
          Log(LOG_ERR, "Error %d (%s) while loading module: %s\n",
              status, error_str[status], filepath);
          Log(LOG_ERR, "Compressed MD5: %s\n", md5str);
-         md5_to_str(&mod->md5_uncompressed, md5str, sizeof(md5str));
+         module_md5_to_str(&mod->md5_uncompressed, md5str, sizeof(md5str));
          Log(LOG_ERR, "Decompressed MD5: %s\n", md5str);
          return status;
       }
@@ -447,9 +881,194 @@ static int load_module(unsigned int n)
    if (show_bandwidth) {
       boot.modules[n].load_time = (end_time > start_time) ?
          (end_time - start_time) : 0;
-      boot.load_time += boot.modules[n].load_time;
    }
 
+   return ERR_SUCCESS;
+}
+
+/*-- mirror_better -------------------------------------------------------------
+ *
+ *      Compare two mirrors. Mirrors that failed fewer times come first, then
+ *      the ones with the lowest expected cost: the probe latency, plus the time
+ *      a MIRROR_COST_SIZE transfer took on average so far. The throughput of a
+ *      mirror is only taken into account once MIRROR_MIN_TIME of transfers
+ *      have been measured, which firmware timer resolution makes necessary.
+ *
+ * Parameters
+ *      IN a: first mirror
+ *      IN b: second mirror
+ *
+ * Results
+ *      True if mirror a is expected to perform better than mirror b.
+ *----------------------------------------------------------------------------*/
+static bool mirror_better(const mirror_t *a, const mirror_t *b)
+{
+   uint64_t cost_a, cost_b;
+
+   if (a->failures != b->failures) {
+      return a->failures < b->failures;
+   }
+
+   cost_a = a->latency;
+   if (a->time >= MIRROR_MIN_TIME && a->bytes > 0) {
+      cost_a += a->time * MIRROR_COST_SIZE / a->bytes;
+   }
+   cost_b = b->latency;
+   if (b->time >= MIRROR_MIN_TIME && b->bytes > 0) {
+      cost_b += b->time * MIRROR_COST_SIZE / b->bytes;
+   }
+
+   return cost_a < cost_b;
+}
+
+/*-- probe_mirrors -------------------------------------------------------------
+ *
+ *      Measure how long each mirror takes to report the size of the kernel (or
+ *      of the first module with a relative path). Unreachable mirrors are
+ *      accounted a failure.
+ *----------------------------------------------------------------------------*/
+static void probe_mirrors(void)
+{
+   const char *relpath = NULL;
+   uint64_t start_time, end_time;
+   unsigned int i;
+   mirror_t *m;
+   size_t size;
+   char *path;
+   int status;
+
+   for (i = 0; i < boot.modules_nr && relpath == NULL; i++) {
+      relpath = boot.modules[i].relpath;
+   }
+   if (relpath == NULL) {
+      return;
+   }
+
+   for (i = 0; i < boot.mirrors_nr; i++) {
+      m = &boot.mirrors[i];
+
+      if (make_path(m->prefix, relpath, &path) != ERR_SUCCESS) {
+         return;
+      }
+
+      start_time = firmware_get_time_ms(false);
+      status = file_get_size_hint(boot.volid, path, &size);
+      end_time = firmware_get_time_ms(true);
+      sys_free(path);
+
+      m->latency = (end_time > start_time) ? (end_time - start_time) : 0;
+      if (status != ERR_SUCCESS) {
+         m->failures++;
+         Log(LOG_DEBUG, "Mirror %s: %s\n", m->prefix, error_str[status]);
+      } else {
+         Log(LOG_DEBUG, "Mirror %s: %"PRIu64" ms\n", m->prefix, m->latency);
+      }
+   }
+}
+
+/*-- fetch_mirrored_module -----------------------------------------------------
+ *
+ *      Load a boot module from the best mirror, falling back to the next best
+ *      ones if the load fails or the module turns out to be corrupted.
+ *
+ * Parameters
+ *      IN  n:         module id
+ *      OUT addr:      extracted module
+ *      OUT load_size: size of the module file, in bytes
+ *      OUT size:      size of the extracted module, in bytes
+ *
+ * Results
+ *      ERR_SUCCESS, or the generic error status of the last attempt.
+ *----------------------------------------------------------------------------*/
+static int fetch_mirrored_module(unsigned int n, void **addr,
+                                 size_t *load_size, size_t *size)
+{
+   module_t *mod = &boot.modules[n];
+   uint64_t load_offset = boot.load_offset;
+   unsigned int i, try, best;
+   bool *tried;
+   mirror_t *m;
+   char *path;
+   int status;
+
+   tried = sys_malloc(boot.mirrors_nr * sizeof (bool));
+   if (tried == NULL) {
+      return ERR_OUT_OF_RESOURCES;
+   }
+   memset(tried, 0, boot.mirrors_nr * sizeof (bool));
+
+   status = ERR_NOT_FOUND;
+
+   for (try = 0; try < boot.mirrors_nr; try++) {
+      best = boot.mirrors_nr;
+      for (i = 0; i < boot.mirrors_nr; i++) {
+         if (!tried[i] && (best == boot.mirrors_nr ||
+                           mirror_better(&boot.mirrors[i],
+                                         &boot.mirrors[best]))) {
+            best = i;
+         }
+      }
+      tried[best] = true;
+      m = &boot.mirrors[best];
+
+      status = make_path(m->prefix, mod->relpath, &path);
+      if (status != ERR_SUCCESS) {
+         break;
+      }
+
+      Log(LOG_DEBUG, "Loading %s from %s\n", mod->relpath, m->prefix);
+      status = fetch_module(n, path, addr, load_size, size);
+      sys_free(path);
+
+      if (status == ERR_SUCCESS) {
+         m->bytes += *load_size;
+         m->time += mod->load_time;
+         break;
+      }
+
+      m->failures++;
+      boot.load_offset = load_offset;
+      Log(LOG_WARNING, "Could not load %s from %s: %s\n", mod->relpath,
+          m->prefix, error_str[status]);
+   }
+
+   sys_free(tried);
+
+   return status;
+}
+
+/*-- load_module --------------------------------------------------------------
+ *
+ *      Load a boot module.
+ *
+ * Parameters
+ *      IN n: module id
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+static int load_module(unsigned int n)
+{
+   const char *filepath;
+   size_t load_size, size;
+   void *addr;
+   int status;
+
+   filepath = boot.modules[n].filename;
+   Log(LOG_INFO, "Loading %s\n", filepath);
+
+   boot.modules[n].load_time = 0;
+   if (boot.mirrors_nr > 1 && boot.modules[n].relpath != NULL) {
+      status = fetch_mirrored_module(n, &addr, &load_size, &size);
+   } else {
+      status = fetch_module(n, filepath, &addr, &load_size, &size);
+   }
+   if (status != ERR_SUCCESS) {
+      return status;
+   }
+
+   boot.load_time += boot.modules[n].load_time;
+
    if (n == 0) {
       /*
        * On x86, kernel can be Multiboot or ESXBootInfo.
@@ -481,6 +1100,8 @@ static int load_module(unsigned int n)
       }
    }
 
+   boot.modules[n].sig_digest.algorithm = 0;
+   boot.modules[n].sig_verified = false;
    boot.modules[n].addr = addr;
    boot.modules[n].load_size = load_size;
    boot.modules[n].size = size;
@@ -555,6 +1176,47 @@ static void log_transfer_stats(unsigned int num_modules_loaded,
        pretty_size, pretty_unit_str, size_extracted);
 }
 
+/*-- check_deferred_crcs -------------------------------------------------------
+ *
+ *      Verify the CRC-32 of the modules whose verification was deferred by the
+ *      fast integrity policy, unless a verified Secure Boot signature already
+ *      covers them. Must be called after secure_boot_check().
+ *
+ * Results
+ *      ERR_SUCCESS, or ERR_CRC_ERROR if a module is corrupted.
+ *----------------------------------------------------------------------------*/
+int check_deferred_crcs(void)
+{
+   unsigned int i, skipped;
+   module_t *mod;
+
+   skipped = 0;
+
+   for (i = 0; i < boot.modules_nr; i++) {
+      mod = &boot.modules[i];
+
+      if (!mod->crc_pending) {
+         continue;
+      }
+      mod->crc_pending = false;
+
+      if (mod->sig_verified) {
+         skipped++;
+         continue;
+      }
+
+      if (crc_32(mod->addr, mod->size) != mod->crc) {
+         Log(LOG_ERR, "CRC error in module %s\n", mod->filename);
+         return ERR_CRC_ERROR;
+      }
+   }
+
+   Log(LOG_DEBUG, "CRC-32 check skipped on %u signature verified modules\n",
+       skipped);
+
+   return ERR_SUCCESS;
+}
+
 /*-- load_boot_modules----------------------------------------------------------
  *
  *      Load kernel and modules into memory (do not relocate them).
@@ -585,6 +1247,22 @@ int load_boot_modules(void)
 
    load_sanity_check();
 
+   if (boot.mirrors_nr > 1 && i == 0) {
+      probe_mirrors();
+   }
+
+   /*
+    * MD5 sums are only worth computing if somebody looks at them: they are
+    * logged at debug level, and handed over to ESXBootInfo kernels.
+    */
+   boot.md5 = boot.integrity == INTEGRITY_FULL || boot.debug ||
+      boot.verbose || boot.serial;
+
+   Log(LOG_DEBUG, "Module integrity: CRC-32 %s, MD5 %s\n",
+       (boot.integrity == INTEGRITY_FAST && boot.efi_info.secure_boot) ?
+       "unless covered by a verified signature" : "always",
+       boot.md5 ? "always" : "never");
+
    for ( ; i < boot.modules_nr; i++) {
       status = load_module(i);
       if (status != ERR_SUCCESS) {
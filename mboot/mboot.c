@@ -119,6 +119,7 @@ static int mboot_init(int argc, char **argv)
 
    memset(&boot, 0, sizeof(boot));
    boot.bootif = true;
+   boot.integrity = INTEGRITY_DEFAULT;
 #ifdef DEBUG
    boot.verbose = true;
    boot.debug = true;
@@ -539,6 +540,7 @@ int main(int argc, char **argv)
    if (status != ERR_SUCCESS) {
       return clean(status);
    }
+   memprof_sample("config");
 
    if (boot.runtimewd) {
       Log(LOG_DEBUG, "Initializing hardware runtime watchdog...");
@@ -609,6 +611,7 @@ int main(int argc, char **argv)
    if (status != ERR_SUCCESS) {
       return clean(status);
    }
+   memprof_sample("modules");
 
 #ifdef SECURE_BOOT
    status = secure_boot_check(crypto_module);
@@ -626,6 +629,11 @@ int main(int argc, char **argv)
    }
 #endif
 
+   status = check_deferred_crcs();
+   if (status != ERR_SUCCESS) {
+      return clean(status);
+   }
+
    /* Must be before boot_init, where the event log is captured. */
    if (boot.tpm_measure) {
       status = measure_kernel_options();
@@ -648,14 +656,34 @@ int main(int argc, char **argv)
    if (status != ERR_SUCCESS) {
       return clean(status);
    }
+   memprof_report("boot_init");
+
+   /*
+    * Plan the relocations while the firmware is still up, against the last
+    * memory map it reports. Only the memory ranges that change before the
+    * boot services are actually shut down need to be revisited afterwards.
+    */
+   status = firmware_shutdown_prepare(&boot.mmap, &boot.mmap_count,
+                                      &boot.efi_info);
+   if (status != ERR_SUCCESS) {
+      return clean(status);
+   }
+
+   status = boot_register();
+   if (status != ERR_SUCCESS) {
+      return clean(status);
+   }
+
+   status = compute_relocations(boot.mmap, boot.mmap_count);
+   if (status != ERR_SUCCESS) {
+      return clean(status);
+   }
 
    Log(LOG_INFO, "Shutting down firmware services...");
 
    log_unsubscribe(firmware_print);
    if (firmware_shutdown(&boot.mmap, &boot.mmap_count,
                          &boot.efi_info)                 != ERR_SUCCESS
-    || boot_register()                                   != ERR_SUCCESS
-    || compute_relocations(boot.mmap, boot.mmap_count)   != ERR_SUCCESS
     || boot_set_runtime_pointers(&ebi)                   != ERR_SUCCESS
     || relocate_runtime_services(&boot.efi_info,
                                  boot.no_rts, boot.no_quirks) != ERR_SUCCESS
@@ -50,6 +50,8 @@ void TRAMPOLINE trampoline(handoff_t *handoff);
  * system.c
  */
 int dump_firmware_info(void);
+int firmware_shutdown_prepare(e820_range_t **mmap, size_t *count,
+                              efi_info_t *efi_info);
 int firmware_shutdown(e820_range_t **mmap, size_t *count, efi_info_t *efi_info);
 
 /*
@@ -82,6 +84,8 @@ typedef struct {
 int add_runtime_object(char type, void *src, uint64_t size, run_addr_t dest,
                        size_t align);
 int compute_relocations(e820_range_t *mmap, size_t count);
+int repair_runtime_mem(uint64_t addr, uint64_t size);
+int update_runtime_object(const void *old_src, void *new_src, uint64_t size);
 int runtime_addr(const void *addr, run_addr_t *runaddr);
 int install_trampoline(trampoline_t *run_trampo, handoff_t **run_handoff);
 
@@ -114,13 +118,44 @@ static inline void PANIC(void)
 
 typedef struct {
    Elf_CommonAddr entry;      /* Run-time entry point address */
+   bool relocatable;          /* x86: kernel may be placed anywhere within
+                                 [reloc_min, reloc_max] */
+   uint64_t reloc_align;      /* Run-time image base alignment */
+   uint64_t reloc_min;        /* Lowest run-time image address */
+   uint64_t reloc_max;        /* Highest run-time image address */
 } kernel_t;
 
+/*
+ * Module integrity policy, from the integrity= boot.cfg option. The build-time
+ * default can be overridden with 'make INTEGRITY=<FULL|STANDARD|FAST>'.
+ */
+typedef enum {
+   INTEGRITY_FULL,      /* CRC-32 and MD5 sums on every module */
+   INTEGRITY_STANDARD,  /* CRC-32 on every module, MD5 only if logged */
+   INTEGRITY_FAST,      /* As STANDARD, but no CRC-32 on Secure Boot verified
+                         * modules */
+} integrity_t;
+
+#ifndef INTEGRITY_DEFAULT
+#define INTEGRITY_DEFAULT INTEGRITY_FULL
+#endif
+
+typedef struct {
+   uint32_t algorithm;        /* ESXBOOTINFO_DIGEST_*, or 0 if not computed */
+   size_t length;             /* Number of bytes covered by the digest */
+   uint8_t value[ESXBOOTINFO_DIGEST_MAX_LEN];
+} sig_digest_t;
+
 typedef struct {
    char *filename;            /* Module file name */
+   char *relpath;             /* File name relative to the prefix, or NULL */
    char *options;             /* Module option string */
    md5_t md5_compressed;      /* md5sum compressed module */
    md5_t md5_uncompressed;    /* md5sum uncompressed module */
+   sig_digest_t sig_digest;   /* Signature digest (Secure Boot only) */
+   bool sig_verified;         /* Signature verified (Secure Boot only) */
+   bool crc_pending;          /* CRC-32 not verified yet */
+   uint32_t crc;              /* Expected CRC-32, if crc_pending */
    void *addr;                /* Load address */
    size_t load_size;          /* Compressed module size (in bytes) */
    size_t size;               /* Decompressed module size (in bytes) */
@@ -128,6 +163,17 @@ typedef struct {
    uint64_t load_time;        /* Time(ms) to load the module */
 } module_t;
 
+/*
+ * Equivalent module sources, from the prefix= and mirrors= boot.cfg options.
+ */
+typedef struct {
+   char *prefix;              /* Path prefix */
+   uint64_t latency;          /* Probe time (ms) */
+   uint64_t bytes;            /* Bytes loaded from this mirror */
+   uint64_t time;             /* Time (ms) spent loading from this mirror */
+   unsigned int failures;     /* Number of failed loads */
+} mirror_t;
+
 typedef struct {
    char *filename;            /* ACPI table file name */
    bool is_installed;         /* True if the ACPI table has been installed */
@@ -139,7 +185,12 @@ typedef struct {
    char title[TITLE_MAX_LEN]; /* Title string */
    char *cfgfile;             /* Configuration filename */
    char *prefix;              /* Module path prefix */
+   unsigned int mirrors_nr;   /* Number of mirrors (0 if none) */
+   mirror_t *mirrors;         /* Mirrors; the first one is the prefix */
    char *crypto;              /* Crypto module filename */
+   char *zdict;               /* Preset dictionary filename */
+   void *zdict_data;          /* Preset dictionary, once loaded */
+   size_t zdict_size;         /* Preset dictionary size (in bytes) */
    int volid;                 /* Volume to load the kernel/modules from */
    kernel_t kernel;           /* Kernel information */
    unsigned int modules_nr;   /* Number of modules */
@@ -154,6 +205,9 @@ typedef struct {
    uint64_t load_offset;      /* Current amount of loaded memory (in bytes) */
    uint64_t load_time;        /* Total time(ms) to load modules */
    char *recovery_cmd;        /* Command to be executed on <SHIFT+R> */
+   integrity_t integrity;     /* Module integrity policy */
+   bool md5;                  /* Are module MD5 sums computed? */
+   bool chunk_hashes;         /* Verify modules against chunk hash lists */
    bool verbose;              /* Verbose mode (true = on, false = off) */
    bool debug;                /* Debug mode (true = on, false = off) */
    bool headless;             /* True if no video adapter is found */
@@ -218,6 +272,7 @@ static INLINE const char *size_unit_to_str(size_unit_t size_unit)
 
 int get_load_size_hint(void);
 int load_boot_modules(void);
+int check_deferred_crcs(void);
 void unload_boot_modules(void);
 
 /*
@@ -94,6 +94,31 @@
  *      and safe memory. After blacklisting the bootloader's memory, we are sure
  *      that the allocator will only provide safe memory.
  *
+ *   4a. Order relocations
+ *      Ordering relocations with reloc_resolve() is necessary to make sure that
+ *      no relocation would overwrite the source of a later one. Sometimes,
+ *      cyclic dependencies prevent from finding a safe relocation order. In
+ *      this case, the object that is causing the cyclic dependency is copied
+ *      to a place it will never overwrite another object. While the boot
+ *      services are up, that place is reserved in bootloader's memory (the
+ *      firmware could still hand out safe memory), and the copy is only made
+ *      in step 6, once the object is final.
+ *
+ *   Steps 1 to 4a are run before the firmware boot services are shut down,
+ *   against the last memory map obtained from the firmware.
+ *
+ * repair_runtime_mem(), update_runtime_object()
+ *
+ *   4b. Repair the relocations
+ *      The firmware memory map may still change between the time the
+ *      relocations are computed and the time the boot services are shut down.
+ *      Memory ranges that have become unavailable are blacklisted, and only
+ *      the objects whose run-time destination overlaps one of them are moved.
+ *      Objects whose boot-time source has been reallocated in the meantime
+ *      (such as the memory maps themselves) are updated in place. Either change
+ *      invalidates the relocation order, which is then checked again in step
+ *      6. Only a cycle introduced by the repairs needs memory at that point.
+ *
  * runtime_addr()
  *
  *   5. Dynamically link run-time objects
@@ -103,12 +128,9 @@
  *
  * install_trampoline()
  *
- *   6. Order relocations
- *      Ordering relocations with reloc_order() is necessary to make sure that
- *      no relocation would overwrite the source of a later one. Sometimes,
- *      cyclic dependencies prevent from finding a safe relocation order. In
- *      this case, the object that is causing the cyclic dependency is moved to
- *      a place it will never overwrite another object: into safe memory.
+ *   6. Order relocations again
+ *      Make the copies reserved in step 4a, and order the relocations again if
+ *      they have been repaired since then.
  *
  *   7. Install the trampoline
  *      The trampoline is relocated into safe memory with install_trampoline()
@@ -126,6 +148,18 @@
 
 static reloc_t relocs[MAX_RELOCS_NR];    /* The relocation table */
 static size_t reloc_count = 0;           /* Number of reloc table entries */
+static bool relocs_resolved = false;     /* The relocation order is valid */
+
+#define MAX_DEFERRED_NR 32               /* Deferred copies table size */
+
+typedef struct {
+   char *src;           /* Relocation source */
+   char *copy;          /* Reserved copy of the source */
+   uint64_t size;       /* Reserved copy length */
+} deferred_copy_t;
+
+static deferred_copy_t deferred[MAX_DEFERRED_NR];
+static size_t deferred_count = 0;        /* Number of deferred copies */
 
 #if only_x86
 run_addr_t trampo_lowmem;                /* Allocated trampoline low-mem */
@@ -256,6 +290,34 @@ static int reloc_compare(const void *a, const void *b)
    return 0;
 }
 
+/*-- runtime_alloc_option ------------------------------------------------------
+ *
+ *      Get the allocation option that must be used for the run-time memory of
+ *      a given type of object.
+ *
+ *      On x86, the system information and the trampoline low memory copy must
+ *      be below 4GB. Modules must be below 4GB as well when booting an old
+ *      Multiboot kernel.
+ *
+ * Parameters
+ *      IN type: object type ('k', 'm', 's', or 't')
+ *
+ * Results
+ *      ALLOC_ANY or ALLOC_32BIT.
+ *----------------------------------------------------------------------------*/
+static int runtime_alloc_option(char type)
+{
+   if (type == 'm') {
+      return boot.is_esxbootinfo ? ALLOC_ANY : ALLOC_32BIT;
+   }
+
+#if only_x86
+   return ALLOC_32BIT;
+#else
+   return ALLOC_ANY;
+#endif
+}
+
 /*-- set_runtime_addr ----------------------------------------------------------
  *
  *      Compute the relocations for a group of objects. When possible, objects
@@ -393,6 +455,120 @@ static size_t find_reloc_dependency(reloc_t *rel, size_t i, size_t seek_offset)
    return i;
 }
 
+/*-- defer_copy ----------------------------------------------------------------
+ *
+ *      Reserve bootloader's memory for a copy of a relocation source that must
+ *      be moved out of the way, while the boot services are up. The object may
+ *      still change until the boot services are shut down, so the copy itself
+ *      is only made by apply_deferred_copies().
+ *
+ * Parameters
+ *      IN  src:  relocation source
+ *      IN  size: relocation length
+ *      OUT addr: address of the reserved copy
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+static int defer_copy(char *src, uint64_t size, run_addr_t *addr)
+{
+   void *copy;
+   int status;
+
+   if (deferred_count >= MAX_DEFERRED_NR) {
+      return ERR_OUT_OF_RESOURCES;
+   }
+
+   copy = sys_malloc((size_t)size);
+   if (copy == NULL) {
+      return ERR_OUT_OF_RESOURCES;
+   }
+
+   /* The copy must not be handed out as a relocation destination. */
+   status = blacklist_runtime_mem(PTR_TO_UINT64(copy), size);
+   if (status != ERR_SUCCESS) {
+      sys_free(copy);
+      return status;
+   }
+
+   deferred[deferred_count].src = src;
+   deferred[deferred_count].copy = copy;
+   deferred[deferred_count].size = size;
+   deferred_count++;
+
+   *addr = PTR_TO_UINT64(copy);
+
+   return ERR_SUCCESS;
+}
+
+/*-- find_reloc_by_src ---------------------------------------------------------
+ *
+ *      Look up a relocation by its source.
+ *
+ * Parameters
+ *      IN src: relocation source
+ *
+ * Results
+ *      The relocation table entry, or NULL if there is none.
+ *----------------------------------------------------------------------------*/
+static reloc_t *find_reloc_by_src(const void *src)
+{
+   size_t i;
+
+   for (i = 0; relocs[i].type != 0; i++) {
+      if (relocs[i].src == src) {
+         return &relocs[i];
+      }
+   }
+
+   return NULL;
+}
+
+/*-- restore_deferred_sources --------------------------------------------------
+ *
+ *      The relocations have been ordered as if the deferred copies had already
+ *      been made. Point them back at their boot-time source, which is what
+ *      runtime_addr() and the repairs look them up by until
+ *      install_trampoline().
+ *----------------------------------------------------------------------------*/
+static void restore_deferred_sources(void)
+{
+   reloc_t *o;
+   size_t i;
+
+   for (i = 0; i < deferred_count; i++) {
+      o = find_reloc_by_src(deferred[i].copy);
+      if (o != NULL) {
+         o->src = deferred[i].src;
+      }
+   }
+}
+
+/*-- apply_deferred_copies -----------------------------------------------------
+ *
+ *      Make the copies reserved by defer_copy(), now that the objects are final,
+ *      and have their relocations use them as their source. If an object has
+ *      been reallocated or has grown since its copy was reserved, the copy is
+ *      dropped and the relocations must be ordered again.
+ *----------------------------------------------------------------------------*/
+static void apply_deferred_copies(void)
+{
+   reloc_t *o;
+   size_t i;
+
+   for (i = 0; i < deferred_count; i++) {
+      o = find_reloc_by_src(deferred[i].src);
+      if (o == NULL || o->size > deferred[i].size) {
+         relocs_resolved = false;
+         continue;
+      }
+
+      o->src = memcpy(deferred[i].copy, o->src, (size_t)o->size);
+   }
+
+   deferred_count = 0;
+}
+
 /*-- break_reloc_deadlock -----------------------------------------------------
  *
  *      Locate and break a circular dependency in the given relocation table.
@@ -422,6 +598,11 @@ static size_t find_reloc_dependency(reloc_t *rel, size_t i, size_t seek_offset)
  *           relocation).
  *           For avoiding copying too much data, we just pick the smallest one.
  *
+ *      While the boot services are up, the firmware may still allocate, and
+ *      write into, safe memory. The copy is then reserved in bootloader's
+ *      memory instead, and only made by install_trampoline(), once the object
+ *      is final (see defer_copy()).
+ *
  * Parameters
  *      IN rel: pointer to the relocation table
  *
@@ -466,7 +647,11 @@ static int break_reloc_deadlock(reloc_t *rel)
       }
    } while (rel[i].visited < 2);
 
-   status = alloc(&addr, size, ALIGN_ANY, ALLOC_ANY);
+   if (in_boot_services()) {
+      status = defer_copy(rel[smallest].src, size, &addr);
+   } else {
+      status = alloc(&addr, size, ALIGN_ANY, ALLOC_ANY);
+   }
    if (status != ERR_SUCCESS) {
       Log(LOG_DEBUG, "...unable to move %p (size 0x%"PRIx64")",
           rel[smallest].src, size);
@@ -483,8 +668,12 @@ static int break_reloc_deadlock(reloc_t *rel)
     * source is meant to have its destination zero'ed. Such relocations have no
     * actual source, so they cannot be part of a cycle.
     */
-   rel[smallest].src = memcpy(UINT64_TO_PTR(addr), rel[smallest].src,
-                              (size_t)size);
+   if (in_boot_services()) {
+      rel[smallest].src = UINT64_TO_PTR(addr);
+   } else {
+      rel[smallest].src = memcpy(UINT64_TO_PTR(addr), rel[smallest].src,
+                                 (size_t)size);
+   }
 
    return ERR_SUCCESS;
 }
@@ -547,6 +736,8 @@ static int reloc_resolve(void)
 
    reloc_sanity_check(relocs, reloc_count);
 
+   relocs_resolved = true;
+
    return ERR_SUCCESS;
 }
 
@@ -579,15 +770,15 @@ int install_trampoline(trampoline_t *run_trampo, handoff_t **run_handoff)
    Log(LOG_DEBUG, "Finalizing relocations validation...\n");
 
    /*
-    * reloc_resolve may allocate and immediately write into safe memory or high
-    * memory via break_reloc_deadlock, so it must be called after
-    * blacklist_bootloader_mem.  Perhaps we should change break_reloc_deadlock
-    * so that instead of moving the chosen relocation out of the way itself, it
-    * inserts an extra table entry so that the trampoline will move it later.
+    * The relocations have been ordered by compute_relocations(). Repairing
+    * them after the boot services were shut down may have broken that order.
     */
-   status = reloc_resolve();
-   if (status != ERR_SUCCESS) {
-      return status;
+   apply_deferred_copies();
+   if (!relocs_resolved) {
+      status = reloc_resolve();
+      if (status != ERR_SUCCESS) {
+         return status;
+      }
    }
 
    Log(LOG_DEBUG, "Preparing a safe environment...\n");
@@ -793,11 +984,8 @@ int compute_relocations(e820_range_t *mmap, size_t count)
     * UEFI mode.  So we need to do this relocation before we possibly
     * run out of low memory.
     */
-#if only_x86
-   status = set_runtime_addr(&relocs[k + m], s, kmem_end, ALLOC_32BIT);
-#else
-   status = set_runtime_addr(&relocs[k + m], s, kmem_end, ALLOC_ANY);
-#endif
+   status = set_runtime_addr(&relocs[k + m], s, kmem_end,
+                             runtime_alloc_option('s'));
    if (status != ERR_SUCCESS) {
       Log(LOG_ERR, "Boot info relocation error: %s", error_str[status]);
       return status;
@@ -811,7 +999,7 @@ int compute_relocations(e820_range_t *mmap, size_t count)
     */
    i = (size_t)(k + m + s);
    status = set_runtime_addr(&relocs[i], 1, relocs[i-1].dest + relocs[i-1].size,
-                             ALLOC_32BIT);
+                             runtime_alloc_option('t'));
    if (status != ERR_SUCCESS) {
       Log(LOG_ERR, "Trampoline reservation error: %s", error_str[status]);
       return status;
@@ -826,8 +1014,7 @@ int compute_relocations(e820_range_t *mmap, size_t count)
     * UEFI mode, but in that case there is no distinction between
     * ALLOC_ANY and ALLOC_32BIT.
     */
-   status = set_runtime_addr(&relocs[k], m, 0,
-                             boot.is_esxbootinfo ? ALLOC_ANY : ALLOC_32BIT);
+   status = set_runtime_addr(&relocs[k], m, 0, runtime_alloc_option('m'));
    if (status != ERR_SUCCESS) {
       Log(LOG_ERR, "Modules relocation error: %s", error_str[status]);
       return status;
@@ -837,13 +1024,151 @@ int compute_relocations(e820_range_t *mmap, size_t count)
    add_runtime_object_delimiter();
 
    status = blacklist_bootloader_mem(mmap, count);
+   if (status != ERR_SUCCESS) {
+      return status;
+   }
 
    /*
     * Now that we have blacklisted the bootloader's memory, there is only one
     * kind of memory remaining available: safe memory.
+    *
+    * reloc_resolve may have to copy objects out of the way via
+    * break_reloc_deadlock, so it must be called after
+    * blacklist_bootloader_mem.
     */
+   Log(LOG_DEBUG, "Ordering relocations...\n");
+
+   status = reloc_resolve();
+   if (status != ERR_SUCCESS) {
+      return status;
+   }
 
-   return status;
+   restore_deferred_sources();
+
+   return ERR_SUCCESS;
+}
+
+/*-- repair_runtime_mem --------------------------------------------------------
+ *
+ *      Blacklist a memory range once the relocations have been computed, and
+ *      move any run-time object whose destination overlaps it elsewhere.
+ *      Objects are moved individually into safe memory, so that the other
+ *      relocations are left untouched.
+ *
+ *      'k' objects have fixed run-time addresses, and cannot be moved.
+ *
+ * Parameters
+ *      IN addr: memory range starting address
+ *      IN size: memory range size
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+int repair_runtime_mem(uint64_t addr, uint64_t size)
+{
+   uint64_t page_start;
+   reloc_t *o;
+   size_t i;
+   int status;
+
+   page_start = PAGE_ADDR(addr);
+   size = PAGE_ALIGN_UP(size + (addr - page_start));
+
+   for (i = 0; relocs[i].type != 0; i++) {
+      o = &relocs[i];
+      if (o->type == 'k' && is_overlap(o->dest, o->size, page_start, size)) {
+         Log(LOG_ERR, "Kernel destination %"PRIx64" - %"PRIx64" is no longer "
+             "available.\n", o->dest, o->dest + o->size - 1);
+         return ERR_OUT_OF_RESOURCES;
+      }
+   }
+
+   status = blacklist_runtime_mem(page_start, size);
+   if (status != ERR_SUCCESS) {
+      return status;
+   }
+
+   for (i = 0; relocs[i].type != 0; i++) {
+      o = &relocs[i];
+      if (!is_overlap(o->dest, o->size, page_start, size)) {
+         continue;
+      }
+
+      status = runtime_alloc(&o->dest, o->size, o->align,
+                             runtime_alloc_option(o->type));
+      if (status != ERR_SUCCESS) {
+         Log(LOG_ERR, "Relocation repair error: %s", error_str[status]);
+         return status;
+      }
+      relocs_resolved = false;
+
+#if only_x86
+      if (o->type == 't') {
+         trampo_lowmem = o->dest;
+      }
+#endif
+
+      if (boot.debug) {
+         Log(LOG_DEBUG, "[%c] %"PRIx64" - %"PRIx64" -> %"PRIx64" - %"PRIx64
+             " (%"PRIu64" bytes) (moved)", o->type,
+             PTR_TO_UINT64(o->src), PTR_TO_UINT64(o->src) + o->size - 1,
+             o->dest, o->dest + o->size - 1, o->size);
+      }
+   }
+
+   return ERR_SUCCESS;
+}
+
+/*-- update_runtime_object -----------------------------------------------------
+ *
+ *      Replace the boot-time source of an object once the relocations have
+ *      been computed. The object keeps its run-time destination, unless the
+ *      new source is larger than the memory that was allocated for it.
+ *
+ * Parameters
+ *      IN old_src: pointer to the object, as registered
+ *      IN new_src: new pointer to the object
+ *      IN size:    new object size, in bytes
+ *
+ * Results
+ *      ERR_SUCCESS, ERR_NOT_FOUND if the object was not registered, or a
+ *      generic error status.
+ *----------------------------------------------------------------------------*/
+int update_runtime_object(const void *old_src, void *new_src, uint64_t size)
+{
+   reloc_t *o;
+   size_t i;
+   int status;
+
+   for (i = 0; relocs[i].type != 0; i++) {
+      o = &relocs[i];
+      if (o->src != old_src) {
+         continue;
+      }
+
+      /* The new source is bootloader memory, which is not safe. */
+      status = blacklist_runtime_mem(PTR_TO_UINT64(new_src), size);
+      if (status != ERR_SUCCESS) {
+         return status;
+      }
+
+      if (size > o->size) {
+         status = runtime_alloc(&o->dest, size, o->align,
+                                runtime_alloc_option(o->type));
+         if (status != ERR_SUCCESS) {
+            Log(LOG_ERR, "Relocation repair error: %s", error_str[status]);
+            return status;
+         }
+      }
+
+      o->src = new_src;
+      o->size = size;
+      relocs_resolved = false;
+
+      return ERR_SUCCESS;
+   }
+
+   return ERR_NOT_FOUND;
 }
 
 /*-- runtime_addr --------------------------------------------------------------
@@ -862,14 +1187,14 @@ int compute_relocations(e820_range_t *mmap, size_t count)
  *----------------------------------------------------------------------------*/
 int runtime_addr(const void *ptr, run_addr_t *runaddr)
 {
-   size_t i;
+   reloc_t *o;
 
-   for (i = 0; relocs[i].type != 0; i++) {
-      if (relocs[i].src == ptr) {
-         *runaddr = relocs[i].dest;
-         return ERR_SUCCESS;
-      }
+   o = find_reloc_by_src(ptr);
+   if (o == NULL) {
+      return ERR_NOT_FOUND;
    }
 
-   return ERR_NOT_FOUND;
+   *runaddr = o->dest;
+
+   return ERR_SUCCESS;
 }
@@ -46,6 +46,36 @@
  *      module and checks that all other modules that the schema identifies
  *      as early have this same version number.
  *
+ *      Schema version 5 has the same early modules as version 4, but the
+ *      signature does not cover the signed data directly. Instead, the data is
+ *      split into fixed-size leaves, and the signature covers a hash tree
+ *      over these leaves:
+ *
+ *         module data
+ *         4-byte leaf size (power of 2, at least 64KB)
+ *         4-byte schema version number = 5
+ *         signature
+ *         4-byte signature length
+ *         4-byte fixed magic number = 0x1abe11ed
+ *
+ *      The signed data (everything that precedes the signature, including the
+ *      leaf size and the schema version number) is split into n leaves of the
+ *      given size, the last one possibly being shorter. The signed digest is
+ *      the root of the tree:
+ *
+ *         L(i) = H(0x00 || H(leaf i))
+ *         root = H(0x01 || leaf size || n || L(0) || ... || L(n-1) || 5)
+ *
+ *      where H is the hash algorithm of the signing key, and the leaf size, n
+ *      and the schema version number 5 are 4-byte numbers. The tag bytes keep
+ *      leaf and root hashes apart, and the trailing schema version number
+ *      keeps the root from being the digest of any schema version 1-4 signed
+ *      data, which ends with a schema version number from 1 to 4: a schema
+ *      version 5 signature never verifies as a signature of another schema.
+ *      The leaf hashes are independent, so they are computed on all the
+ *      processors at once: on a large module, verification is no longer bound
+ *      to the speed of a single CPU hashing the whole module.
+ *
  *      NOTE: Any future additions or changes to schema validation will also
  *            need to be made in the QuickBoot secure boot implementation.
  */
@@ -68,7 +98,27 @@
 #define SCHEMA_MAGIC 0x1abe11ed
 
 /*
- * In schema versions 1-4 the first 16 bytes of a signature are an ASCII
+ * Schema version 5: hash tree over fixed-size leaves.
+ */
+#define TREE_SCHEMA        5
+#define TREE_MIN_LEAF_SIZE (64 * 1024)
+#define TREE_LEAF_TAG      0x00
+#define TREE_ROOT_TAG      0x01
+#define TREE_ROOT_HDR_LEN  (1 + 2 * sizeof (uint32_t))
+
+typedef struct {
+   const uint8_t *data;       /* Signed data */
+   size_t dataLen;            /* Length of the signed data in bytes */
+   size_t leafSize;           /* Leaf size in bytes */
+   size_t leaves;             /* Number of leaves */
+   mbedtls_md_type_t md;      /* Hash algorithm */
+   size_t mdLen;              /* Hash length in bytes */
+   uint8_t *hashes;           /* Leaf hashes */
+   volatile UINTN next;       /* Next leaf to hash */
+} HashTree;
+
+/*
+ * In schema versions 1-5 the first 16 bytes of a signature are an ASCII
  * key id.  This is compared with the expected key id and used to generate
  * nicer error messages on failure.
  */
@@ -129,13 +179,14 @@ NamedModule v4Named[] = {
  *      Parse out the data and signature fields of a signed module.
  *
  * Parameters
- *      IN addr:        address of module
- *      IN len:         length of module
- *      OUT schemaOut:  schema version number of module's signature
- *      OUT dataOut:    address of signed data
- *      OUT dataLenOut: length of signed data
- *      OUT sigOut:     address of signature
- *      OUT sigLenOut:  length of signature
+ *      IN addr:         address of module
+ *      IN len:          length of module
+ *      OUT schemaOut:   schema version number of module's signature
+ *      OUT dataOut:     address of signed data
+ *      OUT dataLenOut:  length of signed data
+ *      OUT sigOut:      address of signature
+ *      OUT sigLenOut:   length of signature
+ *      OUT leafSizeOut: hash tree leaf size (schema version 5), or 0
  *
  * Results
  *      ERR_SUCCESS:   success
@@ -152,10 +203,11 @@ static int secure_boot_parse_module(void *addr,           //IN
                                     void **dataOut,       //OUT
                                     size_t *dataLenOut,   //OUT
                                     void **sigOut,        //OUT
-                                    size_t *sigLenOut)    //OUT
+                                    size_t *sigLenOut,    //OUT
+                                    size_t *leafSizeOut)  //OUT
 {
    uint8_t *p;
-   uint32_t magic, sigLen, schema;
+   uint32_t magic, sigLen, schema, leafSize;
 
    p = (uint8_t *)addr + len;
    p -= sizeof(magic);
@@ -199,6 +251,21 @@ static int secure_boot_parse_module(void *addr,           //IN
       *schemaOut = schema;
    }
 
+   leafSize = 0;
+   if (schema == TREE_SCHEMA) {
+      p -= sizeof(leafSize);
+      if (p < (uint8_t *)addr) {
+         return ERR_SYNTAX;
+      }
+      memcpy(&leafSize, p, sizeof(leafSize));
+      if (leafSize < TREE_MIN_LEAF_SIZE || (leafSize & (leafSize - 1)) != 0) {
+         return ERR_SYNTAX;
+      }
+   }
+   if (leafSizeOut != NULL) {
+      *leafSizeOut = leafSize;
+   }
+
    return ERR_SUCCESS;
 }
 
@@ -252,35 +319,158 @@ int find_named_module(char *name, NamedModule *list)
 }
 
 
+/*-- hash_data -----------------------------------------------------------------
+ *
+ *      Hash a buffer. Safe to call on the APs.
+ *
+ * Parameters
+ *      IN  md:      hash algorithm (MBEDTLS_MD_SHA256 or MBEDTLS_MD_SHA512)
+ *      IN  data:    data to hash
+ *      IN  dataLen: length of data in bytes
+ *      OUT hash:    the resulting hash
+ *----------------------------------------------------------------------------*/
+static void hash_data(mbedtls_md_type_t md, const void *data, size_t dataLen,
+                      unsigned char *hash)
+{
+   if (md == MBEDTLS_MD_SHA256) {
+      mbedtls->Sha256Ret(data, dataLen, hash, 0);
+   } else {
+      mbedtls->Sha512Ret(data, dataLen, hash, 0);
+   }
+}
+
+
+/*-- hash_tree_worker ----------------------------------------------------------
+ *
+ *      Hash leaves until there are none left. Runs on the BSP and on all the
+ *      APs at once: each leaf is claimed by exactly one processor.
+ *
+ * Parameters
+ *      IN Arg: the hash tree
+ *----------------------------------------------------------------------------*/
+static VOID EFIAPI hash_tree_worker(VOID *Arg)
+{
+   HashTree *tree = Arg;
+   uint8_t leaf[1 + MAX_DIGEST_LENGTH];
+   size_t offset;
+   UINTN i;
+
+   for (;;) {
+      i = __sync_fetch_and_add(&tree->next, 1);
+      if (i >= tree->leaves) {
+         break;
+      }
+
+      offset = i * tree->leafSize;
+      leaf[0] = TREE_LEAF_TAG;
+      hash_data(tree->md, tree->data + offset,
+                MIN(tree->leafSize, tree->dataLen - offset), leaf + 1);
+      hash_data(tree->md, leaf, 1 + tree->mdLen,
+                tree->hashes + i * tree->mdLen);
+   }
+}
+
+
+/*-- hash_tree_root ------------------------------------------------------------
+ *
+ *      Compute the root of the hash tree over the signed data (schema
+ *      version 5).
+ *
+ * Parameters
+ *      IN  md:       hash algorithm
+ *      IN  mdLen:    hash length in bytes
+ *      IN  data:     signed data
+ *      IN  dataLen:  length of data in bytes
+ *      IN  leafSize: leaf size in bytes
+ *      OUT root:     the tree root
+ *
+ * Results
+ *      true if the root has been computed; false if not.
+ *----------------------------------------------------------------------------*/
+static bool hash_tree_root(mbedtls_md_type_t md, size_t mdLen,
+                           const void *data, size_t dataLen, size_t leafSize,
+                           unsigned char *root)
+{
+   HashTree tree;
+   uint8_t *buf;
+   uint32_t val;
+   size_t len;
+   UINTN cpus;
+
+   memset(&tree, 0, sizeof (tree));
+   tree.data = data;
+   tree.dataLen = dataLen;
+   tree.leafSize = leafSize;
+   tree.leaves = (dataLen + leafSize - 1) / leafSize;
+   tree.md = md;
+   tree.mdLen = mdLen;
+
+   if (tree.leaves > UINT32_MAX) {
+      Log(LOG_WARNING, "Too many leaves: %zu", tree.leaves);
+      return false;
+   }
+
+   /* The leaf hashes are computed in place, inside the root hash input. */
+   len = TREE_ROOT_HDR_LEN + tree.leaves * mdLen + sizeof (val);
+   buf = sys_malloc(len);
+   if (buf == NULL) {
+      Log(LOG_WARNING, "Out of memory for %zu leaf hashes", tree.leaves);
+      return false;
+   }
+   tree.hashes = buf + TREE_ROOT_HDR_LEN;
+
+   buf[0] = TREE_ROOT_TAG;
+   val = (uint32_t)leafSize;
+   memcpy(buf + 1, &val, sizeof (val));
+   val = (uint32_t)tree.leaves;
+   memcpy(buf + 1 + sizeof (val), &val, sizeof (val));
+   val = TREE_SCHEMA;
+   memcpy(buf + len - sizeof (val), &val, sizeof (val));
+
+   mp_run_all(hash_tree_worker, &tree, &cpus);
+   Log(LOG_DEBUG, "Hashed %zu leaves of %zu bytes on %u processors",
+       tree.leaves, leafSize, (unsigned)cpus);
+
+   hash_data(md, buf, len, root);
+   sys_free(buf);
+
+   return true;
+}
+
+
 /*-- secure_boot_check_sig -----------------------------------------------------
  *
  *      Check one attached signature
  *
  * Parameters
- *      IN schema:  schema version number (determines signature algorithm)
- *      IN data:    signed data
- *      IN dataLen: length of data in bytes
- *      IN sig:     signature
- *      IN sigLen   length of signature in bytes
+ *      IN schema:   schema version number (determines signature algorithm)
+ *      IN data:     signed data
+ *      IN dataLen:  length of data in bytes
+ *      IN sig:      signature
+ *      IN sigLen    length of signature in bytes
+ *      IN leafSize: hash tree leaf size (schema version 5 only)
+ *      OUT digest:  digest of the signed data
  *
  * Results
  *      true if signature checks out; false if not.
  *----------------------------------------------------------------------------*/
 static bool secure_boot_check_sig(uint32_t schema,
                                   void *data, size_t dataLen,
-                                  void *sig, size_t sigLen)
+                                  void *sig, size_t sigLen,
+                                  size_t leafSize,
+                                  sig_digest_t *digest)
 {
    unsigned char md[MAX_DIGEST_LENGTH];
+   size_t mdLen;
    int errcode;
    char keyid[V1_KEYID_LEN + 1];
    RawRSACert *cert;
 
    /*
-    * This function works for all schema versions defined so far,
-    * so the schema parameter is unused.
+    * Schema versions 1-4 sign the data itself; schema version 5 signs the
+    * root of a hash tree over the data. The signature format is the same in
+    * all schema versions defined so far.
     */
-   (void)schema;
-
    memcpy(keyid, sig, V1_KEYID_LEN);
    keyid[V1_KEYID_LEN] = '\0';
 
@@ -342,30 +532,49 @@ static bool secure_boot_check_sig(uint32_t schema,
 
    switch (cert->digest) {
    case MBEDTLS_MD_SHA256:
-      mbedtls->Sha256Ret(data, dataLen, md, 0);
-      errcode = mbedtls->RsaPkcs1Verify(&cert->rsa, NULL, NULL,
-                                        MBEDTLS_RSA_PUBLIC, cert->digest,
-                                        SHA256_DIGEST_LENGTH, md,
-                                        (uint8_t*)sig + V1_KEYID_LEN);
+      mdLen = SHA256_DIGEST_LENGTH;
       break;
 
    case MBEDTLS_MD_SHA512:
-      mbedtls->Sha512Ret(data, dataLen, md, 0);
-      errcode = mbedtls->RsaPkcs1Verify(&cert->rsa, NULL, NULL,
-                                        MBEDTLS_RSA_PUBLIC, cert->digest,
-                                        SHA512_DIGEST_LENGTH, md,
-                                        (uint8_t*)sig + V1_KEYID_LEN);
+      mdLen = SHA512_DIGEST_LENGTH;
       break;
 
    default:
       NOT_REACHED();
    }
 
+   if (schema == TREE_SCHEMA) {
+      if (!hash_tree_root(cert->digest, mdLen, data, dataLen, leafSize, md)) {
+         return false;
+      }
+   } else {
+      hash_data(cert->digest, data, dataLen, md);
+   }
+
+   errcode = mbedtls->RsaPkcs1Verify(&cert->rsa, NULL, NULL,
+                                     MBEDTLS_RSA_PUBLIC, cert->digest,
+                                     mdLen, md, (uint8_t*)sig + V1_KEYID_LEN);
    if (errcode) {
       Log(LOG_WARNING, "Error verifying signature: -0x%x", -errcode);
       return false;
    }
 
+   /*
+    * The tree root is not a digest of the module contents: it is handed over
+    * to the kernel with a digest type of its own.
+    */
+   if (cert->digest == MBEDTLS_MD_SHA256) {
+      digest->algorithm = (schema == TREE_SCHEMA) ?
+                          ESXBOOTINFO_DIGEST_SHA256_TREE :
+                          ESXBOOTINFO_DIGEST_SHA256;
+   } else {
+      digest->algorithm = (schema == TREE_SCHEMA) ?
+                          ESXBOOTINFO_DIGEST_SHA512_TREE :
+                          ESXBOOTINFO_DIGEST_SHA512;
+   }
+   memcpy(digest->value, md, mdLen);
+   digest->length = dataLen;
+
    return true;
 }
 
@@ -420,7 +629,7 @@ int secure_boot_check(bool crypto_module)
 
    status = secure_boot_parse_module(boot.modules[0].addr,
                                      boot.modules[0].size,
-                                     &schema0, NULL, NULL, NULL, NULL);
+                                     &schema0, NULL, NULL, NULL, NULL, NULL);
    switch (status) {
    case ERR_SUCCESS:
       break;
@@ -444,6 +653,7 @@ int secure_boot_check(bool crypto_module)
       named = v2Named;
       break;
    case 4:
+   case TREE_SCHEMA:
       named = v4Named;
       break;
    default:
@@ -453,7 +663,7 @@ int secure_boot_check(bool crypto_module)
    }
 
    /*
-    * In schema versions 1-4:
+    * In schema versions 1-5:
     * - All ELF modules must be signed.
     * - The modules listed by name for the schema must be signed and
     *   their names must not be duplicated.
@@ -467,6 +677,7 @@ int secure_boot_check(bool crypto_module)
       size_t dataLen = -1;
       void *sig = NULL;
       size_t sigLen = -1;
+      size_t leafSize = 0;
       uint32_t schema = -1;
 
       if (mod->size >= SELFMAG &&
@@ -499,7 +710,7 @@ int secure_boot_check(bool crypto_module)
       ok = false;
       status = secure_boot_parse_module(mod->addr, mod->size,
                                         &schema, &data, &dataLen,
-                                        &sig, &sigLen);
+                                        &sig, &sigLen, &leafSize);
       switch (status) {
       case ERR_NOT_FOUND:
          Log(LOG_WARNING, "No signature found");
@@ -512,7 +723,8 @@ int secure_boot_check(bool crypto_module)
             Log(LOG_WARNING, "Wrong schema version (got %u; expected %u)",
                 schema, schema0);
          } else {
-            ok = secure_boot_check_sig(schema, data, dataLen, sig, sigLen);
+            ok = secure_boot_check_sig(schema, data, dataLen, sig, sigLen,
+                                       leafSize, &mod->sig_digest);
          }
          break;
       default:
@@ -522,6 +734,7 @@ int secure_boot_check(bool crypto_module)
       Log(ok ? LOG_DEBUG : LOG_CRIT, "Signature check %s on module %u (%s)",
           ok ? "succeeded" : "failed", i, mod->filename);
 
+      mod->sig_verified = ok;
       if (!ok) {
          errors++;
       }
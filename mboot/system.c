@@ -191,6 +191,208 @@ static int system_blacklist_memory(e820_range_t *mmap, size_t count)
    return ERR_SUCCESS;
 }
 
+/*-- mmap_desc_extra_mem -------------------------------------------------------
+ *
+ *      Amount of extra memory needed for each E820 memory map descriptor, for
+ *      converting it later to the possibly bigger ESXBootInfo or Multiboot
+ *      format.
+ *
+ * Results
+ *      The extra size, in bytes.
+ *----------------------------------------------------------------------------*/
+static size_t mmap_desc_extra_mem(void)
+{
+   if (boot_mmap_desc_size() > sizeof (e820_range_t)) {
+      return boot_mmap_desc_size() - sizeof (e820_range_t);
+   }
+
+   return 0;
+}
+
+/*
+ * Copy of the memory map the relocations were computed against.
+ */
+static e820_range_t *planned_mmap = NULL;
+static size_t planned_count = 0;
+
+/*-- planned_mmap_free ---------------------------------------------------------
+ *
+ *      Free the copy of the planned memory map.
+ *----------------------------------------------------------------------------*/
+static void planned_mmap_free(void)
+{
+   sys_free(planned_mmap);
+   planned_mmap = NULL;
+   planned_count = 0;
+}
+
+/*-- firmware_shutdown_prepare -------------------------------------------------
+ *
+ *     Get the memory map the relocations will be computed against, before the
+ *     boot services are shut down, and blacklist the system memory it reports
+ *     and the EFI system table.
+ *
+ *     The memory map may still change before firmware_shutdown() is called, so
+ *     a copy of it is kept for firmware_shutdown() to only revisit the memory
+ *     ranges that have changed in the meantime.
+ *
+ * Parameters
+ *      OUT mmap:     pointer to the freshly allocated memory map
+ *      OUT count:    number of entries in the memory map
+ *      OUT efi_info: EFI memory map information is filled in
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+int firmware_shutdown_prepare(e820_range_t **mmap, size_t *count,
+                              efi_info_t *efi_info)
+{
+   int status;
+
+   planned_mmap_free();
+
+   status = get_memory_map(mmap_desc_extra_mem(), mmap, count, efi_info);
+   if (status != ERR_SUCCESS) {
+      Log(LOG_ERR, "Failed to get the memory map.\n");
+      return status;
+   }
+
+   Log(LOG_DEBUG, "Scanning system tables...");
+
+   e820_mmap_merge(*mmap, count);
+
+   status = system_blacklist_memory(*mmap, *count);
+   if (status != ERR_SUCCESS) {
+      Log(LOG_ERR, "Error scanning system memory.\n");
+      return status;
+   }
+
+   if (efi_info->systab != 0) {
+      status = reserve_sysmem("EFI system table",
+                              UINT64_TO_PTR(efi_info->systab),
+                              efi_info->systab_size);
+      if (status != ERR_SUCCESS) {
+         return status;
+      }
+   }
+
+   planned_mmap = sys_malloc(*count * sizeof (e820_range_t));
+   if (planned_mmap == NULL) {
+      return ERR_OUT_OF_RESOURCES;
+   }
+   memcpy(planned_mmap, *mmap, *count * sizeof (e820_range_t));
+   planned_count = *count;
+
+   return ERR_SUCCESS;
+}
+
+/*-- repair_changed_mem --------------------------------------------------------
+ *
+ *      Repair the relocations for a memory range that is no longer available,
+ *      unless it was not available in the planned memory map either.
+ *
+ * Parameters
+ *      IN base: memory range start address
+ *      IN len:  memory range size
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+static int repair_changed_mem(uint64_t base, uint64_t len)
+{
+   if (!e820_range_has_type(planned_mmap, planned_count, base, len,
+                            E820_TYPE_AVAILABLE) &&
+       !e820_range_has_type(planned_mmap, planned_count, base, len,
+                            E820_TYPE_BOOTLOADER)) {
+      return ERR_SUCCESS;
+   }
+
+   Log(LOG_DEBUG, "Memory %"PRIx64" - %"PRIx64" is no longer available\n",
+       base, base + len - 1);
+
+   return repair_runtime_mem(base, len);
+}
+
+/*-- system_repair_memory ------------------------------------------------------
+ *
+ *      Compare the final memory map with the one the relocations were computed
+ *      against, and only revisit the memory ranges whose state has changed:
+ *        - memory that has become bootloader's memory is blacklisted, so it is
+ *          not handed out later as safe memory.
+ *        - memory that is no longer available (including new holes in the
+ *          memory map) is blacklisted, and the relocations into it repaired.
+ *
+ *      All the new bootloader's memory is blacklisted first, so that repairing
+ *      a range never moves objects into a range that is blacklisted later on.
+ *
+ * Parameters
+ *      IN mmap:  pointer to the final system memory map
+ *      IN count: number of entries in the memory map
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+static int system_repair_memory(e820_range_t *mmap, size_t count)
+{
+   uint64_t addr, base, len;
+   int status;
+   size_t i;
+
+   status = e820_sanity_check(mmap, count);
+   if (status != ERR_SUCCESS) {
+      return status;
+   }
+
+   for (i = 0; i < count; i++) {
+      base = E820_BASE(&mmap[i]);
+      len = E820_LENGTH(&mmap[i]);
+      if (len == 0 || mmap[i].type != E820_TYPE_BOOTLOADER) {
+         continue;
+      }
+
+      if (e820_range_has_type(planned_mmap, planned_count, base, len,
+                              E820_TYPE_AVAILABLE)) {
+         status = blacklist_runtime_mem(base, len);
+         if (status != ERR_SUCCESS) {
+            return status;
+         }
+      }
+   }
+
+   addr = 0;
+   for (i = 0; i < count; i++) {
+      base = E820_BASE(&mmap[i]);
+      len = E820_LENGTH(&mmap[i]);
+      if (len == 0) {
+         continue;
+      }
+
+      if (base - addr > 0) {
+         status = repair_changed_mem(addr, base - addr);
+         if (status != ERR_SUCCESS) {
+            return status;
+         }
+      }
+
+      if (mmap[i].type != E820_TYPE_AVAILABLE &&
+          mmap[i].type != E820_TYPE_BOOTLOADER) {
+         status = repair_changed_mem(base, len);
+         if (status != ERR_SUCCESS) {
+            return status;
+         }
+      }
+
+      addr = base + len;
+   }
+
+   addr = E820_BASE(&mmap[count - 1]) + E820_LENGTH(&mmap[count - 1]) - 1;
+   if (addr < MAX_64_BIT_ADDR) {
+      return repair_changed_mem(addr + 1, MAX_64_BIT_ADDR - addr);
+   }
+
+   return ERR_SUCCESS;
+}
+
 /*-- firmware_shutdown ---------------------------------------------------------
  *
  *     Shutdown the boot services:
@@ -206,8 +408,14 @@ static int system_blacklist_memory(e820_range_t *mmap, size_t count)
  *         down, it is no longer necessary to run firmware interrupt handlers.
  *         After this function is called, it is safe to clobber the IDT and GDT.
  *
+ *       - Validate the relocations, which have already been computed against
+ *         the memory map returned by firmware_shutdown_prepare(), and repair
+ *         them where the memory map has changed since then.
+ *
  * Parameters
+ *      IN  mmap:     pointer to the memory map from firmware_shutdown_prepare()
  *      OUT mmap:     pointer to the freshly allocated memory map
+ *      IN  count:    number of entries in the planned memory map
  *      OUT count:    number of entries in the memory map
  *      OUT efi_info: EFI information if available
  *
@@ -219,32 +427,65 @@ static int system_blacklist_memory(e820_range_t *mmap, size_t count)
  *----------------------------------------------------------------------------*/
 int firmware_shutdown(e820_range_t **mmap, size_t *count, efi_info_t *efi_info)
 {
-   size_t desc_extra_mem;
+   const void *old_mmap, *old_efi_mmap;
    int status;
 
-   if (boot_mmap_desc_size() > sizeof (e820_range_t)) {
-      desc_extra_mem = boot_mmap_desc_size() - sizeof (e820_range_t);
-   } else {
-      desc_extra_mem = 0;
-   }
+   old_mmap = *mmap;
+   old_efi_mmap = efi_info->mmap;
+   free_memory_map(*mmap, efi_info);
 
-   status = exit_boot_services(desc_extra_mem, mmap, count, efi_info);
+   status = exit_boot_services(mmap_desc_extra_mem(), mmap, count, efi_info);
    if (status != ERR_SUCCESS) {
       Log(LOG_ERR, "Failed to shutdown the boot services.\n");
+      if (in_boot_services()) {
+         planned_mmap_free();
+      }
       return status;
    }
 
    CLI();
 
-   Log(LOG_DEBUG, "Scanning system tables...");
+   Log(LOG_DEBUG, "Validating relocations...");
 
    e820_mmap_merge(*mmap, count);
 
-   status = system_blacklist_memory(*mmap, *count);
+   status = system_repair_memory(*mmap, *count);
+
+#ifdef __COM32__
+   planned_mmap_free();
+#else
+   /*
+    * The UEFI pool cannot be freed any more: the copy is bootloader's memory,
+    * which is reclaimed by the kernel.
+    */
+   planned_mmap = NULL;
+   planned_count = 0;
+#endif
+
    if (status != ERR_SUCCESS) {
       Log(LOG_ERR, "Error scanning system memory.\n");
       return status;
    }
 
+   /*
+    * The memory maps have been reallocated by exit_boot_services(). Only
+    * Multiboot kernels get the E820 memory map itself as a run-time object.
+    */
+   if (boot_mmap_desc_size() > 0) {
+      status = update_runtime_object(old_mmap, *mmap,
+                                     *count * boot_mmap_desc_size());
+      if (status != ERR_SUCCESS) {
+         return status;
+      }
+   }
+
+   if (old_efi_mmap != NULL && efi_info->mmap != NULL) {
+      status = update_runtime_object(old_efi_mmap, efi_info->mmap,
+                                     efi_info->desc_size * efi_info->num_descs);
+      if (status != ERR_SUCCESS) {
+         return status;
+      }
+   }
+
    return ERR_SUCCESS;
 }
@@ -43,18 +43,87 @@ int elf_arch_supported(void *buffer)
    return ERR_SUCCESS;
 }
 
+/*-- elf_arch_alloc_relocatable ------------------------------------------------
+ *
+ *      Allocate run-time memory for a kernel that declared itself relocatable
+ *      in its ESXBootInfo header.
+ *
+ *      The link address is preferred, as long as no bootloader data lives
+ *      there. Otherwise, the image is placed in the lowest available memory
+ *      range, within the limits requested by the kernel, that no bootloader
+ *      data occupies. The kernel sections then have no relocation dependency
+ *      on the other objects, and are copied in place without any bounce.
+ *
+ * Parameters
+ *      IN  link_base:  image base address.
+ *      IN  link_size:  image size.
+ *      OUT run_addend: used to calculate where the ELF binary will
+ *                      be relocated to.
+ *
+ * Results
+ *      ERR_SUCCESS, or ERR_OUT_OF_RESOURCES if no suitable memory was found.
+ *----------------------------------------------------------------------------*/
+static int elf_arch_alloc_relocatable(Elf_CommonAddr link_base,
+                                      Elf64_Size link_size,
+                                      Elf_CommonAddr *run_addend)
+{
+   uint64_t base, end, offset, addr;
+   const e820_range_t *range;
+   size_t i;
+
+   if (!e820_range_has_type(boot.mmap, boot.mmap_count, link_base, link_size,
+                            E820_TYPE_BOOTLOADER) &&
+       alloc_range(&addr, link_size, ALIGN_ANY, link_base,
+                   link_base + link_size - 1) == ERR_SUCCESS &&
+       addr == link_base) {
+      *run_addend = 0;
+      return ERR_SUCCESS;
+   }
+
+   /*
+    * Keep the image offset within an alignment unit, so that the run-time
+    * addend is a multiple of the alignment the kernel asked for.
+    */
+   offset = link_base & (boot.kernel.reloc_align - 1);
+
+   for (i = 0; i < boot.mmap_count; i++) {
+      range = &boot.mmap[i];
+      if (range->type != E820_TYPE_AVAILABLE || E820_LENGTH(range) == 0) {
+         continue;
+      }
+
+      base = MAX(E820_BASE(range), boot.kernel.reloc_min);
+      end = MIN(E820_BASE(range) + E820_LENGTH(range) - 1,
+                boot.kernel.reloc_max);
+      if (base > end) {
+         continue;
+      }
+
+      if (alloc_range(&addr, offset + link_size, boot.kernel.reloc_align,
+                      base, end) == ERR_SUCCESS) {
+         Log(LOG_DEBUG, "Kernel placed at [0x%"PRIx64":0x%"PRIx64")\n",
+             addr + offset, addr + offset + link_size);
+         *run_addend = addr + offset - link_base;
+         return ERR_SUCCESS;
+      }
+   }
+
+   return ERR_OUT_OF_RESOURCES;
+}
+
 /*-- elf_arch_alloc ------------------------------------------------------------
  *
  *      Allocate away the memory ranges that will contain the ELF image
  *      post relocation.
  *
- *      x86 binaries must be loaded at the linked address, thus reported
- *      addend is always zero.
+ *      x86 binaries are loaded at the linked address, thus reported addend
+ *      is zero, unless the kernel declared itself relocatable.
  *
  * Parameters
  *      IN  link_base:  image base address.
  *      IN  link_size:  image size.
- *      OUT run_addend: 0.
+ *      OUT run_addend: used to calculate where the ELF binary will
+ *                      be relocated to.
  *
  * Results
  *      ERR_SUCCESS, or a generic error status.
@@ -64,6 +133,12 @@ int elf_arch_alloc(Elf_CommonAddr link_base, Elf64_Size link_size,
 {
    int status;
 
+   if (boot.kernel.relocatable && boot.mmap != NULL &&
+       elf_arch_alloc_relocatable(link_base, link_size,
+                                  run_addend) == ERR_SUCCESS) {
+      return ERR_SUCCESS;
+   }
+
    status = runtime_alloc_fixed(&link_base, link_size);
    if (status != ERR_SUCCESS) {
       return status;
@@ -679,12 +679,7 @@ int multiboot_register(void)
    if (status != ERR_SUCCESS) {
       return status;
    }
-   if (boot.efi_info.valid) {
-      status = blacklist_runtime_mem(boot.efi_info.systab,
-                                     boot.efi_info.systab_size);
-      if (status != ERR_SUCCESS) {
-         return status;
-      }
+   if (boot.efi_info.mmap != NULL) {
       status = add_sysinfo_object(boot.efi_info.mmap,
                                   boot.efi_info.desc_size * boot.efi_info.num_descs,
                                   ALIGN_PAGE);
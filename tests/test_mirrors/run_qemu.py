@@ -0,0 +1,133 @@
+#! /usr/bin/python3
+
+#*******************************************************************************
+# Copyright (c) 2026 VMware, Inc.  All rights reserved.
+# SPDX-License-Identifier: GPL-2.0
+#*******************************************************************************
+
+# Check that mboot fails over to the next mirror (see mirrors= in
+# mboot/config.c) when a module turns out to be corrupted.
+# Usage: run_qemu.py [--efi file] [--ovmf file] [--timeout s]
+#
+# mboot is PXE booted by OVMF in a QEMU guest, from QEMU's user-mode TFTP
+# server, with the following boot.cfg:
+#
+#    prefix=/m1, mirrors=/m2, integrity=fast
+#    kernel=/kernel.gz (a minimal Multiboot kernel, not mirrored)
+#    modules=probe.gz --- mod.gz
+#
+# probe.gz, which the mirror probe queries, is missing from /m2, so that /m1
+# is always tried first. /m1/mod.gz has a bad CRC-32, /m2/mod.gz is fine:
+# mboot must report that mod.gz could not be loaded from /m1, then get it from
+# /m2 and go on to shut down the firmware. Exits with 0 if it does.
+
+import argparse
+import gzip
+import os
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+
+TOPDIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..')
+DEFAULT_EFI = os.path.join(TOPDIR, 'build', 'uefi64', 'mboot',
+                           'mboot_em64t.efi')
+DEFAULT_OVMF = '/usr/share/ovmf/OVMF.fd'
+
+BOOT_CFG = '''title=test_mirrors
+prefix=/m1
+mirrors=/m2
+integrity=fast
+kernel=/kernel.gz
+kernelopt=
+modules=probe.gz --- mod.gz
+'''
+
+MBH_MAGIC = 0x1BADB002
+MBH_FLAGS = 0x3                 # Page-aligned modules, memory map
+KERNEL_ADDR = 0x100000
+KERNEL_OFFSET = 0x1000
+
+def multiboot_kernel():
+   """A 32-bit ELF Multiboot kernel that halts."""
+   mbh = struct.pack('<III', MBH_MAGIC, MBH_FLAGS,
+                     -(MBH_MAGIC + MBH_FLAGS) & 0xffffffff)
+   mbh += b'\0' * (48 - len(mbh))
+   code = b'\xfa\xf4\xeb\xfd'  # cli; hlt; jmp hlt
+   segment = mbh + code
+
+   ehdr = struct.pack('<16sHHIIIIIHHHHHH',
+                      b'\x7fELF\x01\x01\x01' + b'\0' * 9,
+                      2, 3, 1,                        # ET_EXEC, EM_386
+                      KERNEL_ADDR + len(mbh), 52, 0,  # entry, phoff, shoff
+                      0, 52, 32, 1, 40, 0, 0)
+   phdr = struct.pack('<IIIIIIII', 1, KERNEL_OFFSET,  # PT_LOAD
+                      KERNEL_ADDR, KERNEL_ADDR, len(segment), len(segment),
+                      7, 0x1000)
+   header = ehdr + phdr
+
+   return header + b'\0' * (KERNEL_OFFSET - len(header)) + segment
+
+def corrupt(data):
+   """Flip a bit of the CRC-32 in a gzip trailer."""
+   data = bytearray(data)
+   data[-8] ^= 1
+   return bytes(data)
+
+def write(tftp, path, data):
+   path = os.path.join(tftp, path)
+   os.makedirs(os.path.dirname(path), exist_ok=True)
+   with open(path, 'wb') as f:
+      f.write(data)
+
+parser = argparse.ArgumentParser()
+parser.add_argument('--efi', default=DEFAULT_EFI)
+parser.add_argument('--ovmf', default=DEFAULT_OVMF)
+parser.add_argument('--timeout', type=int, default=300)
+args = parser.parse_args()
+
+module = gzip.compress(os.urandom(1024 * 1024))
+
+tftp = tempfile.mkdtemp()
+try:
+   shutil.copy(args.efi, os.path.join(tftp, 'mboot.efi'))
+   write(tftp, 'boot.cfg', BOOT_CFG.encode())
+   write(tftp, 'kernel.gz', gzip.compress(multiboot_kernel()))
+   write(tftp, 'm1/probe.gz', gzip.compress(b'probe'))
+   write(tftp, 'm1/mod.gz', corrupt(module))
+   write(tftp, 'm2/mod.gz', module)
+
+   cmd = ['qemu-system-x86_64', '-m', '1024', '-nographic', '-vga', 'none',
+          '-bios', args.ovmf,
+          '-netdev', 'user,id=n0,tftp=%s,bootfile=mboot.efi' % tftp,
+          '-device', 'virtio-net-pci,netdev=n0,bootindex=1']
+
+   failed_over = False
+   failed = False
+   done = False
+   proc = subprocess.Popen(cmd, stdout=subprocess.PIPE,
+                           stderr=subprocess.STDOUT, stdin=subprocess.DEVNULL,
+                           text=True, errors='replace')
+   timer = threading.Timer(args.timeout, proc.kill)
+   timer.start()
+   for line in proc.stdout:
+      if 'Could not load' in line or 'Fatal error' in line:
+         sys.stdout.write(line)
+      if 'Could not load mod.gz from /m1' in line:
+         failed_over = True
+      elif 'Could not load' in line or 'Fatal error' in line:
+         failed = True
+      if 'Shutting down firmware services' in line or failed:
+         done = True
+         proc.kill()
+   proc.wait()
+   timer.cancel()
+finally:
+   shutil.rmtree(tftp)
+
+passed = done and failed_over and not failed
+sys.stdout.write('TEST mirrors %s\n' % ('PASSED' if passed else 'FAILED'))
+
+sys.exit(0 if passed else 1)
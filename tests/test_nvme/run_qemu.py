@@ -0,0 +1,128 @@
+#! /usr/bin/python3
+
+#*******************************************************************************
+# Copyright (c) 2026 VMware, Inc.  All rights reserved.
+# SPDX-License-Identifier: GPL-2.0
+#*******************************************************************************
+
+# Check that mboot reads the boot disk with NVMe pass-through (see
+# nvmepassthru= in mboot/config.c) on QEMU's emulated NVMe controller.
+# Usage: run_qemu.py [--efi file] [--ovmf file] [--size bytes] [--timeout s]
+#
+# The boot disk is a directory exposed by QEMU as a FAT volume (vvfat), on an
+# NVMe namespace. It has no removable media boot loader, so OVMF drops to its
+# UEFI Shell, which runs startup.nsh: mboot, with serial debug logging, and
+# the following boot.cfg:
+#
+#    nvmepassthru=1, integrity=fast
+#    kernel=/kernel.gz (a minimal Multiboot kernel)
+#    modules=/mod.gz (--size bytes of random data)
+#
+# mboot must set up NVMe pass-through, load the module without any NVMe read
+# error or Block I/O fallback (the CRC-32 of the module is checked), then go on
+# to shut down the firmware. Exits with 0 if it does.
+
+import argparse
+import gzip
+import os
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+
+TOPDIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..')
+DEFAULT_EFI = os.path.join(TOPDIR, 'build', 'uefi64', 'mboot',
+                           'mboot_em64t.efi')
+DEFAULT_OVMF = '/usr/share/ovmf/OVMF.fd'
+
+BOOT_CFG = '''title=test_nvme
+nvmepassthru=1
+integrity=fast
+kernel=/kernel.gz
+kernelopt=
+modules=/mod.gz
+'''
+
+STARTUP_NSH = '''fs0:
+\\mboot.efi -S 1 -D -c \\boot.cfg
+'''
+
+MBH_MAGIC = 0x1BADB002
+MBH_FLAGS = 0x3                 # Page-aligned modules, memory map
+KERNEL_ADDR = 0x100000
+KERNEL_OFFSET = 0x1000
+
+def multiboot_kernel():
+   """A 32-bit ELF Multiboot kernel that halts."""
+   mbh = struct.pack('<III', MBH_MAGIC, MBH_FLAGS,
+                     -(MBH_MAGIC + MBH_FLAGS) & 0xffffffff)
+   mbh += b'\0' * (48 - len(mbh))
+   code = b'\xfa\xf4\xeb\xfd'  # cli; hlt; jmp hlt
+   segment = mbh + code
+
+   ehdr = struct.pack('<16sHHIIIIIHHHHHH',
+                      b'\x7fELF\x01\x01\x01' + b'\0' * 9,
+                      2, 3, 1,                        # ET_EXEC, EM_386
+                      KERNEL_ADDR + len(mbh), 52, 0,  # entry, phoff, shoff
+                      0, 52, 32, 1, 40, 0, 0)
+   phdr = struct.pack('<IIIIIIII', 1, KERNEL_OFFSET,  # PT_LOAD
+                      KERNEL_ADDR, KERNEL_ADDR, len(segment), len(segment),
+                      7, 0x1000)
+   header = ehdr + phdr
+
+   return header + b'\0' * (KERNEL_OFFSET - len(header)) + segment
+
+def write(disk, path, data):
+   with open(os.path.join(disk, path), 'wb') as f:
+      f.write(data)
+
+parser = argparse.ArgumentParser()
+parser.add_argument('--efi', default=DEFAULT_EFI)
+parser.add_argument('--ovmf', default=DEFAULT_OVMF)
+parser.add_argument('--size', type=int, default=32 * 1024 * 1024)
+parser.add_argument('--timeout', type=int, default=300)
+args = parser.parse_args()
+
+disk = tempfile.mkdtemp()
+try:
+   shutil.copy(args.efi, os.path.join(disk, 'mboot.efi'))
+   write(disk, 'startup.nsh', STARTUP_NSH.encode())
+   write(disk, 'boot.cfg', BOOT_CFG.encode())
+   write(disk, 'kernel.gz', gzip.compress(multiboot_kernel()))
+   write(disk, 'mod.gz', gzip.compress(os.urandom(args.size), 1))
+
+   cmd = ['qemu-system-x86_64', '-m', '1024', '-nographic', '-vga', 'none',
+          '-bios', args.ovmf, '-net', 'none',
+          '-drive', 'file=fat:%s,format=raw,if=none,id=d0' % disk,
+          '-device', 'nvme,drive=d0,serial=esxboot']
+
+   passthru = False
+   failed = False
+   done = False
+   proc = subprocess.Popen(cmd, stdout=subprocess.PIPE,
+                           stderr=subprocess.STDOUT, stdin=subprocess.DEVNULL,
+                           text=True, errors='replace')
+   timer = threading.Timer(args.timeout, proc.kill)
+   timer.start()
+   for line in proc.stdout:
+      if 'NVMe' in line or 'Could not load' in line or 'Fatal error' in line:
+         sys.stdout.write(line)
+      if 'NVMe pass-through: namespace' in line:
+         passthru = True
+      if ('NVMe read at LBA' in line or 'NVMe pass-through read error' in line
+          or 'Could not load' in line or 'Fatal error' in line):
+         failed = True
+      if 'Shutting down firmware services' in line or failed:
+         done = True
+         proc.kill()
+   proc.wait()
+   timer.cancel()
+finally:
+   shutil.rmtree(disk)
+
+passed = done and passthru and not failed
+sys.stdout.write('TEST nvme %s\n' % ('PASSED' if passed else 'FAILED'))
+
+sys.exit(0 if passed else 1)
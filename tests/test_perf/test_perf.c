@@ -0,0 +1,736 @@
+/*******************************************************************************
+ * Copyright (c) 2026 VMware, Inc.  All rights reserved.
+ * SPDX-License-Identifier: GPL-2.0
+ ******************************************************************************/
+
+/*
+ * test_perf.c -- measures what the firmware and the bootloader code actually
+ *                deliver on the machine it runs on.
+ *
+ *   test_perf [-t <tests>] [-f <file>]... [-z <file>] [-n] [-m <nics>]
+ *
+ *      OPTIONS
+ *         -t <tests>  Comma-separated list of the tests to run, among disk,
+ *                     net, gop, fw and cpu (default: all of them).
+ *         -f <file>   Measure the download rate of <file>, given relative to
+ *                     the boot volume (e.g. on the TFTP server when PXE
+ *                     booted) or as an http:// URL. Can be repeated.
+ *         -z <file>   Measure the inflate rate on <file>, which must be
+ *                     gzip'ed.
+ *         -n          Read the disk with NVMe pass-through when the boot disk
+ *                     is an NVMe namespace (e.g. QEMU -device nvme, under
+ *                     OVMF), instead of Block I/O.
+ *         -m <nics>   Spread the http:// downloads of -f across up to <nics>
+ *                     other NICs on the boot subnet (e.g. QEMU guests with
+ *                     several virtio-net devices on the same bridge).
+ *
+ *   Results are reported one per line, in the following format:
+ *
+ *      PERF <test> <parameter> <value> <unit>
+ */
+
+#include <efiutils.h>
+#include <bootlib.h>
+#include <boot_services.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sha256.h>
+#include <fb.h>
+
+#include "BlockIo2.h"
+
+#define PERF_CALIBRATION_US 100000            /* Clock calibration time */
+#define PERF_MIN_MS        1000               /* Minimum duration of a test */
+
+#define PERF_DISK_SPAN     (256 * 1024 * 1024)  /* Disk area read by tests */
+#define PERF_QD_SIZE       (128 * 1024)       /* Queued requests size */
+#define PERF_QD_MAX        32                 /* Maximum queue depth */
+
+#define PERF_CPU_SIZE      (16 * 1024 * 1024) /* memcpy/SHA buffer size */
+#define PERF_MAX_FILES     16
+
+#define PERF_DISK          (1 << 0)
+#define PERF_NET           (1 << 1)
+#define PERF_GOP           (1 << 2)
+#define PERF_FW            (1 << 3)
+#define PERF_CPU           (1 << 4)
+#define PERF_ALL           (PERF_DISK | PERF_NET | PERF_GOP | PERF_FW | PERF_CPU)
+
+static EFI_GUID BlockIo2Proto = EFI_BLOCK_IO2_PROTOCOL_GUID;
+
+static const struct {
+   const char *name;
+   unsigned int mask;
+} perf_tests[] = {
+   {"disk", PERF_DISK},
+   {"net",  PERF_NET},
+   {"gop",  PERF_GOP},
+   {"fw",   PERF_FW},
+   {"cpu",  PERF_CPU},
+};
+
+static unsigned int tests;
+static const char *files[PERF_MAX_FILES];
+static unsigned int files_nr;
+static const char *gzfile;
+
+static uint64_t TscStart;
+static uint64_t TscHz;
+
+/*-- report --------------------------------------------------------------------
+ *
+ *      Print a measurement, in a machine-readable format.
+ *
+ * Parameters
+ *      IN test:  test name
+ *      IN param: measured parameter
+ *      IN value: measured value
+ *      IN unit:  value unit
+ *----------------------------------------------------------------------------*/
+static void report(const char *test, const char *param, uint64_t value,
+                   const char *unit)
+{
+   Log(LOG_INFO, "PERF %s %s %"PRIu64" %s\n", test, param, value, unit);
+}
+
+/*-- report_rate ---------------------------------------------------------------
+ *
+ *      Print a transfer rate, in kB/s.
+ *
+ * Parameters
+ *      IN test:  test name
+ *      IN param: measured parameter
+ *      IN bytes: number of bytes transferred
+ *      IN ms:    transfer duration, in milliseconds
+ *----------------------------------------------------------------------------*/
+static void report_rate(const char *test, const char *param, uint64_t bytes,
+                        uint64_t ms)
+{
+   report(test, param, (ms > 0) ? bytes / ms : 0, "kB/s");
+}
+
+/*-- report_latency ------------------------------------------------------------
+ *
+ *      Print the average duration of an operation, in ns.
+ *
+ * Parameters
+ *      IN test:  test name
+ *      IN param: measured parameter
+ *      IN ops:   number of operations
+ *      IN ms:    total duration, in milliseconds
+ *----------------------------------------------------------------------------*/
+static void report_latency(const char *test, const char *param, uint64_t ops,
+                           uint64_t ms)
+{
+   report(test, param, (ops > 0) ? ms * 1000000 / ops : 0, "ns");
+}
+
+/*-- clock_start ---------------------------------------------------------------
+ *
+ *      Start the test clock, which counts TSC (or system counter) ticks.
+ *      firmware_get_time_ms() is backed by the RTC and may only have a one
+ *      second resolution, and firmware timer events are coalesced to the
+ *      firmware tick (10ms on OVMF), so neither is precise enough.
+ *
+ *      The counter frequency is architectural on arm64. Elsewhere, it is
+ *      measured against the Stall() boot service.
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+static int clock_start(void)
+{
+#if defined(only_arm64)
+   TscHz = tscfreq();
+#else
+   uint64_t start;
+   EFI_STATUS Status;
+
+   start = rdtsc();
+   Status = bs->Stall(PERF_CALIBRATION_US);
+   if (EFI_ERROR(Status)) {
+      return error_efi_to_generic(Status);
+   }
+   TscHz = (rdtsc() - start) * (1000000 / PERF_CALIBRATION_US);
+#endif
+
+   if (TscHz == 0) {
+      return ERR_UNSUPPORTED;
+   }
+
+   report("clock", "frequency", TscHz / 1000, "kHz");
+   TscStart = rdtsc();
+
+   return ERR_SUCCESS;
+}
+
+/*-- now_ms --------------------------------------------------------------------
+ *
+ *      Read the test clock.
+ *
+ * Results
+ *      Monotonic time in milliseconds.
+ *----------------------------------------------------------------------------*/
+static uint64_t now_ms(void)
+{
+   return (rdtsc() - TscStart) * 1000 / TscHz;
+}
+
+/*-- perf_alloc ----------------------------------------------------------------
+ *
+ *      Allocate a buffer suitable for Block I/O transfers.
+ *
+ * Parameters
+ *      IN  size:  buffer size, in bytes
+ *      IN  align: required alignment (0 or 1 mean no requirement)
+ *      OUT mem:   the allocated memory, to be freed with sys_free()
+ *
+ * Results
+ *      The aligned buffer, or NULL if out of resources.
+ *----------------------------------------------------------------------------*/
+static void *perf_alloc(size_t size, size_t align, void **mem)
+{
+   if (align < 1) {
+      align = 1;
+   }
+
+   *mem = sys_malloc(size + align - 1);
+   if (*mem == NULL) {
+      return NULL;
+   }
+
+   return (void *)(((uintptr_t)*mem + align - 1) / align * align);
+}
+
+/*-- perf_disk_queued ----------------------------------------------------------
+ *
+ *      Measure the boot volume read throughput with several requests in
+ *      flight, using the Block I/O 2 protocol.
+ *
+ * Parameters
+ *      IN Volume: boot volume handle
+ *----------------------------------------------------------------------------*/
+static void perf_disk_queued(EFI_HANDLE Volume)
+{
+   EFI_BLOCK_IO2_TOKEN Tokens[PERF_QD_MAX];
+   bool busy[PERF_QD_MAX];
+   EFI_BLOCK_IO2_PROTOCOL *Block2;
+   unsigned int depth, events, i, inflight;
+   uint64_t lba, span, blocks, bytes, start, elapsed;
+   EFI_STATUS Status;
+   char param[32];
+   void *mem, *buf;
+   bool stop;
+
+   Status = get_protocol_interface(Volume, &BlockIo2Proto, (void **)&Block2);
+   if (EFI_ERROR(Status)) {
+      Log(LOG_INFO, "No Block I/O 2 protocol: skipping queued reads\n");
+      return;
+   }
+
+   /* The volume may be a partition: its own media gives its size. */
+   span = MIN(Block2->Media->LastBlock + 1,
+              PERF_DISK_SPAN / Block2->Media->BlockSize);
+   blocks = PERF_QD_SIZE / Block2->Media->BlockSize;
+   if (blocks == 0 || span < blocks) {
+      return;
+   }
+
+   buf = perf_alloc(PERF_QD_MAX * PERF_QD_SIZE, Block2->Media->IoAlign,
+                       &mem);
+   if (buf == NULL) {
+      Log(LOG_ERR, "Out of memory for queued reads\n");
+      return;
+   }
+
+   for (events = 0; events < PERF_QD_MAX; events++) {
+      Status = bs->CreateEvent(0, TPL_CALLBACK, NULL, NULL,
+                               &Tokens[events].Event);
+      if (EFI_ERROR(Status)) {
+         break;
+      }
+   }
+
+   for (depth = 1; depth <= events; depth *= 2) {
+      memset(busy, 0, sizeof (busy));
+      inflight = 0;
+      bytes = 0;
+      lba = 0;
+      stop = false;
+      start = now_ms();
+
+      do {
+         for (i = 0; i < depth; i++) {
+            if (busy[i]) {
+               if (bs->CheckEvent(Tokens[i].Event) != EFI_SUCCESS) {
+                  continue;
+               }
+               busy[i] = false;
+               inflight--;
+               if (EFI_ERROR(Tokens[i].TransactionStatus)) {
+                  stop = true;
+                  continue;
+               }
+               bytes += PERF_QD_SIZE;
+            }
+
+            if (stop || now_ms() - start >= PERF_MIN_MS) {
+               stop = true;
+               continue;
+            }
+
+            if (lba + blocks > span) {
+               lba = 0;
+            }
+            Tokens[i].TransactionStatus = EFI_SUCCESS;
+            Status = Block2->ReadBlocksEx(Block2, Block2->Media->MediaId, lba,
+                                          &Tokens[i], PERF_QD_SIZE,
+                                          (char *)buf + i * PERF_QD_SIZE);
+            if (EFI_ERROR(Status)) {
+               stop = true;
+               continue;
+            }
+            busy[i] = true;
+            inflight++;
+            lba += blocks;
+         }
+      } while (inflight > 0);
+
+      elapsed = now_ms() - start;
+      snprintf(param, sizeof (param), "qd%u", depth);
+      report_rate("disk", param, bytes, elapsed);
+   }
+
+   while (events-- > 0) {
+      bs->CloseEvent(Tokens[events].Event);
+   }
+   sys_free(mem);
+}
+
+/*-- perf_disk -----------------------------------------------------------------
+ *
+ *      Measure the boot volume read throughput, for several request sizes.
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+static int perf_disk(void)
+{
+   static const size_t sizes[] = {
+      4 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024
+   };
+   uint64_t lba, span, count, bytes, start, elapsed;
+   EFI_HANDLE Volume;
+   EFI_BLOCK_IO *Block;
+   EFI_STATUS Status;
+   char param[32];
+   void *mem, *buf;
+   unsigned int i;
+   disk_t disk;
+   int status;
+
+   status = get_boot_disk(&disk);
+   if (status != ERR_SUCCESS) {
+      Log(LOG_ERR, "No boot disk: %s\n", error_str[status]);
+      return status;
+   }
+
+   Block = (EFI_BLOCK_IO *)disk.firmware_id;
+   span = MIN(Block->Media->LastBlock + 1,
+              PERF_DISK_SPAN / disk.bytes_per_sector);
+   report("disk", "block_size", disk.bytes_per_sector, "bytes");
+   report("disk", "io_align", Block->Media->IoAlign, "bytes");
+
+   buf = perf_alloc(sizes[ARRAYSIZE(sizes) - 1], Block->Media->IoAlign,
+                       &mem);
+   if (buf == NULL) {
+      return ERR_OUT_OF_RESOURCES;
+   }
+
+   for (i = 0; i < ARRAYSIZE(sizes); i++) {
+      count = sizes[i] / disk.bytes_per_sector;
+      if (count == 0 || count > span) {
+         continue;
+      }
+
+      bytes = 0;
+      lba = 0;
+      start = now_ms();
+      do {
+         if (lba + count > span) {
+            lba = 0;
+         }
+         status = disk_read(&disk, buf, lba, count);
+         if (status != ERR_SUCCESS) {
+            Log(LOG_ERR, "Disk read error: %s\n", error_str[status]);
+            break;
+         }
+         bytes += sizes[i];
+         lba += count;
+      } while (now_ms() - start < PERF_MIN_MS);
+      elapsed = now_ms() - start;
+
+      snprintf(param, sizeof (param), "read_%zuk", sizes[i] / 1024);
+      report_rate("disk", param, bytes, elapsed);
+   }
+
+   sys_free(mem);
+
+   Status = get_boot_device(&Volume);
+   if (!EFI_ERROR(Status)) {
+      perf_disk_queued(Volume);
+   }
+
+   return ERR_SUCCESS;
+}
+
+/*-- perf_net ------------------------------------------------------------------
+ *
+ *      Measure the download rate of the files given on the command line.
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+static int perf_net(void)
+{
+   uint64_t start, elapsed;
+   unsigned int i;
+   size_t size;
+   void *buf;
+   int status;
+
+   for (i = 0; i < files_nr; i++) {
+      start = now_ms();
+      status = firmware_file_read(files[i], NULL, &buf, &size);
+      elapsed = now_ms() - start;
+      if (status != ERR_SUCCESS) {
+         Log(LOG_ERR, "Error loading %s: %s\n", files[i], error_str[status]);
+         continue;
+      }
+      sys_free(buf);
+
+      report("net", files[i], size, "bytes");
+      report_rate("net", files[i], size, elapsed);
+   }
+
+   return ERR_SUCCESS;
+}
+
+/*-- perf_gop ------------------------------------------------------------------
+ *
+ *      Measure the cost of drawing to the framebuffer.
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+static int perf_gop(void)
+{
+   uint64_t ops, start, elapsed;
+   framebuffer_t fb;
+   int status;
+
+   status = video_set_mode(&fb, 1024, 768, 32, 640, 400, 24, false);
+   if (status != ERR_SUCCESS) {
+      Log(LOG_ERR, "Cannot set a video mode: %s\n", error_str[status]);
+      return status;
+   }
+
+   ops = 0;
+   start = now_ms();
+   do {
+      fb_draw_rect(&fb, 0, 0, fb.width, fb.height,
+                   (ops & 1) ? 0x00ffffff : 0x00000000);
+      ops++;
+   } while (now_ms() - start < PERF_MIN_MS);
+   elapsed = now_ms() - start;
+   report_latency("gop", "fill", ops, elapsed);
+   report_rate("gop", "fill", ops * fb.height * fb.BytesPerScanLine, elapsed);
+
+   ops = 0;
+   start = now_ms();
+   do {
+      fb_print(&fb, "The quick brown fox jumps over the lazy dog", 0, 0,
+               fb.width, 0x00000000, 0x00ffffff, ALIGN_LEFT);
+      ops++;
+   } while (now_ms() - start < PERF_MIN_MS);
+   elapsed = now_ms() - start;
+   report_latency("gop", "print_43_chars", ops, elapsed);
+
+   video_set_text_mode();
+
+   return ERR_SUCCESS;
+}
+
+/*-- perf_fw -------------------------------------------------------------------
+ *
+ *      Measure the latency of the firmware memory services.
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+static int perf_fw(void)
+{
+   static const size_t sizes[] = { 64, 4096, 1024 * 1024 };
+   EFI_MEMORY_DESCRIPTOR *MMap;
+   UINTN MapSize, BufSize, MapKey, DescSize;
+   uint64_t ops, start, elapsed;
+   UINT32 DescVersion;
+   EFI_STATUS Status;
+   char param[32];
+   unsigned int i;
+   VOID *Buffer;
+
+   MapSize = 0;
+   bs->GetMemoryMap(&MapSize, NULL, &MapKey, &DescSize, &DescVersion);
+   BufSize = MapSize + 16 * sizeof (EFI_MEMORY_DESCRIPTOR);
+   MMap = sys_malloc(BufSize);
+   if (MMap == NULL) {
+      return ERR_OUT_OF_RESOURCES;
+   }
+
+   ops = 0;
+   start = now_ms();
+   do {
+      MapSize = BufSize;
+      Status = bs->GetMemoryMap(&MapSize, MMap, &MapKey, &DescSize,
+                                &DescVersion);
+      if (EFI_ERROR(Status)) {
+         break;
+      }
+      ops++;
+   } while (now_ms() - start < PERF_MIN_MS);
+   elapsed = now_ms() - start;
+   sys_free(MMap);
+
+   report("fw", "memory_map_entries", MapSize / DescSize, "entries");
+   report_latency("fw", "get_memory_map", ops, elapsed);
+
+   for (i = 0; i < ARRAYSIZE(sizes); i++) {
+      ops = 0;
+      start = now_ms();
+      do {
+         Status = bs->AllocatePool(EfiLoaderData, sizes[i], &Buffer);
+         if (EFI_ERROR(Status)) {
+            break;
+         }
+         bs->FreePool(Buffer);
+         ops++;
+      } while (now_ms() - start < PERF_MIN_MS);
+      elapsed = now_ms() - start;
+
+      snprintf(param, sizeof (param), "allocate_pool_%zu", sizes[i]);
+      report_latency("fw", param, ops, elapsed);
+   }
+
+   return ERR_SUCCESS;
+}
+
+/*-- perf_cpu ------------------------------------------------------------------
+ *
+ *      Measure the rate of the in-memory algorithms used while booting.
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+static int perf_cpu(void)
+{
+   unsigned char digest[32];
+   uint64_t bytes, start, elapsed;
+   void *src, *dest, *gz;
+   size_t size, gzsize;
+   int status;
+
+   src = sys_malloc(PERF_CPU_SIZE);
+   dest = sys_malloc(PERF_CPU_SIZE);
+   if (src == NULL || dest == NULL) {
+      sys_free(src);
+      sys_free(dest);
+      return ERR_OUT_OF_RESOURCES;
+   }
+   memset(src, 0x5a, PERF_CPU_SIZE);
+
+   bytes = 0;
+   start = now_ms();
+   do {
+      memcpy(dest, src, PERF_CPU_SIZE);
+      bytes += PERF_CPU_SIZE;
+   } while (now_ms() - start < PERF_MIN_MS);
+   elapsed = now_ms() - start;
+   report_rate("cpu", "memcpy", bytes, elapsed);
+
+   bytes = 0;
+   start = now_ms();
+   do {
+      mbedtls_sha256_ret(src, PERF_CPU_SIZE, digest, 0);
+      bytes += PERF_CPU_SIZE;
+   } while (now_ms() - start < PERF_MIN_MS);
+   elapsed = now_ms() - start;
+   report_rate("cpu", "sha256", bytes, elapsed);
+
+   sys_free(src);
+   sys_free(dest);
+
+   if (gzfile == NULL) {
+      return ERR_SUCCESS;
+   }
+
+   status = firmware_file_read(gzfile, NULL, &gz, &gzsize);
+   if (status != ERR_SUCCESS) {
+      Log(LOG_ERR, "Error loading %s: %s\n", gzfile, error_str[status]);
+      return status;
+   }
+
+   if (!is_gzip(gz, gzsize, &status)) {
+      Log(LOG_ERR, "%s is not gzip'ed\n", gzfile);
+      sys_free(gz);
+      return ERR_BAD_TYPE;
+   }
+
+   bytes = 0;
+   start = now_ms();
+   do {
+      status = gzip_extract(gz, gzsize, &dest, &size);
+      if (status != ERR_SUCCESS) {
+         Log(LOG_ERR, "Inflate error: %s\n", error_str[status]);
+         break;
+      }
+      sys_free(dest);
+      bytes += size;
+   } while (now_ms() - start < PERF_MIN_MS);
+   elapsed = now_ms() - start;
+   sys_free(gz);
+
+   report_rate("cpu", "inflate", bytes, elapsed);
+
+   return status;
+}
+
+/*-- test_perf_init ------------------------------------------------------------
+ *
+ *      Parse test_perf command line options.
+ *
+ * Parameters
+ *      IN argc: number of command line arguments
+ *      IN argv: pointer to the command line arguments array
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+static int test_perf_init(int argc, char **argv)
+{
+   const char *p, *end;
+   unsigned int i;
+   size_t len;
+   int opt;
+
+   if (argc == 0 || argv == NULL || argv[0] == NULL) {
+      return ERR_INVALID_PARAMETER;
+   }
+
+   tests = PERF_ALL;
+
+   if (argc > 1) {
+      optind = 1;
+      do {
+         opt = getopt(argc, argv, "t:f:z:nm:");
+         switch (opt) {
+            case -1:
+               break;
+            case 't':
+               tests = 0;
+               for (p = optarg; *p != '\0'; p += len) {
+                  if (*p == ',') {
+                     len = 1;
+                     continue;
+                  }
+                  end = strchr(p, ',');
+                  len = (end != NULL) ? (size_t)(end - p) : strlen(p);
+                  for (i = 0; i < ARRAYSIZE(perf_tests); i++) {
+                     if (strlen(perf_tests[i].name) == len &&
+                         strncmp(p, perf_tests[i].name, len) == 0) {
+                        tests |= perf_tests[i].mask;
+                        break;
+                     }
+                  }
+                  if (i == ARRAYSIZE(perf_tests)) {
+                     return ERR_SYNTAX;
+                  }
+               }
+               break;
+            case 'f':
+               if (files_nr == PERF_MAX_FILES) {
+                  return ERR_SYNTAX;
+               }
+               files[files_nr++] = optarg;
+               break;
+            case 'z':
+               gzfile = optarg;
+               break;
+            case 'n':
+               disk_set_nvme_passthru(true);
+               break;
+            case 'm':
+               set_snphttp_extra_nics(strtoul(optarg, NULL, 0));
+               break;
+            case '?':
+            default:
+               return ERR_SYNTAX;
+         }
+      } while (opt != -1);
+   }
+
+   return ERR_SUCCESS;
+}
+
+/*-- main ----------------------------------------------------------------------
+ *
+ *      test_perf main function.
+ *
+ * Parameters
+ *      IN argc: number of command line arguments
+ *      IN argv: pointer to the command line arguments array
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+int main(int argc, char **argv)
+{
+   int status;
+
+   status = log_init(true);
+   if (status != ERR_SUCCESS) {
+      return status;
+   }
+
+   status = test_perf_init(argc, argv);
+   if (status != ERR_SUCCESS) {
+      Log(LOG_ERR, "test_perf_init: %s\n", error_str[status]);
+      return status;
+   }
+
+   status = clock_start();
+   if (status != ERR_SUCCESS) {
+      Log(LOG_ERR, "Cannot calibrate the clock: %s\n", error_str[status]);
+      return status;
+   }
+
+   if ((tests & PERF_CPU) != 0) {
+      perf_cpu();
+   }
+   if ((tests & PERF_FW) != 0) {
+      perf_fw();
+   }
+   if ((tests & PERF_DISK) != 0) {
+      perf_disk();
+   }
+   if ((tests & PERF_NET) != 0) {
+      perf_net();
+   }
+   if ((tests & PERF_GOP) != 0) {
+      perf_gop();
+   }
+
+   return ERR_SUCCESS;
+}
@@ -0,0 +1,131 @@
+#! /usr/bin/python3
+
+#*******************************************************************************
+# Copyright (c) 2026 VMware, Inc.  All rights reserved.
+# SPDX-License-Identifier: GPL-2.0
+#*******************************************************************************
+
+# Run test_snphttp in a QEMU guest, PXE booted by OVMF.
+# Usage: run_qemu.py [--efi file] [--ovmf file] [--size bytes] [--timeout s]
+#                     [--nics n]
+#
+# Serves a random test file from a local HTTP server (with HEAD and Range
+# support), then boots test_snphttp over TFTP from QEMU's user-mode network,
+# where the host is 10.0.2.2. The test runs twice: against a HTTP/1.1 server
+# that keeps the connection alive, and against a HTTP/1.0 server that closes
+# it after each response, so that every request reconnects. With --nics, the
+# guest gets that many more virtio-net devices, and the file is also loaded
+# spread across them (test_snphttp -m). All the NICs are on one QEMU hub, with
+# the user-mode network's single DHCP server behind it, so that each NIC gets
+# its own lease on the same subnet, and resolves the server with ARP on a
+# shared segment. Exits with 0 if all the tests pass.
+
+import argparse
+import hashlib
+import http.server
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import threading
+
+TOPDIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..')
+DEFAULT_EFI = os.path.join(TOPDIR, 'build', 'uefi64', 'test_snphttp',
+                           'test_snphttp_em64t.efi')
+DEFAULT_OVMF = '/usr/share/ovmf/OVMF.fd'
+FILE_NAME = 'test_snphttp.bin'
+
+class Handler(http.server.BaseHTTPRequestHandler):
+   data = b''
+
+   def send_body(self, head):
+      size = len(self.data)
+      start, end = 0, size - 1
+      byteRange = self.headers.get('Range')
+      if self.path != '/' + FILE_NAME:
+         self.send_error(404)
+         return
+      if byteRange is not None:
+         first, last = byteRange.replace('bytes=', '').split('-')
+         start, end = int(first), min(int(last), size - 1)
+         self.send_response(206)
+         self.send_header('Content-Range', 'bytes %d-%d/%d' %
+                          (start, end, size))
+      else:
+         self.send_response(200)
+      self.send_header('Content-Length', str(end - start + 1))
+      self.end_headers()
+      if not head:
+         self.wfile.write(self.data[start:end + 1])
+
+   def do_GET(self):
+      self.send_body(False)
+
+   def do_HEAD(self):
+      self.send_body(True)
+
+   def log_message(self, *args):
+      pass
+
+def run(args, data, protocol):
+   Handler.protocol_version = protocol
+   server = http.server.ThreadingHTTPServer(('127.0.0.1', 0), Handler)
+   threading.Thread(target=server.serve_forever, daemon=True).start()
+   url = 'http://10.0.2.2:%d/%s' % (server.server_address[1], FILE_NAME)
+
+   tftp = tempfile.mkdtemp()
+   try:
+      shutil.copy(args.efi, os.path.join(tftp, 'test_snphttp.efi'))
+      with open(os.path.join(tftp, 'test_snphttp.cfg'), 'w') as f:
+         f.write('test_snphttp -s %s -m %d %s\n' %
+                 (hashlib.sha256(data).hexdigest(), args.nics, url))
+
+      # The legacy -net option puts the user-mode network on hub 0.
+      cmd = ['qemu-system-x86_64', '-m', '1024', '-nographic',
+             '-bios', args.ovmf,
+             '-net', 'user,tftp=%s,bootfile=test_snphttp.efi' % tftp]
+      for i in range(0, args.nics + 1):
+         cmd += ['-netdev', 'hubport,id=n%d,hubid=0' % i,
+                 '-device', 'virtio-net-pci,netdev=n%d,mac=52:54:00:12:34:%02x'
+                 % (i, 0x56 + i) + (',bootindex=1' if i == 0 else '')]
+
+      passed = False
+      proc = subprocess.Popen(cmd, stdout=subprocess.PIPE,
+                              stderr=subprocess.STDOUT,
+                              stdin=subprocess.DEVNULL, text=True,
+                              errors='replace')
+      timer = threading.Timer(args.timeout, proc.kill)
+      timer.start()
+      for line in proc.stdout:
+         if 'TEST snphttp' in line:
+            sys.stdout.write('[%s] %s\n' % (protocol, line.strip()))
+         if 'TEST snphttp PASSED' in line or 'TEST snphttp FAILED' in line:
+            passed = 'PASSED' in line
+            proc.kill()
+      proc.wait()
+      timer.cancel()
+   finally:
+      shutil.rmtree(tftp)
+      server.shutdown()
+
+   return passed
+
+parser = argparse.ArgumentParser()
+parser.add_argument('--efi', default=DEFAULT_EFI)
+parser.add_argument('--ovmf', default=DEFAULT_OVMF)
+parser.add_argument('--size', type=int, default=24 * 1024 * 1024)
+parser.add_argument('--timeout', type=int, default=300)
+parser.add_argument('--nics', type=int, default=0)
+args = parser.parse_args()
+
+data = os.urandom(args.size)
+Handler.data = data
+
+failed = False
+for protocol in ('HTTP/1.1', 'HTTP/1.0'):
+   if not run(args, data, protocol):
+      sys.stdout.write('[%s] FAILED\n' % protocol)
+      failed = True
+
+sys.exit(1 if failed else 0)
@@ -0,0 +1,368 @@
+/*******************************************************************************
+ * Copyright (c) 2026 VMware, Inc.  All rights reserved.
+ * SPDX-License-Identifier: GPL-2.0
+ ******************************************************************************/
+
+/*
+ * test_snphttp.c -- tests for the native HTTP client (snphttp.c, snpnet.c).
+ *
+ *   test_snphttp [-s <sha256>] [-n <rounds>] [-m <nics>] <url>
+ *
+ *      OPTIONS
+ *         -s <sha256>  Expected SHA-256 digest of the file, in hex.
+ *         -n <rounds>  Number of times the whole file is loaded again
+ *                      (default: 4).
+ *         -m <nics>    Also load the file spread across up to <nics> other
+ *                      NICs on the boot subnet (see multinic).
+ *
+ *   Must be PXE booted over IPv4. Without arguments on the command line, they
+ *   are read from test_snphttp.cfg, next to this program on the TFTP server
+ *   (the whole command line, including the program name). See run_qemu.py,
+ *   which sets up QEMU, OVMF, and a local HTTP server to run the tests.
+ *
+ *   Each test reports one line, in the following format:
+ *
+ *      TEST snphttp <test> <PASS|FAIL>
+ */
+
+#include <efiutils.h>
+#include <bootlib.h>
+#include <boot_services.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sha256.h>
+
+#define TEST_CFG         "test_snphttp.cfg"
+#define TEST_ROUNDS      4
+
+static EFI_HANDLE Volume;
+static const char *url;
+static const char *sha256;
+static unsigned int rounds = TEST_ROUNDS;
+static unsigned int nics;
+
+/*-- report --------------------------------------------------------------------
+ *
+ *      Report the result of a test.
+ *
+ * Parameters
+ *      IN test:   test name
+ *      IN failed: whether the test failed
+ *
+ * Results
+ *      failed
+ *----------------------------------------------------------------------------*/
+static bool report(const char *test, bool failed)
+{
+   Log(LOG_INFO, "TEST snphttp %s %s\n", test, failed ? "FAIL" : "PASS");
+
+   return failed;
+}
+
+/*-- digest_matches ------------------------------------------------------------
+ *
+ *      Check a buffer against a SHA-256 digest.
+ *
+ * Parameters
+ *      IN buf:    buffer
+ *      IN size:   buffer size, in bytes
+ *      IN digest: expected digest
+ *
+ * Results
+ *      true if the buffer has the expected digest, false otherwise.
+ *----------------------------------------------------------------------------*/
+static bool digest_matches(const void *buf, size_t size,
+                           const unsigned char *digest)
+{
+   unsigned char actual[32];
+
+   mbedtls_sha256_ret(buf, size, actual, 0);
+
+   return memcmp(actual, digest, sizeof (actual)) == 0;
+}
+
+/*-- parse_digest --------------------------------------------------------------
+ *
+ *      Parse a SHA-256 digest given in hex.
+ *
+ * Parameters
+ *      IN  hex:    the digest, in hex
+ *      OUT digest: the digest
+ *
+ * Results
+ *      ERR_SUCCESS, or ERR_SYNTAX.
+ *----------------------------------------------------------------------------*/
+static int parse_digest(const char *hex, unsigned char *digest)
+{
+   char byte[3];
+   char *end;
+   int i;
+
+   if (strlen(hex) != 64) {
+      return ERR_SYNTAX;
+   }
+
+   byte[2] = '\0';
+   for (i = 0; i < 32; i++) {
+      byte[0] = hex[2 * i];
+      byte[1] = hex[2 * i + 1];
+      digest[i] = (unsigned char)strtoul(byte, &end, 16);
+      if (*end != '\0') {
+         return ERR_SYNTAX;
+      }
+   }
+
+   return ERR_SUCCESS;
+}
+
+/*-- test_snphttp_run ----------------------------------------------------------
+ *
+ *      Run all the tests.
+ *
+ * Results
+ *      true if any test failed, false otherwise.
+ *----------------------------------------------------------------------------*/
+static bool test_snphttp_run(void)
+{
+   unsigned char digest[32];
+   UINTN size, bufsize, len;
+   uint8_t *file, *buf;
+   EFI_STATUS Status;
+   unsigned int i;
+   UINT64 offset;
+   bool failed;
+   VOID *ptr;
+
+   failed = false;
+
+   /*
+    * Size, and whole file into an allocated buffer.
+    */
+   Status = snphttp_file_get_size(Volume, url, &size);
+   if (report("size", EFI_ERROR(Status) || size == 0)) {
+      return true;
+   }
+
+   ptr = NULL;
+   Status = snphttp_file_load(Volume, url, NULL, &ptr, &bufsize);
+   file = ptr;
+   if (report("load", EFI_ERROR(Status) || bufsize != size)) {
+      return true;
+   }
+
+   mbedtls_sha256_ret(file, size, digest, 0);
+   if (sha256 != NULL) {
+      unsigned char expected[32];
+
+      failed |= report("digest", parse_digest(sha256, expected) != ERR_SUCCESS
+                       || memcmp(digest, expected, sizeof (digest)) != 0);
+   }
+
+   buf = sys_malloc(size);
+   if (buf == NULL) {
+      sys_free(file);
+      return report("alloc", true);
+   }
+
+   /*
+    * Whole file again, into the caller's buffer. With a server that closes
+    * the connection after each response, every round reconnects.
+    */
+   for (i = 0; i < rounds; i++) {
+      memset(buf, 0, size);
+      ptr = buf;
+      bufsize = size;
+      Status = snphttp_file_load(Volume, url, NULL, &ptr, &bufsize);
+      if (EFI_ERROR(Status) || bufsize != size ||
+          !digest_matches(buf, size, digest)) {
+         Log(LOG_ERR, "Round %u: %s\n", i,
+             error_str[error_efi_to_generic(Status)]);
+         break;
+      }
+   }
+   failed |= report("reload", i < rounds);
+
+   /*
+    * Byte ranges: head, tail, middle and single bytes.
+    */
+   for (i = 0; i < 5; i++) {
+      switch (i) {
+         case 0:
+            offset = 0;
+            len = MIN(size, 4096);
+            break;
+         case 1:
+            len = MIN(size, 4096);
+            offset = size - len;
+            break;
+         case 2:
+            offset = size / 3;
+            len = size / 3;
+            break;
+         case 3:
+            offset = 0;
+            len = 1;
+            break;
+         default:
+            offset = size - 1;
+            len = 1;
+            break;
+      }
+      if (len == 0) {
+         continue;
+      }
+
+      memset(buf, 0, len);
+      Status = snphttp_file_load_range(Volume, url, offset, len, buf);
+      if (EFI_ERROR(Status) || memcmp(buf, file + offset, len) != 0) {
+         Log(LOG_ERR, "Range %"PRIu64"+%zu: %s\n", offset, (size_t)len,
+             error_str[error_efi_to_generic(Status)]);
+         break;
+      }
+   }
+   failed |= report("range", i < 5);
+
+   /*
+    * Whole file, spread across the extra NICs.
+    */
+   if (nics > 0) {
+      set_snphttp_extra_nics(nics);
+
+      memset(buf, 0, size);
+      ptr = buf;
+      bufsize = size;
+      Status = snphttp_file_load(Volume, url, NULL, &ptr, &bufsize);
+      failed |= report("multinic", EFI_ERROR(Status) || bufsize != size ||
+                       !digest_matches(buf, size, digest));
+
+      set_snphttp_extra_nics(0);
+      snphttp_cleanup();
+   }
+
+   sys_free(buf);
+   sys_free(file);
+
+   return failed;
+}
+
+/*-- test_snphttp_init ---------------------------------------------------------
+ *
+ *      Parse test_snphttp command line options.
+ *
+ * Parameters
+ *      IN argc: number of command line arguments
+ *      IN argv: pointer to the command line arguments array
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+static int test_snphttp_init(int argc, char **argv)
+{
+   int opt;
+
+   if (argc == 0 || argv == NULL || argv[0] == NULL) {
+      return ERR_INVALID_PARAMETER;
+   }
+
+   optind = 1;
+   do {
+      opt = getopt(argc, argv, "s:n:m:");
+      switch (opt) {
+         case -1:
+            break;
+         case 's':
+            sha256 = optarg;
+            break;
+         case 'n':
+            rounds = strtoul(optarg, NULL, 0);
+            break;
+         case 'm':
+            nics = strtoul(optarg, NULL, 0);
+            break;
+         case '?':
+         default:
+            return ERR_SYNTAX;
+      }
+   } while (opt != -1);
+
+   if (optind != argc - 1) {
+      return ERR_SYNTAX;
+   }
+   url = argv[optind];
+
+   return ERR_SUCCESS;
+}
+
+/*-- main ----------------------------------------------------------------------
+ *
+ *      test_snphttp main function.
+ *
+ * Parameters
+ *      IN argc: number of command line arguments
+ *      IN argv: pointer to the command line arguments array
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+int main(int argc, char **argv)
+{
+   EFI_PXE_BASE_CODE *Pxe;
+   EFI_STATUS Status;
+   size_t cfgsize;
+   char *cfg;
+   int status;
+
+   status = log_init(true);
+   if (status != ERR_SUCCESS) {
+      return status;
+   }
+
+   if (!is_pxe_boot(&Pxe)) {
+      Log(LOG_ERR, "test_snphttp must be PXE booted\n");
+      return ERR_UNSUPPORTED;
+   }
+
+   if (argc <= 1) {
+      status = firmware_file_read(TEST_CFG, NULL, (void **)&cfg, &cfgsize);
+      if (status != ERR_SUCCESS) {
+         Log(LOG_ERR, "Cannot read %s: %s\n", TEST_CFG, error_str[status]);
+         return status;
+      }
+
+      cfg = sys_realloc(cfg, cfgsize, cfgsize + 1);
+      if (cfg == NULL) {
+         return ERR_OUT_OF_RESOURCES;
+      }
+      cfg[cfgsize] = '\0';
+
+      status = str_to_argv(cfg, &argc, &argv, false);
+      if (status != ERR_SUCCESS) {
+         return status;
+      }
+   }
+
+   status = test_snphttp_init(argc, argv);
+   if (status != ERR_SUCCESS) {
+      Log(LOG_ERR, "Usage: test_snphttp [-s <sha256>] [-n <rounds>] "
+          "[-m <nics>] <url>\n");
+      return status;
+   }
+
+   Status = get_boot_volume(&Volume);
+   if (EFI_ERROR(Status)) {
+      return error_efi_to_generic(Status);
+   }
+
+   set_snphttp_criteria(snphttp_always);
+
+   if (test_snphttp_run()) {
+      Log(LOG_INFO, "TEST snphttp FAILED\n");
+      return ERR_ABORTED;
+   }
+
+   Log(LOG_INFO, "TEST snphttp PASSED\n");
+
+   return ERR_SUCCESS;
+}
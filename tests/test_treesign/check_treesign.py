@@ -0,0 +1,141 @@
+#! /usr/bin/python3
+
+#*******************************************************************************
+# Copyright (c) 2026 VMware, Inc.  All rights reserved.
+# SPDX-License-Identifier: GPL-2.0
+#*******************************************************************************
+
+# Host-side round trip of schema version 5 (hash tree) module signatures.
+# Usage: check_treesign.py [--key name] [--size bytes] [--leaf bytes]
+#
+# Signs a random module with env/sign.py --tree, using a test key from
+# localkeys, then checks the result the way secure_boot_parse_module() and
+# secure_boot_check_sig() in mboot/secure.c do: parse the trailer backwards
+# from the magic number, recompute the tree root, and verify the RSA signature
+# over it with openssl. Also checks that the signature does not verify once
+# the module is altered, nor as a schema version 1-4 signature over the
+# signed data or over the root hash input. Exits with 0 if all the checks
+# pass.
+
+import argparse
+import hashlib
+import os
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+
+TOPDIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..')
+SIGN_PY = os.path.join(TOPDIR, 'env', 'sign.py')
+LOCALKEYS = os.path.join(TOPDIR, 'localkeys')
+OPENSSL = os.getenv('OPENSSL') or 'openssl'
+
+SCHEMA_MAGIC = 0x1abe11ed
+TREE_SCHEMA = 5
+TREE_MIN_LEAF_SIZE = 64 * 1024
+KEYID_LEN = 16
+
+def parse(module):
+   """Split a signed module as secure_boot_parse_module() does."""
+   magic, = struct.unpack('<I', module[-4:])
+   if magic != SCHEMA_MAGIC:
+      raise ValueError('bad magic 0x%x' % magic)
+   sigLen, = struct.unpack('<I', module[-8:-4])
+   end = len(module) - 8 - sigLen
+   sig = module[end:-8]
+   schema, = struct.unpack('<I', module[end - 4:end])
+   leafSize = 0
+   if schema == TREE_SCHEMA:
+      leafSize, = struct.unpack('<I', module[end - 8:end - 4])
+      if leafSize < TREE_MIN_LEAF_SIZE or leafSize & (leafSize - 1) != 0:
+         raise ValueError('bad leaf size %d' % leafSize)
+   return module[:end], sig, schema, leafSize
+
+def tree_input(alg, data, leafSize):
+   """Root hash input of the hash tree, as hash_tree_root() builds it."""
+   leaves = []
+   for offset in range(0, len(data), leafSize):
+      leaf = hashlib.new(alg, data[offset:offset + leafSize]).digest()
+      leaves.append(hashlib.new(alg, b'\x00' + leaf).digest())
+   return (b'\x01' + struct.pack('<II', leafSize, len(leaves)) +
+           b''.join(leaves) + struct.pack('<I', TREE_SCHEMA))
+
+def rsa_verify(cert, alg, digest, rsasig, tmp):
+   sigfile = os.path.join(tmp, 'rsasig')
+   with open(sigfile, 'wb') as f:
+      f.write(rsasig)
+   proc = subprocess.run([OPENSSL, 'pkeyutl', '-verify', '-certin',
+                          '-inkey', cert, '-pkeyopt', 'digest:' + alg,
+                          '-sigfile', sigfile],
+                         input=digest, stdout=subprocess.DEVNULL,
+                         stderr=subprocess.DEVNULL)
+   return proc.returncode == 0
+
+def check_sig(module, key, alg, tmp, schema=None):
+   """Verify a signed module, as secure_boot_check_sig() does."""
+   data, sig, parsed, leafSize = parse(module)
+   if schema is None:
+      schema = parsed
+   if sig[:KEYID_LEN].rstrip(b'\0').decode('ascii') != key:
+      return False
+   if schema == TREE_SCHEMA:
+      digest = hashlib.new(alg, tree_input(alg, data, leafSize)).digest()
+   else:
+      digest = hashlib.new(alg, data).digest()
+   cert = os.path.join(LOCALKEYS, key, key + '.cert')
+   return rsa_verify(cert, alg, digest, sig[KEYID_LEN:], tmp)
+
+parser = argparse.ArgumentParser()
+parser.add_argument('--key', default='test_sb2017')
+parser.add_argument('--size', type=int, default=5 * 64 * 1024 + 1234)
+parser.add_argument('--leaf', type=int, default=64 * 1024)
+args = parser.parse_args()
+
+text = subprocess.check_output([OPENSSL, 'x509', '-noout', '-text', '-in',
+                                os.path.join(LOCALKEYS, args.key,
+                                             args.key + '.cert')])
+alg = 'sha512' if b'sha512WithRSAEncryption' in text else 'sha256'
+
+tmp = tempfile.mkdtemp()
+try:
+   iname = os.path.join(tmp, 'module')
+   oname = os.path.join(tmp, 'module.signed')
+   with open(iname, 'wb') as f:
+      f.write(os.urandom(args.size))
+
+   env = dict(os.environ, TOPDIR=TOPDIR, LOCALKEYS=LOCALKEYS)
+   subprocess.check_call([sys.executable, SIGN_PY, '--tree=%d' % args.leaf,
+                          args.key, iname, oname], env=env)
+   with open(iname, 'rb') as f:
+      original = f.read()
+   with open(oname, 'rb') as f:
+      signed = f.read()
+
+   data, sig, schema, leafSize = parse(signed)
+   tampered = bytearray(signed)
+   tampered[len(original) // 2] ^= 1
+   spoofed = tree_input(alg, data, leafSize)
+
+   checks = [
+      ('format', data[:len(original)] == original and schema == TREE_SCHEMA
+                 and leafSize == args.leaf
+                 and len(data) == len(original) + 8),
+      ('signature', check_sig(signed, args.key, alg, tmp)),
+      ('tampered module', not check_sig(bytes(tampered), args.key, alg, tmp)),
+      ('schema 4 over the data',
+       not check_sig(signed, args.key, alg, tmp, schema=4)),
+      # Signed data claiming a schema version 1-4 cannot be the root input.
+      ('schema 4 over the root input',
+       struct.unpack('<I', spoofed[-4:])[0] == TREE_SCHEMA),
+   ]
+finally:
+   shutil.rmtree(tmp)
+
+failed = False
+for name, ok in checks:
+   sys.stdout.write('%s: %s\n' % (name, 'ok' if ok else 'FAILED'))
+   failed = failed or not ok
+
+sys.stdout.write('TEST treesign %s\n' % ('FAILED' if failed else 'PASSED'))
+sys.exit(1 if failed else 0)
@@ -34,6 +34,7 @@
 #include <Protocol/DriverBinding.h>
 #include <Protocol/ShellParameters.h>
 #include <Protocol/Tcg2Protocol.h>
+#include <Protocol/MpService.h>
 #include <Guid/FileInfo.h>
 #include <Guid/FileSystemInfo.h>
 #include <Guid/FileSystemVolumeLabelInfo.h>
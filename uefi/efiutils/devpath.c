@@ -174,6 +174,49 @@ static EFI_STATUS devpath_append(const EFI_DEVICE_PATH *Multi,
    return EFI_SUCCESS;
 }
 
+/*-- file_devpath_node_size ----------------------------------------------------
+ *
+ *      Return the size of a MEDIA_FILEPATH_DP device path node.
+ *
+ * Parameters
+ *      IN PathName: string containing a file path
+ *
+ * Results
+ *      The node size, in bytes, not including the terminating node.
+ *----------------------------------------------------------------------------*/
+static INLINE UINTN file_devpath_node_size(const CHAR16 *PathName)
+{
+   return sizeof (FILEPATH_DEVICE_PATH) - sizeof (CHAR16) + UCS2SIZE(PathName);
+}
+
+/*-- set_file_devpath ----------------------------------------------------------
+ *
+ *      Write a device path of type MEDIA_FILEPATH_DP, followed by an end node.
+ *
+ * Parameters
+ *      IN PathName: string containing a file path
+ *      IN FilePath: where to write the device path (must be large enough to
+ *                   hold the file path node, and the terminating node)
+ *----------------------------------------------------------------------------*/
+static void set_file_devpath(const CHAR16 *PathName,
+                             FILEPATH_DEVICE_PATH *FilePath)
+{
+   UINTN                   Size;
+   EFI_DEVICE_PATH         *Eop;
+
+   Size = file_devpath_node_size(PathName);
+
+   FilePath->Header.Type = MEDIA_DEVICE_PATH;
+   FilePath->Header.SubType = MEDIA_FILEPATH_DP;
+   SetDevPathNodeLength(&FilePath->Header, Size);
+   ucs2_strcpy(FilePath->PathName, PathName);
+
+   Eop = NextDevPathNode(&FilePath->Header);
+   Eop->Type = END_DEVICE_PATH_TYPE;
+   Eop->SubType = END_ENTIRE_DEVICE_PATH_SUBTYPE;
+   SetDevPathNodeLength(Eop, sizeof (EFI_DEVICE_PATH));
+}
+
 /*-- make_file_devpath ---------------------------------------------------------
  *
  *      Convert a file path string to a device path of type MEDIA_FILEPATH_DP.
@@ -190,27 +233,15 @@ static EFI_STATUS devpath_append(const EFI_DEVICE_PATH *Multi,
 static EFI_STATUS make_file_devpath(const CHAR16 *PathName,
                                     EFI_DEVICE_PATH **DevPath)
 {
-   UINTN                   Size;
    FILEPATH_DEVICE_PATH    *FilePath;
-   EFI_DEVICE_PATH         *Eop;
-
-   Size = sizeof (FilePath->Header) + UCS2SIZE(PathName);
 
-   FilePath = sys_malloc(Size + sizeof (EFI_DEVICE_PATH));
+   FilePath = sys_malloc(file_devpath_node_size(PathName) +
+                         sizeof (EFI_DEVICE_PATH));
    if (FilePath == NULL) {
       return EFI_OUT_OF_RESOURCES;
    }
 
-   FilePath->Header.Type = MEDIA_DEVICE_PATH;
-   FilePath->Header.SubType = MEDIA_FILEPATH_DP;
-   SetDevPathNodeLength(&FilePath->Header, Size);
-   ucs2_strcpy(FilePath->PathName, PathName);
-
-   Eop = NextDevPathNode(&FilePath->Header);
-   Eop->Type = END_DEVICE_PATH_TYPE;
-   Eop->SubType = END_ENTIRE_DEVICE_PATH_SUBTYPE;
-   SetDevPathNodeLength(Eop, sizeof (EFI_DEVICE_PATH));
-
+   set_file_devpath(PathName, FilePath);
    *DevPath = &FilePath->Header;
 
    return EFI_SUCCESS;
@@ -256,6 +287,78 @@ EFI_STATUS file_devpath(EFI_HANDLE Device, const CHAR16 *FileName,
    return Status;
 }
 
+/*-- file_devpath_buf ----------------------------------------------------------
+ *
+ *      Same as file_devpath(), but build the device path in the caller's
+ *      buffer when it fits, so that opening a file on a single-instance
+ *      device path (the common case) does not allocate any memory.
+ *
+ * Parameters
+ *      IN  Device:      handle to the device to query
+ *      IN  Filename:    file path on the device
+ *      IN  Buf:         buffer for the device path
+ *      IN  BufSize:     buffer size, in bytes
+ *      OUT FileDevPath: Buf, or the freshly allocated device path if it does
+ *                       not fit in Buf
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+EFI_STATUS file_devpath_buf(EFI_HANDLE Device, const CHAR16 *FileName,
+                            VOID *Buf, size_t BufSize,
+                            EFI_DEVICE_PATH **FileDevPath)
+{
+   EFI_DEVICE_PATH *DevPath;
+   unsigned int instances;
+   size_t prefix, size;
+   EFI_STATUS Status;
+
+   Status = devpath_get(Device, &DevPath);
+   if (EFI_ERROR(Status)) {
+      DevPath = NULL;
+      prefix = 0;
+   } else {
+      /*
+       * Walked every time: the firmware may free a device path and reuse
+       * its memory for another one, so its address is no cache key.
+       */
+      devpath_size(DevPath, &size, &instances);
+      if (instances > 1) {
+         return file_devpath(Device, FileName, FileDevPath);
+      }
+      prefix = size - sizeof (EFI_DEVICE_PATH);
+   }
+
+   if (prefix + file_devpath_node_size(FileName) + sizeof (EFI_DEVICE_PATH) >
+       BufSize) {
+      return file_devpath(Device, FileName, FileDevPath);
+   }
+
+   if (prefix > 0) {
+      memcpy(Buf, DevPath, prefix);
+   }
+   set_file_devpath(FileName, (FILEPATH_DEVICE_PATH *)((char *)Buf + prefix));
+   *FileDevPath = Buf;
+
+   return EFI_SUCCESS;
+}
+
+/*-- file_devpath_free ---------------------------------------------------------
+ *
+ *      Free a device path returned by file_devpath_buf(), unless it was built
+ *      in the caller's buffer.
+ *
+ * Parameters
+ *      IN DevPath: the device path
+ *      IN Buf:     the buffer that was passed to file_devpath_buf()
+ *----------------------------------------------------------------------------*/
+void file_devpath_free(EFI_DEVICE_PATH *DevPath, const VOID *Buf)
+{
+   if ((const VOID *)DevPath != Buf) {
+      sys_free(DevPath);
+   }
+}
+
 /*-- efi_path_concat -----------------------------------------------------------
  *
  *      Concatenate two EFI file paths.
@@ -5,11 +5,358 @@
 
 /*
  * disk.c -- Raw disk access
+ *
+ *   Reads go through the Block I/O protocol. Optionally, when the boot disk is
+ *   an NVMe namespace, they are sent as NVMe Read commands through the NVM
+ *   Express Pass Thru protocol instead: many firmware NVMe drivers split Block
+ *   I/O requests into small transfers and issue them one at a time, while
+ *   pass-through commands can be as large as the controller allows (MDTS),
+ *   and several of them can be in flight when the driver supports
+ *   non-blocking I/O. Block I/O is used whenever pass-through is unavailable
+ *   or fails.
  */
 
+#include <string.h>
 #include <boot_services.h>
 
 #include "efi_private.h"
+#include "NvmExpressPassthru.h"
+
+#define NVME_OPC_READ          0x02      /* NVM command set Read */
+#define NVME_OPC_IDENTIFY      0x06      /* Admin Identify */
+#define NVME_CNS_CONTROLLER    1         /* Identify Controller data */
+#define NVME_IDENTIFY_SIZE     4096      /* Identify data size */
+#define NVME_IDENTIFY_MDTS     77        /* Maximum Data Transfer Size offset */
+#define NVME_MAX_BLOCKS        0x10000   /* Blocks per command (16-bit NLB) */
+#define NVME_MAX_TRANSFER      (4 * 1024 * 1024) /* Bytes per command */
+#define NVME_QUEUE_DEPTH       8         /* Commands in flight */
+#define NVME_TIMEOUT           (5 * 10000000ULL) /* 5 seconds (100ns units) */
+
+#define NVME_CQE_STATUS(_Cqe_) (((_Cqe_)->DW3 >> 17) & 0x7fff)
+#define NVME_CMD_LBA(_Cmd_)    (((uint64_t)(_Cmd_)->Cdw11 << 32) | \
+                                (_Cmd_)->Cdw10)
+
+#define DISK_BOUNCE_SIZE       (1024 * 1024) /* Unaligned reads bounce size */
+
+typedef struct {
+   EFI_NVM_EXPRESS_PASS_THRU_COMMAND_PACKET Packet;
+   EFI_NVM_EXPRESS_COMMAND Command;
+   EFI_NVM_EXPRESS_COMPLETION Completion;
+   EFI_EVENT Event;
+   bool busy;
+} nvme_request_t;
+
+static EFI_GUID NvmePassThruProto = EFI_NVM_EXPRESS_PASS_THRU_PROTOCOL_GUID;
+
+static bool nvme_enabled = false;
+
+static struct {
+   EFI_BLOCK_IO *Block;                      /* NULL if not set up */
+   EFI_NVM_EXPRESS_PASS_THRU_PROTOCOL *Nvme;
+   UINT32 NamespaceId;
+   UINT32 max_blocks;                        /* Blocks per Read command */
+   unsigned int depth;                       /* Commands in flight */
+   nvme_request_t requests[NVME_QUEUE_DEPTH];
+} nvme_disk;
+
+/*-- disk_set_nvme_passthru ----------------------------------------------------
+ *
+ *      Enable or disable reads through the NVM Express Pass Thru protocol.
+ *      This takes effect on the next call to get_boot_disk().
+ *
+ * Parameters
+ *      IN enable: true to use NVMe pass-through when possible
+ *----------------------------------------------------------------------------*/
+void disk_set_nvme_passthru(bool enable)
+{
+   nvme_enabled = enable;
+}
+
+/*-- nvme_close ----------------------------------------------------------------
+ *
+ *      Stop using NVMe pass-through for the boot disk.
+ *----------------------------------------------------------------------------*/
+static void nvme_close(void)
+{
+   unsigned int i;
+
+   for (i = 0; i < nvme_disk.depth; i++) {
+      bs->CloseEvent(nvme_disk.requests[i].Event);
+   }
+
+   memset(&nvme_disk, 0, sizeof (nvme_disk));
+}
+
+/*-- nvme_request_init ---------------------------------------------------------
+ *
+ *      Prepare an NVMe command packet.
+ *
+ * Parameters
+ *      IN req:    the request
+ *      IN queue:  NVME_ADMIN_QUEUE or NVME_IO_QUEUE
+ *      IN opcode: command opcode
+ *      IN buf:    data buffer
+ *      IN size:   data size, in bytes
+ *----------------------------------------------------------------------------*/
+static void nvme_request_init(nvme_request_t *req, UINT8 queue, UINT8 opcode,
+                              void *buf, UINT32 size)
+{
+   memset(&req->Command, 0, sizeof (req->Command));
+   memset(&req->Completion, 0, sizeof (req->Completion));
+   memset(&req->Packet, 0, sizeof (req->Packet));
+
+   req->Command.Cdw0.Opcode = opcode;
+   req->Command.Cdw0.FusedOperation = NORMAL_CMD;
+
+   req->Packet.CommandTimeout = NVME_TIMEOUT;
+   req->Packet.TransferBuffer = buf;
+   req->Packet.TransferLength = size;
+   req->Packet.QueueType = queue;
+   req->Packet.NvmeCmd = &req->Command;
+   req->Packet.NvmeCompletion = &req->Completion;
+}
+
+/*-- nvme_read_init ------------------------------------------------------------
+ *
+ *      Prepare an NVMe Read command packet.
+ *
+ * Parameters
+ *      IN req:    the request
+ *      IN buf:    output buffer
+ *      IN lba:    LBA of the first block to read
+ *      IN count:  number of blocks to read (at most NVME_MAX_BLOCKS)
+ *----------------------------------------------------------------------------*/
+static void nvme_read_init(nvme_request_t *req, void *buf, uint64_t lba,
+                           UINT32 count)
+{
+   nvme_request_init(req, NVME_IO_QUEUE, NVME_OPC_READ, buf,
+                     count * nvme_disk.Block->Media->BlockSize);
+
+   req->Command.Nsid = nvme_disk.NamespaceId;
+   req->Command.Cdw10 = (UINT32)lba;
+   req->Command.Cdw11 = (UINT32)(lba >> 32);
+   req->Command.Cdw12 = count - 1;
+   req->Command.Flags = CDW10_VALID | CDW11_VALID | CDW12_VALID;
+}
+
+/*-- nvme_max_blocks -----------------------------------------------------------
+ *
+ *      Get the largest number of blocks a single Read command can transfer,
+ *      from the controller MDTS (assuming the minimum 4KB memory page size).
+ *
+ * Parameters
+ *      IN BlockSize: block size, in bytes
+ *
+ * Results
+ *      The number of blocks, or 0 if the controller could not be identified.
+ *----------------------------------------------------------------------------*/
+static UINT32 nvme_max_blocks(UINT32 BlockSize)
+{
+   nvme_request_t *req = &nvme_disk.requests[0];
+   UINT32 align, max_transfer;
+   EFI_STATUS Status;
+   UINT8 *mem, *data;
+
+   align = MAX(nvme_disk.Nvme->Mode->IoAlign, 1);
+   mem = sys_malloc(NVME_IDENTIFY_SIZE + align - 1);
+   if (mem == NULL) {
+      return 0;
+   }
+   data = (UINT8 *)(((UINTN)mem + align - 1) / align * align);
+
+   nvme_request_init(req, NVME_ADMIN_QUEUE, NVME_OPC_IDENTIFY, data,
+                     NVME_IDENTIFY_SIZE);
+   req->Command.Cdw10 = NVME_CNS_CONTROLLER;
+   req->Command.Flags = CDW10_VALID;
+
+   Status = nvme_disk.Nvme->PassThru(nvme_disk.Nvme, 0, &req->Packet, NULL);
+   if (EFI_ERROR(Status) || NVME_CQE_STATUS(&req->Completion) != 0) {
+      sys_free(mem);
+      return 0;
+   }
+
+   max_transfer = NVME_MAX_TRANSFER;
+   if (data[NVME_IDENTIFY_MDTS] != 0 && data[NVME_IDENTIFY_MDTS] < 20) {
+      max_transfer = MIN(max_transfer, 4096U << data[NVME_IDENTIFY_MDTS]);
+   }
+   sys_free(mem);
+
+   return MIN(max_transfer / BlockSize, NVME_MAX_BLOCKS);
+}
+
+/*-- nvme_open -----------------------------------------------------------------
+ *
+ *      Set up NVMe pass-through for a disk, if it is an NVMe namespace.
+ *
+ * Parameters
+ *      IN Device: disk handle
+ *      IN Block:  disk Block I/O interface
+ *----------------------------------------------------------------------------*/
+static void nvme_open(EFI_HANDLE Device, EFI_BLOCK_IO *Block)
+{
+   EFI_NVM_EXPRESS_PASS_THRU_PROTOCOL *Nvme;
+   EFI_DEVICE_PATH *DevPath;
+   EFI_HANDLE Controller;
+   UINT32 NamespaceId;
+   EFI_STATUS Status;
+   unsigned int i;
+
+   if (nvme_disk.Block == Block) {
+      return;
+   }
+   if (nvme_disk.Block != NULL) {
+      nvme_close();
+   }
+
+   Status = devpath_get(Device, &DevPath);
+   if (EFI_ERROR(Status)) {
+      return;
+   }
+
+   /* DevPath is left pointing to the namespace node. */
+   Status = bs->LocateDevicePath(&NvmePassThruProto, &DevPath, &Controller);
+   if (EFI_ERROR(Status)) {
+      return;
+   }
+
+   Status = get_protocol_interface(Controller, &NvmePassThruProto,
+                                   (void **)&Nvme);
+   if (EFI_ERROR(Status) || Nvme->Mode == NULL) {
+      return;
+   }
+
+   Status = Nvme->GetNamespace(Nvme, DevPath, &NamespaceId);
+   if (EFI_ERROR(Status)) {
+      Log(LOG_DEBUG, "NVMe boot disk namespace not found: %s",
+          error_str[error_efi_to_generic(Status)]);
+      return;
+   }
+
+   nvme_disk.Nvme = Nvme;
+   nvme_disk.NamespaceId = NamespaceId;
+   nvme_disk.max_blocks = nvme_max_blocks(Block->Media->BlockSize);
+   if (nvme_disk.max_blocks == 0) {
+      memset(&nvme_disk, 0, sizeof (nvme_disk));
+      return;
+   }
+
+   nvme_disk.depth = 0;
+   if ((Nvme->Mode->Attributes &
+        EFI_NVM_EXPRESS_PASS_THRU_ATTRIBUTES_NONBLOCKIO) != 0) {
+      for (i = 0; i < NVME_QUEUE_DEPTH; i++) {
+         Status = bs->CreateEvent(0, TPL_CALLBACK, NULL, NULL,
+                                  &nvme_disk.requests[i].Event);
+         if (EFI_ERROR(Status)) {
+            break;
+         }
+         nvme_disk.depth++;
+      }
+   }
+   nvme_disk.Block = Block;
+
+   Log(LOG_DEBUG, "NVMe pass-through: namespace %u, %u blocks per read, "
+       "%u in flight", NamespaceId, nvme_disk.max_blocks,
+       MAX(nvme_disk.depth, 1));
+}
+
+/*-- nvme_read -----------------------------------------------------------------
+ *
+ *      Read raw blocks from the boot disk with NVMe Read commands. With
+ *      non-blocking I/O, up to nvme_disk.depth commands are kept in flight.
+ *      Once a command fails, no new command is sent, and the commands in
+ *      flight are waited for.
+ *
+ * Parameters
+ *      IN buf:   pointer to the output buffer
+ *      IN lba:   LBA of the first block to read
+ *      IN count: number of blocks to read
+ *
+ * Results
+ *      EFI_SUCCESS, EFI_UNSUPPORTED if the request cannot be sent as is, or an
+ *      UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS nvme_read(void *buf, uint64_t lba, size_t count)
+{
+   EFI_NVM_EXPRESS_PASS_THRU_PROTOCOL *Nvme = nvme_disk.Nvme;
+   EFI_BLOCK_IO_MEDIA *Media = nvme_disk.Block->Media;
+   unsigned int i, inflight;
+   EFI_STATUS Status, Error;
+   nvme_request_t *req;
+   UINT32 blocks;
+   char *p = buf;
+
+   if (lba > Media->LastBlock || count > Media->LastBlock - lba + 1) {
+      return EFI_UNSUPPORTED;
+   }
+   if (Nvme->Mode->IoAlign > 1 && (UINTN)buf % Nvme->Mode->IoAlign != 0) {
+      return EFI_UNSUPPORTED;
+   }
+
+   if (nvme_disk.depth == 0 || count <= nvme_disk.max_blocks) {
+      req = &nvme_disk.requests[0];
+      while (count > 0) {
+         blocks = (UINT32)MIN(count, nvme_disk.max_blocks);
+         nvme_read_init(req, p, lba, blocks);
+         Status = Nvme->PassThru(Nvme, nvme_disk.NamespaceId, &req->Packet,
+                                 NULL);
+         if (!EFI_ERROR(Status) && NVME_CQE_STATUS(&req->Completion) != 0) {
+            Status = EFI_DEVICE_ERROR;
+         }
+         if (EFI_ERROR(Status)) {
+            Log(LOG_WARNING, "NVMe read at LBA %"PRIu64" failed: %s", lba,
+                error_str[error_efi_to_generic(Status)]);
+            return Status;
+         }
+         p += (size_t)blocks * Media->BlockSize;
+         lba += blocks;
+         count -= blocks;
+      }
+      return EFI_SUCCESS;
+   }
+
+   Error = EFI_SUCCESS;
+   inflight = 0;
+   do {
+      for (i = 0; i < nvme_disk.depth; i++) {
+         req = &nvme_disk.requests[i];
+         if (req->busy) {
+            if (bs->CheckEvent(req->Event) != EFI_SUCCESS) {
+               continue;
+            }
+            req->busy = false;
+            inflight--;
+            if (NVME_CQE_STATUS(&req->Completion) != 0) {
+               Log(LOG_WARNING, "NVMe read at LBA %"PRIu64" failed: "
+                   "status 0x%x", NVME_CMD_LBA(&req->Command),
+                   NVME_CQE_STATUS(&req->Completion));
+               Error = EFI_DEVICE_ERROR;
+            }
+         }
+
+         if (count == 0 || EFI_ERROR(Error)) {
+            continue;
+         }
+
+         blocks = (UINT32)MIN(count, nvme_disk.max_blocks);
+         nvme_read_init(req, p, lba, blocks);
+         Status = Nvme->PassThru(Nvme, nvme_disk.NamespaceId, &req->Packet,
+                                 req->Event);
+         if (EFI_ERROR(Status)) {
+            Log(LOG_WARNING, "NVMe read at LBA %"PRIu64" not sent: %s", lba,
+                error_str[error_efi_to_generic(Status)]);
+            Error = Status;
+            continue;
+         }
+         req->busy = true;
+         inflight++;
+         p += (size_t)blocks * Media->BlockSize;
+         lba += blocks;
+         count -= blocks;
+      }
+   } while (inflight > 0 || (count > 0 && !EFI_ERROR(Error)));
+
+   return Error;
+}
 
 /*-- get_boot_disk -------------------------------------------------------------
  *
@@ -39,6 +386,12 @@ int get_boot_disk(disk_t *disk)
 
    EFI_ASSERT_FIRMWARE(Block->Media != NULL);
 
+   if (nvme_enabled) {
+      nvme_open(Volume, Block);
+   } else if (nvme_disk.Block != NULL) {
+      nvme_close();
+   }
+
    memset(disk, 0, sizeof (disk_t));
    disk->firmware_id = (uintptr_t)Block;
    disk->use_edd = TRUE;
@@ -46,14 +399,69 @@ int get_boot_disk(disk_t *disk)
    disk->heads_per_cylinder = 0;
    disk->sectors_per_track = 0;
    disk->bytes_per_sector = Block->Media->BlockSize;
+   disk->io_align = MAX(Block->Media->IoAlign, 1);
+   disk->xfer_blocks = 1;
+   if (Block->Revision >= EFI_BLOCK_IO_PROTOCOL_REVISION3 &&
+       Block->Media->OptimalTransferLengthGranularity > 0) {
+      disk->xfer_blocks = Block->Media->OptimalTransferLengthGranularity;
+   }
+   if (nvme_disk.Block == Block) {
+      disk->io_align = MAX(disk->io_align, nvme_disk.Nvme->Mode->IoAlign);
+   }
 
    return error_efi_to_generic(EFI_SUCCESS);
 }
 
+/*-- disk_read_blocks ----------------------------------------------------------
+ *
+ *      Read raw blocks from a disk using NVMe pass-through (if enabled and
+ *      available), or the Block I/O protocol, into a suitably aligned buffer.
+ *
+ * Parameters
+ *      IN disk:  pointer to the disk info structure
+ *      IN buf:   pointer to the output buffer
+ *      IN lba:   LBA of the first block to read
+ *      IN count: number of blocks to read
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS disk_read_blocks(const disk_t *disk, void *buf,
+                                   uint64_t lba, size_t count)
+{
+   EFI_BLOCK_IO *Block = (EFI_BLOCK_IO *)disk->firmware_id;
+   EFI_STATUS Status;
+
+   if (nvme_disk.Block == Block) {
+      Status = nvme_read(buf, lba, count);
+      if (!EFI_ERROR(Status)) {
+         return EFI_SUCCESS;
+      }
+      if (Status != EFI_UNSUPPORTED) {
+         Log(LOG_WARNING, "NVMe pass-through read error (%s), "
+             "falling back to Block I/O",
+             error_str[error_efi_to_generic(Status)]);
+         nvme_close();
+         nvme_enabled = false;
+      }
+   }
+
+   EFI_ASSERT_FIRMWARE(Block->ReadBlocks != NULL);
+   EFI_ASSERT_FIRMWARE(Block->Media != NULL);
+
+   return Block->ReadBlocks(Block, Block->Media->MediaId, lba,
+                            count * disk->bytes_per_sector, buf);
+}
+
 /*-- disk_read -----------------------------------------------------------------
  *
- *      Read raw blocks from a disk using the Block I/O protocol. All blocks are
- *      read, or an error is returned.
+ *      Read raw blocks from a disk. All blocks are read, or an error is
+ *      returned.
+ *
+ *      Block I/O requires buffers aligned on Media->IoAlign. If the output
+ *      buffer is not, the blocks are read through an aligned bounce buffer,
+ *      in chunks of whole optimal transfers, rather than leaving it to the
+ *      firmware (which may bounce each request in small pieces, or fail).
  *
  * Parameters
  *      IN disk:  pointer to the disk info structure
@@ -66,8 +474,10 @@ int get_boot_disk(disk_t *disk)
  *----------------------------------------------------------------------------*/
 int disk_read(const disk_t *disk, void *buf, uint64_t lba, size_t count)
 {
-   EFI_BLOCK_IO *Block = (EFI_BLOCK_IO *)disk->firmware_id;
+   size_t chunk, n, bytes;
    EFI_STATUS Status;
+   char *p, *bounce;
+   void *mem;
 
    if (count == 0) {
       return error_efi_to_generic(EFI_SUCCESS);
@@ -75,11 +485,37 @@ int disk_read(const disk_t *disk, void *buf, uint64_t lba, size_t count)
 
    EFI_ASSERT_PARAM(buf != NULL);
 
-   EFI_ASSERT_FIRMWARE(Block->ReadBlocks != NULL);
-   EFI_ASSERT_FIRMWARE(Block->Media != NULL);
+   if (disk_buffer_aligned(disk, buf)) {
+      Status = disk_read_blocks(disk, buf, lba, count);
+      return error_efi_to_generic(Status);
+   }
+
+   chunk = DISK_BOUNCE_SIZE / disk->bytes_per_sector;
+   chunk -= chunk % MAX(disk->xfer_blocks, 1);
+   chunk = MIN(MAX(chunk, MAX(disk->xfer_blocks, 1)), count);
+
+   mem = sys_malloc(chunk * disk->bytes_per_sector + disk->io_align - 1);
+   if (mem == NULL) {
+      return ERR_OUT_OF_RESOURCES;
+   }
+   bounce = (char *)(((uintptr_t)mem + disk->io_align - 1) / disk->io_align *
+                     disk->io_align);
+
+   Status = EFI_SUCCESS;
+   for (p = buf; count > 0; count -= n) {
+      n = MIN(count, chunk);
+      bytes = n * disk->bytes_per_sector;
+
+      Status = disk_read_blocks(disk, bounce, lba, n);
+      if (EFI_ERROR(Status)) {
+         break;
+      }
+      memcpy(p, bounce, bytes);
+      p += bytes;
+      lba += n;
+   }
 
-   Status = Block->ReadBlocks(Block, Block->Media->MediaId, lba,
-                              count * disk->bytes_per_sector, buf);
+   sys_free(mem);
 
    return error_efi_to_generic(Status);
 }
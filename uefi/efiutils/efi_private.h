@@ -135,6 +135,28 @@ bool tcg2_init(void);
  */
 void disable_network_controllers(void);
 
+/*
+ * snpnet.c
+ */
+typedef struct snpnet snpnet_t;
+
+EFI_STATUS snpnet_open(EFI_HANDLE Nic, const EFI_PXE_BASE_CODE_MODE *PxeMode,
+                       const EFI_IPv4_ADDRESS *PeerIp, snpnet_t **net);
+void snpnet_close(snpnet_t *net);
+EFI_STATUS snpnet_udp_send(snpnet_t *net, uint16_t sport, uint16_t dport,
+                           const void *data, size_t len);
+EFI_STATUS snpnet_udp_recv(snpnet_t *net, uint16_t dport, uint16_t *sport,
+                           const void **data, size_t *len, UINT32 timeout_ms);
+void snpnet_suspend(snpnet_t *net);
+void snpnet_resume(snpnet_t *net);
+EFI_STATUS snpnet_tcp_connect(snpnet_t *net, uint16_t port, UINT32 timeout_ms);
+EFI_STATUS snpnet_tcp_send(snpnet_t *net, const void *data, size_t len);
+EFI_STATUS snpnet_tcp_poll(snpnet_t *net, const void **data, size_t *len);
+EFI_STATUS snpnet_tcp_recv(snpnet_t *net, const void **data, size_t *len,
+                           UINT32 timeout_ms);
+bool snpnet_tcp_is_open(snpnet_t *net);
+void snpnet_tcp_close(snpnet_t *net);
+
 /*
  * runtime.c
  */
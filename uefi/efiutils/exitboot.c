@@ -585,6 +585,9 @@ int exit_boot_services(size_t desc_extra_mem, e820_range_t **mmap,
    EFI_ASSERT(bs != NULL);
    EFI_ASSERT_FIRMWARE(bs->ExitBootServices != NULL);
 
+   /* Give back the extra NICs the native HTTP client brought up. */
+   snphttp_cleanup();
+
    if ((efi_info->quirks & EFI_NET_DEV_DISABLE) != 0) {
       disable_network_controllers();
    }
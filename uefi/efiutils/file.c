@@ -8,10 +8,11 @@
  *
  * Known file (and URL) access methods:
  * 1. gPXE download protocol
- * 2. HTTP
- * 3. Simple File Protocol
- * 4. Load File Protocol (NetBoot, or re-export of HTTP)
- * 5. TFTP (PXE boot)
+ * 2. HTTP, with the bootloader's own client (PXE boot)
+ * 3. HTTP
+ * 4. Simple File Protocol
+ * 5. Load File Protocol (NetBoot, or re-export of HTTP)
+ * 6. TFTP (PXE boot)
  */
 
 #include <string.h>
@@ -26,6 +27,8 @@ typedef struct {
                            UINTN BufSize);
    EFI_STATUS (*get_size)(EFI_HANDLE Volume, const char *filepath,
                           UINTN *FileSize);
+   EFI_STATUS (*load_range)(EFI_HANDLE Volume, const char *filepath,
+                            UINT64 Offset, UINTN Size, VOID *Buffer);
    const char *name;
 } file_access_methods;
 
@@ -44,35 +47,47 @@ static EFI_STATUS unsupported(void)
 }
 
 static file_access_methods fam[] = {
-   { gpxe_file_load, (void *)unsupported, (void *)unsupported, "gpxe" },
-   { http_file_load, (void *)unsupported, http_file_get_size, "http" },
-   { simple_file_load, simple_file_save, simple_file_get_size, "simple" },
-   { load_file_load, (void *)unsupported, load_file_get_size, "load" },
-   { tftp_file_load, (void *)unsupported, tftp_file_get_size, "tftp" },
+   { gpxe_file_load, (void *)unsupported, (void *)unsupported,
+     (void *)unsupported, "gpxe" },
+   { snphttp_file_load, (void *)unsupported, snphttp_file_get_size,
+     snphttp_file_load_range, "snphttp" },
+   { http_file_load, (void *)unsupported, http_file_get_size,
+     (void *)unsupported, "http" },
+   { simple_file_load, simple_file_save, simple_file_get_size,
+     simple_file_load_range, "simple" },
+   { load_file_load, (void *)unsupported, load_file_get_size,
+     (void *)unsupported, "load" },
+   { tftp_file_load, (void *)unsupported, tftp_file_get_size,
+     (void *)unsupported, "tftp" },
 };
 
-/*-- filepath_unix_to_efi ------------------------------------------------------
+/*-- filepath_unix_to_efi_buf --------------------------------------------------
  *
  *      Convert a UNIX-style path to an equivalent EFI Path Name.
  *        - all occurrences of '/' are replaced with '\\'
  *        - the ASCII input is converted to UTF16
  *
+ *      The caller's buffer is used when the path fits in it, so that the
+ *      common case does not allocate any memory.
+ *
  * Parameters
  *      IN  unix_path: pointer to the UNIX path
- *      OUT uefi_path: pointer to the freshly allocated UEFI Path Name
+ *      IN  Buf:       buffer for the UEFI Path Name (may be NULL)
+ *      IN  BufLen:    buffer size, in characters
+ *      OUT uefi_path: Buf, or the freshly allocated UEFI Path Name if it does
+ *                     not fit in Buf
  *
  * Results
  *      EFI_SUCCESS, or an UEFI error status.
  *----------------------------------------------------------------------------*/
-EFI_STATUS filepath_unix_to_efi(const char *unix_path,
-                                CHAR16 **uefi_path)
+EFI_STATUS filepath_unix_to_efi_buf(const char *unix_path, CHAR16 *Buf,
+                                    size_t BufLen, CHAR16 **uefi_path)
 {
    CHAR16 *Path;
    int i;
    EFI_STATUS Status;
 
-   Path = NULL;
-   Status = ascii_to_ucs2(unix_path, &Path);
+   Status = ascii_to_ucs2_buf(unix_path, Buf, BufLen, &Path);
    if (EFI_ERROR(Status)) {
       return Status;
    }
@@ -88,6 +103,24 @@ EFI_STATUS filepath_unix_to_efi(const char *unix_path,
    return EFI_SUCCESS;
 }
 
+/*-- filepath_unix_to_efi ------------------------------------------------------
+ *
+ *      Convert a UNIX-style path to an equivalent EFI Path Name, in a freshly
+ *      allocated buffer. See filepath_unix_to_efi_buf().
+ *
+ * Parameters
+ *      IN  unix_path: pointer to the UNIX path
+ *      OUT uefi_path: pointer to the freshly allocated UEFI Path Name
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+EFI_STATUS filepath_unix_to_efi(const char *unix_path,
+                                CHAR16 **uefi_path)
+{
+   return filepath_unix_to_efi_buf(unix_path, NULL, 0, uefi_path);
+}
+
 /*-- firmware_file_read --------------------------------------------------------
  *
  *      Read a file.
@@ -144,6 +177,51 @@ int firmware_file_read(const char *filepath,
    return error_efi_to_generic(Status);
 }
 
+/*-- firmware_file_read_range --------------------------------------------------
+ *
+ *      Read part of a file, if the file access method allows it. This is meant
+ *      for repairing a corrupted part of a file that has just been read.
+ *
+ * Parameters
+ *      IN  filepath: absolute path to the file
+ *      IN  offset:   offset of the first byte to read
+ *      IN  size:     number of bytes to read
+ *      OUT buffer:   where to read them
+ *
+ * Results
+ *      ERR_SUCCESS, ERR_UNSUPPORTED if no file access method can read part of
+ *      the file, or a generic error status.
+ *----------------------------------------------------------------------------*/
+int firmware_file_read_range(const char *filepath, uint64_t offset,
+                             size_t size, void *buffer)
+{
+   EFI_STATUS Status;
+   EFI_HANDLE Volume;
+   unsigned try;
+
+   Status = get_boot_volume(&Volume);
+   if (EFI_ERROR(Status)) {
+      return error_efi_to_generic(Status);
+   }
+
+   Status = EFI_UNSUPPORTED;
+
+   /* Try each known file access method until one succeeds or all fail. */
+   for (try = 0; try < ARRAYSIZE(fam); try++) {
+      EFI_STATUS St;
+
+      St = fam[try].load_range(Volume, filepath, offset, size, buffer);
+      if (St != EFI_UNSUPPORTED && St != EFI_INVALID_PARAMETER) {
+         Status = St;
+      }
+      if (!EFI_ERROR(St) || St == EFI_ABORTED) {
+         break;
+      }
+   }
+
+   return error_efi_to_generic(Status);
+}
+
 /*-- last_file_read_via_http ---------------------------------------------------
  *
  *      Was the last successful file read via native UEFI http?
@@ -228,7 +306,9 @@ int firmware_image_load(const char *filepath, const char *options,
 {
    EFI_STATUS Status;
    EFI_HANDLE Volume;
-   EFI_DEVICE_PATH *ChildPath;
+   UINT64 DevPathBuf[EFI_DEVPATH_BUFLEN / sizeof (UINT64)];
+   CHAR16 PathBuf[EFI_FILEPATH_BUFLEN];
+   EFI_DEVICE_PATH *ChildPath, *FileDevPath = NULL;
    EFI_HANDLE ChildDH;
    EFI_LOADED_IMAGE *Child;
    CHAR16 *LoadOptions = NULL;
@@ -262,22 +342,29 @@ int firmware_image_load(const char *filepath, const char *options,
          goto out;
       }
    } else {
-      CHAR16 *Filepath = NULL;
-      Status = ascii_to_ucs2(filepath, &Filepath);
+      CHAR16 *Filepath;
+      Status = ascii_to_ucs2_buf(filepath, PathBuf, ARRAYSIZE(PathBuf),
+                                 &Filepath);
       if (EFI_ERROR(Status)) {
          goto out;
       }
-      Status = file_devpath(Volume, Filepath, &ChildPath);
-      sys_free(Filepath);
+      Status = file_devpath_buf(Volume, Filepath, DevPathBuf,
+                                sizeof (DevPathBuf), &FileDevPath);
+      if (Filepath != PathBuf) {
+         sys_free(Filepath);
+      }
       if (EFI_ERROR(Status)) {
          goto out;
       }
+      ChildPath = FileDevPath;
       ChildDH = Volume;
    }
 
    /* Use the form of LoadImage that takes a memory buffer */
+   /* LoadImage() makes its own copy of the device path. */
    Status = bs->LoadImage(FALSE, ImageHandle, ChildPath,
                           image, imgsize, ChildHandle);
+   file_devpath_free(FileDevPath, DevPathBuf);
    if (EFI_ERROR(Status)) {
       goto out;
    }
@@ -7,15 +7,25 @@
  * httpfile.c -- Provides access to files through the HTTP protocol
  */
 
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <arpa/inet.h>
 #include "efi_private.h"
 #include "ServiceBinding.h"
 #include "Http.h"
+#include "Dns4.h"
+#include "Dns6.h"
 
 static EFI_GUID HttpServiceBindingProto =
    EFI_HTTP_SERVICE_BINDING_PROTOCOL_GUID;
 static EFI_GUID HttpProto = EFI_HTTP_PROTOCOL_GUID;
+static EFI_GUID Dns4ServiceBindingProto =
+   EFI_DNS4_SERVICE_BINDING_PROTOCOL_GUID;
+static EFI_GUID Dns4Proto = EFI_DNS4_PROTOCOL_GUID;
+static EFI_GUID Dns6ServiceBindingProto =
+   EFI_DNS6_SERVICE_BINDING_PROTOCOL_GUID;
+static EFI_GUID Dns6Proto = EFI_DNS6_PROTOCOL_GUID;
 
 /*
  * Cached information about current or most recent HTTP transaction.
@@ -37,9 +47,52 @@ static UINT16 LocalPort;
  */
 static http_criteria_t httpCriteria = http_if_http_booted;
 
+/*
+ * Hostnames resolved so far during this boot.  Failed lookups are cached too
+ * (with address = NULL), so that a slow or unreachable DNS server stalls at
+ * most the first request to a given host.
+ */
+typedef struct dns_entry {
+   struct dns_entry *next;
+   char *hostname;
+   int ipv;
+   char *address;       // address in URL form ("a.b.c.d" or "[a:b:...]")
+} dns_entry_t;
+
+static dns_entry_t *DnsCache;
+
+/*
+ * Adaptive timeouts.  Two delays are measured on every transfer: the time from
+ * sending a request to receiving the response headers, and the interval
+ * between two successive chunks of response body.  Both are smoothed as in
+ * RFC 6298.  A request is considered stalled, and is cancelled and retried,
+ * when no data has arrived for STALL_FACTOR times the expected delay.  Until
+ * a delay has been measured, the fixed TIMEOUT_MS is used instead.
+ *
+ * STALL_MIN_MS keeps the stall timeout above the minimum TCP retransmission
+ * timeout of common firmware stacks, so that a single lost segment is left
+ * to TCP to recover.
+ */
+typedef struct {
+   bool valid;          // at least one sample
+   UINT32 srtt;         // smoothed delay, in ms
+   UINT32 rttvar;       // delay variation, in ms
+} net_delay_t;
+
+static net_delay_t ResponseDelay;
+static net_delay_t ChunkDelay;
+static volatile UINT64 NetTicks;
+static EFI_EVENT TickEvent;
+
 #define NUM_HEADERS 2
 #define TIMEOUT_MS 10000
 #define MAX_RETRIES 2
+#define TICK_MS 10
+#define STALL_FACTOR 8
+#define STALL_MIN_MS 3000
+#define DNS_RETRY_COUNT 2
+#define DNS_PIN_TIMEOUT 86400   // seconds
+#define IP_PROTO_UDP 17
 
 static const char *HttpStatusStrings[] = {
    [HTTP_STATUS_UNSUPPORTED_STATUS] = "Unknown",
@@ -315,26 +368,23 @@ EFI_STATUS make_http_child_dh(EFI_HANDLE Volume, const char *url,
    return Status;
 }
 
-/*-- get_url_hostname ----------------------------------------------------------
+/*-- get_url_host --------------------------------------------------------------
  *
- *      Get the hostname from a URL.
+ *      Locate the host part of a URL.
  *
  * Parameters
  *      IN  url:      URL
- *      OUT hostname: freshly allocated hostname
+ *      OUT host:     pointer to the host part, within url
+ *      OUT len:      length of the host part
  *
  * Results
  *      EFI_SUCCESS if successful,
- *      EFI_INVALID_PARAMETER if not a URL,
- *      or an EFI error status.
+ *      EFI_INVALID_PARAMETER if not a URL.
  *----------------------------------------------------------------------------*/
-static EFI_STATUS get_url_hostname(const char *url, char **hostname)
+static EFI_STATUS get_url_host(const char *url, const char **host, size_t *len)
 {
    const char *p, *q;
-   char *h;
-   size_t len;
-
-   p = url;
+   size_t l;
 
    /* Strip scheme:// */
    q = strstr(url, "://");
@@ -346,25 +396,56 @@ static EFI_STATUS get_url_hostname(const char *url, char **hostname)
    /* Strip path */
    q = strchr(p, '/');
    if (q == NULL) {
-      len = strlen(p);
+      l = strlen(p);
    } else {
-      len = q - p;
+      l = q - p;
    }
 
    /* Strip userinfo@ */
-   q = strchr(p, '@');
-   if (q != NULL) {
-      p = q + 1;
+   q = p + l;
+   while (q > p && q[-1] != '@') {
+      q--;
    }
+   l -= q - p;
+   p = q;
 
    /* Strip :port */
-   q = strrchr(p, ']');
-   if (q == NULL) {
-      q = p;
+   q = p + l;
+   while (q > p && q[-1] != ':' && q[-1] != ']') {
+      q--;
+   }
+   if (q > p && q[-1] == ':') {
+      l = q - 1 - p;
    }
-   q = strrchr(q, ':');
-   if (q != NULL) {
-      len = q - p;
+
+   *host = p;
+   *len = l;
+   return EFI_SUCCESS;
+}
+
+/*-- get_url_hostname ----------------------------------------------------------
+ *
+ *      Get the hostname from a URL.
+ *
+ * Parameters
+ *      IN  url:      URL
+ *      OUT hostname: freshly allocated hostname
+ *
+ * Results
+ *      EFI_SUCCESS if successful,
+ *      EFI_INVALID_PARAMETER if not a URL,
+ *      or an EFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS get_url_hostname(const char *url, char **hostname)
+{
+   EFI_STATUS Status;
+   const char *p;
+   char *h;
+   size_t len;
+
+   Status = get_url_host(url, &p, &len);
+   if (EFI_ERROR(Status)) {
+      return Status;
    }
 
    h = sys_malloc(len + 1);
@@ -390,6 +471,110 @@ VOID EFIAPI http_callback(UNUSED_PARAM(EFI_EVENT Event), VOID *Context)
    *(bool *)Context = true;
 }
 
+/*-- net_tick_callback ---------------------------------------------------------
+ *
+ *      Periodic timer callback, advancing the network timing clock.
+ *
+ * Parameters
+ *      IN  Event:    Event that was notified
+ *      IN  Context:  Context parameter
+ *----------------------------------------------------------------------------*/
+static VOID EFIAPI net_tick_callback(UNUSED_PARAM(EFI_EVENT Event),
+                                     UNUSED_PARAM(VOID *Context))
+{
+   NetTicks++;
+}
+
+/*-- net_clock_start -----------------------------------------------------------
+ *
+ *      Start the network timing clock.  The periodic timer behind it is only
+ *      kept for the duration of a transfer, so that it can't fire once this
+ *      image has exited.  If it can't be created, the clock does not advance:
+ *      all measured delays are then 0 and stall detection never triggers.
+ *----------------------------------------------------------------------------*/
+static void net_clock_start(void)
+{
+   EFI_STATUS Status;
+
+   Status = bs->CreateEvent(EVT_TIMER | EVT_NOTIFY_SIGNAL, TPL_CALLBACK,
+                            net_tick_callback, NULL, &TickEvent);
+   if (EFI_ERROR(Status)) {
+      TickEvent = NULL;
+      return;
+   }
+   bs->SetTimer(TickEvent, TimerPeriodic, TICK_MS * 10000);
+}
+
+/*-- net_clock_stop ------------------------------------------------------------
+ *
+ *      Stop the network timing clock.
+ *----------------------------------------------------------------------------*/
+static void net_clock_stop(void)
+{
+   if (TickEvent != NULL) {
+      bs->CloseEvent(TickEvent);
+      TickEvent = NULL;
+   }
+}
+
+/*-- net_time_ms ---------------------------------------------------------------
+ *
+ *      Read the network timing clock.
+ *
+ * Results
+ *      Monotonic time in milliseconds, with a resolution of TICK_MS.
+ *----------------------------------------------------------------------------*/
+static UINT64 net_time_ms(void)
+{
+   return NetTicks * TICK_MS;
+}
+
+/*-- net_delay_sample ----------------------------------------------------------
+ *
+ *      Account for a newly measured delay (RFC 6298, section 2).
+ *
+ * Parameters
+ *      IN  delay:  smoothed delay to update
+ *      IN  ms:     measured delay, in ms
+ *----------------------------------------------------------------------------*/
+static void net_delay_sample(net_delay_t *delay, UINT32 ms)
+{
+   UINT32 err;
+
+   if (!delay->valid) {
+      delay->srtt = ms;
+      delay->rttvar = ms / 2;
+      delay->valid = true;
+      return;
+   }
+
+   err = (delay->srtt > ms) ? delay->srtt - ms : ms - delay->srtt;
+   delay->rttvar = (3 * delay->rttvar + err) / 4;
+   delay->srtt = (7 * delay->srtt + ms) / 8;
+}
+
+/*-- net_stall_timeout ---------------------------------------------------------
+ *
+ *      Get the time after which an operation is considered stalled.
+ *
+ * Parameters
+ *      IN  delay:  smoothed delay expected for the operation
+ *
+ * Results
+ *      Timeout in ms, between STALL_MIN_MS and TIMEOUT_MS.
+ *----------------------------------------------------------------------------*/
+static UINT32 net_stall_timeout(const net_delay_t *delay)
+{
+   UINT32 timeout;
+
+   if (!delay->valid) {
+      return TIMEOUT_MS;
+   }
+
+   timeout = STALL_FACTOR * (delay->srtt + 4 * delay->rttvar);
+   return MIN(MAX(timeout, STALL_MIN_MS), TIMEOUT_MS);
+}
+
 /*-- http_init -----------------------------------------------------------------
  *
  *      Initialize for loading files via HTTP.
@@ -632,6 +817,38 @@ static const char *http_status(EFI_HTTP_STATUS_CODE code)
    }
 }
 
+/*-- http_wait -----------------------------------------------------------------
+ *
+ *      Wait for the pending Http->Request or Http->Response to complete, and
+ *      cancel it if it stalls.
+ *
+ * Parameters
+ *      IN  Token:    token of the pending operation
+ *      IN  timeout:  stall timeout, in ms
+ *      OUT elapsed:  time the operation took, in ms
+ *
+ * Results
+ *      EFI_SUCCESS, or EFI_TIMEOUT if the operation was cancelled.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS http_wait(EFI_HTTP_TOKEN *Token, UINT32 timeout,
+                            UINT32 *elapsed)
+{
+   UINT64 start;
+
+   start = net_time_ms();
+   while (!HttpDone) {
+      Http->Poll(Http);
+      if (net_time_ms() - start > timeout) {
+         Log(LOG_DEBUG, "No HTTP progress for %u ms, cancelling", timeout);
+         Http->Cancel(Http, Token);
+         return EFI_TIMEOUT;
+      }
+   }
+
+   *elapsed = (UINT32)(net_time_ms() - start);
+   return EFI_SUCCESS;
+}
+
 /*-- http_file_load_try --------------------------------------------------------
  *
  *      Try once to load a file into memory or get its length, using HTTP.
@@ -654,7 +871,8 @@ static const char *http_status(EFI_HTTP_STATUS_CODE code)
  * Results
  *      EFI_SUCCESS, or an EFI error status.  EFI_ACCESS_DENIED or
  *      EFI_CONNECTION_FIN indicates that a retry is needed because the
- *      connection was closed.
+ *      connection was closed.  EFI_TIMEOUT indicates that the transfer
+ *      stalled and was cancelled.
  *----------------------------------------------------------------------------*/
 static EFI_STATUS http_file_load_try(const CHAR16 *Url,
                                      const char *hostname,
@@ -674,6 +892,8 @@ static EFI_STATUS http_file_load_try(const CHAR16 *Url,
    uint8_t *buf = NULL;
    size_t size = (size_t)-1;
    size_t size_recd;
+   UINT32 elapsed;
+   UINT64 start;
 
    /*
     * Needed early to prep for possible "goto out" on error.
@@ -708,8 +928,9 @@ static EFI_STATUS http_file_load_try(const CHAR16 *Url,
           error_str[error_efi_to_generic(Status)]);
       goto out;
    }
-   while (!HttpDone) {
-      Http->Poll(Http);
+   Status = http_wait(&ReqToken, TIMEOUT_MS, &elapsed);
+   if (EFI_ERROR(Status)) {
+      goto out;
    }
    if (EFI_ERROR(ReqToken.Status)) {
       Status = ReqToken.Status;
@@ -737,9 +958,11 @@ static EFI_STATUS http_file_load_try(const CHAR16 *Url,
           error_str[error_efi_to_generic(Status)]);
       goto out;
    }
-   while (!HttpDone) {
-      Http->Poll(Http);
+   Status = http_wait(&RespToken, net_stall_timeout(&ResponseDelay), &elapsed);
+   if (EFI_ERROR(Status)) {
+      goto out;
    }
+   net_delay_sample(&ResponseDelay, elapsed);
    if (EFI_ERROR(RespToken.Status)) {
       if (RespToken.Status == EFI_HTTP_ERROR) {
          /*
@@ -806,6 +1029,7 @@ static EFI_STATUS http_file_load_try(const CHAR16 *Url,
     * Loop reading the body into the buffer.
     */
    size_recd = 0;
+   start = net_time_ms();
    while (size_recd < size) {
       memset(&RespMessage, 0, sizeof(RespMessage));
       RespMessage.Body = &buf[size_recd];
@@ -818,14 +1042,28 @@ static EFI_STATUS http_file_load_try(const CHAR16 *Url,
              error_str[error_efi_to_generic(Status)]);
          goto out;
       }
-      while (!HttpDone) {
-         Http->Poll(Http);
+      Status = http_wait(&RespToken, net_stall_timeout(&ChunkDelay),
+                         &elapsed);
+      if (EFI_ERROR(Status)) {
+         Log(LOG_DEBUG, "HTTP transfer stalled after %zu of %zu bytes",
+             size_recd, size);
+         goto out;
+      }
+      if (EFI_ERROR(RespToken.Status)) {
+         Status = RespToken.Status;
+         Log(LOG_ERR, "Async error from Http->Response (body): %s",
+             error_str[error_efi_to_generic(Status)]);
+         goto out;
       }
+      net_delay_sample(&ChunkDelay, elapsed);
       if (callback != NULL) {
          callback(RespMessage.BodyLength);
       }
       size_recd += RespMessage.BodyLength;
    }
+   Log(LOG_DEBUG, "HTTP: %zu bytes in %u ms (response %u ms, chunk %u ms)",
+       size, (unsigned)(net_time_ms() - start), ResponseDelay.srtt,
+       ChunkDelay.srtt);
 
  out:
    if (RespMessage.Headers != NULL) {
@@ -850,6 +1088,351 @@ static EFI_STATUS http_file_load_try(const CHAR16 *Url,
    return Status;
 }
 
+/*-- is_ip_literal -------------------------------------------------------------
+ *
+ *      Check whether the host part of a URL is a literal IP address, which
+ *      needs no name resolution.
+ *
+ * Parameters
+ *      IN  hostname: host part of a URL
+ *
+ * Results
+ *      True/false
+ *----------------------------------------------------------------------------*/
+static bool is_ip_literal(const char *hostname)
+{
+   EFI_IPv4_ADDRESS ip;
+
+   return hostname[0] == '[' || inet_pton(AF_INET, hostname, &ip) == 1;
+}
+
+/*-- dns4_resolve --------------------------------------------------------------
+ *
+ *      Resolve a hostname to an IPv4 address with the firmware's DNSv4
+ *      protocol.  The result is also pinned in the firmware's DNS cache, which
+ *      is shared with the DNS lookups done by the HTTP driver itself.
+ *
+ * Parameters
+ *      IN  NicHandle: NIC to send the query from
+ *      IN  HostName:  hostname to resolve
+ *      OUT address:   freshly allocated address, in dotted decimal notation
+ *
+ * Results
+ *      EFI_SUCCESS, or an EFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS dns4_resolve(EFI_HANDLE NicHandle, CHAR16 *HostName,
+                               char **address)
+{
+   EFI_SERVICE_BINDING_PROTOCOL *DnsServiceBinding;
+   EFI_HANDLE DnsHandle = NULL;
+   EFI_DNS4_PROTOCOL *Dns = NULL;
+   EFI_DNS4_CONFIG_DATA DnsConfigData;
+   EFI_DNS4_COMPLETION_TOKEN Token;
+   EFI_DNS4_CACHE_ENTRY CacheEntry;
+   DNS_HOST_TO_ADDR_DATA *H2A;
+   EFI_IPv4_ADDRESS *ip;
+   EFI_STATUS Status;
+   bool done = false;
+   char *a;
+
+   memset(&Token, 0, sizeof(Token));
+
+   Status = get_protocol_interface(NicHandle, &Dns4ServiceBindingProto,
+                                   (void **)&DnsServiceBinding);
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+   Status = DnsServiceBinding->CreateChild(DnsServiceBinding, &DnsHandle);
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+   Status = get_protocol_interface(DnsHandle, &Dns4Proto, (void **)&Dns);
+   if (EFI_ERROR(Status)) {
+      goto out;
+   }
+
+   /*
+    * Use the station address and DNS servers obtained from DHCP.
+    */
+   memset(&DnsConfigData, 0, sizeof(DnsConfigData));
+   DnsConfigData.UseDefaultSetting = TRUE;
+   DnsConfigData.EnableDnsCache = TRUE;
+   DnsConfigData.Protocol = IP_PROTO_UDP;
+   DnsConfigData.RetryCount = DNS_RETRY_COUNT;
+   Status = Dns->Configure(Dns, &DnsConfigData);
+   if (EFI_ERROR(Status)) {
+      goto out;
+   }
+
+   Status = bs->CreateEvent(EVT_NOTIFY_SIGNAL, TPL_CALLBACK,
+                            http_callback, &done, &Token.Event);
+   if (EFI_ERROR(Status)) {
+      goto out;
+   }
+   Status = Dns->HostNameToIp(Dns, HostName, &Token);
+   if (EFI_ERROR(Status)) {
+      goto out;
+   }
+   while (!done) {
+      Dns->Poll(Dns);
+   }
+   Status = Token.Status;
+   if (EFI_ERROR(Status)) {
+      goto out;
+   }
+
+   H2A = Token.RspData.H2AData;
+   if (H2A == NULL || H2A->IpCount == 0) {
+      Status = EFI_NOT_FOUND;
+      goto out;
+   }
+   ip = &H2A->IpList[0];
+
+   a = sys_malloc(sizeof ("255.255.255.255"));
+   if (a == NULL) {
+      Status = EFI_OUT_OF_RESOURCES;
+      goto out;
+   }
+   snprintf(a, sizeof ("255.255.255.255"), "%u.%u.%u.%u",
+            ip->Addr[0], ip->Addr[1], ip->Addr[2], ip->Addr[3]);
+   *address = a;
+
+   CacheEntry.HostName = HostName;
+   CacheEntry.IpAddress = ip;
+   CacheEntry.Timeout = DNS_PIN_TIMEOUT;
+   Dns->UpdateDnsCache(Dns, FALSE, TRUE, CacheEntry);
+
+ out:
+   if (Token.RspData.H2AData != NULL) {
+      sys_free(Token.RspData.H2AData->IpList);
+      sys_free(Token.RspData.H2AData);
+   }
+   if (Token.Event != NULL) {
+      bs->CloseEvent(Token.Event);
+   }
+   if (Dns != NULL) {
+      Dns->Configure(Dns, NULL);
+   }
+   DnsServiceBinding->DestroyChild(DnsServiceBinding, DnsHandle);
+   return Status;
+}
+
+/*-- dns6_resolve --------------------------------------------------------------
+ *
+ *      Resolve a hostname to an IPv6 address with the firmware's DNSv6
+ *      protocol.  The result is also pinned in the firmware's DNS cache, which
+ *      is shared with the DNS lookups done by the HTTP driver itself.
+ *
+ * Parameters
+ *      IN  NicHandle: NIC to send the query from
+ *      IN  HostName:  hostname to resolve
+ *      OUT address:   freshly allocated address, in URL form ("[a:b:...:h]")
+ *
+ * Results
+ *      EFI_SUCCESS, or an EFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS dns6_resolve(EFI_HANDLE NicHandle, CHAR16 *HostName,
+                               char **address)
+{
+   EFI_SERVICE_BINDING_PROTOCOL *DnsServiceBinding;
+   EFI_HANDLE DnsHandle = NULL;
+   EFI_DNS6_PROTOCOL *Dns = NULL;
+   EFI_DNS6_CONFIG_DATA DnsConfigData;
+   EFI_DNS6_COMPLETION_TOKEN Token;
+   EFI_DNS6_CACHE_ENTRY CacheEntry;
+   DNS6_HOST_TO_ADDR_DATA *H2A;
+   EFI_IPv6_ADDRESS *ip;
+   EFI_STATUS Status;
+   bool done = false;
+   uint16_t w[8];
+   unsigned i;
+   char *a;
+
+   memset(&Token, 0, sizeof(Token));
+
+   Status = get_protocol_interface(NicHandle, &Dns6ServiceBindingProto,
+                                   (void **)&DnsServiceBinding);
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+   Status = DnsServiceBinding->CreateChild(DnsServiceBinding, &DnsHandle);
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+   Status = get_protocol_interface(DnsHandle, &Dns6Proto, (void **)&Dns);
+   if (EFI_ERROR(Status)) {
+      goto out;
+   }
+
+   /*
+    * Let the IPv6 driver pick the source address, and use the DNS servers
+    * obtained from DHCPv6.
+    */
+   memset(&DnsConfigData, 0, sizeof(DnsConfigData));
+   DnsConfigData.EnableDnsCache = TRUE;
+   DnsConfigData.Protocol = IP_PROTO_UDP;
+   DnsConfigData.RetryCount = DNS_RETRY_COUNT;
+   Status = Dns->Configure(Dns, &DnsConfigData);
+   if (EFI_ERROR(Status)) {
+      goto out;
+   }
+
+   Status = bs->CreateEvent(EVT_NOTIFY_SIGNAL, TPL_CALLBACK,
+                            http_callback, &done, &Token.Event);
+   if (EFI_ERROR(Status)) {
+      goto out;
+   }
+   Status = Dns->HostNameToIp(Dns, HostName, &Token);
+   if (EFI_ERROR(Status)) {
+      goto out;
+   }
+   while (!done) {
+      Dns->Poll(Dns);
+   }
+   Status = Token.Status;
+   if (EFI_ERROR(Status)) {
+      goto out;
+   }
+
+   H2A = Token.RspData.H2AData;
+   if (H2A == NULL || H2A->IpCount == 0) {
+      Status = EFI_NOT_FOUND;
+      goto out;
+   }
+   ip = &H2A->IpList[0];
+
+   a = sys_malloc(sizeof ("[ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff]"));
+   if (a == NULL) {
+      Status = EFI_OUT_OF_RESOURCES;
+      goto out;
+   }
+   for (i = 0; i < ARRAYSIZE(w); i++) {
+      w[i] = (ip->Addr[2 * i] << 8) | ip->Addr[2 * i + 1];
+   }
+   snprintf(a, sizeof ("[ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff]"),
+            "[%x:%x:%x:%x:%x:%x:%x:%x]",
+            w[0], w[1], w[2], w[3], w[4], w[5], w[6], w[7]);
+   *address = a;
+
+   CacheEntry.HostName = HostName;
+   CacheEntry.IpAddress = ip;
+   CacheEntry.Timeout = DNS_PIN_TIMEOUT;
+   Dns->UpdateDnsCache(Dns, FALSE, TRUE, CacheEntry);
+
+ out:
+   if (Token.RspData.H2AData != NULL) {
+      sys_free(Token.RspData.H2AData->IpList);
+      sys_free(Token.RspData.H2AData);
+   }
+   if (Token.Event != NULL) {
+      bs->CloseEvent(Token.Event);
+   }
+   if (Dns != NULL) {
+      Dns->Configure(Dns, NULL);
+   }
+   DnsServiceBinding->DestroyChild(DnsServiceBinding, DnsHandle);
+   return Status;
+}
+
+/*-- dns_lookup ----------------------------------------------------------------
+ *
+ *      Look up a hostname in the per-boot DNS cache, resolving it on a cache
+ *      miss.  Failures are cached as well: the HTTP driver then falls back to
+ *      resolving the name by itself.
+ *
+ * Parameters
+ *      IN  NicHandle: NIC to send the query from
+ *      IN  ipv:       IP version (4 or 6)
+ *      IN  hostname:  hostname to resolve
+ *
+ * Results
+ *      The address in URL form, or NULL if the hostname was not resolved.
+ *----------------------------------------------------------------------------*/
+static const char *dns_lookup(EFI_HANDLE NicHandle, int ipv,
+                              const char *hostname)
+{
+   EFI_STATUS Status;
+   CHAR16 *HostName = NULL;
+   dns_entry_t *entry;
+   char *address = NULL;
+
+   for (entry = DnsCache; entry != NULL; entry = entry->next) {
+      if (entry->ipv == ipv && strcasecmp(entry->hostname, hostname) == 0) {
+         return entry->address;
+      }
+   }
+
+   entry = sys_malloc(sizeof (dns_entry_t));
+   if (entry == NULL) {
+      return NULL;
+   }
+   entry->hostname = strdup(hostname);
+   if (entry->hostname == NULL) {
+      sys_free(entry);
+      return NULL;
+   }
+
+   Status = ascii_to_ucs2(hostname, &HostName);
+   if (!EFI_ERROR(Status)) {
+      if (ipv == 6) {
+         Status = dns6_resolve(NicHandle, HostName, &address);
+      } else {
+         Status = dns4_resolve(NicHandle, HostName, &address);
+      }
+      sys_free(HostName);
+   }
+   if (EFI_ERROR(Status)) {
+      Log(LOG_DEBUG, "Could not resolve %s: %s", hostname,
+          error_str[error_efi_to_generic(Status)]);
+   } else {
+      Log(LOG_DEBUG, "Resolved %s to %s", hostname, address);
+   }
+
+   entry->ipv = ipv;
+   entry->address = address;
+   entry->next = DnsCache;
+   DnsCache = entry;
+
+   return address;
+}
+
+/*-- url_set_host --------------------------------------------------------------
+ *
+ *      Make a copy of a URL with its host part replaced.
+ *
+ * Parameters
+ *      IN  url:     URL
+ *      IN  host:    new host part
+ *      OUT newurl:  freshly allocated URL
+ *
+ * Results
+ *      EFI_SUCCESS, or an EFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS url_set_host(const char *url, const char *host,
+                               char **newurl)
+{
+   EFI_STATUS Status;
+   const char *p;
+   size_t len, hlen;
+   char *u;
+
+   Status = get_url_host(url, &p, &len);
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+
+   hlen = strlen(host);
+   u = sys_malloc(strlen(url) - len + hlen + 1);
+   if (u == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+   }
+   memcpy(u, url, p - url);
+   memcpy(u + (p - url), host, hlen);
+   strcpy(u + (p - url) + hlen, p + len);
+   *newurl = u;
+   return EFI_SUCCESS;
+}
+
 /*-- http_file_load ------------------------------------------------------------
  *
  *      Load a file into memory or get its length, using HTTP.
@@ -878,6 +1461,8 @@ EFI_STATUS http_file_load(EFI_HANDLE Volume, const char *filepath,
 {
    EFI_STATUS Status;
    char *hostname = NULL;
+   const char *address;
+   char *url = NULL;
    CHAR16 *Url = NULL;
    unsigned try;
    EFI_HANDLE NicHandle;
@@ -904,8 +1489,8 @@ EFI_STATUS http_file_load(EFI_HANDLE Volume, const char *filepath,
       goto out;
    }
 
-   ascii_to_ucs2(filepath, &Url);
    efi_set_watchdog_timer(WATCHDOG_DISABLE);
+   net_clock_start();
 
    Status = get_http_nic_and_ipv(Volume, &NicHandle, &ipv);
    if (EFI_ERROR(Status)) {
@@ -929,6 +1514,29 @@ EFI_STATUS http_file_load(EFI_HANDLE Volume, const char *filepath,
       }
    }
 
+   /*
+    * Resolve the hostname once per boot instead of letting the HTTP driver
+    * look it up for every request.  Plain http:// requests are sent to the
+    * resolved address, still with the original hostname in the Host header.
+    * https:// URLs must keep the hostname so that the server certificate is
+    * validated against it; they only benefit from the address being pinned
+    * in the firmware's DNS cache.
+    */
+   if (!is_ip_literal(hostname)) {
+      address = dns_lookup(NicHandle, ipv, hostname);
+      if (address != NULL && strncasecmp(filepath, "http:", 5) == 0) {
+         Status = url_set_host(filepath, address, &url);
+         if (EFI_ERROR(Status)) {
+            goto out;
+         }
+      }
+   }
+
+   Status = ascii_to_ucs2(url != NULL ? url : filepath, &Url);
+   if (EFI_ERROR(Status)) {
+      goto out;
+   }
+
    for (try = 0; try <= MAX_RETRIES; try++) {
       Status = http_init(Volume);
       if (EFI_ERROR(Status)) {
@@ -969,8 +1577,10 @@ EFI_STATUS http_file_load(EFI_HANDLE Volume, const char *filepath,
    }
 
  out:
+   net_clock_stop();
    efi_set_watchdog_timer(WATCHDOG_DEFAULT_TIMEOUT);
    sys_free(Url);
+   sys_free(url);
    sys_free(hostname);
    return Status;
 }
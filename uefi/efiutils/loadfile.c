@@ -24,6 +24,8 @@
 EFI_STATUS load_file_get_size(EFI_HANDLE Volume, const char *filepath,
                               UINTN *FileSize)
 {
+   UINT64 DevPathBuf[EFI_DEVPATH_BUFLEN / sizeof (UINT64)];
+   CHAR16 PathBuf[EFI_FILEPATH_BUFLEN];
    EFI_LOAD_FILE_INTERFACE *LoadFile;
    CHAR16 *FilePath;
    EFI_DEVICE_PATH *DevicePath;
@@ -35,13 +37,17 @@ EFI_STATUS load_file_get_size(EFI_HANDLE Volume, const char *filepath,
       return Status;
    }
 
-   Status = filepath_unix_to_efi(filepath, &FilePath);
+   Status = filepath_unix_to_efi_buf(filepath, PathBuf, ARRAYSIZE(PathBuf),
+                                     &FilePath);
    if (EFI_ERROR(Status)) {
       return Status;
    }
 
-   Status = file_devpath(Volume, FilePath, &DevicePath);
-   sys_free(FilePath);
+   Status = file_devpath_buf(Volume, FilePath, DevPathBuf, sizeof (DevPathBuf),
+                             &DevicePath);
+   if (FilePath != PathBuf) {
+      sys_free(FilePath);
+   }
    if (EFI_ERROR(Status)) {
       return Status;
    }
@@ -50,7 +56,7 @@ EFI_STATUS load_file_get_size(EFI_HANDLE Volume, const char *filepath,
    efi_set_watchdog_timer(WATCHDOG_DISABLE);
    Status = LoadFile->LoadFile(LoadFile, DevicePath, FALSE, &BufferSize, NULL);
    efi_set_watchdog_timer(WATCHDOG_DEFAULT_TIMEOUT);
-   sys_free(DevicePath);
+   file_devpath_free(DevicePath, DevPathBuf);
    if (EFI_ERROR(Status) && Status != EFI_BUFFER_TOO_SMALL) {
       return Status;
    }
@@ -81,6 +87,8 @@ EFI_STATUS load_file_load(EFI_HANDLE Volume, const char *filepath,
                           int (*callback)(size_t), VOID **Buffer,
                           UINTN *BufSize)
 {
+   UINT64 DevPathBuf[EFI_DEVPATH_BUFLEN / sizeof (UINT64)];
+   CHAR16 PathBuf[EFI_FILEPATH_BUFLEN];
    EFI_LOAD_FILE_INTERFACE *LoadFile;
    CHAR16 *FilePath;
    EFI_DEVICE_PATH *DevicePath;
@@ -94,13 +102,17 @@ EFI_STATUS load_file_load(EFI_HANDLE Volume, const char *filepath,
       return Status;
    }
 
-   Status = filepath_unix_to_efi(filepath, &FilePath);
+   Status = filepath_unix_to_efi_buf(filepath, PathBuf, ARRAYSIZE(PathBuf),
+                                     &FilePath);
    if (EFI_ERROR(Status)) {
       return Status;
    }
 
-   Status = file_devpath(Volume, FilePath, &DevicePath);
-   sys_free(FilePath);
+   Status = file_devpath_buf(Volume, FilePath, DevPathBuf, sizeof (DevPathBuf),
+                             &DevicePath);
+   if (FilePath != PathBuf) {
+      sys_free(FilePath);
+   }
    if (EFI_ERROR(Status)) {
       return Status;
    }
@@ -110,20 +122,20 @@ EFI_STATUS load_file_load(EFI_HANDLE Volume, const char *filepath,
    Status = LoadFile->LoadFile(LoadFile, DevicePath, FALSE, &Size, NULL);
    efi_set_watchdog_timer(WATCHDOG_DEFAULT_TIMEOUT);
    if (EFI_ERROR(Status)) {
-      sys_free(DevicePath);
+      file_devpath_free(DevicePath, DevPathBuf);
       return Status;
    }
 
    Data = sys_malloc((size_t)Size);
    if (Data == NULL) {
-      sys_free(DevicePath);
+      file_devpath_free(DevicePath, DevPathBuf);
       return EFI_OUT_OF_RESOURCES;
    }
 
    efi_set_watchdog_timer(WATCHDOG_DISABLE);
    Status = LoadFile->LoadFile(LoadFile, DevicePath, FALSE, &Size, Data);
    efi_set_watchdog_timer(WATCHDOG_DEFAULT_TIMEOUT);
-   sys_free(DevicePath);
+   file_devpath_free(DevicePath, DevPathBuf);
    if (EFI_ERROR(Status)) {
       sys_free(Data);
       return Status;
@@ -5,6 +5,13 @@
 
 /*
  * memory.c -- EFI-specific memory management functions
+ *
+ *   Small dynamic memory allocations come from the UEFI pool. Allocations of
+ *   at least page_alloc_threshold bytes (module and inflate buffers) are made
+ *   with AllocatePages() instead, so that they start on a page boundary, and
+ *   on a large page boundary (page_alloc_align) when they are at least that
+ *   big. Page allocations are recorded in a small table, so that sys_free()
+ *   and sys_realloc() work the same for both kinds of allocations.
  */
 
 #include <string.h>
@@ -12,10 +19,24 @@
 #include "efi_private.h"
 #include "cpu.h"
 
+#define PAGE_ALLOC_MAX          64                 /* Tracked allocations */
+#define PAGE_ALLOC_THRESHOLD    (1024 * 1024)      /* Default threshold */
+#define PAGE_ALLOC_ALIGN        (2 * 1024 * 1024)  /* Default large alignment */
+
+typedef struct {
+   VOID *ptr;                 /* Allocated memory (NULL if the entry is free) */
+   UINTN pages;               /* Number of allocated pages */
+} page_alloc_t;
+
 UINTN MapKey;
 
 static EFI_MEMORY_TYPE ImageDataType = EfiReservedMemoryType;
 
+static page_alloc_t page_allocs[PAGE_ALLOC_MAX];
+static unsigned int page_allocs_nr = 0;
+static UINTN page_alloc_threshold = PAGE_ALLOC_THRESHOLD;
+static UINTN page_alloc_align = PAGE_ALLOC_ALIGN;
+
 /*-- efi_get_memory_map --------------------------------------------------------
  *
  *      Get the EFI-specific memory map.
@@ -175,7 +196,8 @@ EFI_STATUS efi_get_memory_map(UINTN desc_extra_mem,
  *      IN  desc_extra_mem: extra size needed for each entry (in bytes)
  *      OUT e820_mmap:      pointer to the memory map (not sorted, not merged)
  *      OUT count:          number of descriptors in the memory map
- *      OUT efi_info:       EFI memory map information is filled in
+ *      OUT efi_info:       EFI memory map and system table information is
+ *                          filled in
  *
  * Results
  *      ERR_SUCCESS, or a generic error status.
@@ -218,6 +240,8 @@ int get_memory_map(size_t desc_extra_mem, e820_range_t **e820_mmap,
    efi_info->num_descs = nEntries;
    efi_info->desc_size = SizeOfDesc;
    efi_info->version = MMapVersion;
+   efi_info->systab = PTR_TO_UINT64(st);
+   efi_info->systab_size = st->Hdr.HeaderSize;
 
    for (i = 0; i < nEntries; i++) {
       base = MMap->PhysicalStart;
@@ -360,6 +384,108 @@ void free_memory_map(UNUSED_PARAM(e820_range_t *e820_mmap),
    efi_info->mmap = NULL;
 }
 
+/*-- efi_set_page_alloc --------------------------------------------------------
+ *
+ *      Set the policy for large dynamic memory allocations.
+ *
+ * Parameters
+ *      IN threshold: allocations of at least this many bytes are made with
+ *                    AllocatePages() (0 to always use the pool)
+ *      IN align:     alignment of page allocations of at least this many
+ *                    bytes (a power of 2, e.g. 2MB; smaller page allocations
+ *                    are page aligned)
+ *----------------------------------------------------------------------------*/
+void efi_set_page_alloc(UINTN threshold, UINTN align)
+{
+   EFI_ASSERT((align & (align - 1)) == 0);
+
+   page_alloc_threshold = threshold;
+   page_alloc_align = MAX(align, EFI_PAGE_SIZE);
+}
+
+/*-- page_alloc_lookup ---------------------------------------------------------
+ *
+ *      Look up a page allocation.
+ *
+ * Parameters
+ *      IN ptr: pointer to the allocated memory
+ *
+ * Results
+ *      The page allocation entry, or NULL if ptr was not allocated with
+ *      page_alloc().
+ *----------------------------------------------------------------------------*/
+static page_alloc_t *page_alloc_lookup(const VOID *ptr)
+{
+   unsigned int i;
+
+   if (page_allocs_nr == 0 || ((UINTN)ptr & EFI_PAGE_MASK) != 0) {
+      return NULL;
+   }
+
+   for (i = 0; i < PAGE_ALLOC_MAX; i++) {
+      if (page_allocs[i].ptr == ptr) {
+         return &page_allocs[i];
+      }
+   }
+
+   return NULL;
+}
+
+/*-- page_alloc ----------------------------------------------------------------
+ *
+ *      Allocate dynamic memory with AllocatePages(). The unaligned head and tail
+ *      of the allocated range are given back to the firmware.
+ *
+ * Parameters
+ *      IN size: amount of contiguous memory to allocate
+ *
+ * Results
+ *      A pointer to the allocated memory, or NULL if an error occurred, or if
+ *      the page allocations table is full.
+ *----------------------------------------------------------------------------*/
+static VOID *page_alloc(UINTN size)
+{
+   EFI_PHYSICAL_ADDRESS Base, Aligned;
+   UINTN pages, slack, head, align;
+   page_alloc_t *entry;
+   EFI_STATUS Status;
+
+   EFI_ASSERT_FIRMWARE(bs->AllocatePages != NULL);
+   EFI_ASSERT_FIRMWARE(bs->FreePages != NULL);
+
+   if (page_allocs_nr == PAGE_ALLOC_MAX) {
+      return NULL;
+   }
+
+   align = (size >= page_alloc_align) ? page_alloc_align : EFI_PAGE_SIZE;
+   pages = EFI_SIZE_TO_PAGES(size);
+   slack = EFI_SIZE_TO_PAGES(align) - 1;
+
+   Status = bs->AllocatePages(AllocateAnyPages, ImageDataType, pages + slack,
+                              &Base);
+   if (EFI_ERROR(Status)) {
+      return NULL;
+   }
+
+   Aligned = (Base + align - 1) & ~((EFI_PHYSICAL_ADDRESS)align - 1);
+   head = EFI_SIZE_TO_PAGES((UINTN)(Aligned - Base));
+   if (head > 0) {
+      bs->FreePages(Base, head);
+   }
+   if (slack > head) {
+      bs->FreePages(Aligned + EFI_PAGES_TO_SIZE(pages), slack - head);
+   }
+
+   for (entry = page_allocs; entry->ptr != NULL; entry++) {
+      ;
+   }
+   entry->ptr = (VOID *)(UINTN)Aligned;
+   entry->pages = pages;
+   page_allocs_nr++;
+
+   return entry->ptr;
+}
+
 /*-- efi_malloc ----------------------------------------------------------------
  *
  *      Allocate dynamic memory.
@@ -379,6 +505,13 @@ VOID *efi_malloc(UINTN size)
    EFI_ASSERT_FIRMWARE(bs->AllocatePool != NULL);
    EFI_ASSERT(ImageDataType < EfiMaxMemoryType);
 
+   if (page_alloc_threshold > 0 && size >= page_alloc_threshold) {
+      p = page_alloc(size);
+      if (p != NULL) {
+         return p;
+      }
+   }
+
    Status = bs->AllocatePool(ImageDataType, size, &p);
 
    return EFI_ERROR(Status) ? NULL : p;
@@ -423,8 +556,16 @@ VOID *efi_calloc(UINTN nmemb, UINTN size)
  *----------------------------------------------------------------------------*/
 VOID *efi_realloc(VOID *ptr, UINTN oldsize, UINTN newsize)
 {
+   page_alloc_t *entry;
    VOID *p = NULL;
 
+   /* Page allocations can grow up to their last page without moving. */
+   entry = page_alloc_lookup(ptr);
+   if (entry != NULL && newsize > 0 &&
+       newsize <= EFI_PAGES_TO_SIZE(entry->pages)) {
+      return ptr;
+   }
+
    if (newsize > 0) {
       p = efi_malloc(newsize);
    }
@@ -450,12 +591,22 @@ VOID *efi_realloc(VOID *ptr, UINTN oldsize, UINTN newsize)
  *----------------------------------------------------------------------------*/
 VOID efi_free(VOID *ptr)
 {
+   page_alloc_t *entry;
+
    EFI_ASSERT(bs != NULL);
    EFI_ASSERT_FIRMWARE(bs->FreePool != NULL);
    EFI_ASSERT(ImageDataType < EfiMaxMemoryType);
 
    if (ptr != NULL) {
-      bs->FreePool(ptr);
+      memprof_free(ptr);
+      entry = page_alloc_lookup(ptr);
+      if (entry != NULL) {
+         bs->FreePages((EFI_PHYSICAL_ADDRESS)(UINTN)ptr, entry->pages);
+         entry->ptr = NULL;
+         page_allocs_nr--;
+      } else {
+         bs->FreePool(ptr);
+      }
    }
 }
 
@@ -485,7 +636,12 @@ void mem_init(EFI_MEMORY_TYPE MemType)
  *----------------------------------------------------------------------------*/
 void *sys_malloc(size_t size)
 {
-   return efi_malloc((UINTN)size);
+   void *p;
+
+   p = efi_malloc((UINTN)size);
+   memprof_alloc(p, size, __builtin_return_address(0));
+
+   return p;
 }
 
 /*-- sys_realloc ---------------------------------------------------------------
@@ -502,7 +658,12 @@ void *sys_malloc(size_t size)
  *----------------------------------------------------------------------------*/
 void *sys_realloc(void *ptr, size_t oldsize, size_t newsize)
 {
-   return efi_realloc(ptr, (UINTN)oldsize, (UINTN)newsize);
+   void *p;
+
+   p = efi_realloc(ptr, (UINTN)oldsize, (UINTN)newsize);
+   memprof_realloc(p, ptr, oldsize, newsize, __builtin_return_address(0));
+
+   return p;
 }
 
 /*-- sys_free ------------------------------------------------------------------
@@ -0,0 +1,108 @@
+/*******************************************************************************
+ * Copyright (c) 2026 VMware, Inc.  All rights reserved.
+ * SPDX-License-Identifier: GPL-2.0
+ ******************************************************************************/
+
+/*
+ * mp.c -- Multi-processor dispatch
+ *
+ *   Runs a procedure on all the enabled processors at once, through the PI
+ *   MP Services protocol. The procedure runs on the Application Processors
+ *   (APs) and on the Bootstrap Processor (BSP) concurrently, so it must be
+ *   able to share its work between an unknown number of callers, e.g. by
+ *   claiming work items with atomic operations.
+ *
+ *   On the APs, the procedure must neither call any boot service nor log
+ *   anything (Log() ends up in the console protocols). It may only touch
+ *   memory that has been allocated by the BSP beforehand.
+ *
+ *   Without MP services, or when there is no enabled AP, the procedure just
+ *   runs on the BSP.
+ */
+
+#include "efi_private.h"
+
+static EFI_GUID MpServicesProto = EFI_MP_SERVICES_PROTOCOL_GUID;
+
+/*-- mp_run_all ----------------------------------------------------------------
+ *
+ *      Run a procedure on all the enabled processors, and wait for all of
+ *      them to return.
+ *
+ * Parameters
+ *      IN  Procedure: procedure to run
+ *      IN  Argument:  argument passed to the procedure
+ *      OUT Count:     if not NULL, number of processors the procedure has
+ *                     been started on, including the BSP
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status. The procedure has returned on all
+ *      the processors it was started on, in either case.
+ *----------------------------------------------------------------------------*/
+EFI_STATUS mp_run_all(EFI_AP_PROCEDURE Procedure, VOID *Argument, UINTN *Count)
+{
+   EFI_MP_SERVICES_PROTOCOL *Mp;
+   UINTN Total, Enabled, Index;
+   EFI_EVENT Event;
+   EFI_STATUS Status;
+
+   EFI_ASSERT_PARAM(Procedure != NULL);
+
+   Enabled = 1;
+
+   Status = LocateProtocol(&MpServicesProto, (void **)&Mp);
+   if (!EFI_ERROR(Status)) {
+      Status = Mp->GetNumberOfProcessors(Mp, &Total, &Enabled);
+      if (EFI_ERROR(Status)) {
+         Enabled = 1;
+      }
+   }
+
+   if (Enabled <= 1) {
+      Procedure(Argument);
+      if (Count != NULL) {
+         *Count = 1;
+      }
+      return EFI_SUCCESS;
+   }
+
+   /*
+    * Non-blocking mode, so that the BSP does its share of the work while the
+    * APs are running. The event is signaled once they have all returned.
+    */
+   Status = bs->CreateEvent(0, TPL_CALLBACK, NULL, NULL, &Event);
+   if (!EFI_ERROR(Status)) {
+      Status = Mp->StartupAllAPs(Mp, Procedure, FALSE, Event, 0, Argument,
+                                 NULL);
+      if (EFI_ERROR(Status)) {
+         bs->CloseEvent(Event);
+      }
+   }
+
+   if (EFI_ERROR(Status)) {
+      Log(LOG_DEBUG, "Cannot start the APs: %s",
+          error_str[error_efi_to_generic(Status)]);
+      Procedure(Argument);
+      if (Count != NULL) {
+         *Count = 1;
+      }
+      return EFI_SUCCESS;
+   }
+
+   Procedure(Argument);
+
+   Status = bs->WaitForEvent(1, &Event, &Index);
+   if (EFI_ERROR(Status)) {
+      /* e.g. raised TPL: the APs may still be using Argument. */
+      do {
+         Status = bs->CheckEvent(Event);
+      } while (Status == EFI_NOT_READY);
+   }
+   bs->CloseEvent(Event);
+
+   if (Count != NULL) {
+      *Count = Enabled;
+   }
+
+   return Status;
+}
@@ -70,6 +70,7 @@ static EFI_STATUS simple_file_volume_open(EFI_HANDLE Handle, EFI_FILE **Volume)
 static EFI_STATUS simple_file_open(EFI_HANDLE Volume, const char *filepath,
                                    UINT64 mode, EFI_FILE_HANDLE *File)
 {
+   CHAR16 PathBuf[EFI_FILEPATH_BUFLEN];
    CHAR16 *FilePath;
    EFI_FILE *vol = NULL, *fd;
    EFI_STATUS Status;
@@ -79,14 +80,18 @@ static EFI_STATUS simple_file_open(EFI_HANDLE Volume, const char *filepath,
       return Status;
    }
 
-   Status = filepath_unix_to_efi(filepath, &FilePath);
+   Status = filepath_unix_to_efi_buf(filepath, PathBuf, ARRAYSIZE(PathBuf),
+                                     &FilePath);
    if (EFI_ERROR(Status)) {
+      vol->Close(vol);
       return Status;
    }
 
    Status = vol->Open(vol, &fd, FilePath, mode, 0);
    vol->Close(vol);
-   sys_free(FilePath);
+   if (FilePath != PathBuf) {
+      sys_free(FilePath);
+   }
 
    if (EFI_ERROR(Status)) {
       return Status;
@@ -274,6 +279,55 @@ EFI_STATUS simple_file_load(EFI_HANDLE Volume, const char *filepath,
    return Status;
 }
 
+/*-- simple_file_load_range ----------------------------------------------------
+ *
+ *      Load part of a file into memory using the Simple File Protocol.
+ *
+ * Parameters
+ *      IN  Volume:   handle to the volume on which the file is located
+ *      IN  filepath: absolute path to the file
+ *      IN  Offset:   offset of the first byte to load
+ *      IN  Size:     number of bytes to load
+ *      OUT Buffer:   where to load them
+ *
+ * Results
+ *      EFI_SUCCESS, EFI_END_OF_FILE if the file is too short, or an UEFI error
+ *      status.
+ *----------------------------------------------------------------------------*/
+EFI_STATUS simple_file_load_range(EFI_HANDLE Volume, const char *filepath,
+                                  UINT64 Offset, UINTN Size, VOID *Buffer)
+{
+   EFI_FILE *File;
+   EFI_STATUS Status;
+   UINTN chunk_size;
+   char *Data = Buffer;
+
+   Status = simple_file_open(Volume, filepath, EFI_FILE_MODE_READ, &File);
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+
+   Status = File->SetPosition(File, Offset);
+
+   while (!EFI_ERROR(Status) && Size > 0) {
+      chunk_size = MIN(Size, SIMPLEFILE_READ_BUFSIZE);
+
+      efi_set_watchdog_timer(WATCHDOG_DISABLE);
+      Status = File->Read(File, &chunk_size, Data);
+      efi_set_watchdog_timer(WATCHDOG_DEFAULT_TIMEOUT);
+
+      if (!EFI_ERROR(Status) && chunk_size == 0) {
+         Status = EFI_END_OF_FILE;
+      }
+
+      Data += chunk_size;
+      Size -= chunk_size;
+   }
+
+   File->Close(File);
+
+   return Status;
+}
 
 /*-- simple_file_save ----------------------------------------------------------
  *
@@ -0,0 +1,1867 @@
+/*******************************************************************************
+ * Copyright (c) 2026 VMware, Inc.  All rights reserved.
+ * SPDX-License-Identifier: GPL-2.0
+ ******************************************************************************/
+
+/*
+ * snphttp.c -- HTTP/1.1 client on top of the TCP stack in snpnet.c
+ *
+ *      Many systems have no EFI_HTTP_PROTOCOL at all, and those which do often
+ *      run it with a small TCP receive window and copy the body through
+ *      several buffers. This file implements just enough of HTTP/1.1 to
+ *      download files from a plain http:// server, on IPv4 PXE boots:
+ *
+ *         - the IPv4 configuration (and DNS server) comes from the PXE DHCP
+ *           lease,
+ *         - the connection is kept alive from one file to the next, as long
+ *           as the files are on the same server,
+ *         - the body is decoded (Content-Length or chunked) and copied
+ *           straight from the received frames into the caller's buffer,
+ *         - part of a file can be loaded again with a Range request,
+ *         - large files can be spread across other NICs on the boot subnet,
+ *           each loading pieces of the file with Range requests at once.
+ *
+ *      https:// URLs, IPv6 and HTTP booted systems still need the firmware
+ *      HTTP client (httpfile.c).
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+#include "efi_private.h"
+#include "Protocol/SimpleNetwork.h"
+#include "ServiceBinding.h"
+#include "Dhcp4.h"
+
+#define HTTP_PORT               80
+#define HTTP_CONNECT_MS         5000
+#define HTTP_STALL_MS           10000  /* Longest silence from the server */
+#define HTTP_HEADER_MAX         8192
+#define HTTP_CHUNK_LINE_MAX     32
+
+#define MULTINIC_MAX            8            /* Extra NICs */
+#define MULTINIC_MIN_SIZE       (8 * 1024 * 1024)  /* Smallest file spread */
+#define MULTINIC_PIECE          (2 * 1024 * 1024)  /* Range request size */
+#define MULTINIC_PROBE_MS       10000        /* Longest time spent probing */
+#define MULTINIC_DHCP_SECONDS   2            /* DHCP discover/request timeout */
+
+#define DNS_PORT                53
+#define DNS_TIMEOUT_MS          1000
+#define DNS_RETRIES             3
+#define DNS_NAME_MAX            255
+#define DNS_TYPE_A              1
+#define DNS_CLASS_IN            1
+
+#define DHCP_OPT_PAD            0
+#define DHCP_OPT_DNS_SERVER     6
+#define DHCP_OPT_END            255
+
+typedef enum {
+   CHUNK_SIZE,                 /* Reading a chunk size line */
+   CHUNK_DATA,                 /* Reading chunk data */
+   CHUNK_DATA_END,             /* Reading the CRLF after chunk data */
+   CHUNK_TRAILER,              /* Reading the trailer fields */
+   CHUNK_DONE                  /* Last chunk received */
+} chunk_state_t;
+
+typedef struct {
+   /* Response header */
+   unsigned int status;
+   bool chunked;
+   bool close;
+   bool has_length;
+   size_t length;
+
+   /* Body destination */
+   uint8_t *buf;
+   size_t capacity;
+   size_t size;
+   bool allocated;
+   int (*callback)(size_t);
+
+   /* Chunked transfer coding */
+   chunk_state_t chunk_state;
+   size_t chunk_left;
+   char line[HTTP_CHUNK_LINE_MAX];
+   size_t line_len;
+} snphttp_t;
+
+typedef struct {
+   EFI_HANDLE Nic;
+   const EFI_PXE_BASE_CODE_MODE *Mode;  /* IPv4 configuration */
+   EFI_PXE_BASE_CODE_MODE *Lease;       /* Our own DHCP lease, if any */
+   EFI_SERVICE_BINDING_PROTOCOL *Dhcp4Sb;
+   EFI_HANDLE Dhcp4Handle;              /* DHCP child holding the lease */
+   EFI_DHCP4_PROTOCOL *Dhcp4;
+   bool failed;                /* Not to be used any more */
+} snphttp_nic_t;
+
+typedef struct {
+   snpnet_t *net;
+   int nic;                    /* Index in ExtraNics[], -1 for the boot NIC */
+   UINT64 offset;              /* Piece being loaded */
+   UINTN size;
+   char *hdr;                  /* Response header */
+   size_t hdr_len;
+   bool in_body;
+   snphttp_t http;
+   bool busy;                  /* A piece has been requested */
+   bool moved;                 /* Progress since the last stall check */
+   bool dead;                  /* Not to be polled any more */
+} snphttp_stream_t;
+
+/*
+ * Current criteria for using the native HTTP client, initialized to the
+ * default. The client is opt-in until it has been run on more than the QEMU
+ * test setup of tests/test_snphttp. Remember to change the usage help in
+ * mboot/config.c if changing the default here.
+ */
+static snphttp_criteria_t snphttpCriteria = snphttp_never;
+
+/*
+ * Kept-alive connection to the server of the previous file.
+ */
+static snpnet_t *HttpNet;
+static EFI_IPv4_ADDRESS HttpIp;
+static uint16_t HttpPort;
+
+/*
+ * NICs, besides the boot NIC, on the boot subnet.
+ */
+static unsigned int ExtraNicsMax = 0;
+static bool ExtraNicsProbed = false;
+static snphttp_nic_t ExtraNics[MULTINIC_MAX];
+static unsigned int ExtraNicsNr = 0;
+
+/*
+ * Last hostname resolved.
+ */
+static char *DnsName;
+static EFI_IPv4_ADDRESS DnsAddr;
+
+/*-- set_snphttp_criteria ------------------------------------------------------
+ *
+ *      Adjust the criteria for when the native HTTP client may be used.
+ *
+ *      snphttp_never = never use the native HTTP client (default).
+ *
+ *      snphttp_if_no_firmware_http = use the native HTTP client for http://
+ *      URLs, unless native UEFI HTTP is to be used (see has_http()).
+ *
+ *      snphttp_always = use the native HTTP client for http:// URLs.
+ *----------------------------------------------------------------------------*/
+void set_snphttp_criteria(snphttp_criteria_t criteria)
+{
+   Log(LOG_DEBUG, "set_snphttp_criteria: %u -> %u", snphttpCriteria,
+       criteria);
+   snphttpCriteria = criteria;
+}
+
+/*-- snphttp_parse_url ---------------------------------------------------------
+ *
+ *      Split a http:// URL into host, port and path.
+ *
+ * Parameters
+ *      IN  url:  URL
+ *      OUT host: freshly allocated hostname
+ *      OUT port: TCP port
+ *      OUT path: pointer to the absolute path, within url ("" for "/")
+ *
+ * Results
+ *      EFI_SUCCESS, EFI_UNSUPPORTED if the URL is not supported, or an UEFI
+ *      error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS snphttp_parse_url(const char *url, char **host,
+                                    uint16_t *port, const char **path)
+{
+   const char *p, *end, *colon;
+   unsigned long n;
+   char *h, *q;
+   size_t len;
+
+   if (strncasecmp(url, "http://", 7) != 0) {
+      return EFI_UNSUPPORTED;
+   }
+   p = url + 7;
+
+   end = strchr(p, '/');
+   if (end == NULL) {
+      end = p + strlen(p);
+   }
+
+   if (memchr(p, '@', end - p) != NULL || *p == '[') {
+      /* No userinfo, no IPv6 literal */
+      return EFI_UNSUPPORTED;
+   }
+
+   *port = HTTP_PORT;
+   colon = memchr(p, ':', end - p);
+   if (colon != NULL) {
+      n = strtoul(colon + 1, &q, 10);
+      if (q != end || n == 0 || n > 0xffff) {
+         return EFI_INVALID_PARAMETER;
+      }
+      *port = (uint16_t)n;
+      len = colon - p;
+   } else {
+      len = end - p;
+   }
+
+   if (len == 0 || len > DNS_NAME_MAX) {
+      return EFI_INVALID_PARAMETER;
+   }
+
+   h = sys_malloc(len + 1);
+   if (h == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+   }
+   memcpy(h, p, len);
+   h[len] = '\0';
+
+   *host = h;
+   *path = end;
+
+   return EFI_SUCCESS;
+}
+
+/*-- dhcp_dns_server -----------------------------------------------------------
+ *
+ *      Get the first DNS server from the DHCP lease.
+ *
+ * Parameters
+ *      IN  PxeMode: PXE Base Code mode data
+ *      OUT Server:  the DNS server IPv4 address
+ *
+ * Results
+ *      EFI_SUCCESS, or EFI_NOT_FOUND.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS dhcp_dns_server(const EFI_PXE_BASE_CODE_MODE *PxeMode,
+                                  EFI_IPv4_ADDRESS *Server)
+{
+   const EFI_PXE_BASE_CODE_PACKET *Packet;
+   const uint8_t *p, *optEnd;
+   uint8_t optCode, optLen;
+
+   if (!PxeMode->DhcpAckReceived) {
+      return EFI_NOT_FOUND;
+   }
+
+   /* The options go on past the DhcpOptions field, to the end of Raw. */
+   Packet = &PxeMode->DhcpAck;
+   p = Packet->Dhcpv4.DhcpOptions;
+   optEnd = Packet->Raw + sizeof (Packet->Raw);
+
+   while (p < optEnd) {
+      optCode = *p++;
+      if (optCode == DHCP_OPT_PAD) {
+         continue;
+      }
+      if (optCode == DHCP_OPT_END || p == optEnd) {
+         break;
+      }
+
+      optLen = *p++;
+      optLen = MIN(optLen, (uintptr_t)optEnd - (uintptr_t)p);
+
+      if (optCode == DHCP_OPT_DNS_SERVER && optLen >= sizeof (*Server)) {
+         memcpy(Server, p, sizeof (*Server));
+         return EFI_SUCCESS;
+      }
+
+      p += optLen;
+   }
+
+   return EFI_NOT_FOUND;
+}
+
+/*-- dns_skip_name -------------------------------------------------------------
+ *
+ *      Skip a (possibly compressed) domain name in a DNS message.
+ *
+ * Parameters
+ *      IN msg:    DNS message
+ *      IN len:    DNS message length, in bytes
+ *      IN offset: offset of the name
+ *
+ * Results
+ *      The offset following the name, or 0 if the message is malformed.
+ *----------------------------------------------------------------------------*/
+static size_t dns_skip_name(const uint8_t *msg, size_t len, size_t offset)
+{
+   while (offset < len) {
+      if (msg[offset] == 0) {
+         return offset + 1;
+      }
+      if ((msg[offset] & 0xc0) == 0xc0) {
+         return (offset + 2 <= len) ? offset + 2 : 0;
+      }
+      offset += 1 + msg[offset];
+   }
+
+   return 0;
+}
+
+/*-- dns_parse_reply -----------------------------------------------------------
+ *
+ *      Find the first IPv4 address in the reply to our DNS query.
+ *
+ * Parameters
+ *      IN  msg:  DNS message
+ *      IN  len:  DNS message length, in bytes
+ *      IN  id:   query identifier
+ *      OUT Addr: the IPv4 address
+ *
+ * Results
+ *      EFI_SUCCESS, EFI_NOT_READY if this is not the reply to our query,
+ *      or EFI_NOT_FOUND.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS dns_parse_reply(const uint8_t *msg, size_t len, uint16_t id,
+                                  EFI_IPv4_ADDRESS *Addr)
+{
+   size_t offset, rdlen;
+   unsigned int qd, an;
+   uint16_t type, class;
+
+   if (len < 12 || ((msg[0] << 8) | msg[1]) != id || (msg[2] & 0x80) == 0) {
+      return EFI_NOT_READY;
+   }
+   if ((msg[3] & 0x0f) != 0) {
+      /* RCODE */
+      return EFI_NOT_FOUND;
+   }
+
+   qd = (msg[4] << 8) | msg[5];
+   an = (msg[6] << 8) | msg[7];
+   offset = 12;
+
+   for (; qd > 0; qd--) {
+      offset = dns_skip_name(msg, len, offset);
+      if (offset == 0 || offset + 4 > len) {
+         return EFI_NOT_FOUND;
+      }
+      offset += 4;
+   }
+
+   for (; an > 0; an--) {
+      offset = dns_skip_name(msg, len, offset);
+      if (offset == 0 || offset + 10 > len) {
+         return EFI_NOT_FOUND;
+      }
+      type = (msg[offset] << 8) | msg[offset + 1];
+      class = (msg[offset + 2] << 8) | msg[offset + 3];
+      rdlen = (msg[offset + 8] << 8) | msg[offset + 9];
+      offset += 10;
+      if (offset + rdlen > len) {
+         return EFI_NOT_FOUND;
+      }
+      if (type == DNS_TYPE_A && class == DNS_CLASS_IN && rdlen == 4) {
+         memcpy(Addr, msg + offset, 4);
+         return EFI_SUCCESS;
+      }
+      offset += rdlen;
+   }
+
+   return EFI_NOT_FOUND;
+}
+
+/*-- dns_resolve ---------------------------------------------------------------
+ *
+ *      Look up the IPv4 address of a host, by sending an A query to the DNS
+ *      server of the DHCP lease. The last answer is cached.
+ *
+ * Parameters
+ *      IN  Nic:      handle of the NIC
+ *      IN  PxeMode:  PXE Base Code mode data
+ *      IN  hostname: host name
+ *      OUT Addr:     the IPv4 address
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS dns_resolve(EFI_HANDLE Nic,
+                              const EFI_PXE_BASE_CODE_MODE *PxeMode,
+                              const char *hostname, EFI_IPv4_ADDRESS *Addr)
+{
+   uint8_t query[12 + DNS_NAME_MAX + 2 + 4];
+   EFI_IPv4_ADDRESS Server;
+   const char *label, *dot;
+   const void *reply;
+   snpnet_t *net;
+   EFI_STATUS Status;
+   uint16_t id, port, sport;
+   unsigned int try;
+   size_t len, n;
+
+   if (DnsName != NULL && strcasecmp(DnsName, hostname) == 0) {
+      *Addr = DnsAddr;
+      return EFI_SUCCESS;
+   }
+
+   Status = dhcp_dns_server(PxeMode, &Server);
+   if (EFI_ERROR(Status)) {
+      Log(LOG_DEBUG, "No DNS server to resolve %s", hostname);
+      return Status;
+   }
+
+   id = (uint16_t)firmware_get_time_ms(false);
+   port = 0xc000 | (id & 0x3fff);
+
+   memset(query, 0, 12);
+   query[0] = id >> 8;
+   query[1] = id & 0xff;
+   query[2] = 0x01;             /* Recursion desired */
+   query[5] = 1;                /* One question */
+
+   len = 12;
+   for (label = hostname; *label != '\0'; label = dot + 1) {
+      dot = strchr(label, '.');
+      if (dot == NULL) {
+         dot = label + strlen(label);
+      }
+      n = dot - label;
+      if (n == 0 || n > 63 || len + 1 + n + 1 + 4 > sizeof (query)) {
+         return EFI_INVALID_PARAMETER;
+      }
+      query[len++] = (uint8_t)n;
+      memcpy(query + len, label, n);
+      len += n;
+      if (*dot == '\0') {
+         break;
+      }
+   }
+   query[len++] = 0;
+   query[len++] = 0;
+   query[len++] = DNS_TYPE_A;
+   query[len++] = 0;
+   query[len++] = DNS_CLASS_IN;
+
+   Status = snpnet_open(Nic, PxeMode, &Server, &net);
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+
+   for (try = 0; try < DNS_RETRIES; try++) {
+      Status = snpnet_udp_send(net, port, DNS_PORT, query, len);
+      if (EFI_ERROR(Status)) {
+         break;
+      }
+
+      do {
+         Status = snpnet_udp_recv(net, port, &sport, &reply, &n,
+                                  DNS_TIMEOUT_MS);
+         if (!EFI_ERROR(Status)) {
+            Status = (sport == DNS_PORT) ? dns_parse_reply(reply, n, id, Addr)
+                                         : EFI_NOT_READY;
+         }
+      } while (Status == EFI_NOT_READY);
+
+      if (Status != EFI_TIMEOUT) {
+         break;
+      }
+   }
+
+   snpnet_close(net);
+
+   if (EFI_ERROR(Status)) {
+      Log(LOG_DEBUG, "Failed to resolve %s: %s", hostname,
+          error_str[error_efi_to_generic(Status)]);
+      return Status;
+   }
+
+   sys_free(DnsName);
+   DnsName = strdup(hostname);
+   DnsAddr = *Addr;
+
+   return EFI_SUCCESS;
+}
+
+/*-- snphttp_disconnect --------------------------------------------------------
+ *
+ *      Close the kept-alive connection, if any.
+ *----------------------------------------------------------------------------*/
+static void snphttp_disconnect(void)
+{
+   if (HttpNet != NULL) {
+      snpnet_resume(HttpNet);
+      snpnet_tcp_close(HttpNet);
+      snpnet_close(HttpNet);
+      HttpNet = NULL;
+   }
+}
+
+/*-- snphttp_connect -----------------------------------------------------------
+ *
+ *      Get a connection to the server, reusing the kept-alive one if possible.
+ *
+ * Parameters
+ *      IN  Nic:     handle of the NIC
+ *      IN  PxeMode: PXE Base Code mode data
+ *      IN  Ip:      server IPv4 address
+ *      IN  port:    server TCP port
+ *      OUT reused:  whether the kept-alive connection is reused
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS snphttp_connect(EFI_HANDLE Nic,
+                                  const EFI_PXE_BASE_CODE_MODE *PxeMode,
+                                  const EFI_IPv4_ADDRESS *Ip, uint16_t port,
+                                  bool *reused)
+{
+   EFI_STATUS Status;
+
+   if (HttpNet != NULL) {
+      if (memcmp(&HttpIp, Ip, sizeof (HttpIp)) == 0 && HttpPort == port) {
+         snpnet_resume(HttpNet);
+         if (snpnet_tcp_is_open(HttpNet)) {
+            *reused = true;
+            return EFI_SUCCESS;
+         }
+      }
+      snphttp_disconnect();
+   }
+
+   *reused = false;
+
+   Status = snpnet_open(Nic, PxeMode, Ip, &HttpNet);
+   if (EFI_ERROR(Status)) {
+      HttpNet = NULL;
+      return Status;
+   }
+
+   Status = snpnet_tcp_connect(HttpNet, port, HTTP_CONNECT_MS);
+   if (EFI_ERROR(Status)) {
+      snphttp_disconnect();
+      return Status;
+   }
+
+   HttpIp = *Ip;
+   HttpPort = port;
+
+   return EFI_SUCCESS;
+}
+
+/*-- snphttp_header ------------------------------------------------------------
+ *
+ *      Parse the response status line and header fields.
+ *
+ * Parameters
+ *      IN     hdr:  response header, NUL-terminated
+ *      IN/OUT http: transfer state
+ *
+ * Results
+ *      EFI_SUCCESS, or EFI_PROTOCOL_ERROR if the header is malformed.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS snphttp_header(char *hdr, snphttp_t *http)
+{
+   char *line, *next, *value, *end;
+
+   next = strstr(hdr, "\r\n");
+   if (next == NULL || strncmp(hdr, "HTTP/1.", 7) != 0) {
+      return EFI_PROTOCOL_ERROR;
+   }
+   *next = '\0';
+
+   /* HTTP/1.0 closes the connection by default. */
+   http->close = (hdr[7] == '0');
+   http->status = (unsigned int)strtoul(hdr + 8, &end, 10);
+   if (end == hdr + 8) {
+      return EFI_PROTOCOL_ERROR;
+   }
+
+   for (line = next + 2; *line != '\0'; line = next + 2) {
+      next = strstr(line, "\r\n");
+      if (next == NULL) {
+         break;
+      }
+      *next = '\0';
+
+      value = strchr(line, ':');
+      if (value == NULL) {
+         continue;
+      }
+      *value++ = '\0';
+      while (*value == ' ' || *value == '\t') {
+         value++;
+      }
+
+      if (strcasecmp(line, "Content-Length") == 0) {
+         http->length = strtoul(value, &end, 10);
+         http->has_length = (end != value);
+      } else if (strcasecmp(line, "Transfer-Encoding") == 0) {
+         http->chunked = (strstr(value, "chunked") != NULL);
+      } else if (strcasecmp(line, "Connection") == 0) {
+         if (strcasecmp(value, "close") == 0) {
+            http->close = true;
+         } else if (strcasecmp(value, "keep-alive") == 0) {
+            http->close = false;
+         }
+      }
+   }
+
+   if (http->chunked) {
+      /* Transfer-Encoding overrides Content-Length. */
+      http->has_length = false;
+   }
+
+   return EFI_SUCCESS;
+}
+
+/*-- snphttp_body --------------------------------------------------------------
+ *
+ *      Copy body data into the destination buffer, growing it if it has been
+ *      allocated here.
+ *
+ * Parameters
+ *      IN     data: body data
+ *      IN     len:  body data length, in bytes
+ *      IN/OUT http: transfer state
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS snphttp_body(const uint8_t *data, size_t len,
+                               snphttp_t *http)
+{
+   size_t capacity;
+   uint8_t *buf;
+
+   if (len > http->capacity - http->size) {
+      if (!http->allocated) {
+         return EFI_BUFFER_TOO_SMALL;
+      }
+      capacity = MAX(2 * http->capacity, http->size + len);
+      buf = sys_realloc(http->buf, http->capacity, capacity);
+      if (buf == NULL) {
+         return EFI_OUT_OF_RESOURCES;
+      }
+      http->buf = buf;
+      http->capacity = capacity;
+   }
+
+   memcpy(http->buf + http->size, data, len);
+   http->size += len;
+
+   if (http->callback != NULL) {
+      http->callback(len);
+   }
+
+   return EFI_SUCCESS;
+}
+
+/*-- snphttp_chunked -----------------------------------------------------------
+ *
+ *      Decode body data sent with the chunked transfer coding.
+ *
+ * Parameters
+ *      IN     data: encoded body data
+ *      IN     len:  encoded body data length, in bytes
+ *      IN/OUT http: transfer state
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS snphttp_chunked(const uint8_t *data, size_t len,
+                                  snphttp_t *http)
+{
+   EFI_STATUS Status;
+   char *end;
+   size_t n;
+
+   while (len > 0 && http->chunk_state != CHUNK_DONE) {
+      if (http->chunk_state == CHUNK_DATA) {
+         n = MIN(len, http->chunk_left);
+         Status = snphttp_body(data, n, http);
+         if (EFI_ERROR(Status)) {
+            return Status;
+         }
+         data += n;
+         len -= n;
+         http->chunk_left -= n;
+         if (http->chunk_left == 0) {
+            http->chunk_state = CHUNK_DATA_END;
+         }
+         continue;
+      }
+
+      /* Line oriented states */
+      if (*data != '\n') {
+         if (*data != '\r' && http->line_len < sizeof (http->line) - 1) {
+            http->line[http->line_len++] = *data;
+         }
+         data++;
+         len--;
+         continue;
+      }
+      data++;
+      len--;
+      http->line[http->line_len] = '\0';
+
+      switch (http->chunk_state) {
+      case CHUNK_SIZE:
+         http->chunk_left = strtoul(http->line, &end, 16);
+         if (end == http->line) {
+            return EFI_PROTOCOL_ERROR;
+         }
+         http->chunk_state = (http->chunk_left > 0) ? CHUNK_DATA
+                                                    : CHUNK_TRAILER;
+         break;
+      case CHUNK_DATA_END:
+         http->chunk_state = CHUNK_SIZE;
+         break;
+      case CHUNK_TRAILER:
+         if (http->line_len == 0) {
+            http->chunk_state = CHUNK_DONE;
+         }
+         break;
+      default:
+         break;
+      }
+      http->line_len = 0;
+   }
+
+   return EFI_SUCCESS;
+}
+
+/*-- snphttp_done --------------------------------------------------------------
+ *
+ *      Check whether the whole body has been received.
+ *
+ * Parameters
+ *      IN http: transfer state
+ *
+ * Results
+ *      true if the body is complete, false otherwise.
+ *----------------------------------------------------------------------------*/
+static bool snphttp_done(const snphttp_t *http)
+{
+   if (http->chunked) {
+      return http->chunk_state == CHUNK_DONE;
+   }
+   if (http->has_length) {
+      return http->size == http->length;
+   }
+   return false;
+}
+
+/*-- snphttp_send_request ------------------------------------------------------
+ *
+ *      Send a GET or HEAD request.
+ *
+ * Parameters
+ *      IN net:    connection
+ *      IN host:   server hostname, for the Host header
+ *      IN port:   server TCP port, for the Host header
+ *      IN path:   absolute path of the file
+ *      IN offset: offset of the byte range to get
+ *      IN range:  size of the byte range to get, 0 for the whole file
+ *      IN head:   send a HEAD request instead of a GET request
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS snphttp_send_request(snpnet_t *net, const char *host,
+                                       uint16_t port, const char *path,
+                                       UINT64 offset, UINTN range, bool head)
+{
+   char hostport[8], byterange[64];
+   EFI_STATUS Status;
+   char *request;
+   int reqlen;
+
+   hostport[0] = '\0';
+   if (port != HTTP_PORT) {
+      snprintf(hostport, sizeof (hostport), ":%u", port);
+   }
+
+   byterange[0] = '\0';
+   if (range > 0) {
+      snprintf(byterange, sizeof (byterange),
+               "Range: bytes=%"PRIu64"-%"PRIu64"\r\n", offset,
+               offset + range - 1);
+   }
+
+   reqlen = asprintf(&request, "%s %s HTTP/1.1\r\n"
+                     "Host: %s%s\r\n"
+                     "%s"
+                     "Connection: keep-alive\r\n"
+                     "\r\n", head ? "HEAD" : "GET",
+                     (*path != '\0') ? path : "/", host, hostport,
+                     byterange);
+   if (reqlen < 0) {
+      return EFI_OUT_OF_RESOURCES;
+   }
+
+   Status = snpnet_tcp_send(net, request, reqlen);
+   sys_free(request);
+
+   return Status;
+}
+
+/*-- snphttp_request -----------------------------------------------------------
+ *
+ *      Send a request on the current connection, and receive the response.
+ *
+ * Parameters
+ *      IN     host:     server hostname, for the Host header
+ *      IN     port:     server TCP port, for the Host header
+ *      IN     path:     absolute path of the file
+ *      IN     offset:   offset of the byte range to get
+ *      IN     range:    size of the byte range to get, 0 for the whole file
+ *      IN     callback: routine to be called periodically while the file is
+ *                       being loaded
+ *      IN/OUT Buffer:   see snphttp_file_load(); for a byte range, *Buffer
+ *                       must be a buffer of range bytes
+ *      IN/OUT BufSize:  see snphttp_file_load()
+ *      OUT    answered: whether the server has sent anything back
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS snphttp_request(const char *host, uint16_t port,
+                                  const char *path, UINT64 offset,
+                                  UINTN range, int (*callback)(size_t),
+                                  VOID **Buffer, UINTN *BufSize,
+                                  bool *answered)
+{
+   const uint8_t *data, *body;
+   size_t len, hdr_len, n;
+   snphttp_t http;
+   char *hdr, *end;
+   unsigned int expected;
+   EFI_STATUS Status;
+
+   *answered = false;
+   hdr = NULL;
+   memset(&http, 0, sizeof (http));
+   http.callback = callback;
+   http.chunk_state = CHUNK_SIZE;
+
+   expected = (range > 0) ? 206 : 200;
+
+   Status = snphttp_send_request(HttpNet, host, port, path, offset, range,
+                                 Buffer == NULL);
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+
+   /*
+    * Receive the response header.
+    */
+   hdr = sys_malloc(HTTP_HEADER_MAX + 1);
+   if (hdr == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+   }
+
+   hdr_len = 0;
+   body = NULL;
+   len = 0;
+
+   while (body == NULL) {
+      Status = snpnet_tcp_recv(HttpNet, (const void **)&data, &len,
+                               HTTP_STALL_MS);
+      if (EFI_ERROR(Status)) {
+         goto out;
+      }
+      *answered = true;
+
+      n = MIN(len, HTTP_HEADER_MAX - hdr_len);
+      memcpy(hdr + hdr_len, data, n);
+      hdr[hdr_len + n] = '\0';
+
+      end = strstr(hdr + ((hdr_len > 3) ? hdr_len - 3 : 0), "\r\n\r\n");
+      if (end != NULL) {
+         /* The rest of the segment is body data. */
+         n = (size_t)(end + 4 - hdr) - hdr_len;
+         end[2] = '\0';
+         body = data + n;
+         len -= n;
+      } else if (hdr_len + n == HTTP_HEADER_MAX) {
+         Status = EFI_PROTOCOL_ERROR;
+         goto out;
+      } else {
+         hdr_len += n;
+      }
+   }
+
+   Status = snphttp_header(hdr, &http);
+   if (EFI_ERROR(Status)) {
+      goto out;
+   }
+
+   if (http.status != expected) {
+      Log(LOG_DEBUG, "HTTP error: %u", http.status);
+      /* Don't bother skipping the body: drop the connection instead. */
+      http.close = true;
+      Status = EFI_HTTP_ERROR;
+      goto out;
+   }
+
+   /*
+    * If just getting the file length, we are done now.
+    */
+   if (Buffer == NULL) {
+      if (!http.has_length) {
+         Log(LOG_DEBUG, "No http Content-Length header");
+         Status = EFI_PROTOCOL_ERROR;
+         http.close = true;
+         goto out;
+      }
+      *BufSize = http.length;
+      goto out;
+   }
+
+   /*
+    * Set up the destination buffer.
+    */
+   if (range > 0 && (!http.has_length || http.length != range)) {
+      Log(LOG_DEBUG, "Unexpected http byte range length");
+      Status = EFI_PROTOCOL_ERROR;
+      http.close = true;
+      goto out;
+   }
+
+   if (*Buffer != NULL) {
+      if (http.has_length && *BufSize < http.length) {
+         Log(LOG_DEBUG, "Buffer for http file too small (%zu < %zu)",
+             (size_t)*BufSize, http.length);
+         *BufSize = http.length;
+         Status = EFI_BUFFER_TOO_SMALL;
+         http.close = true;
+         goto out;
+      }
+      http.buf = *Buffer;
+      http.capacity = *BufSize;
+   } else {
+      http.capacity = http.has_length ? http.length : HTTP_HEADER_MAX;
+      http.buf = sys_malloc(MAX(http.capacity, 1));
+      if (http.buf == NULL) {
+         Status = EFI_OUT_OF_RESOURCES;
+         http.close = true;
+         goto out;
+      }
+      http.allocated = true;
+   }
+
+   /*
+    * Receive the body, straight from the frames into the buffer.
+    */
+   data = body;
+   while (!snphttp_done(&http)) {
+      if (len > 0) {
+         if (http.chunked) {
+            Status = snphttp_chunked(data, len, &http);
+         } else {
+            n = http.has_length ? MIN(len, http.length - http.size) : len;
+            Status = snphttp_body(data, n, &http);
+         }
+         if (EFI_ERROR(Status) || snphttp_done(&http)) {
+            break;
+         }
+      }
+
+      Status = snpnet_tcp_recv(HttpNet, (const void **)&data, &len,
+                               HTTP_STALL_MS);
+      if (Status == EFI_END_OF_FILE && !http.chunked && !http.has_length) {
+         /* Body delimited by the end of the connection */
+         Status = EFI_SUCCESS;
+         break;
+      }
+      if (EFI_ERROR(Status)) {
+         break;
+      }
+   }
+
+   if (EFI_ERROR(Status)) {
+      http.close = true;
+      if (http.allocated) {
+         sys_free(http.buf);
+      }
+      goto out;
+   }
+
+   *Buffer = http.buf;
+   *BufSize = http.size;
+
+ out:
+   if (EFI_ERROR(Status) || http.close || !snpnet_tcp_is_open(HttpNet)) {
+      snphttp_disconnect();
+   }
+   sys_free(hdr);
+
+   return Status;
+}
+
+/*-- snphttp_exchange ----------------------------------------------------------
+ *
+ *      Get a file, a byte range of a file, or the size of a file, from the
+ *      server, on the boot NIC. The kept-alive connection is reused if
+ *      possible.
+ *
+ * Parameters
+ *      IN     Nic:      handle of the boot NIC
+ *      IN     PxeMode:  PXE Base Code mode data
+ *      IN     Ip:       server IPv4 address
+ *      IN     host:     server hostname, for the Host header
+ *      IN     port:     server TCP port
+ *      IN     path:     absolute path of the file
+ *      IN     Offset:   offset of the byte range to get
+ *      IN     Range:    size of the byte range to get, 0 for the whole file
+ *      IN     callback: routine to be called periodically while the file is
+ *                       being loaded
+ *      IN/OUT Buffer:   see snphttp_file_load()
+ *      IN/OUT BufSize:  see snphttp_file_load()
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS snphttp_exchange(EFI_HANDLE Nic,
+                                   const EFI_PXE_BASE_CODE_MODE *PxeMode,
+                                   const EFI_IPv4_ADDRESS *Ip,
+                                   const char *host, uint16_t port,
+                                   const char *path, UINT64 Offset,
+                                   UINTN Range, int (*callback)(size_t),
+                                   VOID **Buffer, UINTN *BufSize)
+{
+   bool reused, answered;
+   EFI_STATUS Status;
+
+   Status = snphttp_connect(Nic, PxeMode, Ip, port, &reused);
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+
+   Status = snphttp_request(host, port, path, Offset, Range, callback,
+                            Buffer, BufSize, &answered);
+   if (EFI_ERROR(Status) && reused && !answered) {
+      /* The server may have closed the kept-alive connection. */
+      Log(LOG_DEBUG, "Reconnecting to %s", host);
+      Status = snphttp_connect(Nic, PxeMode, Ip, port, &reused);
+      if (!EFI_ERROR(Status)) {
+         Status = snphttp_request(host, port, path, Offset, Range, callback,
+                                  Buffer, BufSize, &answered);
+      }
+   }
+
+   return Status;
+}
+
+/*-- set_snphttp_extra_nics ----------------------------------------------------
+ *
+ *      Set how many NICs, besides the boot NIC, the native HTTP client may
+ *      spread large downloads across.
+ *
+ * Parameters
+ *      IN count: maximum number of extra NICs, 0 to only use the boot NIC
+ *----------------------------------------------------------------------------*/
+void set_snphttp_extra_nics(unsigned int count)
+{
+   ExtraNicsMax = MIN(count, MULTINIC_MAX);
+}
+
+/*-- snphttp_nic_release -------------------------------------------------------
+ *
+ *      Release the DHCP lease we got for an extra NIC, if any, and give the
+ *      NIC back to the firmware.
+ *
+ * Parameters
+ *      IN nic: the extra NIC
+ *----------------------------------------------------------------------------*/
+static void snphttp_nic_release(snphttp_nic_t *nic)
+{
+   if (nic->Dhcp4 != NULL) {
+      nic->Dhcp4->Release(nic->Dhcp4);
+      nic->Dhcp4->Stop(nic->Dhcp4);
+      nic->Dhcp4->Configure(nic->Dhcp4, NULL);
+      nic->Dhcp4 = NULL;
+   }
+   if (nic->Dhcp4Handle != NULL) {
+      nic->Dhcp4Sb->DestroyChild(nic->Dhcp4Sb, nic->Dhcp4Handle);
+      nic->Dhcp4Handle = NULL;
+   }
+   sys_free(nic->Lease);
+   nic->Lease = NULL;
+   nic->Mode = NULL;
+}
+
+/*-- snphttp_nic_dhcp ----------------------------------------------------------
+ *
+ *      Get a DHCP lease for an extra NIC. Unlike the PXE Base Code, which
+ *      retries for about a minute, a single discover and a single request are
+ *      sent, so that a NIC without a DHCP server blocks the boot for a few
+ *      seconds at most.
+ *
+ * Parameters
+ *      IN  Handle: handle of the NIC
+ *      OUT nic:    the extra NIC, holding the lease
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS snphttp_nic_dhcp(EFI_HANDLE Handle, snphttp_nic_t *nic)
+{
+   EFI_GUID Dhcp4ServiceBindingProto = EFI_DHCP4_SERVICE_BINDING_PROTOCOL_GUID;
+   EFI_GUID Dhcp4Proto = EFI_DHCP4_PROTOCOL_GUID;
+   UINT32 Timeout[1] = { MULTINIC_DHCP_SECONDS };
+   EFI_DHCP4_CONFIG_DATA Config;
+   EFI_DHCP4_MODE_DATA ModeData;
+   EFI_PXE_BASE_CODE_MODE *Lease;
+   EFI_STATUS Status;
+
+   memset(nic, 0, sizeof (*nic));
+   nic->Nic = Handle;
+
+   Status = get_protocol_interface(Handle, &Dhcp4ServiceBindingProto,
+                                   (void **)&nic->Dhcp4Sb);
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+
+   Status = nic->Dhcp4Sb->CreateChild(nic->Dhcp4Sb, &nic->Dhcp4Handle);
+   if (EFI_ERROR(Status)) {
+      nic->Dhcp4Handle = NULL;
+      return Status;
+   }
+
+   Status = get_protocol_interface(nic->Dhcp4Handle, &Dhcp4Proto,
+                                   (void **)&nic->Dhcp4);
+   if (EFI_ERROR(Status)) {
+      nic->Dhcp4 = NULL;
+      goto error;
+   }
+
+   memset(&Config, 0, sizeof (Config));
+   Config.DiscoverTryCount = 1;
+   Config.DiscoverTimeout = Timeout;
+   Config.RequestTryCount = 1;
+   Config.RequestTimeout = Timeout;
+   Status = nic->Dhcp4->Configure(nic->Dhcp4, &Config);
+   if (EFI_ERROR(Status)) {
+      goto error;
+   }
+
+   Status = nic->Dhcp4->Start(nic->Dhcp4, NULL);
+   if (EFI_ERROR(Status)) {
+      goto error;
+   }
+
+   Status = nic->Dhcp4->GetModeData(nic->Dhcp4, &ModeData);
+   if (EFI_ERROR(Status)) {
+      goto error;
+   }
+   if (ModeData.State != Dhcp4Bound) {
+      Status = EFI_NO_RESPONSE;
+      goto error;
+   }
+
+   /*
+    * snpnet only needs the address, the subnet mask and the gateway.
+    */
+   Lease = sys_malloc(sizeof (*Lease));
+   if (Lease == NULL) {
+      Status = EFI_OUT_OF_RESOURCES;
+      goto error;
+   }
+   memset(Lease, 0, sizeof (*Lease));
+   memcpy(&Lease->StationIp.v4, &ModeData.ClientAddress, 4);
+   memcpy(&Lease->SubnetMask.v4, &ModeData.SubnetMask, 4);
+   if (ModeData.RouterAddress.Addr[0] != 0) {
+      memcpy(&Lease->RouteTable[0].GwAddr.v4, &ModeData.RouterAddress, 4);
+      Lease->RouteTableEntries = 1;
+   }
+
+   nic->Lease = Lease;
+   nic->Mode = Lease;
+
+   return EFI_SUCCESS;
+
+ error:
+   snphttp_nic_release(nic);
+
+   return Status;
+}
+
+/*-- snphttp_probe_nics --------------------------------------------------------
+ *
+ *      Bring up the NICs, besides the boot NIC, that can share the downloads:
+ *      NICs that have a link, and hold a DHCP lease on the subnet of the boot
+ *      NIC. A lease already held by the PXE Base Code of a NIC (e.g. from an
+ *      earlier boot attempt of the firmware) is reused. Otherwise a short DHCP
+ *      exchange is tried, and the whole probe gives up after
+ *      MULTINIC_PROBE_MS. This is done once, at the first download large
+ *      enough to be spread. The leases we got are released by
+ *      snphttp_cleanup().
+ *
+ *      Must be called at TPL_APPLICATION: DHCP needs its timers to run.
+ *
+ * Parameters
+ *      IN Nic:     handle of the boot NIC
+ *      IN PxeMode: PXE Base Code mode data of the boot NIC
+ *----------------------------------------------------------------------------*/
+static void snphttp_probe_nics(EFI_HANDLE Nic,
+                               const EFI_PXE_BASE_CODE_MODE *PxeMode)
+{
+   EFI_GUID SimpleNetworkProto = EFI_SIMPLE_NETWORK_PROTOCOL_GUID;
+   EFI_GUID PxeBaseCodeProto = EFI_PXE_BASE_CODE_PROTOCOL_GUID;
+   EFI_SIMPLE_NETWORK *Snp, *BootSnp;
+   const uint8_t *ip, *mask, *boot_ip;
+   snphttp_nic_t *extra;
+   EFI_PXE_BASE_CODE *Pxe;
+   EFI_EVENT ProbeTimer;
+   EFI_HANDLE *Handles;
+   EFI_STATUS Status;
+   UINTN count, i;
+   unsigned int j;
+
+   if (ExtraNicsProbed) {
+      return;
+   }
+   ExtraNicsProbed = true;
+
+   Status = get_protocol_interface(Nic, &SimpleNetworkProto,
+                                   (void **)&BootSnp);
+   if (EFI_ERROR(Status)) {
+      return;
+   }
+
+   Status = LocateHandleByProtocol(&SimpleNetworkProto, &count, &Handles);
+   if (EFI_ERROR(Status)) {
+      return;
+   }
+
+   Status = bs->CreateEvent(EVT_TIMER, 0, NULL, NULL, &ProbeTimer);
+   if (EFI_ERROR(Status)) {
+      sys_free(Handles);
+      return;
+   }
+   bs->SetTimer(ProbeTimer, TimerRelative, (UINT64)MULTINIC_PROBE_MS * 10000);
+
+   boot_ip = (const uint8_t *)&PxeMode->StationIp.v4;
+   mask = (const uint8_t *)&PxeMode->SubnetMask.v4;
+
+   for (i = 0; i < count && ExtraNicsNr < ExtraNicsMax; i++) {
+      if (Handles[i] == Nic) {
+         continue;
+      }
+
+      if (bs->CheckEvent(ProbeTimer) == EFI_SUCCESS) {
+         Log(LOG_DEBUG, "Gave up probing extra NICs after %ums",
+             MULTINIC_PROBE_MS);
+         break;
+      }
+
+      Status = get_protocol_interface(Handles[i], &SimpleNetworkProto,
+                                      (void **)&Snp);
+      if (EFI_ERROR(Status) || Snp == BootSnp ||
+          memcmp(&Snp->Mode->CurrentAddress, &BootSnp->Mode->CurrentAddress,
+                 Snp->Mode->HwAddressSize) == 0) {
+         continue;
+      }
+      if (Snp->Mode->MediaPresentSupported && !Snp->Mode->MediaPresent) {
+         continue;
+      }
+
+      extra = &ExtraNics[ExtraNicsNr];
+
+      Status = get_protocol_interface(Handles[i], &PxeBaseCodeProto,
+                                      (void **)&Pxe);
+      if (!EFI_ERROR(Status) && Pxe->Mode->Started &&
+          !Pxe->Mode->UsingIpv6 && Pxe->Mode->DhcpAckReceived) {
+         memset(extra, 0, sizeof (*extra));
+         extra->Nic = Handles[i];
+         extra->Mode = Pxe->Mode;
+      } else {
+         Status = snphttp_nic_dhcp(Handles[i], extra);
+         if (EFI_ERROR(Status)) {
+            Log(LOG_DEBUG, "No DHCP lease on extra NIC %zu: %s", (size_t)i,
+                error_str[error_efi_to_generic(Status)]);
+            continue;
+         }
+      }
+
+      ip = (const uint8_t *)&extra->Mode->StationIp.v4;
+      for (j = 0; j < 4; j++) {
+         if ((ip[j] & mask[j]) != (boot_ip[j] & mask[j])) {
+            break;
+         }
+      }
+      if (j < 4) {
+         Log(LOG_DEBUG, "Extra NIC %zu is not on the boot subnet", (size_t)i);
+         snphttp_nic_release(extra);
+         continue;
+      }
+
+      ExtraNicsNr++;
+
+      Log(LOG_DEBUG, "Extra NIC %u: %u.%u.%u.%u", ExtraNicsNr, ip[0], ip[1],
+          ip[2], ip[3]);
+   }
+
+   bs->CloseEvent(ProbeTimer);
+   sys_free(Handles);
+}
+
+/*-- snphttp_cleanup -----------------------------------------------------------
+ *
+ *      Release the DHCP leases the native HTTP client got for extra NICs.
+ *      Must be called before handing the NICs over to the OS.
+ *----------------------------------------------------------------------------*/
+void snphttp_cleanup(void)
+{
+   unsigned int i;
+
+   for (i = 0; i < ExtraNicsNr; i++) {
+      snphttp_nic_release(&ExtraNics[i]);
+   }
+   ExtraNicsNr = 0;
+   ExtraNicsProbed = false;
+}
+
+/*-- snphttp_stream_start ------------------------------------------------------
+ *
+ *      Request a piece of the file on a stream.
+ *
+ * Parameters
+ *      IN     host:     server hostname, for the Host header
+ *      IN     port:     server TCP port
+ *      IN     path:     absolute path of the file
+ *      IN     buf:      the whole file buffer
+ *      IN     offset:   offset of the piece
+ *      IN     size:     size of the piece
+ *      IN     callback: routine to be called periodically while the file is
+ *                       being loaded
+ *      IN/OUT stream:   the stream
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS snphttp_stream_start(const char *host, uint16_t port,
+                                       const char *path, uint8_t *buf,
+                                       UINT64 offset, UINTN size,
+                                       int (*callback)(size_t),
+                                       snphttp_stream_t *stream)
+{
+   memset(&stream->http, 0, sizeof (stream->http));
+   stream->http.callback = callback;
+   stream->http.chunk_state = CHUNK_SIZE;
+   stream->http.buf = buf + offset;
+   stream->http.capacity = size;
+   stream->offset = offset;
+   stream->size = size;
+   stream->hdr_len = 0;
+   stream->in_body = false;
+   stream->busy = true;
+
+   return snphttp_send_request(stream->net, host, port, path, offset, size,
+                               false);
+}
+
+/*-- snphttp_stream_input ------------------------------------------------------
+ *
+ *      Process data received on a stream: the response header, then the body
+ *      of the piece, which must be sent as is (206 Partial Content with a
+ *      Content-Length).
+ *
+ * Parameters
+ *      IN     data:   received data
+ *      IN     len:    received data length, in bytes
+ *      IN/OUT stream: the stream
+ *
+ * Results
+ *      EFI_SUCCESS, EFI_UNSUPPORTED if the server did not answer with the
+ *      piece alone (e.g. it ignores Range requests), or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS snphttp_stream_input(const uint8_t *data, size_t len,
+                                       snphttp_stream_t *stream)
+{
+   EFI_STATUS Status;
+   char *end;
+   size_t n;
+
+   if (!stream->in_body) {
+      n = MIN(len, HTTP_HEADER_MAX - stream->hdr_len);
+      memcpy(stream->hdr + stream->hdr_len, data, n);
+      stream->hdr[stream->hdr_len + n] = '\0';
+
+      end = strstr(stream->hdr + ((stream->hdr_len > 3) ?
+                                  stream->hdr_len - 3 : 0), "\r\n\r\n");
+      if (end == NULL) {
+         if (stream->hdr_len + n == HTTP_HEADER_MAX) {
+            return EFI_PROTOCOL_ERROR;
+         }
+         stream->hdr_len += n;
+         return EFI_SUCCESS;
+      }
+
+      /* The rest of the segment is body data. */
+      n = (size_t)(end + 4 - stream->hdr) - stream->hdr_len;
+      end[2] = '\0';
+      data += n;
+      len -= n;
+
+      Status = snphttp_header(stream->hdr, &stream->http);
+      if (EFI_ERROR(Status)) {
+         return Status;
+      }
+      if (stream->http.status != 206 || !stream->http.has_length ||
+          stream->http.length != stream->size) {
+         Log(LOG_DEBUG, "Unexpected http byte range response: %u",
+             stream->http.status);
+         return EFI_UNSUPPORTED;
+      }
+      stream->in_body = true;
+   }
+
+   n = MIN(len, stream->http.length - stream->http.size);
+
+   return snphttp_body(data, n, &stream->http);
+}
+
+/*-- snphttp_fetch_multi -------------------------------------------------------
+ *
+ *      Load a whole file with Range requests for pieces of it, sent on the
+ *      boot NIC and on the extra NICs at once. All the connections are driven
+ *      from a single polling loop, each NIC requesting the next piece as soon
+ *      as it is done with the previous one.
+ *
+ *      An extra NIC that fails is not used any more, and its piece is
+ *      requested again on another NIC. Whatever is left when no extra NIC
+ *      remains is loaded on the boot NIC alone.
+ *
+ *      Nothing is loaded if the first response is not the requested piece: the
+ *      server does not do Range requests, and the file has to be loaded with a
+ *      single request instead.
+ *
+ * Parameters
+ *      IN     Nic:      handle of the boot NIC
+ *      IN     PxeMode:  PXE Base Code mode data of the boot NIC
+ *      IN     Ip:       server IPv4 address
+ *      IN     host:     server hostname, for the Host header
+ *      IN     port:     server TCP port
+ *      IN     path:     absolute path of the file
+ *      IN     FileSize: file size, in bytes
+ *      IN     callback: routine to be called periodically while the file is
+ *                       being loaded
+ *      IN/OUT Buffer:   see snphttp_file_load() (Buffer is not NULL)
+ *      IN/OUT BufSize:  see snphttp_file_load()
+ *
+ * Results
+ *      EFI_SUCCESS, EFI_UNSUPPORTED if no extra NIC could connect to the
+ *      server or if the server ignores Range requests, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS snphttp_fetch_multi(EFI_HANDLE Nic,
+                                      const EFI_PXE_BASE_CODE_MODE *PxeMode,
+                                      const EFI_IPv4_ADDRESS *Ip,
+                                      const char *host, uint16_t port,
+                                      const char *path, UINTN FileSize,
+                                      int (*callback)(size_t), VOID **Buffer,
+                                      UINTN *BufSize)
+{
+   snphttp_stream_t streams[1 + MULTINIC_MAX];
+   UINT64 requeue[1 + MULTINIC_MAX];
+   unsigned int nr, live, requeued, i;
+   snphttp_stream_t *stream;
+   UINT64 next, offset;
+   EFI_EVENT StallTimer;
+   const uint8_t *data;
+   EFI_STATUS Status;
+   snpnet_t *net;
+   uint8_t *buf;
+   UINTN done, size;
+   VOID *piece;
+   bool reused, ranged;
+   size_t len;
+
+   if (*Buffer != NULL) {
+      if (*BufSize < FileSize) {
+         *BufSize = FileSize;
+         return EFI_BUFFER_TOO_SMALL;
+      }
+      buf = *Buffer;
+   } else {
+      buf = sys_malloc(FileSize);
+      if (buf == NULL) {
+         return EFI_OUT_OF_RESOURCES;
+      }
+   }
+
+   Status = bs->CreateEvent(EVT_TIMER, 0, NULL, NULL, &StallTimer);
+   if (EFI_ERROR(Status)) {
+      goto free_buf;
+   }
+
+   memset(streams, 0, sizeof (streams));
+   nr = 0;
+   next = 0;
+   done = 0;
+   requeued = 0;
+
+   Status = snphttp_connect(Nic, PxeMode, Ip, port, &reused);
+   if (EFI_ERROR(Status)) {
+      goto close_timer;
+   }
+   streams[nr].net = HttpNet;
+   streams[nr].nic = -1;
+   nr++;
+
+   /* Connections are opened, and must be closed, in nested order. */
+   for (i = 0; i < ExtraNicsNr; i++) {
+      if (ExtraNics[i].failed) {
+         continue;
+      }
+
+      Status = snpnet_open(ExtraNics[i].Nic, ExtraNics[i].Mode, Ip, &net);
+      if (!EFI_ERROR(Status)) {
+         Status = snpnet_tcp_connect(net, port, HTTP_CONNECT_MS);
+         if (EFI_ERROR(Status)) {
+            snpnet_close(net);
+         }
+      }
+      if (EFI_ERROR(Status)) {
+         Log(LOG_WARNING, "Extra NIC %u disabled: %s", i + 1,
+             error_str[error_efi_to_generic(Status)]);
+         ExtraNics[i].failed = true;
+         continue;
+      }
+
+      streams[nr].net = net;
+      streams[nr].nic = (int)i;
+      nr++;
+   }
+
+   for (i = 0; i < nr; i++) {
+      streams[i].hdr = sys_malloc(HTTP_HEADER_MAX + 1);
+      if (streams[i].hdr == NULL) {
+         Status = EFI_OUT_OF_RESOURCES;
+         goto close_streams;
+      }
+   }
+
+   if (nr == 1) {
+      Status = EFI_UNSUPPORTED;
+      goto close_streams;
+   }
+
+   Log(LOG_DEBUG, "Loading %s over %u NICs", path, nr);
+
+   bs->SetTimer(StallTimer, TimerPeriodic, (UINT64)HTTP_STALL_MS * 10000);
+
+   live = nr;
+   ranged = false;
+
+   while (done < FileSize && live > 0) {
+      for (i = 0; i < nr; i++) {
+         stream = &streams[i];
+         if (stream->dead) {
+            continue;
+         }
+
+         Status = EFI_SUCCESS;
+
+         if (!stream->busy) {
+            if (requeued > 0) {
+               offset = requeue[--requeued];
+            } else if (next < FileSize) {
+               offset = next;
+               next += MIN(MULTINIC_PIECE, FileSize - next);
+            } else {
+               continue;
+            }
+            size = MIN(MULTINIC_PIECE, FileSize - offset);
+            stream->moved = true;
+            Status = snphttp_stream_start(host, port, path, buf, offset, size,
+                                          callback, stream);
+         }
+
+         if (!EFI_ERROR(Status)) {
+            Status = snpnet_tcp_poll(stream->net, (const void **)&data, &len);
+            if (!EFI_ERROR(Status) && len > 0) {
+               stream->moved = true;
+               Status = snphttp_stream_input(data, len, stream);
+               if (Status == EFI_UNSUPPORTED && !ranged) {
+                  Log(LOG_DEBUG, "No byte range support, single NIC used");
+                  goto close_streams;
+               }
+               ranged = ranged || stream->in_body;
+            }
+         }
+
+         if (!EFI_ERROR(Status) && stream->in_body &&
+             stream->http.size == stream->size) {
+            done += stream->size;
+            stream->busy = false;
+            if (stream->http.close) {
+               /* The server closes the connection: retire the stream. */
+               stream->dead = true;
+               live--;
+            }
+            continue;
+         }
+
+         if (EFI_ERROR(Status)) {
+            if (stream->nic >= 0) {
+               Log(LOG_WARNING, "Extra NIC %d disabled: %s", stream->nic + 1,
+                   error_str[error_efi_to_generic(Status)]);
+               ExtraNics[stream->nic].failed = true;
+            }
+            if (stream->busy) {
+               requeue[requeued++] = stream->offset;
+               stream->busy = false;
+            }
+            stream->dead = true;
+            live--;
+         }
+      }
+
+      if (bs->CheckEvent(StallTimer) == EFI_SUCCESS) {
+         for (i = 0; i < nr; i++) {
+            stream = &streams[i];
+            if (!stream->dead && stream->busy && !stream->moved) {
+               Log(LOG_DEBUG, "Stream %u stalled", i);
+               if (stream->nic >= 0) {
+                  ExtraNics[stream->nic].failed = true;
+               }
+               requeue[requeued++] = stream->offset;
+               stream->busy = false;
+               stream->dead = true;
+               live--;
+            }
+            stream->moved = false;
+         }
+      }
+   }
+
+   Status = EFI_SUCCESS;
+
+ close_streams:
+   for (i = nr; i-- > 1;) {
+      sys_free(streams[i].hdr);
+      snpnet_tcp_close(streams[i].net);
+      snpnet_close(streams[i].net);
+   }
+   sys_free(streams[0].hdr);
+   if (streams[0].dead || streams[0].busy) {
+      /* The connection is gone, or a response is left unread on it. */
+      snphttp_disconnect();
+   }
+
+   /*
+    * Fall back to the boot NIC alone for whatever is left.
+    */
+   while (!EFI_ERROR(Status) && requeued > 0) {
+      offset = requeue[--requeued];
+      size = MIN(MULTINIC_PIECE, FileSize - offset);
+      piece = buf + offset;
+      Status = snphttp_exchange(Nic, PxeMode, Ip, host, port, path, offset,
+                                size, callback, &piece, &size);
+   }
+   if (!EFI_ERROR(Status) && next < FileSize) {
+      size = FileSize - next;
+      piece = buf + next;
+      Status = snphttp_exchange(Nic, PxeMode, Ip, host, port, path, next,
+                                size, callback, &piece, &size);
+   }
+
+ close_timer:
+   bs->CloseEvent(StallTimer);
+
+ free_buf:
+   if (EFI_ERROR(Status)) {
+      if (*Buffer == NULL) {
+         sys_free(buf);
+      }
+      return Status;
+   }
+
+   *Buffer = buf;
+   *BufSize = FileSize;
+
+   return EFI_SUCCESS;
+}
+
+/*-- snphttp_fetch -------------------------------------------------------------
+ *
+ *      Get a file, a byte range of a file, or the size of a file, with the
+ *      native HTTP client. Large files are spread across the extra NICs, if
+ *      any.
+ *
+ * Parameters
+ *      IN     Volume:    handle to the "volume" from which to load the file.
+ *      IN     filepath:  the ASCII absolute path of the file to retrieve;
+ *                        must be a http:// URL.
+ *      IN     Offset:    offset of the byte range to get
+ *      IN     Range:     size of the byte range to get, 0 for the whole file
+ *      IN     callback:  routine to be called periodically while the file
+ *                        is being loaded.
+ *      IN/OUT Buffer:    see snphttp_file_load()
+ *      IN/OUT BufSize:   see snphttp_file_load()
+ *
+ * Results
+ *      EFI_SUCCESS, or an EFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS snphttp_fetch(EFI_HANDLE Volume, const char *filepath,
+                                UINT64 Offset, UINTN Range,
+                                int (*callback)(size_t), VOID **Buffer,
+                                UINTN *BufSize)
+{
+   EFI_PXE_BASE_CODE *Pxe;
+   EFI_IPv4_ADDRESS Ip;
+   EFI_HANDLE Nic;
+   EFI_STATUS Status;
+   const char *path;
+   UINTN FileSize;
+   char *host;
+   uint16_t port;
+
+   /*
+    * Don't log when the native client is not to be used: this is normal when
+    * firmware_file_* is looping through methods.
+    */
+   if (snphttpCriteria == snphttp_never) {
+      return EFI_UNSUPPORTED;
+   }
+
+   Status = snphttp_parse_url(filepath, &host, &port, &path);
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+
+   if (!is_pxe_boot(&Pxe) || !Pxe->Mode->Started || Pxe->Mode->UsingIpv6 ||
+       (snphttpCriteria == snphttp_if_no_firmware_http && has_http(Volume))) {
+      sys_free(host);
+      return EFI_UNSUPPORTED;
+   }
+
+   Status = get_boot_volume(&Nic);
+   if (EFI_ERROR(Status)) {
+      sys_free(host);
+      return Status;
+   }
+
+   efi_set_watchdog_timer(WATCHDOG_DISABLE);
+
+   if (inet_pton(AF_INET, host, &Ip) != 1) {
+      Status = dns_resolve(Nic, Pxe->Mode, host, &Ip);
+      if (EFI_ERROR(Status)) {
+         goto out;
+      }
+   }
+
+   if (Range == 0 && Buffer != NULL && ExtraNicsMax > 0) {
+      snphttp_probe_nics(Nic, Pxe->Mode);
+   }
+
+   Status = EFI_UNSUPPORTED;
+   if (Range == 0 && Buffer != NULL && ExtraNicsNr > 0) {
+      Status = snphttp_exchange(Nic, Pxe->Mode, &Ip, host, port, path, 0, 0,
+                                NULL, NULL, &FileSize);
+      if (!EFI_ERROR(Status)) {
+         Status = EFI_UNSUPPORTED;
+         if (FileSize >= MULTINIC_MIN_SIZE) {
+            Status = snphttp_fetch_multi(Nic, Pxe->Mode, &Ip, host, port,
+                                         path, FileSize, callback, Buffer,
+                                         BufSize);
+         }
+      } else if (Status != EFI_HTTP_ERROR) {
+         Status = EFI_UNSUPPORTED;
+      }
+   }
+
+   if (Status == EFI_UNSUPPORTED) {
+      Status = snphttp_exchange(Nic, Pxe->Mode, &Ip, host, port, path, Offset,
+                                Range, callback, Buffer, BufSize);
+   }
+
+   if (HttpNet != NULL) {
+      snpnet_suspend(HttpNet);
+   }
+
+   if (EFI_ERROR(Status) && Status != EFI_HTTP_ERROR) {
+      Log(LOG_DEBUG, "Native HTTP failed for %s: %s", filepath,
+          error_str[error_efi_to_generic(Status)]);
+   }
+
+ out:
+   efi_set_watchdog_timer(WATCHDOG_DEFAULT_TIMEOUT);
+   sys_free(host);
+
+   return Status;
+}
+
+/*-- snphttp_file_load ---------------------------------------------------------
+ *
+ *      Load a file into memory or get its length, with the native HTTP client.
+ *
+ * Parameters
+ *      IN     Volume:    handle to the "volume" from which to load the file.
+ *      IN     filepath:  the ASCII absolute path of the file to retrieve;
+ *                        must be a http:// URL.
+ *      IN     callback:  routine to be called periodically while the file
+ *                        is being loaded.
+ *      IN/OUT Buffer:    buffer where the file is loaded:
+ *                           if Buffer=NULL, just get the file's length;
+ *                           else if *Buffer=NULL, allocate a buffer;
+ *                           else use the given *Buffer (size in *BufSize).
+ *      IN/OUT BufSize:   length of Buffer, size of file:
+ *                           if Buffer=NULL, OUT only;
+ *                           else if *Buffer=NULL, OUT only;
+ *                           else IN/OUT.
+ *
+ * Results
+ *      EFI_SUCCESS, or an EFI error status.
+ *----------------------------------------------------------------------------*/
+EFI_STATUS snphttp_file_load(EFI_HANDLE Volume, const char *filepath,
+                             int (*callback)(size_t), VOID **Buffer,
+                             UINTN *BufSize)
+{
+   return snphttp_fetch(Volume, filepath, 0, 0, callback, Buffer, BufSize);
+}
+
+/*-- snphttp_file_load_range ---------------------------------------------------
+ *
+ *      Load part of a file into memory with the native HTTP client, using a
+ *      Range request.
+ *
+ * Parameters
+ *      IN  Volume:   handle to the "volume" from which to load the file.
+ *      IN  filepath: the ASCII absolute path of the file; must be a http://
+ *                    URL.
+ *      IN  Offset:   offset of the first byte to load
+ *      IN  Size:     number of bytes to load
+ *      OUT Buffer:   where to load them
+ *
+ * Results
+ *      EFI_SUCCESS, or an EFI error status.
+ *----------------------------------------------------------------------------*/
+EFI_STATUS snphttp_file_load_range(EFI_HANDLE Volume, const char *filepath,
+                                   UINT64 Offset, UINTN Size, VOID *Buffer)
+{
+   UINTN BufSize = Size;
+
+   if (Size == 0) {
+      return EFI_SUCCESS;
+   }
+
+   return snphttp_fetch(Volume, filepath, Offset, Size, NULL, &Buffer,
+                        &BufSize);
+}
+
+/*-- snphttp_file_get_size -----------------------------------------------------
+ *
+ *      Get the size of a file with the native HTTP client.
+ *
+ * Parameters
+ *      IN  Volume:    handle to the volume from which to load the file
+ *      IN  filepath:  the ASCII absolute path of the file; must be a http://
+ *                     URL.
+ *      OUT FileSize:  the file size, in bytes.
+ *
+ * Results
+ *      EFI_SUCCESS, or an EFI error status.
+ *----------------------------------------------------------------------------*/
+EFI_STATUS snphttp_file_get_size(EFI_HANDLE Volume, const char *filepath,
+                                 UINTN *FileSize)
+{
+   return snphttp_file_load(Volume, filepath, NULL, NULL, FileSize);
+}
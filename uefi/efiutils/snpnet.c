@@ -0,0 +1,1698 @@
+/*******************************************************************************
+ * Copyright (c) 2026 VMware, Inc.  All rights reserved.
+ * SPDX-License-Identifier: GPL-2.0
+ ******************************************************************************/
+
+/*
+ * snpnet.c -- Minimal IPv4/UDP/TCP stack on top of the Simple Network Protocol
+ *
+ *      The firmware network stack (MNP, ARP, IP4, UDP4, TCP4...) is layered,
+ *      allocation-heavy, its MTFTP client is strictly lock-step, and its TCP
+ *      often has a small receive window. This file implements just enough of
+ *      ARP, IPv4, UDP and TCP to talk to one peer at a time, by sending and
+ *      receiving raw frames through the Simple Network Protocol of the boot
+ *      NIC, or of another NIC that has its own PXE DHCP lease. Connections on
+ *      different NICs can be open at once, and polled in turn with
+ *      snpnet_tcp_poll(); they must be closed in the reverse order.
+ *
+ *      The IP configuration is not negotiated again: it is taken from the DHCP
+ *      lease the PXE Base Code obtained when it downloaded this program, and
+ *      the peer MAC address is looked up in the PXE ARP cache first.
+ *
+ *      While a connection is open, the TPL is raised to TPL_CALLBACK. This
+ *      keeps the firmware MNP driver from polling the NIC in the background,
+ *      which would otherwise steal the frames this stack is waiting for. The
+ *      firmware stack resumes where it left off once the connection is closed,
+ *      or suspended between two transfers.
+ *
+ *      Incoming datagrams are reassembled when fragmented, one at a time, which
+ *      is sufficient for protocols that send one datagram per block.
+ *
+ *      A connection carries at most one TCP stream, for a request/response
+ *      protocol: the data sent fits in a single segment, and the received data
+ *      is handed over one in-order segment at a time, straight from the frame
+ *      buffer. Since the caller consumes every segment right away, a large
+ *      receive window is advertised (with window scaling, RFC 7323). Out-of-
+ *      order segments are kept in a buffer the size of the window, allocated
+ *      on first use, and immediately acknowledged with the last in-order
+ *      sequence number, so that the sender fast-retransmits the missing data
+ *      only. The kept data is handed over once the gap is filled.
+ */
+
+#include <string.h>
+#include <arpa/inet.h>
+#include "efi_private.h"
+#include "Protocol/SimpleNetwork.h"
+
+#define ETH_ALEN          6
+#define ETH_P_IP          0x0800
+#define ETH_P_ARP         0x0806
+
+#define ARP_HTYPE_ETHER   1
+#define ARP_OP_REQUEST    1
+#define ARP_OP_REPLY      2
+
+#define IP_PROTO_TCP      6
+#define IP_PROTO_UDP      17
+#define IP_TTL            64
+#define IP_MF             0x2000
+#define IP_OFFSET_MASK    0x1fff
+#define IP_MAX_SIZE       65535
+#define REASM_MAP_SIZE    (IP_MAX_SIZE / 8 / 8 + 1)
+
+#define ETH_MIN_FRAME     60     /* Without FCS */
+
+#define TCP_FIN           0x01
+#define TCP_SYN           0x02
+#define TCP_RST           0x04
+#define TCP_PSH           0x08
+#define TCP_ACK           0x10
+
+#define TCP_OPT_END       0
+#define TCP_OPT_NOP       1
+#define TCP_OPT_MSS       2
+#define TCP_OPT_WSCALE    3
+
+#define TCP_DEFAULT_MSS   536
+#define TCP_RCV_WINDOW    (4 * 1024 * 1024)
+#define TCP_WSCALE        7      /* TCP_RCV_WINDOW >> TCP_WSCALE < 64K */
+#define TCP_OOO_RANGES    8      /* Out-of-order data ranges kept at most */
+#define TCP_ACK_SEGMENTS  4      /* ACK at least every that many segments */
+#define TCP_RTO_MS        1000   /* Initial retransmission timeout */
+#define TCP_RETRIES       5
+#define TCP_LPORT_BASE    49152  /* Ephemeral ports */
+#define TCP_LPORT_COUNT   16384
+
+#define ARP_RETRIES       4
+#define ARP_TIMEOUT_MS    500
+#define TX_RECYCLE_TRIES  1000   /* ... of 10us each */
+
+typedef struct {
+   uint8_t dst[ETH_ALEN];
+   uint8_t src[ETH_ALEN];
+   uint16_t type;
+} __attribute__((packed)) eth_hdr_t;
+
+typedef struct {
+   uint16_t htype;
+   uint16_t ptype;
+   uint8_t hlen;
+   uint8_t plen;
+   uint16_t op;
+   uint8_t sha[ETH_ALEN];
+   uint8_t spa[4];
+   uint8_t tha[ETH_ALEN];
+   uint8_t tpa[4];
+} __attribute__((packed)) arp_pkt_t;
+
+typedef struct {
+   uint8_t ver_ihl;
+   uint8_t tos;
+   uint16_t len;
+   uint16_t id;
+   uint16_t frag;
+   uint8_t ttl;
+   uint8_t proto;
+   uint16_t csum;
+   uint8_t src[4];
+   uint8_t dst[4];
+} __attribute__((packed)) ipv4_hdr_t;
+
+typedef struct {
+   uint16_t sport;
+   uint16_t dport;
+   uint16_t len;
+   uint16_t csum;
+} __attribute__((packed)) udp_hdr_t;
+
+typedef struct {
+   uint16_t sport;
+   uint16_t dport;
+   uint32_t seq;
+   uint32_t ack;
+   uint8_t off;
+   uint8_t flags;
+   uint16_t win;
+   uint16_t csum;
+   uint16_t urg;
+} __attribute__((packed)) tcp_hdr_t;
+
+struct snpnet {
+   EFI_SIMPLE_NETWORK *Snp;
+   EFI_TPL OldTpl;            /* TPL to restore when closing */
+   UINT32 OldFilters;         /* Receive filters to restore when closing */
+   EFI_EVENT Timer;           /* Receive timeout */
+   EFI_EVENT RtoTimer;        /* TCP retransmission timeout */
+   bool suspended;            /* TPL restored by snpnet_suspend() */
+   uint8_t mac[ETH_ALEN];     /* Local MAC address */
+   uint8_t hop_mac[ETH_ALEN]; /* Next hop MAC address */
+   uint8_t ip[4];             /* Local IP address */
+   uint8_t peer_ip[4];        /* Peer IP address */
+   uint8_t hop_ip[4];         /* Next hop IP address (peer or gateway) */
+   bool hop_resolved;         /* hop_mac is valid */
+   uint16_t ip_id;            /* Next outgoing IP datagram ID */
+   size_t mtu;                /* Largest IP datagram that fits in a frame */
+   uint8_t *tx;               /* Outgoing frame buffer */
+   uint8_t *rx;               /* Incoming frame buffer */
+   size_t rx_size;            /* Size of the incoming frame buffer */
+
+   /* Reassembly of a fragmented incoming datagram */
+   uint8_t *reasm;            /* Datagram payload */
+   uint8_t *reasm_map;        /* Received 8-byte units bitmap */
+   bool reasm_busy;           /* A datagram is being reassembled */
+   uint16_t reasm_id;         /* ...with this IP ID */
+   uint8_t reasm_proto;       /* ...and this protocol */
+   size_t reasm_len;          /* Total payload size (0 until last fragment) */
+   size_t reasm_got;          /* Payload bytes received so far */
+
+   /* TCP stream */
+   bool tcp_open;             /* Established, and not reset */
+   bool tcp_reset;            /* Reset by the peer */
+   bool tcp_fin;              /* Closed by the peer */
+   uint16_t tcp_lport;        /* Local port */
+   uint16_t tcp_rport;        /* Peer port */
+   uint32_t snd_una;          /* Oldest unacknowledged sequence number */
+   uint32_t snd_nxt;          /* Next sequence number to send */
+   uint32_t rcv_nxt;          /* Next sequence number expected */
+   uint8_t rcv_wscale;        /* Receive window scale, 0 if not negotiated */
+   size_t snd_mss;            /* Largest segment the peer accepts */
+   unsigned int rcv_unacked;  /* Segments received since the last ACK */
+   uint8_t *snd_buf;          /* Unacknowledged data, for retransmission */
+   size_t snd_len;            /* ...and its length */
+   UINT32 rto;                /* Retransmission timeout, in ms */
+   unsigned int retries;      /* Retransmissions of the same segment */
+
+   /* Out-of-order TCP data, kept until the missing data has been received */
+   uint8_t *ooo_buf;          /* TCP_RCV_WINDOW bytes, indexed by sequence */
+   struct {
+      uint32_t start;
+      uint32_t end;
+   } ooo[TCP_OOO_RANGES];     /* Kept ranges, sorted and disjoint */
+   unsigned int ooo_count;    /* Number of kept ranges */
+};
+
+/*
+ * Local port offset of the next TCP stream, 0 until the first stream is
+ * opened. Every stream gets a new port, so that a server which still has the
+ * previous stream in TIME_WAIT does not mistake the new SYN for it.
+ */
+static uint16_t tcp_lport_next = 0;
+
+/*-- ip_csum_add ---------------------------------------------------------------
+ *
+ *      Add a buffer to a running Internet checksum (RFC 1071).
+ *
+ * Parameters
+ *      IN sum:  running sum
+ *      IN data: data to add
+ *      IN len:  data length, in bytes
+ *
+ * Results
+ *      The updated running sum.
+ *----------------------------------------------------------------------------*/
+static uint32_t ip_csum_add(uint32_t sum, const void *data, size_t len)
+{
+   const uint8_t *p = data;
+
+   while (len > 1) {
+      sum += ((uint32_t)p[0] << 8) | p[1];
+      p += 2;
+      len -= 2;
+   }
+   if (len > 0) {
+      sum += (uint32_t)p[0] << 8;
+   }
+
+   while ((sum >> 16) != 0) {
+      sum = (sum & 0xffff) + (sum >> 16);
+   }
+
+   return sum;
+}
+
+/*-- ip_csum_fold --------------------------------------------------------------
+ *
+ *      Finalize an Internet checksum.
+ *
+ * Parameters
+ *      IN sum: running sum
+ *
+ * Results
+ *      The checksum, in network byte order.
+ *----------------------------------------------------------------------------*/
+static uint16_t ip_csum_fold(uint32_t sum)
+{
+   return htons((uint16_t)~sum);
+}
+
+/*-- l4_csum -------------------------------------------------------------------
+ *
+ *      Compute the checksum of a UDP datagram or TCP segment, including its
+ *      pseudo-header.
+ *
+ * Parameters
+ *      IN src:   source IP address
+ *      IN dst:   destination IP address
+ *      IN proto: IP_PROTO_UDP or IP_PROTO_TCP
+ *      IN hdr:   UDP/TCP header, followed by the payload
+ *      IN len:   datagram/segment length, header included
+ *
+ * Results
+ *      The checksum, in network byte order (0 if the datagram is valid).
+ *----------------------------------------------------------------------------*/
+static uint16_t l4_csum(const uint8_t src[4], const uint8_t dst[4],
+                        uint8_t proto, const void *hdr, size_t len)
+{
+   uint32_t sum;
+
+   sum = ip_csum_add(0, src, 4);
+   sum = ip_csum_add(sum, dst, 4);
+   sum += proto + (uint32_t)len;
+   sum = ip_csum_add(sum, hdr, len);
+
+   return ip_csum_fold(sum);
+}
+
+/*-- snpnet_timer_set ----------------------------------------------------------
+ *
+ *      Arm the receive timeout.
+ *
+ * Parameters
+ *      IN net:        connection
+ *      IN timeout_ms: timeout, in ms
+ *----------------------------------------------------------------------------*/
+static void snpnet_timer_set(snpnet_t *net, UINT32 timeout_ms)
+{
+   /* Clear any expiry that was not checked. */
+   bs->CheckEvent(net->Timer);
+   bs->SetTimer(net->Timer, TimerRelative, (UINT64)timeout_ms * 10000);
+}
+
+/*-- snpnet_timer_expired ------------------------------------------------------
+ *
+ *      Check whether the receive timeout has expired.
+ *
+ * Parameters
+ *      IN net: connection
+ *
+ * Results
+ *      true if the timeout has expired, false otherwise.
+ *----------------------------------------------------------------------------*/
+static bool snpnet_timer_expired(snpnet_t *net)
+{
+   return bs->CheckEvent(net->Timer) == EFI_SUCCESS;
+}
+
+/*-- snpnet_transmit -----------------------------------------------------------
+ *
+ *      Send the frame in the transmit buffer, and wait for the NIC to give the
+ *      buffer back.
+ *
+ * Parameters
+ *      IN net:  connection
+ *      IN dst:  destination MAC address
+ *      IN type: Ethernet frame type
+ *      IN len:  frame payload length, in bytes
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS snpnet_transmit(snpnet_t *net, const uint8_t *dst,
+                                  uint16_t type, size_t len)
+{
+   eth_hdr_t *eth = (eth_hdr_t *)net->tx;
+   EFI_STATUS Status;
+   VOID *TxBuf;
+   unsigned int i;
+
+   memcpy(eth->dst, dst, ETH_ALEN);
+   memcpy(eth->src, net->mac, ETH_ALEN);
+   eth->type = htons(type);
+
+   len += sizeof (eth_hdr_t);
+   if (len < ETH_MIN_FRAME) {
+      memset(net->tx + len, 0, ETH_MIN_FRAME - len);
+      len = ETH_MIN_FRAME;
+   }
+
+   Status = net->Snp->Transmit(net->Snp, 0, len, net->tx, NULL, NULL, NULL);
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+
+   for (i = 0; i < TX_RECYCLE_TRIES; i++) {
+      TxBuf = NULL;
+      Status = net->Snp->GetStatus(net->Snp, NULL, &TxBuf);
+      if (EFI_ERROR(Status) || TxBuf == net->tx) {
+         return Status;
+      }
+      bs->Stall(10);
+   }
+
+   return EFI_TIMEOUT;
+}
+
+/*-- arp_send ------------------------------------------------------------------
+ *
+ *      Send an ARP request or reply.
+ *
+ * Parameters
+ *      IN net: connection
+ *      IN op:  ARP_OP_REQUEST or ARP_OP_REPLY
+ *      IN tha: target MAC address (NULL for a broadcast request)
+ *      IN tpa: target IP address
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS arp_send(snpnet_t *net, uint16_t op, const uint8_t *tha,
+                           const uint8_t *tpa)
+{
+   static const uint8_t broadcast[ETH_ALEN] = {
+      0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+   };
+   arp_pkt_t *arp = (arp_pkt_t *)(net->tx + sizeof (eth_hdr_t));
+
+   arp->htype = htons(ARP_HTYPE_ETHER);
+   arp->ptype = htons(ETH_P_IP);
+   arp->hlen = ETH_ALEN;
+   arp->plen = 4;
+   arp->op = htons(op);
+   memcpy(arp->sha, net->mac, ETH_ALEN);
+   memcpy(arp->spa, net->ip, 4);
+   if (tha != NULL) {
+      memcpy(arp->tha, tha, ETH_ALEN);
+   } else {
+      memset(arp->tha, 0, ETH_ALEN);
+   }
+   memcpy(arp->tpa, tpa, 4);
+
+   return snpnet_transmit(net, (tha != NULL) ? tha : broadcast, ETH_P_ARP,
+                          sizeof (arp_pkt_t));
+}
+
+/*-- arp_input -----------------------------------------------------------------
+ *
+ *      Process an incoming ARP packet: answer requests for our address, and
+ *      learn the next hop MAC address from replies.
+ *
+ * Parameters
+ *      IN net: connection
+ *      IN arp: ARP packet
+ *      IN len: packet length, in bytes
+ *----------------------------------------------------------------------------*/
+static void arp_input(snpnet_t *net, const arp_pkt_t *arp, size_t len)
+{
+   if (len < sizeof (arp_pkt_t) || arp->htype != htons(ARP_HTYPE_ETHER) ||
+       arp->ptype != htons(ETH_P_IP) || arp->hlen != ETH_ALEN ||
+       arp->plen != 4) {
+      return;
+   }
+
+   if (memcmp(arp->spa, net->hop_ip, 4) == 0) {
+      memcpy(net->hop_mac, arp->sha, ETH_ALEN);
+      net->hop_resolved = true;
+   }
+
+   if (arp->op == htons(ARP_OP_REQUEST) && memcmp(arp->tpa, net->ip, 4) == 0) {
+      arp_send(net, ARP_OP_REPLY, arp->sha, arp->spa);
+   }
+}
+
+/*-- ip_reassemble -------------------------------------------------------------
+ *
+ *      Add a fragment to the datagram being reassembled. A fragment that
+ *      belongs to another datagram restarts the reassembly.
+ *
+ * Parameters
+ *      IN  net:  connection
+ *      IN  ip:   fragment IP header
+ *      IN  data: fragment payload
+ *      IN  len:  fragment payload length, in bytes
+ *      OUT dlen: the complete datagram payload length
+ *
+ * Results
+ *      true if the datagram is complete, false otherwise.
+ *----------------------------------------------------------------------------*/
+static bool ip_reassemble(snpnet_t *net, const ipv4_hdr_t *ip,
+                          const uint8_t *data, size_t len, size_t *dlen)
+{
+   size_t offset, unit;
+   uint16_t frag;
+
+   frag = ntohs(ip->frag);
+   offset = (size_t)(frag & IP_OFFSET_MASK) * 8;
+
+   if (offset + len > IP_MAX_SIZE || ((frag & IP_MF) != 0 && len % 8 != 0)) {
+      return false;
+   }
+
+   if (!net->reasm_busy || net->reasm_id != ip->id ||
+       net->reasm_proto != ip->proto) {
+      memset(net->reasm_map, 0, REASM_MAP_SIZE);
+      net->reasm_busy = true;
+      net->reasm_id = ip->id;
+      net->reasm_proto = ip->proto;
+      net->reasm_len = 0;
+      net->reasm_got = 0;
+   }
+
+   unit = offset / 8;
+   if ((net->reasm_map[unit / 8] & (1 << (unit % 8))) != 0) {
+      /* Duplicate */
+      return false;
+   }
+
+   for (; unit * 8 < offset + len; unit++) {
+      net->reasm_map[unit / 8] |= 1 << (unit % 8);
+   }
+
+   memcpy(net->reasm + offset, data, len);
+   net->reasm_got += len;
+   if ((frag & IP_MF) == 0) {
+      net->reasm_len = offset + len;
+   }
+
+   if (net->reasm_len == 0 || net->reasm_got != net->reasm_len) {
+      return false;
+   }
+
+   net->reasm_busy = false;
+   *dlen = net->reasm_len;
+
+   return true;
+}
+
+/*-- ip_input ------------------------------------------------------------------
+ *
+ *      Validate an incoming IPv4 datagram sent by the peer to us.
+ *
+ * Parameters
+ *      IN  net:   connection
+ *      IN  ip:    IP header
+ *      IN  len:   frame payload length, in bytes
+ *      OUT proto: IP protocol
+ *      OUT data:  pointer to the (reassembled) datagram payload
+ *      OUT dlen:  datagram payload length
+ *
+ * Results
+ *      true if a complete datagram has been received, false otherwise.
+ *----------------------------------------------------------------------------*/
+static bool ip_input(snpnet_t *net, const ipv4_hdr_t *ip, size_t len,
+                     uint8_t *proto, const uint8_t **data, size_t *dlen)
+{
+   size_t hlen, tlen;
+
+   if (len < sizeof (ipv4_hdr_t) || (ip->ver_ihl >> 4) != 4) {
+      return false;
+   }
+
+   hlen = (ip->ver_ihl & 0xf) * 4;
+   tlen = ntohs(ip->len);
+   if (hlen < sizeof (ipv4_hdr_t) || tlen < hlen || tlen > len ||
+       ip_csum_add(0, ip, hlen) != 0xffff) {
+      return false;
+   }
+
+   if (memcmp(ip->dst, net->ip, 4) != 0 ||
+       memcmp(ip->src, net->peer_ip, 4) != 0) {
+      return false;
+   }
+
+   *proto = ip->proto;
+
+   if ((ntohs(ip->frag) & (IP_MF | IP_OFFSET_MASK)) != 0) {
+      if (!ip_reassemble(net, ip, (const uint8_t *)ip + hlen, tlen - hlen,
+                         dlen)) {
+         return false;
+      }
+      *data = net->reasm;
+      return true;
+   }
+
+   *data = (const uint8_t *)ip + hlen;
+   *dlen = tlen - hlen;
+
+   return true;
+}
+
+/*-- snpnet_poll ---------------------------------------------------------------
+ *
+ *      Process the next incoming frame, if any. ARP requests are answered.
+ *
+ * Parameters
+ *      IN  net:   connection
+ *      OUT proto: IP protocol
+ *      OUT data:  pointer to the datagram payload, valid until the next call
+ *      OUT dlen:  datagram payload length
+ *
+ * Results
+ *      EFI_SUCCESS if a datagram was received from the peer, EFI_NOT_READY if
+ *      not, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS snpnet_poll(snpnet_t *net, uint8_t *proto,
+                              const uint8_t **data, size_t *dlen)
+{
+   const eth_hdr_t *eth = (const eth_hdr_t *)net->rx;
+   const uint8_t *payload = net->rx + sizeof (eth_hdr_t);
+   EFI_STATUS Status;
+   UINTN Size;
+
+   Size = net->rx_size;
+   Status = net->Snp->Receive(net->Snp, NULL, &Size, net->rx, NULL, NULL, NULL);
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+   if (Size < sizeof (eth_hdr_t)) {
+      return EFI_NOT_READY;
+   }
+
+   Size -= sizeof (eth_hdr_t);
+
+   if (eth->type == htons(ETH_P_ARP)) {
+      arp_input(net, (const arp_pkt_t *)payload, Size);
+   } else if (eth->type == htons(ETH_P_IP) &&
+              ip_input(net, (const ipv4_hdr_t *)payload, Size, proto, data,
+                       dlen)) {
+      return EFI_SUCCESS;
+   }
+
+   return EFI_NOT_READY;
+}
+
+/*-- snpnet_receive ------------------------------------------------------------
+ *
+ *      Wait for a datagram from the peer.
+ *
+ * Parameters
+ *      IN  net:   connection
+ *      OUT proto: IP protocol
+ *      OUT data:  pointer to the datagram payload, valid until the next call
+ *      OUT dlen:  datagram payload length
+ *
+ * Results
+ *      EFI_SUCCESS, EFI_TIMEOUT if the timer expired, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS snpnet_receive(snpnet_t *net, uint8_t *proto,
+                                 const uint8_t **data, size_t *dlen)
+{
+   EFI_STATUS Status;
+
+   for (;;) {
+      Status = snpnet_poll(net, proto, data, dlen);
+      if (Status != EFI_NOT_READY) {
+         return Status;
+      }
+      if (snpnet_timer_expired(net)) {
+         return EFI_TIMEOUT;
+      }
+   }
+}
+
+/*-- ip_send -------------------------------------------------------------------
+ *
+ *      Send an unfragmented IPv4 datagram to the peer. The payload must
+ *      already be in the transmit buffer, right after the IPv4 header.
+ *
+ * Parameters
+ *      IN net:   connection
+ *      IN proto: IP protocol
+ *      IN len:   payload length, in bytes
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS ip_send(snpnet_t *net, uint8_t proto, size_t len)
+{
+   ipv4_hdr_t *ip = (ipv4_hdr_t *)(net->tx + sizeof (eth_hdr_t));
+
+   ip->ver_ihl = 0x45;
+   ip->tos = 0;
+   ip->len = htons(sizeof (ipv4_hdr_t) + len);
+   ip->id = htons(net->ip_id++);
+   ip->frag = 0;
+   ip->ttl = IP_TTL;
+   ip->proto = proto;
+   ip->csum = 0;
+   memcpy(ip->src, net->ip, 4);
+   memcpy(ip->dst, net->peer_ip, 4);
+   ip->csum = ip_csum_fold(ip_csum_add(0, ip, sizeof (ipv4_hdr_t)));
+
+   return snpnet_transmit(net, net->hop_mac, ETH_P_IP,
+                          sizeof (ipv4_hdr_t) + len);
+}
+
+/*-- arp_resolve ---------------------------------------------------------------
+ *
+ *      Find the MAC address of the next hop, first in the PXE ARP cache, then
+ *      by sending ARP requests.
+ *
+ * Parameters
+ *      IN net:     connection
+ *      IN PxeMode: PXE Base Code mode data
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS arp_resolve(snpnet_t *net,
+                              const EFI_PXE_BASE_CODE_MODE *PxeMode)
+{
+   const uint8_t *data;
+   EFI_STATUS Status;
+   unsigned int i;
+   uint8_t proto;
+   size_t len;
+
+   for (i = 0; i < PxeMode->ArpCacheEntries &&
+               i < EFI_PXE_BASE_CODE_MAX_ARP_ENTRIES; i++) {
+      if (memcmp(&PxeMode->ArpCache[i].IpAddr.v4, net->hop_ip, 4) == 0) {
+         memcpy(net->hop_mac, &PxeMode->ArpCache[i].MacAddr, ETH_ALEN);
+         net->hop_resolved = true;
+         return EFI_SUCCESS;
+      }
+   }
+
+   for (i = 0; i < ARP_RETRIES && !net->hop_resolved; i++) {
+      Status = arp_send(net, ARP_OP_REQUEST, NULL, net->hop_ip);
+      if (EFI_ERROR(Status)) {
+         return Status;
+      }
+
+      snpnet_timer_set(net, ARP_TIMEOUT_MS);
+      do {
+         Status = snpnet_receive(net, &proto, &data, &len);
+      } while (Status == EFI_SUCCESS && !net->hop_resolved);
+
+      if (Status != EFI_SUCCESS && Status != EFI_TIMEOUT) {
+         return Status;
+      }
+   }
+
+   return net->hop_resolved ? EFI_SUCCESS : EFI_NO_RESPONSE;
+}
+
+/*-- snpnet_restore_filters ---------------------------------------------------
+ *
+ *      Give the NIC its receive filters back, as they were before
+ *      snpnet_open(). The multicast filter list is left untouched.
+ *
+ * Parameters
+ *      IN net: connection
+ *----------------------------------------------------------------------------*/
+static void snpnet_restore_filters(snpnet_t *net)
+{
+   EFI_SIMPLE_NETWORK *Snp = net->Snp;
+   UINT32 Current;
+
+   Current = Snp->Mode->ReceiveFilterSetting;
+   if (Current != net->OldFilters) {
+      Snp->ReceiveFilters(Snp, net->OldFilters, Current & ~net->OldFilters,
+                          FALSE, 0, NULL);
+   }
+}
+
+/*-- snpnet_open ---------------------------------------------------------------
+ *
+ *      Open a connection to a peer, on the NIC the PXE Base Code is bound to.
+ *
+ * Parameters
+ *      IN  Nic:     handle of the NIC (Simple Network Protocol)
+ *      IN  PxeMode: PXE Base Code mode data, holding the DHCP lease
+ *      IN  PeerIp:  peer IPv4 address
+ *      OUT net:     the new connection
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+EFI_STATUS snpnet_open(EFI_HANDLE Nic, const EFI_PXE_BASE_CODE_MODE *PxeMode,
+                       const EFI_IPv4_ADDRESS *PeerIp, snpnet_t **net)
+{
+   EFI_GUID SimpleNetworkProto = EFI_SIMPLE_NETWORK_PROTOCOL_GUID;
+   const EFI_PXE_BASE_CODE_ROUTE_ENTRY *route;
+   EFI_SIMPLE_NETWORK *Snp;
+   const uint8_t *mask;
+   EFI_STATUS Status;
+   bool routed;
+   snpnet_t *n;
+   unsigned int i;
+
+   if (PxeMode->UsingIpv6) {
+      return EFI_UNSUPPORTED;
+   }
+
+   Status = get_protocol_interface(Nic, &SimpleNetworkProto, (void **)&Snp);
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+
+   if (Snp->Mode->State != EfiSimpleNetworkInitialized ||
+       Snp->Mode->MediaHeaderSize != sizeof (eth_hdr_t) ||
+       Snp->Mode->HwAddressSize != ETH_ALEN ||
+       Snp->Mode->MaxPacketSize < 576) {
+      return EFI_UNSUPPORTED;
+   }
+
+   n = sys_malloc(sizeof (snpnet_t));
+   if (n == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+   }
+   memset(n, 0, sizeof (snpnet_t));
+
+   n->Snp = Snp;
+   n->mtu = MIN(Snp->Mode->MaxPacketSize, IP_MAX_SIZE);
+   n->rx_size = sizeof (eth_hdr_t) + Snp->Mode->MaxPacketSize;
+   n->tx = sys_malloc(MAX(n->rx_size, ETH_MIN_FRAME));
+   n->rx = sys_malloc(n->rx_size);
+   n->reasm = sys_malloc(IP_MAX_SIZE);
+   n->reasm_map = sys_malloc(REASM_MAP_SIZE);
+   n->snd_buf = sys_malloc(n->mtu);
+   if (n->tx == NULL || n->rx == NULL || n->reasm == NULL ||
+       n->reasm_map == NULL || n->snd_buf == NULL) {
+      Status = EFI_OUT_OF_RESOURCES;
+      goto error;
+   }
+
+   Status = bs->CreateEvent(EVT_TIMER, 0, NULL, NULL, &n->Timer);
+   if (EFI_ERROR(Status)) {
+      n->Timer = NULL;
+      goto error;
+   }
+
+   Status = bs->CreateEvent(EVT_TIMER, 0, NULL, NULL, &n->RtoTimer);
+   if (EFI_ERROR(Status)) {
+      n->RtoTimer = NULL;
+      goto error;
+   }
+
+   memcpy(n->mac, &Snp->Mode->CurrentAddress, ETH_ALEN);
+   memcpy(n->ip, &PxeMode->StationIp.v4, 4);
+   memcpy(n->peer_ip, PeerIp, 4);
+   n->ip_id = (uint16_t)rdtsc();
+
+   /*
+    * Route through the first gateway if the peer is not on our subnet.
+    */
+   memcpy(n->hop_ip, n->peer_ip, 4);
+   mask = (const uint8_t *)&PxeMode->SubnetMask.v4;
+   for (i = 0; i < 4; i++) {
+      if ((n->ip[i] & mask[i]) != (n->peer_ip[i] & mask[i])) {
+         break;
+      }
+   }
+   if (i < 4) {
+      routed = false;
+      for (i = 0; i < PxeMode->RouteTableEntries &&
+                  i < EFI_PXE_BASE_CODE_MAX_ROUTE_ENTRIES && !routed; i++) {
+         route = &PxeMode->RouteTable[i];
+         if (route->GwAddr.Addr[0] != 0) {
+            memcpy(n->hop_ip, &route->GwAddr.v4, 4);
+            routed = true;
+         }
+      }
+      if (!routed) {
+         Status = EFI_NO_MAPPING;
+         goto error;
+      }
+   }
+
+   n->OldFilters = Snp->Mode->ReceiveFilterSetting;
+   Snp->ReceiveFilters(Snp, EFI_SIMPLE_NETWORK_RECEIVE_UNICAST |
+                       EFI_SIMPLE_NETWORK_RECEIVE_BROADCAST, 0, FALSE, 0, NULL);
+
+   n->OldTpl = bs->RaiseTPL(TPL_CALLBACK);
+
+   Status = arp_resolve(n, PxeMode);
+   if (EFI_ERROR(Status)) {
+      bs->RestoreTPL(n->OldTpl);
+      snpnet_restore_filters(n);
+      goto error;
+   }
+
+   *net = n;
+
+   return EFI_SUCCESS;
+
+ error:
+   if (n->RtoTimer != NULL) {
+      bs->CloseEvent(n->RtoTimer);
+   }
+   if (n->Timer != NULL) {
+      bs->CloseEvent(n->Timer);
+   }
+   sys_free(n->snd_buf);
+   sys_free(n->reasm_map);
+   sys_free(n->reasm);
+   sys_free(n->rx);
+   sys_free(n->tx);
+   sys_free(n);
+
+   return Status;
+}
+
+/*-- snpnet_close --------------------------------------------------------------
+ *
+ *      Close a connection, and give the NIC back to the firmware.
+ *
+ * Parameters
+ *      IN net: connection
+ *----------------------------------------------------------------------------*/
+void snpnet_close(snpnet_t *net)
+{
+   if (!net->suspended) {
+      bs->RestoreTPL(net->OldTpl);
+   }
+   snpnet_restore_filters(net);
+   bs->CloseEvent(net->RtoTimer);
+   bs->CloseEvent(net->Timer);
+   sys_free(net->ooo_buf);
+   sys_free(net->snd_buf);
+   sys_free(net->reasm_map);
+   sys_free(net->reasm);
+   sys_free(net->rx);
+   sys_free(net->tx);
+   sys_free(net);
+}
+
+/*-- snpnet_suspend ------------------------------------------------------------
+ *
+ *      Give the NIC back to the firmware, without closing the connection.
+ *      Frames received while the connection is suspended may be lost.
+ *
+ * Parameters
+ *      IN net: connection
+ *----------------------------------------------------------------------------*/
+void snpnet_suspend(snpnet_t *net)
+{
+   if (!net->suspended) {
+      bs->RestoreTPL(net->OldTpl);
+      net->suspended = true;
+   }
+}
+
+/*-- snpnet_resume -------------------------------------------------------------
+ *
+ *      Take the NIC over again, after snpnet_suspend().
+ *
+ * Parameters
+ *      IN net: connection
+ *----------------------------------------------------------------------------*/
+void snpnet_resume(snpnet_t *net)
+{
+   if (net->suspended) {
+      net->OldTpl = bs->RaiseTPL(TPL_CALLBACK);
+      net->suspended = false;
+   }
+}
+
+/*-- snpnet_udp_send -----------------------------------------------------------
+ *
+ *      Send an unfragmented UDP datagram to the peer.
+ *
+ * Parameters
+ *      IN net:   connection
+ *      IN sport: source port
+ *      IN dport: destination port
+ *      IN data:  payload
+ *      IN len:   payload length, in bytes
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+EFI_STATUS snpnet_udp_send(snpnet_t *net, uint16_t sport, uint16_t dport,
+                           const void *data, size_t len)
+{
+   udp_hdr_t *udp;
+   size_t ulen = sizeof (udp_hdr_t) + len;
+
+   if (sizeof (ipv4_hdr_t) + ulen > net->mtu) {
+      return EFI_BAD_BUFFER_SIZE;
+   }
+
+   udp = (udp_hdr_t *)(net->tx + sizeof (eth_hdr_t) + sizeof (ipv4_hdr_t));
+
+   udp->sport = htons(sport);
+   udp->dport = htons(dport);
+   udp->len = htons(ulen);
+   udp->csum = 0;
+   memcpy(udp + 1, data, len);
+   udp->csum = l4_csum(net->ip, net->peer_ip, IP_PROTO_UDP, udp, ulen);
+   if (udp->csum == 0) {
+      udp->csum = 0xffff;
+   }
+
+   return ip_send(net, IP_PROTO_UDP, ulen);
+}
+
+/*-- snpnet_udp_recv -----------------------------------------------------------
+ *
+ *      Receive a UDP datagram from the peer.
+ *
+ * Parameters
+ *      IN  net:        connection
+ *      IN  dport:      local port
+ *      OUT sport:      peer port
+ *      OUT data:       pointer to the payload, valid until the next call
+ *      OUT len:        payload length, in bytes
+ *      IN  timeout_ms: how long to wait for a datagram
+ *
+ * Results
+ *      EFI_SUCCESS, EFI_TIMEOUT, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+EFI_STATUS snpnet_udp_recv(snpnet_t *net, uint16_t dport, uint16_t *sport,
+                           const void **data, size_t *len, UINT32 timeout_ms)
+{
+   const udp_hdr_t *udp;
+   const uint8_t *dgram;
+   EFI_STATUS Status;
+   uint8_t proto;
+   size_t dlen, ulen;
+
+   snpnet_timer_set(net, timeout_ms);
+
+   for (;;) {
+      Status = snpnet_receive(net, &proto, &dgram, &dlen);
+      if (EFI_ERROR(Status)) {
+         return Status;
+      }
+
+      if (proto != IP_PROTO_UDP || dlen < sizeof (udp_hdr_t)) {
+         continue;
+      }
+
+      udp = (const udp_hdr_t *)dgram;
+      ulen = ntohs(udp->len);
+      if (udp->dport != htons(dport) || ulen < sizeof (udp_hdr_t) ||
+          ulen > dlen) {
+         continue;
+      }
+
+      if (udp->csum != 0 &&
+          l4_csum(net->peer_ip, net->ip, IP_PROTO_UDP, udp, ulen) != 0) {
+         continue;
+      }
+
+      *sport = ntohs(udp->sport);
+      *data = udp + 1;
+      *len = ulen - sizeof (udp_hdr_t);
+
+      return EFI_SUCCESS;
+   }
+}
+
+/*-- tcp_rto_set ---------------------------------------------------------------
+ *
+ *      (Re)arm the TCP retransmission timer.
+ *
+ * Parameters
+ *      IN net: connection
+ *----------------------------------------------------------------------------*/
+static void tcp_rto_set(snpnet_t *net)
+{
+   bs->CheckEvent(net->RtoTimer);
+   bs->SetTimer(net->RtoTimer, TimerRelative, (UINT64)net->rto * 10000);
+}
+
+/*-- tcp_output ----------------------------------------------------------------
+ *
+ *      Send a TCP segment to the peer. The segment acknowledges everything
+ *      received so far if it has the ACK flag.
+ *
+ * Parameters
+ *      IN net:   connection
+ *      IN flags: TCP flags
+ *      IN seq:   sequence number
+ *      IN data:  payload
+ *      IN len:   payload length, in bytes
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS tcp_output(snpnet_t *net, uint8_t flags, uint32_t seq,
+                             const void *data, size_t len)
+{
+   tcp_hdr_t *tcp;
+   uint8_t *opt;
+   size_t hlen, mss;
+   uint32_t win;
+
+   tcp = (tcp_hdr_t *)(net->tx + sizeof (eth_hdr_t) + sizeof (ipv4_hdr_t));
+   opt = (uint8_t *)(tcp + 1);
+   hlen = sizeof (tcp_hdr_t);
+
+   if ((flags & TCP_SYN) != 0) {
+      mss = net->mtu - sizeof (ipv4_hdr_t) - sizeof (tcp_hdr_t);
+      opt[0] = TCP_OPT_MSS;
+      opt[1] = 4;
+      opt[2] = (uint8_t)(mss >> 8);
+      opt[3] = (uint8_t)mss;
+      opt[4] = TCP_OPT_NOP;
+      opt[5] = TCP_OPT_WSCALE;
+      opt[6] = 3;
+      opt[7] = TCP_WSCALE;
+      hlen += 8;
+      /* The window of a SYN segment is never scaled. */
+      win = TCP_RCV_WINDOW;
+   } else {
+      win = TCP_RCV_WINDOW >> net->rcv_wscale;
+   }
+
+   if (sizeof (ipv4_hdr_t) + hlen + len > net->mtu) {
+      return EFI_BAD_BUFFER_SIZE;
+   }
+
+   tcp->sport = htons(net->tcp_lport);
+   tcp->dport = htons(net->tcp_rport);
+   tcp->seq = htonl(seq);
+   tcp->ack = ((flags & TCP_ACK) != 0) ? htonl(net->rcv_nxt) : 0;
+   tcp->off = (uint8_t)((hlen / 4) << 4);
+   tcp->flags = flags;
+   tcp->win = htons((uint16_t)MIN(win, 0xffff));
+   tcp->csum = 0;
+   tcp->urg = 0;
+   if (len > 0) {
+      memcpy((uint8_t *)tcp + hlen, data, len);
+   }
+   tcp->csum = l4_csum(net->ip, net->peer_ip, IP_PROTO_TCP, tcp, hlen + len);
+
+   if ((flags & TCP_ACK) != 0) {
+      net->rcv_unacked = 0;
+   }
+
+   return ip_send(net, IP_PROTO_TCP, hlen + len);
+}
+
+/*-- tcp_options ---------------------------------------------------------------
+ *
+ *      Parse the options of the SYN segment sent by the peer.
+ *
+ * Parameters
+ *      IN net: connection
+ *      IN opt: TCP options
+ *      IN len: TCP options length, in bytes
+ *----------------------------------------------------------------------------*/
+static void tcp_options(snpnet_t *net, const uint8_t *opt, size_t len)
+{
+   size_t i, olen, mss;
+
+   for (i = 0; i < len && opt[i] != TCP_OPT_END; i += olen) {
+      if (opt[i] == TCP_OPT_NOP) {
+         olen = 1;
+         continue;
+      }
+
+      if (i + 1 >= len || opt[i + 1] < 2 || i + opt[i + 1] > len) {
+         break;
+      }
+      olen = opt[i + 1];
+
+      if (opt[i] == TCP_OPT_MSS && olen == 4) {
+         mss = ((size_t)opt[i + 2] << 8) | opt[i + 3];
+         if (mss > 0) {
+            net->snd_mss = MIN(mss, net->mtu - sizeof (ipv4_hdr_t) -
+                               sizeof (tcp_hdr_t));
+         }
+      } else if (opt[i] == TCP_OPT_WSCALE && olen == 3) {
+         /* Both ends sent the option: our window is scaled. */
+         net->rcv_wscale = TCP_WSCALE;
+      }
+   }
+}
+
+/*-- tcp_ooo_keep --------------------------------------------------------------
+ *
+ *      Keep the part of an out-of-order segment that fits in the receive
+ *      window, unless too many ranges are already kept.
+ *
+ * Parameters
+ *      IN net:  connection
+ *      IN seq:  segment sequence number, after the next expected one
+ *      IN data: segment payload
+ *      IN len:  segment payload length, in bytes
+ *----------------------------------------------------------------------------*/
+static void tcp_ooo_keep(snpnet_t *net, uint32_t seq, const uint8_t *data,
+                         size_t len)
+{
+   uint32_t start, end, off;
+   unsigned int i, j;
+   size_t n;
+
+   off = seq - net->rcv_nxt;
+   if (off >= TCP_RCV_WINDOW) {
+      return;
+   }
+   len = MIN(len, TCP_RCV_WINDOW - off);
+
+   if (net->ooo_buf == NULL) {
+      net->ooo_buf = sys_malloc(TCP_RCV_WINDOW);
+      if (net->ooo_buf == NULL) {
+         return;
+      }
+   }
+
+   /* Ranges [i, j) overlap or touch the new one, and are merged into it. */
+   start = seq;
+   end = seq + (uint32_t)len;
+   for (i = 0; i < net->ooo_count; i++) {
+      if ((int32_t)(net->ooo[i].end - start) >= 0) {
+         break;
+      }
+   }
+   for (j = i; j < net->ooo_count; j++) {
+      if ((int32_t)(net->ooo[j].start - end) > 0) {
+         break;
+      }
+      if ((int32_t)(net->ooo[j].start - start) < 0) {
+         start = net->ooo[j].start;
+      }
+      if ((int32_t)(net->ooo[j].end - end) > 0) {
+         end = net->ooo[j].end;
+      }
+   }
+
+   if (i == j) {
+      if (net->ooo_count == TCP_OOO_RANGES) {
+         return;
+      }
+      memmove(&net->ooo[i + 1], &net->ooo[i],
+              (net->ooo_count - i) * sizeof (net->ooo[0]));
+      net->ooo_count++;
+   } else {
+      memmove(&net->ooo[i + 1], &net->ooo[j],
+              (net->ooo_count - j) * sizeof (net->ooo[0]));
+      net->ooo_count -= j - i - 1;
+   }
+   net->ooo[i].start = start;
+   net->ooo[i].end = end;
+
+   off = seq % TCP_RCV_WINDOW;
+   n = MIN(len, TCP_RCV_WINDOW - off);
+   memcpy(net->ooo_buf + off, data, n);
+   memcpy(net->ooo_buf, data + n, len - n);
+}
+
+/*-- tcp_ooo_deliver -----------------------------------------------------------
+ *
+ *      Hand over the kept data that has become in-order, if any. The peer is
+ *      acknowledged as soon as a whole range has been handed over.
+ *
+ * Parameters
+ *      IN  net:  connection
+ *      OUT data: pointer to the new in-order data, if any
+ *      OUT dlen: new in-order data length (0 if none)
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS tcp_ooo_deliver(snpnet_t *net, const uint8_t **data,
+                                  size_t *dlen)
+{
+   uint32_t end, off;
+
+   *dlen = 0;
+
+   if (net->ooo_count == 0 ||
+       (int32_t)(net->ooo[0].start - net->rcv_nxt) > 0) {
+      return EFI_SUCCESS;
+   }
+
+   end = net->ooo[0].end;
+   if ((int32_t)(end - net->rcv_nxt) > 0) {
+      off = net->rcv_nxt % TCP_RCV_WINDOW;
+      *data = net->ooo_buf + off;
+      *dlen = MIN(end - net->rcv_nxt, TCP_RCV_WINDOW - off);
+      net->rcv_nxt += (uint32_t)*dlen;
+      net->rcv_unacked++;
+      if (net->rcv_nxt != end) {
+         return EFI_SUCCESS;
+      }
+   }
+
+   net->ooo_count--;
+   memmove(&net->ooo[0], &net->ooo[1], net->ooo_count * sizeof (net->ooo[0]));
+
+   if (*dlen == 0) {
+      /* The range has been received again, in order. */
+      return EFI_SUCCESS;
+   }
+
+   return tcp_output(net, TCP_ACK, net->snd_nxt, NULL, 0);
+}
+
+/*-- tcp_input -----------------------------------------------------------------
+ *
+ *      Process a TCP segment received from the peer.
+ *
+ * Parameters
+ *      IN  net:  connection
+ *      IN  seg:  TCP segment
+ *      IN  len:  TCP segment length, in bytes
+ *      OUT data: pointer to the new in-order data, if any
+ *      OUT dlen: new in-order data length (0 if none)
+ *
+ * Results
+ *      EFI_SUCCESS, EFI_CONNECTION_REFUSED or EFI_CONNECTION_RESET if the peer
+ *      reset the connection, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS tcp_input(snpnet_t *net, const uint8_t *seg, size_t len,
+                            const uint8_t **data, size_t *dlen)
+{
+   const tcp_hdr_t *tcp = (const tcp_hdr_t *)seg;
+   uint32_t seq, ack, trim;
+   size_t hlen;
+
+   *dlen = 0;
+
+   if (len < sizeof (tcp_hdr_t)) {
+      return EFI_SUCCESS;
+   }
+
+   hlen = (size_t)(tcp->off >> 4) * 4;
+   if (hlen < sizeof (tcp_hdr_t) || hlen > len ||
+       tcp->sport != htons(net->tcp_rport) ||
+       tcp->dport != htons(net->tcp_lport) ||
+       l4_csum(net->peer_ip, net->ip, IP_PROTO_TCP, seg, len) != 0) {
+      return EFI_SUCCESS;
+   }
+
+   seq = ntohl(tcp->seq);
+   ack = ntohl(tcp->ack);
+
+   if (!net->tcp_open) {
+      /* SYN-SENT */
+      if ((tcp->flags & TCP_ACK) == 0 || ack != net->snd_nxt) {
+         return EFI_SUCCESS;
+      }
+      if ((tcp->flags & TCP_RST) != 0) {
+         net->tcp_reset = true;
+         return EFI_CONNECTION_REFUSED;
+      }
+      if ((tcp->flags & TCP_SYN) == 0) {
+         return EFI_SUCCESS;
+      }
+
+      tcp_options(net, seg + sizeof (tcp_hdr_t), hlen - sizeof (tcp_hdr_t));
+      net->rcv_nxt = seq + 1;
+      net->snd_una = ack;
+      net->tcp_open = true;
+      net->retries = 0;
+      net->rto = TCP_RTO_MS;
+
+      return tcp_output(net, TCP_ACK, net->snd_nxt, NULL, 0);
+   }
+
+   if ((tcp->flags & TCP_RST) != 0) {
+      if (seq - net->rcv_nxt >= TCP_RCV_WINDOW) {
+         return EFI_SUCCESS;
+      }
+      net->tcp_open = false;
+      net->tcp_reset = true;
+      return EFI_CONNECTION_RESET;
+   }
+
+   if ((tcp->flags & TCP_ACK) != 0 && (int32_t)(ack - net->snd_una) > 0 &&
+       (int32_t)(ack - net->snd_nxt) <= 0) {
+      /* Drop the acknowledged data from the retransmission buffer. */
+      memmove(net->snd_buf, net->snd_buf + (ack - net->snd_una),
+              net->snd_nxt - ack);
+      net->snd_una = ack;
+      net->retries = 0;
+      net->rto = TCP_RTO_MS;
+      if (net->snd_una != net->snd_nxt) {
+         tcp_rto_set(net);
+      }
+   }
+
+   seg += hlen;
+   len -= hlen;
+
+   if (len == 0 && (tcp->flags & TCP_FIN) == 0) {
+      return EFI_SUCCESS;
+   }
+
+   if (net->tcp_fin) {
+      /* Retransmitted FIN */
+      return tcp_output(net, TCP_ACK, net->snd_nxt, NULL, 0);
+   }
+
+   if ((int32_t)(seq - net->rcv_nxt) < 0 &&
+       (int32_t)(seq + len - net->rcv_nxt) > 0) {
+      /* Partly retransmitted */
+      trim = net->rcv_nxt - seq;
+      seg += trim;
+      len -= trim;
+      seq = net->rcv_nxt;
+   }
+
+   if (seq != net->rcv_nxt) {
+      /*
+       * Out of order or retransmitted: tell the peer what we are missing.
+       * A FIN is only taken once everything before it has been received.
+       */
+      if ((int32_t)(seq - net->rcv_nxt) > 0 && len > 0) {
+         tcp_ooo_keep(net, seq, seg, len);
+      }
+      return tcp_output(net, TCP_ACK, net->snd_nxt, NULL, 0);
+   }
+
+   net->rcv_nxt += (uint32_t)len;
+   *data = seg;
+   *dlen = len;
+
+   if ((tcp->flags & TCP_FIN) != 0) {
+      net->rcv_nxt++;
+      net->tcp_fin = true;
+      return tcp_output(net, TCP_ACK, net->snd_nxt, NULL, 0);
+   }
+
+   if (++net->rcv_unacked >= TCP_ACK_SEGMENTS) {
+      return tcp_output(net, TCP_ACK, net->snd_nxt, NULL, 0);
+   }
+
+   return EFI_SUCCESS;
+}
+
+/*-- tcp_poll ------------------------------------------------------------------
+ *
+ *      Process the next incoming frame, if any. When there is none, send any
+ *      pending ACK, and retransmit the unacknowledged data if its timer has
+ *      expired.
+ *
+ * Parameters
+ *      IN  net:  connection
+ *      OUT data: pointer to the new in-order data, if any
+ *      OUT dlen: new in-order data length (0 if none)
+ *
+ * Results
+ *      EFI_SUCCESS, EFI_TIMEOUT if the peer does not acknowledge our data, or
+ *      an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS tcp_poll(snpnet_t *net, const uint8_t **data, size_t *dlen)
+{
+   const uint8_t *dgram;
+   EFI_STATUS Status;
+   uint8_t proto;
+   size_t len;
+
+   Status = tcp_ooo_deliver(net, data, dlen);
+   if (EFI_ERROR(Status) || *dlen > 0) {
+      return Status;
+   }
+
+   Status = snpnet_poll(net, &proto, &dgram, &len);
+   if (Status == EFI_SUCCESS) {
+      return (proto == IP_PROTO_TCP) ? tcp_input(net, dgram, len, data, dlen)
+                                     : EFI_SUCCESS;
+   }
+   if (Status != EFI_NOT_READY) {
+      return Status;
+   }
+
+   /* Nothing more to read at the moment. */
+   if (net->rcv_unacked > 0) {
+      Status = tcp_output(net, TCP_ACK, net->snd_nxt, NULL, 0);
+      if (EFI_ERROR(Status)) {
+         return Status;
+      }
+   }
+
+   if (net->snd_una == net->snd_nxt ||
+       bs->CheckEvent(net->RtoTimer) != EFI_SUCCESS) {
+      return EFI_SUCCESS;
+   }
+
+   if (++net->retries > TCP_RETRIES) {
+      return EFI_TIMEOUT;
+   }
+
+   net->rto *= 2;
+   tcp_rto_set(net);
+
+   if (!net->tcp_open) {
+      return tcp_output(net, TCP_SYN, net->snd_una, NULL, 0);
+   }
+
+   return tcp_output(net, TCP_ACK | TCP_PSH, net->snd_una, net->snd_buf,
+                     net->snd_nxt - net->snd_una);
+}
+
+/*-- snpnet_tcp_connect --------------------------------------------------------
+ *
+ *      Open a TCP stream to the peer. A connection carries one TCP stream at a
+ *      time.
+ *
+ * Parameters
+ *      IN net:        connection
+ *      IN port:       peer port
+ *      IN timeout_ms: how long to wait for the peer to accept the connection
+ *
+ * Results
+ *      EFI_SUCCESS, EFI_CONNECTION_REFUSED, EFI_TIMEOUT, or an UEFI error
+ *      status.
+ *----------------------------------------------------------------------------*/
+EFI_STATUS snpnet_tcp_connect(snpnet_t *net, uint16_t port, UINT32 timeout_ms)
+{
+   const uint8_t *data;
+   EFI_STATUS Status;
+   uint32_t iss;
+   uint64_t tsc;
+   size_t len;
+
+   if (net->tcp_open) {
+      return EFI_ALREADY_STARTED;
+   }
+
+   /* The TSC is a fine enough clock for the ISS to differ on each stream. */
+   tsc = rdtsc();
+   iss = (uint32_t)(tsc ^ (tsc >> 32)) * 2654435761U;
+
+   if (tcp_lport_next == 0) {
+      tcp_lport_next = (uint16_t)(1 + iss % (TCP_LPORT_COUNT - 1));
+   }
+
+   net->tcp_reset = false;
+   net->tcp_fin = false;
+   net->tcp_lport = (uint16_t)(TCP_LPORT_BASE + tcp_lport_next);
+   tcp_lport_next = (uint16_t)(1 + tcp_lport_next % (TCP_LPORT_COUNT - 1));
+   net->tcp_rport = port;
+   net->snd_una = iss;
+   net->snd_nxt = iss + 1;
+   net->rcv_wscale = 0;
+   net->snd_mss = TCP_DEFAULT_MSS;
+   net->rcv_unacked = 0;
+   net->rto = TCP_RTO_MS;
+   net->retries = 0;
+   net->ooo_count = 0;
+
+   Status = tcp_output(net, TCP_SYN, iss, NULL, 0);
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+
+   tcp_rto_set(net);
+   snpnet_timer_set(net, timeout_ms);
+
+   while (!net->tcp_open) {
+      Status = tcp_poll(net, &data, &len);
+      if (EFI_ERROR(Status)) {
+         return Status;
+      }
+      if (snpnet_timer_expired(net)) {
+         return EFI_TIMEOUT;
+      }
+   }
+
+   return EFI_SUCCESS;
+}
+
+/*-- tcp_wait_ack --------------------------------------------------------------
+ *
+ *      Wait for all the data sent on the TCP stream to be acknowledged.
+ *
+ * Parameters
+ *      IN net: connection
+ *
+ * Results
+ *      EFI_SUCCESS, EFI_PROTOCOL_ERROR if the peer sent data in the meantime,
+ *      EFI_TIMEOUT, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS tcp_wait_ack(snpnet_t *net)
+{
+   const uint8_t *data;
+   EFI_STATUS Status;
+   size_t len;
+
+   while (net->snd_una != net->snd_nxt) {
+      Status = tcp_poll(net, &data, &len);
+      if (EFI_ERROR(Status)) {
+         return Status;
+      }
+      if (len > 0) {
+         return EFI_PROTOCOL_ERROR;
+      }
+      if (!net->tcp_open) {
+         return EFI_CONNECTION_RESET;
+      }
+   }
+
+   return EFI_SUCCESS;
+}
+
+/*-- snpnet_tcp_send -----------------------------------------------------------
+ *
+ *      Send data on the TCP stream. This is meant for requests: the data is
+ *      sent one segment at a time, and the peer must not send anything until
+ *      it has received all of it. The last segment is acknowledged, or
+ *      retransmitted, while the caller waits for the response with
+ *      snpnet_tcp_recv().
+ *
+ * Parameters
+ *      IN net:  connection
+ *      IN data: data to send
+ *      IN len:  data length, in bytes
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+EFI_STATUS snpnet_tcp_send(snpnet_t *net, const void *data, size_t len)
+{
+   const uint8_t *p = data;
+   EFI_STATUS Status;
+   size_t seglen;
+   uint32_t seq;
+
+   if (!net->tcp_open) {
+      return net->tcp_reset ? EFI_CONNECTION_RESET : EFI_NOT_STARTED;
+   }
+
+   while (len > 0) {
+      Status = tcp_wait_ack(net);
+      if (EFI_ERROR(Status)) {
+         return Status;
+      }
+
+      seglen = MIN(len, net->snd_mss);
+      memcpy(net->snd_buf, p, seglen);
+      seq = net->snd_nxt;
+      net->snd_nxt += (uint32_t)seglen;
+      net->rto = TCP_RTO_MS;
+      net->retries = 0;
+
+      Status = tcp_output(net, TCP_ACK | TCP_PSH, seq, net->snd_buf, seglen);
+      tcp_rto_set(net);
+      if (EFI_ERROR(Status)) {
+         return Status;
+      }
+
+      p += seglen;
+      len -= seglen;
+   }
+
+   return EFI_SUCCESS;
+}
+
+/*-- snpnet_tcp_poll -----------------------------------------------------------
+ *
+ *      Process the next incoming frame on the TCP stream, if any, without
+ *      waiting. This lets a caller drive several connections at once.
+ *
+ * Parameters
+ *      IN  net:  connection
+ *      OUT data: pointer to the new in-order data, valid until the next call
+ *      OUT len:  new in-order data length, in bytes (0 if none)
+ *
+ * Results
+ *      EFI_SUCCESS, EFI_END_OF_FILE if the peer has closed the stream,
+ *      EFI_CONNECTION_RESET, EFI_TIMEOUT if the peer does not acknowledge our
+ *      data, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+EFI_STATUS snpnet_tcp_poll(snpnet_t *net, const void **data, size_t *len)
+{
+   const uint8_t *seg;
+   EFI_STATUS Status;
+
+   *len = 0;
+
+   if (net->tcp_fin) {
+      return EFI_END_OF_FILE;
+   }
+   if (!net->tcp_open) {
+      return net->tcp_reset ? EFI_CONNECTION_RESET : EFI_NOT_STARTED;
+   }
+
+   Status = tcp_poll(net, &seg, len);
+   if (!EFI_ERROR(Status) && *len > 0) {
+      *data = seg;
+   }
+
+   return Status;
+}
+
+/*-- snpnet_tcp_recv -----------------------------------------------------------
+ *
+ *      Receive the next in-order data from the TCP stream.
+ *
+ * Parameters
+ *      IN  net:        connection
+ *      OUT data:       pointer to the data, valid until the next call
+ *      OUT len:        data length, in bytes
+ *      IN  timeout_ms: how long to wait for data
+ *
+ * Results
+ *      EFI_SUCCESS, EFI_END_OF_FILE if the peer has closed the stream,
+ *      EFI_CONNECTION_RESET, EFI_TIMEOUT, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+EFI_STATUS snpnet_tcp_recv(snpnet_t *net, const void **data, size_t *len,
+                           UINT32 timeout_ms)
+{
+   EFI_STATUS Status;
+
+   snpnet_timer_set(net, timeout_ms);
+
+   for (;;) {
+      Status = snpnet_tcp_poll(net, data, len);
+      if (EFI_ERROR(Status) || *len > 0) {
+         return Status;
+      }
+      if (snpnet_timer_expired(net)) {
+         return EFI_TIMEOUT;
+      }
+   }
+}
+
+/*-- snpnet_tcp_is_open --------------------------------------------------------
+ *
+ *      Check whether the TCP stream is established, and has not been closed by
+ *      the peer.
+ *
+ * Parameters
+ *      IN net: connection
+ *
+ * Results
+ *      true if more data can be exchanged on the stream, false otherwise.
+ *----------------------------------------------------------------------------*/
+bool snpnet_tcp_is_open(snpnet_t *net)
+{
+   return net->tcp_open && !net->tcp_fin;
+}
+
+/*-- snpnet_tcp_close ----------------------------------------------------------
+ *
+ *      Close the TCP stream, without waiting for the peer. The stream is reset
+ *      unless the peer has already closed its side.
+ *
+ * Parameters
+ *      IN net: connection
+ *----------------------------------------------------------------------------*/
+void snpnet_tcp_close(snpnet_t *net)
+{
+   if (net->tcp_open) {
+      if (net->tcp_fin) {
+         tcp_output(net, TCP_FIN | TCP_ACK, net->snd_nxt, NULL, 0);
+      } else {
+         tcp_output(net, TCP_RST | TCP_ACK, net->snd_nxt, NULL, 0);
+      }
+      net->tcp_open = false;
+   }
+
+   net->snd_una = net->snd_nxt;
+}
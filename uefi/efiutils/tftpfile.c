@@ -21,9 +21,19 @@
  *      modules must have been initialized and the PXE protocol carried out in
  *      order to discover and download this program. Therefore, after proper
  *      sanity checks, the TFTP functionality is accessed directly.
+ *
+ *      Optionally (see tftp_set_snp), IPv4 files are first downloaded with a
+ *      TFTP client of our own, running on the minimal UDP stack in snpnet.c.
+ *      It negotiates the window size option (RFC 7440), so that a whole window
+ *      of blocks is acknowledged at once instead of every single block. If the
+ *      server does not answer it, or the transfer fails for another reason
+ *      than a missing file, a cancellation, or a timeout once data has been
+ *      received, the firmware MTFTP client is used instead.
  */
 
 #include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <arpa/inet.h>
 #include "efi_private.h"
 
@@ -93,6 +103,45 @@ static UINTN tftp_block_size = 1468; // default; fits in 1500 byte MTU
 
 static bool isIPv6 = false;
 
+/*
+ * Native (Simple Network Protocol) TFTP client.
+ *
+ * TFTP_SNP_WINDOW is the number of blocks per acknowledgement to request
+ * (RFC 7440); the server may choose fewer. A lost block costs a whole window
+ * at most. The receive timeout doubles on every retry.
+ */
+#define TFTP_PORT            69
+#define TFTP_OP_RRQ          1
+#define TFTP_OP_DATA         3
+#define TFTP_OP_ACK          4
+#define TFTP_OP_ERROR        5
+#define TFTP_OP_OACK         6
+#define TFTP_ERR_NOT_FOUND   1
+#define TFTP_SNP_WINDOW      64
+#define TFTP_SNP_TIMEOUT_MS  500
+#define TFTP_SNP_RETRIES     6
+#define TFTP_SNP_RRQ_SIZE    512
+#define TFTP_SNP_PORT_BASE   0xc000
+#define TFTP_SNP_PORT_COUNT  0x4000
+
+static bool tftp_snp = false;
+static uint16_t tftp_snp_port = 0;   // next local port offset, 0 until seeded
+
+typedef struct {
+   snpnet_t *net;
+   uint16_t port;       // local port
+   uint16_t server;     // server port (transfer ID), 0 until known
+   size_t blksize;      // negotiated block size
+   size_t window;       // negotiated window size
+   uint64_t tsize;      // file size announced by the server, 0 if unknown
+   uint64_t block;      // last block received in order
+   size_t unacked;      // blocks received since the last ACK
+   bool gap_acked;      // an ACK was sent for the current gap
+   uint8_t *data;       // file contents
+   size_t size;         // bytes received
+   size_t capacity;     // size of the data buffer
+} tftp_snp_t;
+
 /*-- tftp_set_block_size  ------------------------------------------------------
  *
  *      Set the blksize option value to be used in TFTP requests.
@@ -114,6 +163,19 @@ void tftp_set_block_size(size_t blksize)
 }
 
 
+/*-- tftp_set_snp --------------------------------------------------------------
+ *
+ *      Enable or disable the native TFTP client, that drives the Simple Network
+ *      Protocol directly instead of going through the PXE Base Code.
+ *
+ * Parameters
+ *      IN enable: true to try the native client first
+ *----------------------------------------------------------------------------*/
+void tftp_set_snp(bool enable)
+{
+   tftp_snp = enable;
+}
+
 /*-- get_ipv6_boot_url ---------------------------------------------------------
  *
  *      Retrieve the IPv6 boot file URL from a PXE BC packet. The URL format is
@@ -508,6 +570,346 @@ EFI_STATUS tftp_file_get_size(UNUSED_PARAM(EFI_HANDLE Volume),
    return EFI_SUCCESS;
 }
 
+/*-- tftp_snp_send_ack ---------------------------------------------------------
+ *
+ *      Acknowledge the last block received in order.
+ *
+ * Parameters
+ *      IN tftp: transfer state
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS tftp_snp_send_ack(tftp_snp_t *tftp)
+{
+   uint16_t ack[2];
+
+   ack[0] = htons(TFTP_OP_ACK);
+   ack[1] = htons((uint16_t)tftp->block);
+   tftp->unacked = 0;
+
+   return snpnet_udp_send(tftp->net, tftp->port, tftp->server, ack,
+                          sizeof (ack));
+}
+
+/*-- tftp_snp_send_rrq ---------------------------------------------------------
+ *
+ *      Send a read request, with the blksize, tsize and windowsize options.
+ *
+ * Parameters
+ *      IN tftp:     transfer state
+ *      IN filepath: the ASCII absolute path of the file to retrieve
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS tftp_snp_send_rrq(tftp_snp_t *tftp, const char *filepath)
+{
+   char rrq[TFTP_SNP_RRQ_SIZE];
+   char blksize[16], window[16];
+   const char *fields[8];
+   size_t len, n;
+   unsigned int i;
+
+   snprintf(blksize, sizeof (blksize), "%zu", (size_t)tftp_block_size);
+   snprintf(window, sizeof (window), "%u", TFTP_SNP_WINDOW);
+
+   fields[0] = filepath;
+   fields[1] = "octet";
+   fields[2] = "blksize";
+   fields[3] = blksize;
+   fields[4] = "tsize";
+   fields[5] = "0";
+   fields[6] = "windowsize";
+   fields[7] = window;
+
+   rrq[0] = 0;
+   rrq[1] = TFTP_OP_RRQ;
+   len = 2;
+
+   for (i = 0; i < ARRAYSIZE(fields); i++) {
+      n = strlen(fields[i]) + 1;
+      if (len + n > sizeof (rrq)) {
+         return EFI_BAD_BUFFER_SIZE;
+      }
+      memcpy(rrq + len, fields[i], n);
+      len += n;
+   }
+
+   return snpnet_udp_send(tftp->net, tftp->port, TFTP_PORT, rrq, len);
+}
+
+/*-- tftp_snp_oack -------------------------------------------------------------
+ *
+ *      Parse the options acknowledged by the server.
+ *
+ * Parameters
+ *      IN tftp: transfer state
+ *      IN opts: OACK options
+ *      IN len:  options length, in bytes
+ *----------------------------------------------------------------------------*/
+static void tftp_snp_oack(tftp_snp_t *tftp, const char *opts, size_t len)
+{
+   const char *name, *value, *end;
+
+   end = opts + len;
+
+   while (opts < end) {
+      name = opts;
+      value = memchr(name, '\0', end - name);
+      if (value == NULL || ++value >= end) {
+         break;
+      }
+      opts = memchr(value, '\0', end - value);
+      if (opts == NULL) {
+         break;
+      }
+      opts++;
+
+      if (strcasecmp(name, "blksize") == 0) {
+         tftp->blksize = strtoul(value, NULL, 10);
+      } else if (strcasecmp(name, "tsize") == 0) {
+         tftp->tsize = strtoul(value, NULL, 10);
+      } else if (strcasecmp(name, "windowsize") == 0) {
+         tftp->window = strtoul(value, NULL, 10);
+      }
+   }
+}
+
+/*-- tftp_snp_data -------------------------------------------------------------
+ *
+ *      Store an in-order data block.
+ *
+ * Parameters
+ *      IN tftp: transfer state
+ *      IN data: block contents
+ *      IN len:  block length, in bytes
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS tftp_snp_data(tftp_snp_t *tftp, const void *data, size_t len)
+{
+   size_t capacity;
+   uint8_t *buf;
+
+   if (tftp->size + len > tftp->capacity) {
+      capacity = MAX(tftp->capacity * 2, tftp->size + len);
+      buf = sys_realloc(tftp->data, tftp->capacity, capacity);
+      if (buf == NULL) {
+         return EFI_OUT_OF_RESOURCES;
+      }
+      tftp->data = buf;
+      tftp->capacity = capacity;
+   }
+
+   memcpy(tftp->data + tftp->size, data, len);
+   tftp->size += len;
+   tftp->block++;
+   tftp->unacked++;
+   tftp->gap_acked = false;
+
+   return EFI_SUCCESS;
+}
+
+/*-- tftp_snp_load -------------------------------------------------------------
+ *
+ *      Load a file into memory with the native TFTP client.
+ *
+ * Parameters
+ *      IN  Pxe:      pointer to the PXE BC interface
+ *      IN  ServerIp: the IPv4 address of the TFTP server
+ *      IN  filepath: the ASCII absolute path of the file to retrieve
+ *      IN  callback: routine to be called periodically while the file is being
+ *                    loaded
+ *      OUT Buffer:   pointer to the freshly allocated file contents
+ *      OUT BufSize:  file size in bytes
+ *
+ * Results
+ *      EFI_SUCCESS, EFI_NO_RESPONSE if the server never answered, EFI_TIMEOUT
+ *      if it stopped answering, EFI_ABORTED if the callback cancelled the
+ *      transfer, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS tftp_snp_load(EFI_PXE_BASE_CODE *Pxe,
+                                const EFI_IP_ADDRESS *ServerIp,
+                                const char *filepath, int (*callback)(size_t),
+                                VOID **Buffer, UINTN *BufSize)
+{
+   EFI_HANDLE BootVolume;
+   const uint8_t *pkt;
+   const void *payload;
+   tftp_snp_t tftp;
+   size_t len, reported;
+   unsigned int retries;
+   UINT32 timeout;
+   uint16_t sport, op, block;
+   EFI_STATUS Status;
+   bool done;
+   int error;
+
+   Status = get_boot_volume(&BootVolume);
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+
+   memset(&tftp, 0, sizeof (tftp));
+   tftp.blksize = 512;
+   tftp.window = 1;
+
+   /* A new port for every transfer, so that stale packets are ignored. */
+   if (tftp_snp_port == 0) {
+      tftp_snp_port = (uint16_t)(1 + rdtsc() % (TFTP_SNP_PORT_COUNT - 1));
+   }
+   tftp.port = TFTP_SNP_PORT_BASE + tftp_snp_port;
+   tftp_snp_port = (uint16_t)(1 + tftp_snp_port % (TFTP_SNP_PORT_COUNT - 1));
+
+   Status = snpnet_open(BootVolume, Pxe->Mode, &ServerIp->v4, &tftp.net);
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+
+   Status = tftp_snp_send_rrq(&tftp, filepath);
+
+   done = false;
+   reported = 0;
+   retries = 0;
+   timeout = TFTP_SNP_TIMEOUT_MS;
+
+   while (!EFI_ERROR(Status) && !done) {
+      Status = snpnet_udp_recv(tftp.net, tftp.port, &sport, &payload, &len,
+                               timeout);
+      if (Status == EFI_TIMEOUT) {
+         if (++retries > TFTP_SNP_RETRIES) {
+            break;
+         }
+         timeout *= 2;
+         if (tftp.server == 0) {
+            Status = tftp_snp_send_rrq(&tftp, filepath);
+         } else {
+            Status = tftp_snp_send_ack(&tftp);
+         }
+         continue;
+      }
+      if (EFI_ERROR(Status)) {
+         break;
+      }
+
+      if (len < 4) {
+         continue;
+      }
+      pkt = payload;
+
+      op = ntohs(*(const uint16_t *)pkt);
+      block = ntohs(*(const uint16_t *)(pkt + 2));
+
+      /*
+       * The server answers from a port of its own, the transfer ID (RFC 1350,
+       * section 4). snpnet only lets datagrams from the server IP through:
+       * take the port of the first OACK or DATA block 1, and ignore anything
+       * from other ports afterwards.
+       */
+      if (tftp.server == 0) {
+         if (op == TFTP_OP_OACK || (op == TFTP_OP_DATA && block == 1)) {
+            tftp.server = sport;
+         } else if (op != TFTP_OP_ERROR) {
+            continue;
+         }
+      } else if (sport != tftp.server) {
+         continue;
+      }
+
+      if (op == TFTP_OP_ERROR) {
+         Log(LOG_DEBUG, "TFTP error %u: %.*s", block, (int)(len - 4),
+             (const char *)pkt + 4);
+         Status = (block == TFTP_ERR_NOT_FOUND) ? EFI_NOT_FOUND :
+                                                  EFI_TFTP_ERROR;
+         break;
+      }
+
+      if (op == TFTP_OP_OACK && tftp.block == 0) {
+         tftp_snp_oack(&tftp, (const char *)pkt + 2, len - 2);
+         if (tftp.blksize < TFTP_BLKSIZE_MIN ||
+             tftp.blksize > TFTP_BLKSIZE_MAX || tftp.window == 0) {
+            Status = EFI_PROTOCOL_ERROR;
+            break;
+         }
+         if (tftp.tsize > 0 && (size_t)tftp.tsize == tftp.tsize && tftp.data == NULL) {
+            tftp.data = sys_malloc(tftp.tsize);
+            if (tftp.data == NULL) {
+               Status = EFI_OUT_OF_RESOURCES;
+               break;
+            }
+            tftp.capacity = tftp.tsize;
+         }
+         retries = 0;
+         Status = tftp_snp_send_ack(&tftp);
+         continue;
+      }
+
+      if (op != TFTP_OP_DATA) {
+         continue;
+      }
+
+      if (block != (uint16_t)(tftp.block + 1)) {
+         /*
+          * Out of order, or duplicate: ask the server to resume right after
+          * the last block received in order, once per gap (RFC 7440,
+          * section 4).
+          */
+         if (!tftp.gap_acked) {
+            tftp.gap_acked = true;
+            Status = tftp_snp_send_ack(&tftp);
+         }
+         continue;
+      }
+
+      Status = tftp_snp_data(&tftp, pkt + 4, len - 4);
+      if (EFI_ERROR(Status)) {
+         break;
+      }
+      retries = 0;
+      timeout = TFTP_SNP_TIMEOUT_MS;
+
+      done = len - 4 < tftp.blksize;
+      if (done || tftp.unacked == tftp.window) {
+         Status = tftp_snp_send_ack(&tftp);
+         if (callback != NULL) {
+            error = callback(tftp.size - reported);
+            reported = tftp.size;
+            if (error != 0) {
+               Status = error_generic_to_efi(error);
+            }
+         }
+      }
+   }
+
+   snpnet_close(tftp.net);
+
+   if (!done && !EFI_ERROR(Status)) {
+      Status = EFI_TIMEOUT;
+   }
+   if (Status == EFI_TIMEOUT && tftp.server == 0) {
+      Status = EFI_NO_RESPONSE;
+   }
+   if (EFI_ERROR(Status)) {
+      sys_free(tftp.data);
+      return Status;
+   }
+
+   if (tftp.data == NULL) {
+      /* Empty file */
+      tftp.data = sys_malloc(1);
+      if (tftp.data == NULL) {
+         return EFI_OUT_OF_RESOURCES;
+      }
+   }
+
+   *Buffer = tftp.data;
+   *BufSize = tftp.size;
+
+   return EFI_SUCCESS;
+}
+
 /*-- tftp_file_load ------------------------------------------------------------
  *
  *      Load a file into memory using TFTP. UEFI watchdog timer is disabled
@@ -542,6 +944,23 @@ EFI_STATUS tftp_file_load(EFI_HANDLE Volume, const char *filepath,
    EFI_ASSERT_PARAM(Buffer != NULL);
    EFI_ASSERT_PARAM(BufSize != NULL);
 
+   if (tftp_snp) {
+      Status = get_pxe_info(&Pxe, &ServerIp);
+      if (!EFI_ERROR(Status) && !isIPv6) {
+         efi_set_watchdog_timer(WATCHDOG_DISABLE);
+         Status = tftp_snp_load(Pxe, &ServerIp, filepath, callback, Buffer,
+                                BufSize);
+         efi_set_watchdog_timer(WATCHDOG_DEFAULT_TIMEOUT);
+         if (!EFI_ERROR(Status) || Status == EFI_NOT_FOUND ||
+             Status == EFI_ABORTED || Status == EFI_TIMEOUT) {
+            /* Starting the whole transfer again would not help. */
+            return Status;
+         }
+         Log(LOG_DEBUG, "Native TFTP failed (%s), falling back to MTFTP",
+             error_str[error_efi_to_generic(Status)]);
+      }
+   }
+
    Status = tftp_file_get_size(Volume, filepath, &Size);
    if (EFI_ERROR(Status)) {
       return Status;
@@ -179,6 +179,52 @@ EFI_STATUS ascii_to_ucs2(const char *src, CHAR16 **Dest)
    return EFI_SUCCESS;
 }
 
+/*-- ascii_to_ucs2_buf ---------------------------------------------------------
+ *
+ *      Convert an ASCII string into UCS-2, in the caller's buffer when the
+ *      string fits in it. Short strings can thus be converted without any
+ *      memory allocation.
+ *
+ * Parameters
+ *      IN  src:    pointer to the ASCII input string
+ *      IN  Buf:    buffer for the UCS-2 string (may be NULL)
+ *      IN  BufLen: buffer size, in characters
+ *      OUT Dest:   Buf, or the freshly allocated UCS-2 string if it does not
+ *                  fit in Buf
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+EFI_STATUS ascii_to_ucs2_buf(const char *src, CHAR16 *Buf, size_t BufLen,
+                             CHAR16 **Dest)
+{
+   CHAR16 *Str;
+   EFI_STATUS Status;
+   size_t i, len;
+
+   EFI_ASSERT_PARAM(src != NULL);
+   EFI_ASSERT_PARAM(Dest != NULL);
+
+   len = strlen(src);
+
+   if (len < BufLen) {
+      Str = Buf;
+   } else {
+      Status = ucs2_alloc(len, &Str);
+      if (EFI_ERROR(Status)) {
+         return Status;
+      }
+   }
+
+   for (i = 0; i <= len; i++) {
+      Str[i] = (CHAR16)src[i];
+   }
+
+   *Dest = Str;
+
+   return EFI_SUCCESS;
+}
+
 /*-- ucs2_alloc ----------------------------------------------------------------
  *
  *      Allocate space for a new UCS-2 string. The first character of the string
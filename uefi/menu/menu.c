@@ -137,6 +137,11 @@
  *        program is used to continue with the current version of
  *        pxelinux in the "then" (s1) case or chainload a different
  *        version of pxelinux and restart in the "else" (s2) case.
+ *
+ *      While a menu with a nonzero TIMEOUT is displayed, the image (or menu)
+ *      that its default item would read first is prefetched. It is used if
+ *      that item is chosen, and discarded otherwise. The time spent
+ *      prefetching counts towards the timeout.
  */
 
 #include <efiutils.h>
@@ -194,6 +199,20 @@ char *pxelinux_cfg;
 Menu *rootmenu;
 EFI_HANDLE Volume;
 
+/*
+ * Image (or menu) speculatively read for the default item while its menu is
+ * displayed.
+ */
+typedef struct {
+   MenuItem *item;        // item the file was read for
+   char *name;            // name that was passed to read_file()
+   const char *filename;  // actual name of the file (after path search)
+   void *buffer;
+   size_t bufsize;
+} Prefetch;
+
+Prefetch prefetch;
+
 /*
  * Debug bit flags
  */
@@ -784,8 +803,11 @@ int file_load_wrapper(int volid, const char *filename, int (*callback)(size_t),
  *
  *      Read a file into newly allocated memory.
  *
+ *      If the file has been prefetched, the prefetched data is returned.
+ *
  * Parameters
  *      IN f: name of file requested to be read.
+ *      IN callback: progress callback, see file_load (may be NULL).
  *      OUT fOut: actual name of file (after path search).
  *      OUT bufOut: contents of file.
  *      OUT sizeOut: size of file.
@@ -793,7 +815,8 @@ int file_load_wrapper(int volid, const char *filename, int (*callback)(size_t),
  * Results
  *      ERR_SUCCESS, or a generic error status.
  *----------------------------------------------------------------------------*/
-int read_file(const char *f, const char **fOut, void **bufOut, size_t *sizeOut)
+int read_file(const char *f, int (*callback)(size_t), const char **fOut,
+              void **bufOut, size_t *sizeOut)
 {
    int status;
    const char *filename;
@@ -801,6 +824,23 @@ int read_file(const char *f, const char **fOut, void **bufOut, size_t *sizeOut)
    char *absname = NULL;
 
    Log(LOG_DEBUG, "read_file %s", f);
+
+   if (prefetch.name != NULL && strcmp(prefetch.name, f) == 0) {
+      Log(LOG_DEBUG, "read_file %s: using prefetched %s", f,
+          prefetch.filename);
+      if (fOut) {
+         *fOut = prefetch.filename;
+      }
+      *bufOut = prefetch.buffer;
+      *sizeOut = prefetch.bufsize;
+      if (prefetch.filename != prefetch.name) {
+         /* Otherwise, the name is handed over as the file name. */
+         free(prefetch.name);
+      }
+      memset(&prefetch, 0, sizeof (prefetch));
+      return ERR_SUCCESS;
+   }
+
    /*
     * Interpret relative names relative to the directory that menu.efi
     * was loaded from.  Note that make_path() considers URLs to be
@@ -815,7 +855,7 @@ int read_file(const char *f, const char **fOut, void **bufOut, size_t *sizeOut)
       }
       filename = absname;
    }
-   status = file_load_wrapper(volid, filename, NULL, bufOut, sizeOut);
+   status = file_load_wrapper(volid, filename, callback, bufOut, sizeOut);
 
    /*
     * If file is not found, try its basename relative to the
@@ -841,7 +881,7 @@ int read_file(const char *f, const char **fOut, void **bufOut, size_t *sizeOut)
          return status;
       }
       filename = absname;
-      status = file_load_wrapper(volid, filename, NULL, bufOut, sizeOut);
+      status = file_load_wrapper(volid, filename, callback, bufOut, sizeOut);
    }
 
    if (status != ERR_SUCCESS) {
@@ -853,7 +893,7 @@ int read_file(const char *f, const char **fOut, void **bufOut, size_t *sizeOut)
          return status;
       }
       filename = absname;
-      status = file_load_wrapper(volid, filename, NULL, bufOut, sizeOut);
+      status = file_load_wrapper(volid, filename, callback, bufOut, sizeOut);
    }
 
    if (status != ERR_SUCCESS) {
@@ -870,6 +910,227 @@ int read_file(const char *f, const char **fOut, void **bufOut, size_t *sizeOut)
 }
 
 
+/*-- item_command --------------------------------------------------------------
+ *
+ *      Split the command line of an item into program name and arguments.
+ *
+ * Parameters
+ *      IN  item:      menu item.
+ *      OUT program:   program name (freshly allocated).
+ *      OUT arguments: command-line arguments (in the same allocation).
+ *
+ * Results
+ *      ERR_SUCCESS, or a generic error status.
+ *----------------------------------------------------------------------------*/
+int item_command(MenuItem *item, char **program, char **arguments)
+{
+   char *p, *a;
+
+   if (asprintf(&p, "%s %s", item->kernel,
+                item->append ? item->append : "") == -1) {
+      return ERR_OUT_OF_RESOURCES;
+   }
+
+   a = strchr(p, ' ');
+   *a++ = '\0';
+   while (*a == ' ') {
+      a++;
+   }
+
+   *program = p;
+   *arguments = a;
+
+   return ERR_SUCCESS;
+}
+
+/*-- is_if_program -------------------------------------------------------------
+ *
+ *      Check whether a program is one of the condition testing programs that
+ *      do_item() evaluates itself.
+ *
+ * Parameters
+ *      IN bn: basename of the program.
+ *
+ * Results
+ *      True if this is ifgpxe.c32, ifver410.c32 or ifvm.c32.
+ *----------------------------------------------------------------------------*/
+bool is_if_program(const char *bn)
+{
+   return strcmp(bn, "ifgpxe.c32") == 0 ||
+          strcmp(bn, "ifver410.c32") == 0 ||
+          strcmp(bn, "ifvm.c32") == 0;
+}
+
+/*-- is_menu_program -----------------------------------------------------------
+ *
+ *      Check whether a program is menu.efi itself, run in a way that can be
+ *      done by restarting this instance instead.
+ *
+ * Parameters
+ *      IN bn:        basename of the program.
+ *      IN arguments: command-line arguments.
+ *
+ * Results
+ *      True if the arguments can be passed to do_menu() instead.
+ *----------------------------------------------------------------------------*/
+bool is_menu_program(const char *bn, const char *arguments)
+{
+   return (strcmp(bn, "menu.efi") == 0 ||
+           strcmp(bn, "menu.c32") == 0) && arguments[0] != '-';
+}
+
+/*-- efi_program ---------------------------------------------------------------
+ *
+ *      Change a .c32 or .0 program extension to .efi.
+ *
+ * Parameters
+ *      IN program: program name (may be modified in place).
+ *
+ * Results
+ *      The UEFI program name, or NULL if out of resources.
+ *----------------------------------------------------------------------------*/
+char *efi_program(char *program)
+{
+   int len;
+   char *p;
+
+   len = strlen(program);
+   if (len >= 4 && strcmp(&program[len - 4], ".c32") == 0) {
+      /*
+       * Change .c32 extension to .efi.
+       */
+      strcpy(&program[len - 4], ".efi");
+
+   } else if (len >= 2 && strcmp(&program[len - 2], ".0") == 0) {
+      /*
+       * Change .0 extension to .efi.
+       */
+      p = malloc(len + 3);
+      if (p == NULL) {
+         return NULL;
+      }
+      memcpy(p, program, len - 2);
+      strcpy(p + len - 2, ".efi");
+      program = p;
+   }
+
+   return program;
+}
+
+/*-- prefetch_discard ----------------------------------------------------------
+ *
+ *      Free the prefetched file, if any.
+ *----------------------------------------------------------------------------*/
+void prefetch_discard(void)
+{
+   if (prefetch.name == NULL) {
+      return;
+   }
+
+   Log(LOG_DEBUG, "Discarding prefetched %s", prefetch.filename);
+   if (prefetch.filename != prefetch.name) {
+      free((char *)prefetch.filename);
+   }
+   free(prefetch.name);
+   free(prefetch.buffer);
+   memset(&prefetch, 0, sizeof (prefetch));
+}
+
+/*-- prefetch_progress ---------------------------------------------------------
+ *
+ *      file_load progress callback for prefetching: abort when a key has been
+ *      pressed, so that the user does not have to wait for the transfer. The
+ *      key stays in the input buffer.
+ *
+ * Parameters
+ *      IN size: unused.
+ *
+ * Results
+ *      ERR_SUCCESS, or ERR_ABORTED if a key is pending.
+ *----------------------------------------------------------------------------*/
+int prefetch_progress(UNUSED_PARAM(size_t size))
+{
+   if (bs->CheckEvent(st->ConIn->WaitForKey) == EFI_SUCCESS) {
+      return ERR_ABORTED;
+   }
+
+   return ERR_SUCCESS;
+}
+
+/*-- prefetch_item -------------------------------------------------------------
+ *
+ *      Read the file that would be read first if the given item were chosen:
+ *      the image it chains to, or the menu it restarts with. This is done
+ *      while the menu is displayed, so that the network is not idle while the
+ *      user makes a choice (or the timeout expires). read_file() returns the
+ *      prefetched data when the item is chosen; do_item() discards it when
+ *      another item is chosen.
+ *
+ *      Boot services are single threaded: key presses during the prefetch are
+ *      only processed once it is complete, or aborted by prefetch_progress.
+ *
+ * Parameters
+ *      IN item: item to prefetch for.
+ *----------------------------------------------------------------------------*/
+void prefetch_item(MenuItem *item)
+{
+   char *program, *arguments, *bn, *name, *p;
+   const char *filename;
+   void *buffer;
+   size_t bufsize;
+   int status;
+
+   if (prefetch.item == item) {
+      return;
+   }
+   prefetch_discard();
+
+   if (item == NULL || item->localboot != LOCALBOOT_NONE ||
+       item->kernel == NULL) {
+      return;
+   }
+
+   if (item->recurse) {
+      name = strdup(item->kernel);
+   } else {
+      if (item_command(item, &program, &arguments) != ERR_SUCCESS) {
+         return;
+      }
+
+      bn = basename(program);
+      if (is_if_program(bn)) {
+         name = NULL;
+      } else if (is_menu_program(bn, arguments)) {
+         name = strdup(arguments);
+      } else {
+         p = efi_program(program);
+         name = (p == NULL) ? NULL : strdup(p);
+         if (p != program) {
+            free(p);
+         }
+      }
+      free(program);
+   }
+
+   if (name == NULL) {
+      return;
+   }
+
+   Log(LOG_DEBUG, "Prefetching %s", name);
+   status = read_file(name, prefetch_progress, &filename, &buffer, &bufsize);
+   if (status != ERR_SUCCESS) {
+      Log(LOG_DEBUG, "Prefetch of %s failed: %s", name, error_str[status]);
+      free(name);
+      return;
+   }
+
+   prefetch.item = item;
+   prefetch.name = name;
+   prefetch.filename = filename;
+   prefetch.buffer = buffer;
+   prefetch.bufsize = bufsize;
+}
+
 /*-- run_menu ------------------------------------------------------------------
  *
  *      Interact with the user to select from the current menu.  Then
@@ -893,10 +1154,13 @@ int run_menu(Menu *menu)
    unsigned timeout;
    MenuItem *selection;
    bool hidden;
+   bool prefetching;
+   uint64_t start, elapsed;
 
    hidden = menu->hidden;
    selection = menu->defitem;
    timeout = menu->timeout;
+   prefetching = timeout > 0;
 
    if (debug & DEBUG_PAUSE_BEFORE_DISPLAY) {
       if (await_keypress() == ERR_ABORTED) {
@@ -941,6 +1205,15 @@ int run_menu(Menu *menu)
    hidden = false;
 
    for (;;) {
+      if (prefetching) {
+         /* The time spent prefetching counts towards the timeout */
+         prefetching = false;
+         start = firmware_get_time_ms(false);
+         prefetch_item(menu->defitem);
+         elapsed = (firmware_get_time_ms(true) - start) / 1000;
+         timeout = (elapsed >= timeout) ? 0 : timeout - elapsed;
+      }
+
       kbd_waitkey_timeout(&key, timeout);
       timeout = TIMEOUT_INFINITE;
 
@@ -1028,11 +1301,15 @@ int run_menu(Menu *menu)
 int do_item(Menu *menu, MenuItem *item)
 {
    char *program, *arguments, *bn;
-   int len;
+   int status;
 
    Log(LOG_DEBUG, "do_item label=%s display=%s kernel=%s append=%s",
        item->label, item->display, item->kernel, item->append);
 
+   if (item != prefetch.item) {
+      prefetch_discard();
+   }
+
    if (item->localboot == -2) {
       return ERR_SUCCESS;
 
@@ -1047,15 +1324,9 @@ int do_item(Menu *menu, MenuItem *item)
       return ERR_SYNTAX;
    }
 
-   if (asprintf(&program, "%s %s", item->kernel,
-               item->append ? item->append : "") == -1) {
-      return ERR_OUT_OF_RESOURCES;
-   }
-
-   arguments = strchr(program, ' ');
-   *arguments++ = '\0';
-   while (*arguments == ' ') {
-      arguments++;
+   status = item_command(item, &program, &arguments);
+   if (status != ERR_SUCCESS) {
+      return status;
    }
 
    Log(LOG_DEBUG, "do_item program=%s arguments=%s", program, arguments);
@@ -1084,9 +1355,7 @@ int do_item(Menu *menu, MenuItem *item)
     * probably doesn't matter to us, we always take the true branch.
     */
    bn = basename(program);
-   if (strcmp(bn, "ifgpxe.c32") == 0 ||
-       strcmp(bn, "ifver410.c32") == 0 ||
-       strcmp(bn, "ifvm.c32") == 0) {
+   if (is_if_program(bn)) {
       char *p;
       MenuItem *item2;
 
@@ -1119,26 +1388,13 @@ int do_item(Menu *menu, MenuItem *item)
     * recursively.  This is just an optimization.  We can't do it if
     * there are options on the command line.
     */
-   if ((strcmp(bn, "menu.efi") == 0 ||
-        strcmp(bn, "menu.c32") == 0) && arguments[0] != '-') {
+   if (is_menu_program(bn, arguments)) {
       return do_menu(arguments);
    }
 
-   len = strlen(program);
-   if (len >= 4 && strcmp(&program[len - 4], ".c32") == 0) {
-      /*
-       * Change .c32 extension to .efi.
-       */
-      strcpy(&program[len - 4], ".efi");
-
-   } else if (len >= 2 && strcmp(&program[len - 2], ".0") == 0) {
-      /*
-       * Change .0 extension to .efi.
-       */
-      char *p = malloc(len + 3);
-      memcpy(p, program, len - 2);
-      strcpy(p + len, ".efi");
-      program = p;
+   program = efi_program(program);
+   if (program == NULL) {
+      return ERR_OUT_OF_RESOURCES;
    }
 
    return chain_to(program, arguments);
@@ -1168,7 +1424,7 @@ int chain_to(const char *program, const char *arguments)
     * Search for and read the image into memory.  Sets "program" to the
     * filepath where the image was actually found.
     */
-   status = read_file(program, &program, &image, &imgsize);
+   status = read_file(program, NULL, &program, &image, &imgsize);
    if (status != ERR_SUCCESS) {
       return status;
    }
@@ -1227,14 +1483,15 @@ int do_menu(const char *filename)
 
       status = get_mac_address(&mac);
       if (status == ERR_SUCCESS) {
-         status = read_file(mac, &filename, &buffer, &bufsize);
+         status = read_file(mac, NULL, &filename, &buffer, &bufsize);
       }
       if (status != ERR_SUCCESS) {
-         status = read_file("default", &filename, &buffer, &bufsize);
+         status = read_file("default", NULL, &filename, &buffer,
+                            &bufsize);
       }
 
    } else {
-      status = read_file(filename, &filename, &buffer, &bufsize);
+      status = read_file(filename, NULL, &filename, &buffer, &bufsize);
 
    }
    if (status != ERR_SUCCESS) {
@@ -0,0 +1,169 @@
+/*******************************************************************************
+ * Copyright (c) 2026 VMware, Inc.  All rights reserved.
+ * SPDX-License-Identifier: GPL-2.0
+ ******************************************************************************/
+
+/*
+ * zstub.c -- Self-decompressing UEFI image stub
+ *
+ *      The firmware fetches the first bootloader stage over whatever transport
+ *      it booted from, which on PXE is usually plain lock-step TFTP. This small
+ *      program embeds a gzip'ed copy of a larger, signed, UEFI image (mboot,
+ *      safeboot, menu...). It inflates that image in memory and hands it over
+ *      to the firmware LoadImage() service, which applies the relocations and,
+ *      when Secure Boot is enabled, verifies its signature just as if it had
+ *      been loaded from the boot media.
+ *
+ *      The child image is loaded with the device path of the stub itself, and
+ *      gets the same load options. From its point of view, it has been started
+ *      directly by the firmware, from the same file.
+ */
+
+#include <efiutils.h>
+#include <bootlib.h>
+#include <boot_services.h>
+
+EXTERN const char zstub_payload[];
+EXTERN const char zstub_payload_end[];
+
+/*-- zstub_handle_devpath ------------------------------------------------------
+ *
+ *      Get a copy of the device path of a handle. The protocol interface is
+ *      owned by the firmware, and must not be freed.
+ *
+ * Parameters
+ *      IN  Handle:  the handle
+ *      OUT DevPath: pointer to the freshly allocated device path
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS zstub_handle_devpath(EFI_HANDLE Handle,
+                                       EFI_DEVICE_PATH **DevPath)
+{
+   EFI_DEVICE_PATH *Path;
+   EFI_STATUS Status;
+
+   Status = devpath_get(Handle, &Path);
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+
+   return devpath_duplicate(Path, DevPath);
+}
+
+/*-- zstub_devpath -------------------------------------------------------------
+ *
+ *      Get the full device path of the file this image was loaded from.
+ *
+ * Parameters
+ *      IN  Self:    this image's Loaded Image protocol interface
+ *      OUT DevPath: pointer to the freshly allocated device path
+ *
+ * Results
+ *      EFI_SUCCESS, or an UEFI error status.
+ *----------------------------------------------------------------------------*/
+static EFI_STATUS zstub_devpath(EFI_LOADED_IMAGE *Self,
+                                EFI_DEVICE_PATH **DevPath)
+{
+   CHAR16 *FilePath;
+   EFI_STATUS Status;
+
+   if (Self->FilePath == NULL) {
+      return zstub_handle_devpath(Self->DeviceHandle, DevPath);
+   }
+
+   Status = devpath_get_filepath(Self->FilePath, &FilePath);
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+
+   if (FilePath[0] == L'\0') {
+      /* e.g. PXE: the boot device has no file system */
+      Status = zstub_handle_devpath(Self->DeviceHandle, DevPath);
+   } else {
+      Status = file_devpath(Self->DeviceHandle, FilePath, DevPath);
+   }
+
+   sys_free(FilePath);
+
+   return Status;
+}
+
+/*-- main ----------------------------------------------------------------------
+ *
+ *      Inflate the embedded image, then load and start it.
+ *
+ * Parameters
+ *      IN argc: unused
+ *      IN argv: unused
+ *
+ * Results
+ *      The child image status, or a generic error status.
+ *----------------------------------------------------------------------------*/
+int main(UNUSED_PARAM(int argc), UNUSED_PARAM(char **argv))
+{
+   EFI_LOADED_IMAGE *Self, *Child;
+   EFI_DEVICE_PATH *DevPath;
+   EFI_HANDLE ChildHandle;
+   EFI_STATUS Status;
+   void *image;
+   size_t size;
+   int status;
+
+#ifdef DEBUG
+   log_init(true);
+#else
+   log_init(false);
+#endif
+
+   EFI_ASSERT(bs != NULL);
+   EFI_ASSERT_FIRMWARE(bs->LoadImage != NULL);
+   EFI_ASSERT_FIRMWARE(bs->UnloadImage != NULL);
+
+   status = gzip_extract(zstub_payload, zstub_payload_end - zstub_payload,
+                         &image, &size);
+   if (status != ERR_SUCCESS) {
+      Log(LOG_ERR, "Failed to inflate the boot image: %s", error_str[status]);
+      return status;
+   }
+
+   Log(LOG_DEBUG, "Inflated %zu bytes into %zu bytes",
+       (size_t)(zstub_payload_end - zstub_payload), size);
+
+   Status = image_get_info(ImageHandle, &Self);
+   if (EFI_ERROR(Status)) {
+      sys_free(image);
+      return error_efi_to_generic(Status);
+   }
+
+   Status = zstub_devpath(Self, &DevPath);
+   if (EFI_ERROR(Status)) {
+      sys_free(image);
+      return error_efi_to_generic(Status);
+   }
+
+   /* The firmware copies the image sections: the buffer can be freed. */
+   Status = bs->LoadImage(FALSE, ImageHandle, DevPath, image, size,
+                          &ChildHandle);
+   sys_free(DevPath);
+   sys_free(image);
+   if (EFI_ERROR(Status)) {
+      status = error_efi_to_generic(Status);
+      Log(LOG_ERR, "LoadImage: %s", error_str[status]);
+      return status;
+   }
+
+   Status = image_get_info(ChildHandle, &Child);
+   if (EFI_ERROR(Status)) {
+      bs->UnloadImage(ChildHandle);
+      return error_efi_to_generic(Status);
+   }
+
+   Child->LoadOptions = Self->LoadOptions;
+   Child->LoadOptionsSize = Self->LoadOptionsSize;
+   Child->SystemTable = st;
+   Child->DeviceHandle = Self->DeviceHandle;
+
+   return firmware_image_start(ChildHandle);
+}